@@ -0,0 +1,365 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- load-driven scaling of the instances of a service
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "autoscaler.h"
+
+// snapwebsites lib
+//
+#include "not_reached.h"
+
+// C++ lib
+//
+#include <algorithm>
+
+
+/** \file
+ * \brief Decide how many instances of a service have to run.
+ *
+ * A service with an \<instances> tag can also have an \<autoscale> tag.
+ * In that case, the number of instances is the maximum and only the
+ * first \<min> instances get started. The others remain READY but
+ * without a process until the load requires them:
+ *
+ * \code
+ *      <instances>8</instances>
+ *      <autoscale>
+ *          <min>1</min>
+ *          <metric>cpu</metric>
+ *          <scale-up>75</scale-up>
+ *          <scale-down>25</scale-down>
+ *          <cooldown>300</cooldown>
+ *      </autoscale>
+ * \endcode
+ *
+ * The load is the average of the active instances. With the "cpu"
+ * metric, it is the percent of one CPU used by each process between
+ * two samples of /proc/<pid>/stat (see snap_init::sample_services()).
+ * With the "queue" metric, it is the queue depth that each instance
+ * reports with a LOAD message.
+ *
+ * When the load goes over scale-up, one more instance gets started.
+ * When it goes under scale-down, and removing an instance would not
+ * push the load of the other instances over scale-up, the last
+ * instance gets stopped. The gap between the two thresholds is the
+ * hysteresis and no other change happens until cooldown seconds
+ * have elapsed so the new instance has time to have an effect.
+ */
+
+
+namespace snapinit
+{
+
+
+
+/////////////////////////////////////////////////
+// AUTOSCALER (class implementation)           //
+/////////////////////////////////////////////////
+
+
+/** \brief Read the scaling policy from an \<autoscale> tag.
+ *
+ * \param[in] e  The \<autoscale> element.
+ * \param[in] service_name  The name of the service, for error messages.
+ * \param[in] max  The number of instances defined by the \<instances> tag.
+ */
+void autoscaler::configure(QDomElement e, QString const & service_name, int max)
+{
+    f_max = max;
+    f_min = 1;
+    bool has_scale_up(false);
+    bool has_scale_down(false);
+
+    for(QDomElement sub_element(e.firstChildElement());
+        !sub_element.isNull();
+        sub_element = sub_element.nextSiblingElement())
+    {
+        QString const name(sub_element.tagName());
+        QString const value(sub_element.text().trimmed());
+        if(name == "metric")
+        {
+            if(value == "cpu")
+            {
+                f_metric = metric_t::METRIC_CPU;
+            }
+            else if(value == "queue")
+            {
+                f_metric = metric_t::METRIC_QUEUE;
+            }
+            else
+            {
+                common::fatal_error(QString("the <metric> tag of the <autoscale> tag of service \"%1\" must be \"cpu\" or \"queue\", not \"%2\".")
+                                    .arg(service_name)
+                                    .arg(value));
+                snap::NOTREACHED();
+            }
+            continue;
+        }
+
+        bool ok(false);
+        if(name == "min")
+        {
+            f_min = value.toInt(&ok, 10);
+            if(!ok || f_min < 1 || f_min > f_max)
+            {
+                common::fatal_error(QString("the <min> tag of the <autoscale> tag of service \"%1\" must be an integer between 1 and the number of instances (%2).")
+                                    .arg(service_name)
+                                    .arg(f_max));
+                snap::NOTREACHED();
+            }
+            continue;
+        }
+
+        double const number(value.toDouble(&ok));
+        if(!ok || number < 0.0)
+        {
+            common::fatal_error(QString("the <%1> tag of the <autoscale> tag of service \"%2\" must be a positive number, \"%3\" is not valid.")
+                                .arg(name)
+                                .arg(service_name)
+                                .arg(value));
+            snap::NOTREACHED();
+        }
+
+        if(name == "scale-up")
+        {
+            f_scale_up = number;
+            has_scale_up = true;
+        }
+        else if(name == "scale-down")
+        {
+            f_scale_down = number;
+            has_scale_down = true;
+        }
+        else if(name == "cooldown")
+        {
+            f_cooldown = static_cast<int64_t>(number * common::SECONDS_TO_MICROSECONDS);
+        }
+        else
+        {
+            common::fatal_error(QString("unknown tag <%1> in the <autoscale> tag of service \"%2\".")
+                                .arg(name)
+                                .arg(service_name));
+            snap::NOTREACHED();
+        }
+    }
+
+    // the CPU thresholds have sensible defaults, a queue depth does not
+    //
+    if(f_metric == metric_t::METRIC_QUEUE
+    && (!has_scale_up || !has_scale_down))
+    {
+        common::fatal_error(QString("the <autoscale> tag of service \"%1\" must define <scale-up> and <scale-down> with the \"queue\" metric.")
+                            .arg(service_name));
+        snap::NOTREACHED();
+    }
+
+    if(f_scale_down >= f_scale_up)
+    {
+        common::fatal_error(QString("the <scale-down> threshold of the <autoscale> tag of service \"%1\" must be smaller than its <scale-up> threshold.")
+                            .arg(service_name));
+        snap::NOTREACHED();
+    }
+
+    f_active = f_min;
+    f_instances.resize(f_max);
+}
+
+
+/** \brief Get the smallest number of instances kept running.
+ *
+ * \return The \<min> of the \<autoscale> tag.
+ */
+int autoscaler::get_min() const
+{
+    return f_min;
+}
+
+
+/** \brief Get the largest number of instances we can run.
+ *
+ * \return The number of instances defined by the \<instances> tag.
+ */
+int autoscaler::get_max() const
+{
+    return f_max;
+}
+
+
+/** \brief Get the number of instances that currently have to run.
+ *
+ * The active instances are always the first ones (0 to active - 1.)
+ *
+ * \return The number of active instances.
+ */
+int autoscaler::get_active() const
+{
+    return f_active;
+}
+
+
+/** \brief Restore the number of instances that have to run.
+ *
+ * This is used when snapinit re-executes itself, so the instances
+ * started because of the load keep running. The number is kept
+ * within the limits of the current configuration.
+ *
+ * \param[in] active  The number of active instances.
+ */
+void autoscaler::set_active(int active)
+{
+    f_active = std::max(f_min, std::min(active, f_max));
+}
+
+
+/** \brief Get the metric used to measure the load.
+ *
+ * \return The metric defined in the \<metric> tag.
+ */
+autoscaler::metric_t autoscaler::get_metric() const
+{
+    return f_metric;
+}
+
+
+/** \brief Record a CPU sample of one of the instances.
+ *
+ * The load is computed from the previous sample of the same process.
+ * A new process (i.e. the instance was restarted) only gives us a
+ * reference for the next sample.
+ *
+ * \param[in] instance  The index of the instance.
+ * \param[in] pid  The process the sample was taken from.
+ * \param[in] sample  The sample as read from /proc/<pid>/stat.
+ */
+void autoscaler::record_cpu(int instance, pid_t pid, resource_usage::sample_t const & sample)
+{
+    if(instance < 0
+    || static_cast<size_t>(instance) >= f_instances.size())
+    {
+        return;
+    }
+
+    instance_t & i(f_instances[instance]);
+    int64_t const cpu_time(sample.f_user_time + sample.f_system_time);
+    if(i.f_pid == pid
+    && sample.f_date > i.f_sample_date
+    && cpu_time >= i.f_cpu_time)
+    {
+        i.f_load = static_cast<double>(cpu_time - i.f_cpu_time) * 100.0
+                 / static_cast<double>(sample.f_date - i.f_sample_date);
+        i.f_load_date = sample.f_date;
+    }
+    i.f_pid = pid;
+    i.f_sample_date = sample.f_date;
+    i.f_cpu_time = cpu_time;
+}
+
+
+/** \brief Record the queue depth reported by one of the instances.
+ *
+ * \param[in] instance  The index of the instance.
+ * \param[in] depth  The number of items waiting in its queue.
+ * \param[in] date  When the depth was received, in microseconds.
+ */
+void autoscaler::record_queue(int instance, int64_t depth, int64_t date)
+{
+    if(instance < 0
+    || static_cast<size_t>(instance) >= f_instances.size())
+    {
+        return;
+    }
+
+    instance_t & i(f_instances[instance]);
+    i.f_load = static_cast<double>(depth);
+    i.f_load_date = date;
+}
+
+
+/** \brief Compute the number of instances that have to run.
+ *
+ * The load is the average of the active instances which measured a
+ * load since \p since. If none did, nothing changes.
+ *
+ * The number of instances changes by one at most and then no other
+ * change happens for cooldown microseconds. The first call only
+ * starts the cooldown so the instances have time to settle after
+ * snapinit started.
+ *
+ * \param[in] now  The current date in microseconds.
+ * \param[in] since  Loads measured before that date are ignored.
+ *
+ * \return The new number of active instances.
+ */
+int autoscaler::evaluate(int64_t now, int64_t since)
+{
+    if(f_last_change == 0)
+    {
+        f_last_change = now;
+        return f_active;
+    }
+    if(now < f_last_change + f_cooldown)
+    {
+        return f_active;
+    }
+
+    double total(0.0);
+    int count(0);
+    for(int idx(0); idx < f_active; ++idx)
+    {
+        instance_t const & i(f_instances[idx]);
+        if(i.f_load_date != 0
+        && i.f_load_date >= since)
+        {
+            total += i.f_load;
+            ++count;
+        }
+    }
+    if(count == 0)
+    {
+        return f_active;
+    }
+    double const load(total / static_cast<double>(count));
+
+    if(load > f_scale_up
+    && f_active < f_max)
+    {
+        ++f_active;
+        f_last_change = now;
+    }
+    else if(load < f_scale_down
+         && f_active > f_min
+         && load * static_cast<double>(f_active) / static_cast<double>(f_active - 1) <= f_scale_up)
+    {
+        // the instance going down does not report anything anymore
+        //
+        --f_active;
+        f_instances[f_active] = instance_t();
+        f_last_change = now;
+    }
+
+    return f_active;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
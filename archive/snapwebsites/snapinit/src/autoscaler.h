@@ -0,0 +1,98 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- load-driven scaling of the instances of a service
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+#include "resource_usage.h"
+
+// Qt lib
+//
+#include <QDomElement>
+#include <QString>
+
+// C++ lib
+//
+#include <memory>
+#include <vector>
+
+namespace snapinit
+{
+
+
+class autoscaler
+{
+public:
+    typedef std::shared_ptr<autoscaler>     pointer_t;
+
+    static int64_t const        DEFAULT_COOLDOWN = 300LL * common::SECONDS_TO_MICROSECONDS;    // 5 minutes
+
+    enum class metric_t
+    {
+        METRIC_CPU,             // percent of one CPU used by each instance, from /proc/<pid>/stat
+        METRIC_QUEUE            // queue depth of each instance, from the LOAD message
+    };
+
+    void                        configure(QDomElement e, QString const & service_name, int max);
+
+    int                         get_min() const;
+    int                         get_max() const;
+    int                         get_active() const;
+    void                        set_active(int active);
+    metric_t                    get_metric() const;
+
+    void                        record_cpu(int instance, pid_t pid, resource_usage::sample_t const & sample);
+    void                        record_queue(int instance, int64_t depth, int64_t date);
+    int                         evaluate(int64_t now, int64_t since);
+
+private:
+    // the last load measured for one instance
+    //
+    struct instance_t
+    {
+        pid_t                   f_pid = -1;
+        int64_t                 f_sample_date = 0;      // microseconds
+        int64_t                 f_cpu_time = 0;         // user + system, microseconds
+        double                  f_load = 0.0;
+        int64_t                 f_load_date = 0;        // 0 when no load was measured yet
+    };
+
+    // policy
+    //
+    int                         f_min = 1;
+    int                         f_max = 1;
+    metric_t                    f_metric = metric_t::METRIC_CPU;
+    double                      f_scale_up = 75.0;
+    double                      f_scale_down = 25.0;
+    int64_t                     f_cooldown = DEFAULT_COOLDOWN;
+
+    // current state
+    //
+    int                         f_active = 1;
+    int64_t                     f_last_change = 0;
+    std::vector<instance_t>     f_instances;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,297 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- restart backoff policy of the snapinit processes
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "backoff.h"
+
+// snapwebsites lib
+//
+#include "not_reached.h"
+#include "not_used.h"
+
+// C++ lib
+//
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+
+/** \file
+ * \brief Decide when a process which died with an error gets restarted.
+ *
+ * Each time a process dies with an error, it gets restarted after a
+ * delay which grows exponentially: initial_delay, then initial_delay
+ * times multiplier, etc. up to max_delay. A random jitter is applied
+ * to each delay so a whole set of servers restarted at the same time
+ * (i.e. after a bad deploy) do not all hammer snapcommunicator and
+ * snapdbproxy in sync.
+ *
+ * Each error also adds one to an error score which decays with the
+ * specified half-life. When the score reaches the error budget, the
+ * service is paused (see service::process_pause()) instead of being
+ * restarted. A process which keeps running for a while between errors
+ * therefore never exhausts its budget.
+ *
+ * The defaults are defined in snapinit.conf (restart_... parameters)
+ * and each service can override them with a \<backoff> tag.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief The random generator used to compute the jitter.
+ *
+ * It is seeded from std::random_device so each snapinit instance
+ * gets a different sequence.
+ */
+std::mt19937 & random_generator()
+{
+    static std::mt19937 g_generator{std::random_device()()};
+    return g_generator;
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// BACKOFF (class implementation)              //
+/////////////////////////////////////////////////
+
+
+/** \brief Change one of the backoff parameters.
+ *
+ * The supported parameters are:
+ *
+ * \li initial_delay -- the first delay in seconds (may be fractional);
+ * \li max_delay -- the largest delay in seconds;
+ * \li multiplier -- the delay gets multiplied by this number on each
+ *     new error, it must be at least 1;
+ * \li jitter -- a number from 0 to 1, the delay is randomly changed by
+ *     up to that fraction in either direction;
+ * \li error_budget -- the error score at which the service gets paused;
+ * \li budget_half_life -- the number of seconds for the error score to
+ *     be divided by two.
+ *
+ * \param[in] name  The name of the parameter.
+ * \param[in] value  The new value.
+ * \param[in] where  Where the parameter was defined, for error messages.
+ */
+void backoff::set_parameter(QString const & name, QString const & value, QString const & where)
+{
+    bool ok(false);
+    double const number(value.toDouble(&ok));
+    if(!ok || number < 0.0)
+    {
+        common::fatal_error(QString("the %1 parameter of %2 must be a positive number, \"%3\" is not valid.")
+                            .arg(name)
+                            .arg(where)
+                            .arg(value));
+        snap::NOTREACHED();
+    }
+
+    if(name == "initial_delay")
+    {
+        f_initial_delay = static_cast<int64_t>(number * common::SECONDS_TO_MICROSECONDS);
+    }
+    else if(name == "max_delay")
+    {
+        f_max_delay = static_cast<int64_t>(number * common::SECONDS_TO_MICROSECONDS);
+    }
+    else if(name == "multiplier")
+    {
+        if(number < 1.0)
+        {
+            common::fatal_error(QString("the multiplier parameter of %1 must be at least 1, \"%2\" is not valid.")
+                                .arg(where)
+                                .arg(value));
+            snap::NOTREACHED();
+        }
+        f_multiplier = number;
+    }
+    else if(name == "jitter")
+    {
+        if(number > 1.0)
+        {
+            common::fatal_error(QString("the jitter parameter of %1 must be between 0 and 1, \"%2\" is not valid.")
+                                .arg(where)
+                                .arg(value));
+            snap::NOTREACHED();
+        }
+        f_jitter = number;
+    }
+    else if(name == "error_budget")
+    {
+        if(number < 1.0)
+        {
+            common::fatal_error(QString("the error_budget parameter of %1 must be at least 1, \"%2\" is not valid.")
+                                .arg(where)
+                                .arg(value));
+            snap::NOTREACHED();
+        }
+        f_error_budget = number;
+    }
+    else if(name == "budget_half_life")
+    {
+        f_budget_half_life = static_cast<int64_t>(number * common::SECONDS_TO_MICROSECONDS);
+    }
+    else
+    {
+        common::fatal_error(QString("unknown backoff parameter \"%1\" in %2.")
+                            .arg(name)
+                            .arg(where));
+        snap::NOTREACHED();
+    }
+
+    if(f_max_delay < f_initial_delay)
+    {
+        f_max_delay = f_initial_delay;
+    }
+}
+
+
+/** \brief Override the backoff parameters from a service \<backoff> tag.
+ *
+ * The \<backoff> tag accepts one sub-tag per parameter. The sub-tag
+ * names are the names of the parameters with a dash instead of the
+ * underscore (i.e. \<initial-delay>.)
+ *
+ * \param[in] e  The \<backoff> element.
+ * \param[in] service_name  The name of the service, for error messages.
+ */
+void backoff::configure(QDomElement e, QString const & service_name)
+{
+    QString const where(QString("service \"%1\"").arg(service_name));
+    for(QDomElement sub_element(e.firstChildElement());
+        !sub_element.isNull();
+        sub_element = sub_element.nextSiblingElement())
+    {
+        QString name(sub_element.tagName());
+        set_parameter(name.replace('-', '_'), sub_element.text(), where);
+    }
+}
+
+
+/** \brief Record the fact that the process died with an error.
+ *
+ * The error score gets decayed according to the time elapsed since the
+ * last error and then it gets incremented by one.
+ *
+ * If the process ran for at least max_delay, it is considered to have
+ * been healthy so the exponential delay starts over.
+ *
+ * \param[in] start_date  When the process was started, in microseconds.
+ * \param[in] end_date  When the process died, in microseconds.
+ *
+ * \return true if the error budget is exhausted.
+ */
+bool backoff::record_error(int64_t start_date, int64_t end_date)
+{
+    if(f_last_error_date != 0
+    && f_budget_half_life > 0)
+    {
+        double const elapsed(static_cast<double>(std::max(end_date - f_last_error_date, static_cast<int64_t>(0))));
+        f_error_score *= std::pow(0.5, elapsed / static_cast<double>(f_budget_half_life));
+    }
+    f_error_score += 1.0;
+    f_last_error_date = end_date;
+
+    if(end_date - start_date >= f_max_delay)
+    {
+        f_attempt = 0;
+    }
+
+    return f_error_score >= f_error_budget;
+}
+
+
+/** \brief Compute the delay before the next restart.
+ *
+ * The delay is initial_delay times multiplier to the power of the
+ * number of attempts so far, capped to max_delay, and then the jitter
+ * is applied.
+ *
+ * \return The delay in microseconds.
+ */
+int64_t backoff::next_delay()
+{
+    double const delay(std::min(
+                static_cast<double>(f_initial_delay) * std::pow(f_multiplier, f_attempt),
+                static_cast<double>(f_max_delay)));
+
+    // avoid overflowing the counter, once at max_delay it does not matter
+    //
+    if(delay < static_cast<double>(f_max_delay))
+    {
+        ++f_attempt;
+    }
+
+    return add_jitter(static_cast<int64_t>(delay));
+}
+
+
+/** \brief Apply the jitter to a delay.
+ *
+ * The delay is changed by a random amount of up to jitter times the
+ * delay, in either direction.
+ *
+ * \param[in] delay  The delay in microseconds.
+ *
+ * \return The delay with the jitter applied.
+ */
+int64_t backoff::add_jitter(int64_t delay) const
+{
+    if(f_jitter <= 0.0
+    || delay <= 0)
+    {
+        return delay;
+    }
+
+    std::uniform_real_distribution<double> distribution(-f_jitter, f_jitter);
+    return static_cast<int64_t>(static_cast<double>(delay) * (1.0 + distribution(random_generator())));
+}
+
+
+/** \brief Forget about the past errors.
+ *
+ * This function is called when the process exits normally or once the
+ * service gets paused.
+ */
+void backoff::reset()
+{
+    f_attempt = 0;
+    f_error_score = 0.0;
+    f_last_error_date = 0;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,72 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- restart backoff policy of the snapinit processes
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QDomElement>
+#include <QString>
+
+namespace snapinit
+{
+
+
+class backoff
+{
+public:
+    static int64_t const        DEFAULT_INITIAL_DELAY = 1LL * common::SECONDS_TO_MICROSECONDS;      // 1 second
+    static int64_t const        DEFAULT_MAX_DELAY = 60LL * common::SECONDS_TO_MICROSECONDS;         // 1 minute
+    static int64_t const        DEFAULT_BUDGET_HALF_LIFE = 60LL * common::SECONDS_TO_MICROSECONDS;  // 1 minute
+    static int const            DEFAULT_ERROR_BUDGET = 5;
+
+    void                        set_parameter(QString const & name, QString const & value, QString const & where);
+    void                        configure(QDomElement e, QString const & service_name);
+
+    bool                        record_error(int64_t start_date, int64_t end_date);
+    int64_t                     next_delay();
+    int64_t                     add_jitter(int64_t delay) const;
+    void                        reset();
+
+private:
+    // policy
+    //
+    int64_t                     f_initial_delay = DEFAULT_INITIAL_DELAY;
+    int64_t                     f_max_delay = DEFAULT_MAX_DELAY;
+    double                      f_multiplier = 2.0;
+    double                      f_jitter = 0.2;                 // +/- 20%
+    double                      f_error_budget = DEFAULT_ERROR_BUDGET;
+    int64_t                     f_budget_half_life = DEFAULT_BUDGET_HALF_LIFE;
+
+    // current state
+    //
+    int                         f_attempt = 0;
+    double                      f_error_score = 0.0;
+    int64_t                     f_last_error_date = 0;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,550 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- cgroup v2 placement of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "cgroup.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+#include "mkdir_p.h"
+#include "not_reached.h"
+
+// Qt lib
+//
+#include <QFile>
+#include <QStringList>
+
+// C++ lib
+//
+#include <algorithm>
+
+// C lib
+//
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Place the services in their own cgroup.
+ *
+ * When a service XML file includes a \<cgroup> tag, the process of that
+ * service runs in a cgroup v2 of its own, named after the service, under
+ * the snapinit cgroup root. The limits defined in the \<cgroup> tag are
+ * written to that cgroup before the process gets started.
+ *
+ * The child moves itself into the cgroup (by writing "0" to the
+ * cgroup.procs file opened by the parent) before it drops its privileges
+ * and calls execv(). This way the service cannot create children before
+ * it is in its cgroup.
+ *
+ * The cgroup v2 rules do not allow a cgroup with processes to delegate
+ * controllers to its children. When the cgroup root is the cgroup in
+ * which snapinit runs (the default, i.e. the snapinit.service cgroup
+ * with systemd's Delegate=yes), snapinit first moves itself to a
+ * "snapinit" leaf cgroup.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief The cgroup v2 mount point.
+ */
+char const * const g_cgroup_mount = "/sys/fs/cgroup";
+
+
+/** \brief The \<cgroup> sub-tags and the matching cgroup files.
+ */
+struct cgroup_limit_t
+{
+    char const *    f_tag;
+    char const *    f_filename;
+};
+
+cgroup_limit_t const g_cgroup_limits[] =
+{
+    { "cpu-weight",  "cpu.weight"  },
+    { "cpu-max",     "cpu.max"     },
+    { "memory-high", "memory.high" },
+    { "memory-max",  "memory.max"  },
+    { "io-weight",   "io.weight"   },
+    { "pids-max",    "pids.max"    }
+};
+
+
+/** \brief The controllers snapinit enables for its services.
+ */
+char const * const g_controllers[] =
+{
+    "cpu",
+    "memory",
+    "io",
+    "pids"
+};
+
+
+/** \brief Write a value to a cgroup file.
+ *
+ * The file is not buffered: the kernel validates the value in the
+ * write() itself, which would otherwise only happen (and fail
+ * silently) when the QFile gets closed.
+ *
+ * \param[in] filename  The full path to the cgroup file.
+ * \param[in] value  The value to write.
+ *
+ * \return true if the value was written.
+ */
+bool write_cgroup_file(QString const & filename, QString const & value)
+{
+    QByteArray const data(value.toUtf8());
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Unbuffered)
+    || file.write(data) != data.size())
+    {
+        SNAP_LOG_ERROR("could not write \"")
+                      (value)
+                      ("\" to cgroup file \"")
+                      (filename)
+                      ("\" (")
+                      (file.errorString())
+                      (").");
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief Read a cgroup file.
+ *
+ * \param[in] filename  The full path to the cgroup file.
+ *
+ * \return The content of the file, empty if it could not be read.
+ */
+QString read_cgroup_file(QString const & filename)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return QString();
+    }
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+
+/** \brief Check a \<cgroup> value before we give it to the kernel.
+ *
+ * The kernel verifies the values too, but we want to catch errors
+ * when snapinit starts, not when the service starts.
+ *
+ * \param[in] filename  The cgroup file name.
+ * \param[in] value  The value to check.
+ *
+ * \return true if the value looks valid.
+ */
+bool valid_limit(QString const & filename, QString const & value)
+{
+    bool ok(false);
+    if(filename == "cpu.weight"
+    || filename == "io.weight")
+    {
+        int const weight(value.toInt(&ok, 10));
+        return ok && weight >= 1 && weight <= 10000;
+    }
+    if(filename == "cpu.max")
+    {
+        // "<quota> [<period>]" where quota may be "max"
+        //
+        QStringList const values(value.split(' ', QString::SkipEmptyParts));
+        if(values.isEmpty() || values.size() > 2)
+        {
+            return false;
+        }
+        if(values[0] != "max")
+        {
+            values[0].toLongLong(&ok, 10);
+            if(!ok)
+            {
+                return false;
+            }
+        }
+        if(values.size() == 2)
+        {
+            values[1].toLongLong(&ok, 10);
+            return ok;
+        }
+        return true;
+    }
+    if(filename == "pids.max")
+    {
+        if(value == "max")
+        {
+            return true;
+        }
+        return value.toLongLong(&ok, 10) > 0 && ok;
+    }
+
+    // memory.high and memory.max accept a size with a K, M, G or T suffix
+    //
+    if(value == "max")
+    {
+        return true;
+    }
+    QString size(value.toUpper());
+    if(size.endsWith('K')
+    || size.endsWith('M')
+    || size.endsWith('G')
+    || size.endsWith('T'))
+    {
+        size.chop(1);
+    }
+    size.toLongLong(&ok, 10);
+    return ok;
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// CGROUP (class implementation)               //
+/////////////////////////////////////////////////
+
+
+cgroup::cgroup()
+{
+}
+
+
+/** \brief Close the cgroup.procs file.
+ */
+cgroup::~cgroup()
+{
+    if(f_procs_fd != -1)
+    {
+        close(f_procs_fd);
+    }
+}
+
+
+/** \brief Prepare the cgroup under which the services cgroups get created.
+ *
+ * This function verifies that cgroup v2 is mounted, creates the root
+ * if necessary, moves snapinit to a leaf cgroup if it runs in the root,
+ * and enables the cpu, memory, io and pids controllers for the children
+ * of the root (the controllers not available are skipped.)
+ *
+ * \param[in] root  The root cgroup directory, if empty, use the cgroup
+ *                  in which snapinit runs.
+ *
+ * \return The root cgroup directory or an empty string if cgroups can't
+ *         be used.
+ */
+QString cgroup::setup_root(QString const & root)
+{
+    if(!QFile::exists(QString("%1/cgroup.controllers").arg(g_cgroup_mount)))
+    {
+        SNAP_LOG_WARNING("cgroup v2 is not mounted on \"")
+                        (g_cgroup_mount)
+                        ("\", the <cgroup> tags of the services are ignored.");
+        return QString();
+    }
+
+    // find the cgroup we are running in ("0::/path")
+    //
+    QString own_cgroup;
+    QStringList const lines(read_cgroup_file("/proc/self/cgroup").split('\n'));
+    for(auto const & l : lines)
+    {
+        if(l.startsWith("0::"))
+        {
+            own_cgroup = QString("%1%2").arg(g_cgroup_mount).arg(l.mid(3));
+            if(own_cgroup.endsWith('/'))
+            {
+                own_cgroup.chop(1);
+            }
+            break;
+        }
+    }
+
+    QString path(root);
+    if(path.isEmpty())
+    {
+        // when running in the root cgroup (no systemd) use our own
+        // sub-cgroup, the root cgroup cannot have limits
+        //
+        path = own_cgroup == g_cgroup_mount
+                    ? QString("%1/snapinit").arg(g_cgroup_mount)
+                    : own_cgroup;
+    }
+
+    if(snap::mkdir_p(path, false) != 0)
+    {
+        SNAP_LOG_ERROR("could not create cgroup \"")
+                      (path)
+                      ("\", the <cgroup> tags of the services are ignored.");
+        return QString();
+    }
+
+    // a cgroup with processes cannot delegate controllers
+    //
+    if(path == own_cgroup)
+    {
+        QString const leaf(QString("%1/snapinit").arg(path));
+        if(snap::mkdir_p(leaf, false) != 0
+        || !write_cgroup_file(QString("%1/cgroup.procs").arg(leaf), QString("%1").arg(getpid())))
+        {
+            SNAP_LOG_ERROR("could not move snapinit to cgroup \"")
+                          (leaf)
+                          ("\", the <cgroup> tags of the services are ignored.");
+            return QString();
+        }
+    }
+
+    QStringList const available(read_cgroup_file(QString("%1/cgroup.controllers").arg(path)).split(' '));
+    for(auto const & c : g_controllers)
+    {
+        if(!available.contains(c))
+        {
+            SNAP_LOG_WARNING("cgroup controller \"")
+                            (c)
+                            ("\" is not available in \"")
+                            (path)
+                            ("\", the corresponding limits are ignored.");
+            continue;
+        }
+        if(!write_cgroup_file(QString("%1/cgroup.subtree_control").arg(path), QString("+%1").arg(c)))
+        {
+            SNAP_LOG_ERROR("cgroup controller \"")
+                          (c)
+                          ("\" could not be enabled in \"")
+                          (path)
+                          ("\", the corresponding limits are not applied.");
+        }
+    }
+
+    return path;
+}
+
+
+/** \brief Read the limits from the \<cgroup> tag of a service.
+ *
+ * Each sub-tag defines one limit, see g_cgroup_limits for the list.
+ * An invalid tag or value is a fatal error.
+ *
+ * \param[in] e  The \<cgroup> element.
+ * \param[in] service_name  The name of the service, for error messages.
+ */
+void cgroup::configure(QDomElement e, QString const & service_name)
+{
+    for(QDomElement sub_element(e.firstChildElement());
+        !sub_element.isNull();
+        sub_element = sub_element.nextSiblingElement())
+    {
+        QString const tag(sub_element.tagName());
+        auto const it(std::find_if(
+                  std::begin(g_cgroup_limits)
+                , std::end(g_cgroup_limits)
+                , [&tag](auto const & l)
+                {
+                    return tag == l.f_tag;
+                }));
+        if(it == std::end(g_cgroup_limits))
+        {
+            common::fatal_error(QString("unknown cgroup limit <%1> in service \"%2\".")
+                                .arg(tag)
+                                .arg(service_name));
+            snap::NOTREACHED();
+        }
+
+        QString const value(sub_element.text().simplified());
+        if(!valid_limit(it->f_filename, value))
+        {
+            common::fatal_error(QString("the <%1> cgroup limit of service \"%2\" is not valid: \"%3\".")
+                                .arg(tag)
+                                .arg(service_name)
+                                .arg(value));
+            snap::NOTREACHED();
+        }
+        f_limits[it->f_filename] = value;
+    }
+}
+
+
+/** \brief Check whether the service has a \<cgroup> tag.
+ *
+ * \return true if the service process has to run in its own cgroup.
+ */
+bool cgroup::is_defined() const
+{
+    return !f_limits.empty();
+}
+
+
+cgroup::limits_t const & cgroup::get_limits() const
+{
+    return f_limits;
+}
+
+
+/** \brief Create the cgroup of the service and apply the limits.
+ *
+ * The cgroup is created once and reused each time the service process
+ * gets restarted. The limits are written each time so changes made to
+ * the cgroup by hand get reset.
+ *
+ * \param[in] root  The root cgroup as returned by setup_root().
+ * \param[in] service_name  The name of the service.
+ *
+ * \return true if the cgroup is ready; if false, the process runs in
+ *         the snapinit cgroup.
+ */
+bool cgroup::create(QString const & root, QString const & service_name)
+{
+    if(root.isEmpty()
+    || f_limits.empty())
+    {
+        return false;
+    }
+
+    if(f_procs_fd == -1)
+    {
+        f_path = QString("%1/%2").arg(root).arg(service_name);
+        if(snap::mkdir_p(f_path, false) != 0)
+        {
+            SNAP_LOG_ERROR("could not create cgroup \"")
+                          (f_path)
+                          ("\" for service \"")
+                          (service_name)
+                          ("\".");
+            return false;
+        }
+
+        if(!open_procs())
+        {
+            return false;
+        }
+    }
+
+    for(auto const & l : f_limits)
+    {
+        if(!write_cgroup_file(QString("%1/%2").arg(f_path).arg(l.first), l.second))
+        {
+            SNAP_LOG_ERROR("the ")
+                          (l.first)
+                          (" limit of service \"")
+                          (service_name)
+                          ("\" is not applied.");
+        }
+    }
+
+    return true;
+}
+
+
+/** \brief Reuse a cgroup created by the previous snapinit binary.
+ *
+ * After a REEXEC, the cgroup of a service already exists and its
+ * process may be running in it. The cgroup.procs file gets opened
+ * again so the next process of the service goes to the same cgroup.
+ *
+ * \param[in] path  The cgroup directory saved by the previous binary.
+ *
+ * \return true if the cgroup.procs file could be opened.
+ */
+bool cgroup::adopt(QString const & path)
+{
+    if(f_procs_fd != -1
+    || path.isEmpty())
+    {
+        return false;
+    }
+
+    f_path = path;
+    if(!open_procs())
+    {
+        f_path.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+/** \brief Open the cgroup.procs file of the cgroup.
+ *
+ * \return true if the file is open.
+ */
+bool cgroup::open_procs()
+{
+    QString const procs(QString("%1/cgroup.procs").arg(f_path));
+    f_procs_fd = open(procs.toUtf8().data(), O_WRONLY | O_CLOEXEC);
+    if(f_procs_fd == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not open \"")
+                      (procs)
+                      ("\" (errno: ")
+                      (e)
+                      (" -- ")
+                      (strerror(e))
+                      (").");
+        return false;
+    }
+
+    return true;
+}
+
+
+/** \brief Retrieve the path to the cgroup of the service.
+ *
+ * \return The cgroup directory, empty until create() succeeded.
+ */
+QString const & cgroup::get_path() const
+{
+    return f_path;
+}
+
+
+/** \brief Retrieve the file descriptor of the cgroup.procs file.
+ *
+ * The child writes "0" to this file to move itself to the cgroup.
+ *
+ * \return The file descriptor or -1.
+ */
+int cgroup::get_procs_fd() const
+{
+    return f_procs_fd;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,72 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- cgroup v2 placement of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QDomElement>
+#include <QString>
+
+// C++ lib
+//
+#include <map>
+
+namespace snapinit
+{
+
+
+class cgroup
+{
+public:
+    typedef std::map<QString, QString>  limits_t;   // cgroup file name -> value
+
+                            cgroup();
+                            cgroup(cgroup const & rhs) = delete;
+    cgroup &                operator = (cgroup const & rhs) = delete;
+                            ~cgroup();
+
+    static QString          setup_root(QString const & root);
+
+    void                    configure(QDomElement e, QString const & service_name);
+    bool                    is_defined() const;
+    limits_t const &        get_limits() const;
+
+    bool                    create(QString const & root, QString const & service_name);
+    bool                    adopt(QString const & path);
+    QString const &         get_path() const;
+    int                     get_procs_fd() const;
+
+private:
+    bool                    open_procs();
+
+    limits_t                f_limits;
+    QString                 f_path;
+    int                     f_procs_fd = -1;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -28,14 +28,20 @@
 // our library
 //
 #include <log.h>
+#include <not_used.h>
 
 // C++ library
 //
+#include <algorithm>
 #include <iostream>
 
 // C library
 //
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <syslog.h>
+#include <unistd.h>
 
 
 namespace snapinit
@@ -159,6 +165,121 @@ void setup_fatal_pid()
 
 
 
+/** \brief Get a pidfd for the specified process.
+ *
+ * This function calls the pidfd_open() system call. The C library
+ * may not offer a wrapper so we call syscall() directly.
+ *
+ * The returned file descriptor becomes readable once the process
+ * exits. It also refers to that one process, so it cannot be confused
+ * with another process which would reuse the same PID.
+ *
+ * If the kernel (or the headers we are compiled with) does not support
+ * pidfd, then the function returns -1 and errno is set to ENOSYS.
+ *
+ * \param[in] pid  The PID of one of our children.
+ *
+ * \return The pidfd or -1 on error.
+ */
+int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    snap::NOTUSED(pid);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/** \brief Send a signal to a process through its pidfd.
+ *
+ * This function calls the pidfd_send_signal() system call. Contrary
+ * to kill(), the signal cannot reach a different process which would
+ * have reused the PID of a child which already died.
+ *
+ * \param[in] pidfd  The pidfd of the process to signal.
+ * \param[in] signum  The signal to send such as SIGTERM.
+ *
+ * \return 0 on success, -1 on error with errno set.
+ */
+int pidfd_send_signal(int pidfd, int signum)
+{
+#ifdef SYS_pidfd_send_signal
+    return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, signum, nullptr, 0));
+#else
+    snap::NOTUSED(pidfd);
+    snap::NOTUSED(signum);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/** \brief Create an anonymous file in memory.
+ *
+ * This function calls the memfd_create() system call. The C library
+ * may not offer a wrapper so we call syscall() directly.
+ *
+ * The file is created without the close-on-exec flag so it can be
+ * passed to a program we execute.
+ *
+ * \param[in] name  The name of the file, only used for debugging.
+ *
+ * \return The file descriptor or -1 on error with errno set.
+ */
+int memfd_create(char const * name)
+{
+#ifdef SYS_memfd_create
+    return static_cast<int>(syscall(SYS_memfd_create, name, 0));
+#else
+    snap::NOTUSED(name);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+
+/** \brief Get the list of CPUs snapinit is allowed to run on.
+ *
+ * This is the affinity of snapinit itself so a cpuset restricting
+ * snapinit also restricts the services. If the affinity cannot be
+ * retrieved, all the online CPUs are returned.
+ *
+ * \return The CPU numbers, never empty.
+ */
+std::vector<int> get_allowed_cpus()
+{
+    std::vector<int> cpus;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for(int cpu(0); cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    if(cpus.empty())
+    {
+        long const count(sysconf(_SC_NPROCESSORS_ONLN));
+        for(int cpu(0); cpu < std::max(count, 1L); ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+
 } // namespace common
 } // namespace snapinit
 // vim: ts=4 sw=4 et
@@ -23,8 +23,17 @@
 
 // Qt library
 //
+#include <QHash>
 #include <QString>
 
+// C++ lib
+//
+#include <vector>
+
+// C lib
+//
+#include <sys/types.h>
+
 namespace snapinit
 {
 namespace common
@@ -37,10 +46,27 @@ int64_t const        SECONDS_TO_MICROSECONDS = 1000000LL;        // 1 second in
 //       then properly handle various cases (and probably make use
 //       of an exception instead of exit(1)...)
 
+/** \brief Hash function used to index QString keys in std::unordered_map.
+ *
+ * Qt 5 does not offer a std::hash<QString> specialization so we
+ * use qHash() instead.
+ */
+struct qstring_hash
+{
+    size_t operator () (QString const & s) const
+    {
+        return qHash(s);
+    }
+};
+
 bool                is_a_tty();
 void                fatal_message(QString const & msg);
 [[noreturn]] void   fatal_error(QString const & msg);
 void                setup_fatal_pid();
+int                 pidfd_open(pid_t pid);
+int                 pidfd_send_signal(int pidfd, int signum);
+int                 memfd_create(char const * name);
+std::vector<int>    get_allowed_cpus();
 
 } // namespace common
 } // namespace snapinit
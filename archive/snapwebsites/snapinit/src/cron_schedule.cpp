@@ -0,0 +1,532 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- schedule of the snapinit cron tasks
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "cron_schedule.h"
+
+// snapwebsites lib
+//
+#include "not_reached.h"
+#include "snapwebsites.h"
+
+// Qt lib
+//
+#include <QStringList>
+
+// C++ lib
+//
+#include <algorithm>
+
+// C lib
+//
+#include <time.h>
+
+
+/** \file
+ * \brief Compute the ticks of a cron task.
+ *
+ * The \<cron> tag accepts two syntaxes:
+ *
+ * \li a number of seconds, the ticks are multiples of that number
+ *     counting from Jan 1, 2012 at midnight UTC (the original syntax);
+ * \li a crontab expression with five fields: minute, hour, day of the
+ *     month, month and day of the week, in local time. The fields
+ *     support "*", lists ("1,15"), ranges ("1-5"), steps ("0-59/5"
+ *     or "10-50/10") and the three letter English names of the months
+ *     and days. The \@hourly, \@daily, \@weekly, \@monthly and \@yearly
+ *     shortcuts are also accepted.
+ *
+ * All the ticks of a schedule can be shifted by a jitter. The shift
+ * is computed from the server and service names so it does not change
+ * between restarts, but different computers run the same task at
+ * different times.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief The start date of the interval ticks.
+ *
+ * This date was hard coded in service::compute_next_tick() and is kept
+ * so the existing installations keep the same ticks.
+ */
+int64_t const g_interval_start_date(SNAP_UNIX_TIMESTAMP(2012, 1, 1, 0, 0, 0));
+
+
+char const * const g_month_names[] =
+{
+    "jan", "feb", "mar", "apr", "may", "jun",
+    "jul", "aug", "sep", "oct", "nov", "dec",
+    nullptr
+};
+
+
+char const * const g_day_names[] =
+{
+    "sun", "mon", "tue", "wed", "thu", "fri", "sat",
+    nullptr
+};
+
+
+/** \brief The number of steps next_base_after() may take.
+ *
+ * Each step moves to the next month, day, hour or minute, so this is
+ * enough to find any date that can be found within a few years. An
+ * expression such as "0 0 30 2 *" never matches and this is how we
+ * detect it.
+ */
+int const g_max_search_steps = 50000;
+
+
+/** \brief Convert a local time back to a Unix time.
+ *
+ * The tm structure may be out of range (i.e. tm_mday set to 32) in
+ * which case mktime() normalizes it.
+ *
+ * \param[in] t  The local time to convert.
+ *
+ * \return The corresponding Unix time.
+ */
+int64_t to_time(struct tm t)
+{
+    t.tm_sec = 0;
+    t.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&t));
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// CRON SCHEDULE (class implementation)        //
+/////////////////////////////////////////////////
+
+
+/** \brief Parse the content of a \<cron> tag.
+ *
+ * If the specification is invalid, the function calls
+ * common::fatal_error() which does not return.
+ *
+ * \param[in] spec  The content of the \<cron> tag.
+ * \param[in] service_name  The name of the service, for error messages.
+ */
+void cron_schedule::parse(QString const & spec, QString const & service_name)
+{
+    f_interval = 0;
+    f_expression = false;
+
+    QString expression(spec.simplified());
+    if(expression == "off")
+    {
+        return;
+    }
+
+    bool ok(false);
+    f_interval = expression.toLongLong(&ok, 10);
+    if(ok)
+    {
+        // we function like anacron and know when we have to run
+        // (i.e. whether we missed some prior runs) so very large
+        // cron values will work just as expected
+        // (see /var/spool/snapwebsites/snapinit/cron-ticks.spool)
+        //
+        if(f_interval < 60
+        || f_interval > 86400 * 367)
+        {
+            common::fatal_error(QString("the cron tag of service \"%1\" must be a number between 60 (1 minute) and 31708800 (a little over 1 year in seconds).")
+                          .arg(service_name));
+            snap::NOTREACHED();
+        }
+        return;
+    }
+    f_interval = 0;
+
+    if(expression == "@hourly")
+    {
+        expression = "0 * * * *";
+    }
+    else if(expression == "@daily")
+    {
+        expression = "0 0 * * *";
+    }
+    else if(expression == "@weekly")
+    {
+        expression = "0 0 * * 0";
+    }
+    else if(expression == "@monthly")
+    {
+        expression = "0 0 1 * *";
+    }
+    else if(expression == "@yearly"
+         || expression == "@annually")
+    {
+        expression = "0 0 1 1 *";
+    }
+
+    QStringList const fields(expression.toLower().split(' '));
+    if(fields.size() != 5
+    || !parse_field(fields[0], 0, 59, nullptr, f_minutes)
+    || !parse_field(fields[1], 0, 23, nullptr, f_hours)
+    || !parse_field(fields[2], 1, 31, nullptr, f_days_of_month)
+    || !parse_field(fields[3], 1, 12, g_month_names, f_months)
+    || !parse_field(fields[4], 0, 7, g_day_names, f_days_of_week))
+    {
+        common::fatal_error(QString("the cron tag of service \"%1\" must be \"off\", a number of seconds or a crontab expression (minute hour day-of-month month day-of-week), \"%2\" is not valid.")
+                      .arg(service_name)
+                      .arg(spec));
+        snap::NOTREACHED();
+    }
+
+    // Sunday can be 0 or 7
+    //
+    if(f_days_of_week[7])
+    {
+        f_days_of_week[0] = true;
+        f_days_of_week[7] = false;
+    }
+    f_any_day_of_month = fields[2] == "*";
+    f_any_day_of_week = fields[4] == "*";
+    f_expression = true;
+
+    if(next_base_after(snap::snap_child::get_current_date() / common::SECONDS_TO_MICROSECONDS) == -1)
+    {
+        common::fatal_error(QString("the cron expression \"%1\" of service \"%2\" never matches any date.")
+                      .arg(spec)
+                      .arg(service_name));
+        snap::NOTREACHED();
+    }
+}
+
+
+/** \brief Shift all the ticks by a jitter.
+ *
+ * The shift is a number of seconds between 0 and \p max_jitter. It is
+ * computed from \p seed (the server and service names) with an FNV-1a
+ * hash so the same computer always gets the same shift.
+ *
+ * \param[in] max_jitter  The largest shift in seconds.
+ * \param[in] seed  The string used to compute the shift.
+ */
+void cron_schedule::set_jitter(int64_t max_jitter, QString const & seed)
+{
+    if(max_jitter <= 0)
+    {
+        f_offset = 0;
+        return;
+    }
+
+    uint64_t hash(14695981039346656037ULL);
+    QByteArray const utf8(seed.toUtf8());
+    for(char const c : utf8)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    f_offset = static_cast<int64_t>(hash % static_cast<uint64_t>(max_jitter + 1));
+}
+
+
+/** \brief Define what happens with the ticks we missed.
+ *
+ * \param[in] catch_up  One of "skip", "run-once" or "run-all".
+ * \param[in] service_name  The name of the service, for error messages.
+ */
+void cron_schedule::set_catch_up(QString const & catch_up, QString const & service_name)
+{
+    if(catch_up == "skip")
+    {
+        f_catch_up = catch_up_t::CATCH_UP_SKIP;
+    }
+    else if(catch_up == "run-once")
+    {
+        f_catch_up = catch_up_t::CATCH_UP_RUN_ONCE;
+    }
+    else if(catch_up == "run-all")
+    {
+        f_catch_up = catch_up_t::CATCH_UP_RUN_ALL;
+    }
+    else
+    {
+        common::fatal_error(QString("the catch-up attribute of the cron tag of service \"%1\" must be \"skip\", \"run-once\" or \"run-all\", \"%2\" is not valid.")
+                      .arg(service_name)
+                      .arg(catch_up));
+        snap::NOTREACHED();
+    }
+}
+
+
+cron_schedule::catch_up_t cron_schedule::get_catch_up() const
+{
+    return f_catch_up;
+}
+
+
+/** \brief Check whether a schedule was defined.
+ *
+ * \return true if the \<cron> tag defined an interval or an expression.
+ */
+bool cron_schedule::is_defined() const
+{
+    return f_interval != 0 || f_expression;
+}
+
+
+/** \brief Compute the first tick strictly after \p date.
+ *
+ * \param[in] date  A Unix time in seconds.
+ *
+ * \return The next tick in seconds or -1 if there is none.
+ */
+int64_t cron_schedule::next_after(int64_t date) const
+{
+    int64_t const tick(next_base_after(date - f_offset));
+    return tick == -1 ? -1 : tick + f_offset;
+}
+
+
+/** \brief Compute the latest tick at or before \p date.
+ *
+ * The search starts at \p from, which is expected to be a tick. If
+ * no tick happens between \p from and \p date, then \p from is
+ * returned.
+ *
+ * \param[in] from  A tick at or before \p date.
+ * \param[in] date  A Unix time in seconds.
+ *
+ * \return The latest tick at or before \p date.
+ */
+int64_t cron_schedule::latest_at(int64_t from, int64_t date) const
+{
+    if(f_interval != 0)
+    {
+        int64_t const base(date - f_offset - g_interval_start_date);
+        int64_t const tick(g_interval_start_date + (base / f_interval) * f_interval + f_offset);
+        return std::max(from, tick);
+    }
+
+    int64_t tick(from);
+    for(;;)
+    {
+        int64_t const next(next_after(tick));
+        if(next == -1
+        || next > date)
+        {
+            return tick;
+        }
+        tick = next;
+    }
+}
+
+
+/** \brief Parse one field of a crontab expression.
+ *
+ * \param[in] field  The field to parse.
+ * \param[in] min  The smallest valid value.
+ * \param[in] max  The largest valid value.
+ * \param[in] names  The names of the values starting at \p min, or nullptr.
+ * \param[out] bits  The bits representing the values of the field.
+ *
+ * \return true if the field is valid.
+ */
+bool cron_schedule::parse_field(QString const & field, int min, int max, char const * const * names, std::bitset<60> & bits)
+{
+    auto const value([min, max, names](QString const & v, int & result)
+        {
+            bool ok(false);
+            result = v.toInt(&ok, 10);
+            if(!ok && names != nullptr)
+            {
+                for(int idx(0); names[idx] != nullptr; ++idx)
+                {
+                    if(v == names[idx])
+                    {
+                        result = idx + (min == 0 ? 0 : 1);
+                        ok = true;
+                        break;
+                    }
+                }
+            }
+            return ok && result >= min && result <= max;
+        });
+
+    bits.reset();
+    for(auto const & item : field.split(','))
+    {
+        QStringList const range_step(item.split('/'));
+        if(range_step.size() > 2)
+        {
+            return false;
+        }
+
+        int step(1);
+        if(range_step.size() == 2)
+        {
+            bool ok(false);
+            step = range_step[1].toInt(&ok, 10);
+            if(!ok || step <= 0)
+            {
+                return false;
+            }
+        }
+
+        int first(min);
+        int last(max);
+        if(range_step[0] != "*")
+        {
+            QStringList const range(range_step[0].split('-'));
+            if(range.size() > 2
+            || !value(range[0], first))
+            {
+                return false;
+            }
+            if(range.size() == 2)
+            {
+                if(!value(range[1], last)
+                || last < first)
+                {
+                    return false;
+                }
+            }
+            else if(range_step.size() == 1)
+            {
+                last = first;
+            }
+        }
+
+        for(int v(first); v <= last; v += step)
+        {
+            bits[v] = true;
+        }
+    }
+
+    return bits.any();
+}
+
+
+/** \brief Compute the next tick without the jitter.
+ *
+ * \param[in] date  A Unix time in seconds.
+ *
+ * \return The next tick in seconds or -1 if there is none.
+ */
+int64_t cron_schedule::next_base_after(int64_t date) const
+{
+    if(f_interval != 0)
+    {
+        int64_t const ticks((date - g_interval_start_date) / f_interval);
+        int64_t tick(g_interval_start_date + ticks * f_interval);
+        while(tick <= date)
+        {
+            tick += f_interval;
+        }
+        return tick;
+    }
+
+    if(!f_expression)
+    {
+        return -1;
+    }
+
+    // start on the next minute, each step below either returns or
+    // moves to the start of the next month, day, hour or minute
+    //
+    int64_t result((date / 60 + 1) * 60);
+    for(int step(0); step < g_max_search_steps; ++step)
+    {
+        time_t const now(static_cast<time_t>(result));
+        struct tm t;
+        localtime_r(&now, &t);
+
+        int64_t next(0);
+        if(!f_months[t.tm_mon + 1])
+        {
+            t.tm_mon += 1;
+            t.tm_mday = 1;
+            t.tm_hour = 0;
+            t.tm_min = 0;
+            next = to_time(t);
+        }
+        else if(!day_matches(t))
+        {
+            t.tm_mday += 1;
+            t.tm_hour = 0;
+            t.tm_min = 0;
+            next = to_time(t);
+        }
+        else if(!f_hours[t.tm_hour])
+        {
+            t.tm_hour += 1;
+            t.tm_min = 0;
+            next = to_time(t);
+        }
+        else if(!f_minutes[t.tm_min])
+        {
+            t.tm_min += 1;
+            next = to_time(t);
+        }
+        else
+        {
+            return result;
+        }
+
+        // daylight saving time changes could send us backward
+        //
+        result = std::max(next, result + 60);
+    }
+
+    return -1;
+}
+
+
+/** \brief Check whether the day of \p t matches.
+ *
+ * Like cron, when both the day of the month and the day of the week
+ * are restricted, a day matching either one matches.
+ *
+ * \param[in] t  The local time to check.
+ *
+ * \return true if the day matches.
+ */
+bool cron_schedule::day_matches(struct tm const & t) const
+{
+    bool const dom(f_days_of_month[t.tm_mday]);
+    bool const dow(f_days_of_week[t.tm_wday]);
+    if(f_any_day_of_month || f_any_day_of_week)
+    {
+        return dom && dow;
+    }
+    return dom || dow;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- schedule of the snapinit cron tasks
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <bitset>
+
+namespace snapinit
+{
+
+
+class cron_schedule
+{
+public:
+    enum class catch_up_t
+    {
+        CATCH_UP_SKIP,          // ignore the missed ticks, wait for the next one
+        CATCH_UP_RUN_ONCE,      // run once for all the missed ticks (default)
+        CATCH_UP_RUN_ALL        // run once per missed tick
+    };
+
+    void                    parse(QString const & spec, QString const & service_name);
+    void                    set_jitter(int64_t max_jitter, QString const & seed);
+    void                    set_catch_up(QString const & catch_up, QString const & service_name);
+    catch_up_t              get_catch_up() const;
+
+    bool                    is_defined() const;
+    int64_t                 next_after(int64_t date) const;
+    int64_t                 latest_at(int64_t from, int64_t date) const;
+
+private:
+    bool                    parse_field(QString const & field, int min, int max, char const * const * names, std::bitset<60> & bits);
+    int64_t                 next_base_after(int64_t date) const;
+    bool                    day_matches(struct tm const & t) const;
+
+    // a period in seconds (the old <cron>300</cron> syntax)
+    //
+    int64_t                 f_interval = 0;
+
+    // a crontab like expression
+    //
+    bool                    f_expression = false;
+    bool                    f_any_day_of_month = true;
+    bool                    f_any_day_of_week = true;
+    std::bitset<60>         f_minutes;
+    std::bitset<60>         f_hours;
+    std::bitset<60>         f_days_of_month;
+    std::bitset<60>         f_months;
+    std::bitset<60>         f_days_of_week;
+
+    int64_t                 f_offset = 0;
+    catch_up_t              f_catch_up = catch_up_t::CATCH_UP_RUN_ONCE;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
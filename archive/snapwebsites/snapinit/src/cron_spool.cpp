@@ -0,0 +1,379 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- memory mapped spool of the cron tasks ticks
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "cron_spool.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+
+// Qt lib
+//
+#include <QFile>
+
+// C++ lib
+//
+#include <stdexcept>
+
+// C lib
+//
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief The spool file of the cron tasks.
+ *
+ * Each cron task needs to remember its next tick so when snapinit
+ * restarts, it does not run the task again too soon (or miss a run.)
+ * All the cron tasks share one file, "cron-ticks.spool", in the
+ * snapinit spool directory. The file has a 64 byte header followed
+ * by MAX_SLOTS slots of 64 bytes, one per cron task. A slot is the
+ * name of the service followed by its tick, a 64 bit number of
+ * seconds since the Unix epoch.
+ *
+ * The file is memory mapped, so updating a tick is one atomic 64 bit
+ * store. The file always holds either the old or the new tick, even
+ * if snapinit crashes in between. The sync policy (see set_sync())
+ * defines whether we also ask the kernel to flush the page right away.
+ *
+ * The previous versions of snapinit saved the tick in one text file
+ * per service (\<service>.txt). Those get imported the first time a
+ * service is not yet found in the spool.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+char const      g_cron_spool_magic[8] = { 'S', 'N', 'A', 'P', 'C', 'R', 'O', 'N' };
+uint32_t const  g_cron_spool_version = 1;
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// CRON SPOOL (class implementation)           //
+/////////////////////////////////////////////////
+
+
+cron_spool::cron_spool()
+{
+}
+
+
+cron_spool::~cron_spool()
+{
+    if(f_header != nullptr)
+    {
+        size_t const size(sizeof(header_t) + MAX_SLOTS * sizeof(slot_t));
+        munmap(f_header, size);
+    }
+    if(f_fd != -1)
+    {
+        close(f_fd);
+    }
+}
+
+
+/** \brief Open the spool file.
+ *
+ * This function creates the spool file if it does not exist yet and
+ * maps it in memory. If the file does not have the expected header,
+ * it gets reinitialized.
+ *
+ * In read-only mode (i.e. snapinit --list) the file is not created,
+ * not reinitialized and no new slots get allocated.
+ *
+ * Calling the function again once the file is open has no effect.
+ *
+ * \param[in] spool_path  The directory where the spool file is saved.
+ * \param[in] read_only  Whether the file is only going to be read.
+ *
+ * \return true if the spool file is ready.
+ */
+bool cron_spool::open(QString const & spool_path, bool read_only)
+{
+    if(f_header != nullptr)
+    {
+        return true;
+    }
+
+    f_spool_path = spool_path;
+    f_read_only = read_only;
+    QString const filename(QString("%1/cron-ticks.spool").arg(spool_path));
+
+    f_fd = ::open(filename.toUtf8().data(), read_only ? O_RDONLY | O_CLOEXEC : O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(f_fd == -1)
+    {
+        if(read_only)
+        {
+            return false;
+        }
+        int const e(errno);
+        SNAP_LOG_ERROR("could not open cron spool file \"")
+                      (filename)
+                      ("\" (errno: ")
+                      (e)
+                      (" -- ")
+                      (strerror(e))
+                      (").");
+        return false;
+    }
+
+    size_t const size(sizeof(header_t) + MAX_SLOTS * sizeof(slot_t));
+    struct stat st;
+    if(fstat(f_fd, &st) != 0
+    || (static_cast<size_t>(st.st_size) < size && (read_only || ftruncate(f_fd, size) != 0)))
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not resize cron spool file \"")
+                      (filename)
+                      ("\" (errno: ")
+                      (e)
+                      (" -- ")
+                      (strerror(e))
+                      (").");
+        close(f_fd);
+        f_fd = -1;
+        return false;
+    }
+
+    void * ptr(mmap(nullptr, size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, f_fd, 0));
+    if(ptr == MAP_FAILED)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not map cron spool file \"")
+                      (filename)
+                      ("\" (errno: ")
+                      (e)
+                      (" -- ")
+                      (strerror(e))
+                      (").");
+        close(f_fd);
+        f_fd = -1;
+        return false;
+    }
+    f_header = reinterpret_cast<header_t *>(ptr);
+    f_slots = reinterpret_cast<slot_t *>(f_header + 1);
+
+    if(memcmp(f_header->f_magic, g_cron_spool_magic, sizeof(g_cron_spool_magic)) != 0
+    || f_header->f_version != g_cron_spool_version
+    || f_header->f_slot_count > static_cast<uint32_t>(MAX_SLOTS))
+    {
+        if(read_only)
+        {
+            munmap(ptr, size);
+            f_header = nullptr;
+            f_slots = nullptr;
+            close(f_fd);
+            f_fd = -1;
+            return false;
+        }
+
+        // new or invalid file, start from scratch
+        //
+        memset(ptr, 0, size);
+        memcpy(f_header->f_magic, g_cron_spool_magic, sizeof(g_cron_spool_magic));
+        f_header->f_version = g_cron_spool_version;
+        f_header->f_slot_count = 0;
+        sync(ptr, size);
+    }
+
+    for(uint32_t idx(0); idx < f_header->f_slot_count; ++idx)
+    {
+        f_slot_map[QString::fromUtf8(f_slots[idx].f_name)] = static_cast<int>(idx);
+    }
+
+    return true;
+}
+
+
+/** \brief Define how the updates get flushed to disk.
+ *
+ * \param[in] sync  The new sync policy.
+ */
+void cron_spool::set_sync(sync_t sync)
+{
+    f_sync = sync;
+}
+
+
+/** \brief Get the tick saved for the specified service.
+ *
+ * \param[in] service_name  The name of the cron service.
+ *
+ * \return The tick in seconds or 0 if no tick was saved yet.
+ */
+int64_t cron_spool::get_tick(QString const & service_name)
+{
+    slot_t const * slot(find_slot(service_name, !f_read_only));
+    if(slot == nullptr)
+    {
+        return 0;
+    }
+    return __atomic_load_n(&slot->f_tick, __ATOMIC_ACQUIRE);
+}
+
+
+/** \brief Save the tick of the specified service.
+ *
+ * \param[in] service_name  The name of the cron service.
+ * \param[in] tick  The tick in seconds.
+ */
+void cron_spool::set_tick(QString const & service_name, int64_t tick)
+{
+    if(f_read_only)
+    {
+        throw std::runtime_error("cron_spool::set_tick() called on a read-only cron spool.");
+    }
+
+    slot_t * slot(find_slot(service_name, true));
+    if(slot == nullptr)
+    {
+        return;
+    }
+    __atomic_store_n(&slot->f_tick, tick, __ATOMIC_RELEASE);
+    sync(&slot->f_tick, sizeof(slot->f_tick));
+}
+
+
+/** \brief Search the slot of a service.
+ *
+ * If the service does not yet have a slot and \p create is true, a new
+ * slot gets allocated. The tick of the new slot is imported from the
+ * legacy \<service>.txt file if it exists.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in] create  Whether to create the slot if it does not exist.
+ *
+ * \return The slot or nullptr.
+ */
+cron_spool::slot_t * cron_spool::find_slot(QString const & service_name, bool create)
+{
+    if(f_header == nullptr)
+    {
+        return nullptr;
+    }
+
+    auto const it(f_slot_map.find(service_name));
+    if(it != f_slot_map.end())
+    {
+        return f_slots + it->second;
+    }
+
+    if(!create)
+    {
+        return nullptr;
+    }
+
+    QByteArray const name(service_name.toUtf8());
+    if(name.size() > MAX_NAME_LENGTH)
+    {
+        SNAP_LOG_ERROR("cron service name \"")
+                      (service_name)
+                      ("\" is too long to be saved in the cron spool.");
+        return nullptr;
+    }
+    if(f_header->f_slot_count >= static_cast<uint32_t>(MAX_SLOTS))
+    {
+        SNAP_LOG_ERROR("the cron spool is full, cannot save the tick of \"")
+                      (service_name)
+                      ("\".");
+        return nullptr;
+    }
+
+    // fill the slot before we count it so a crash in between does
+    // not leave a half initialized slot in the file
+    //
+    int const idx(static_cast<int>(f_header->f_slot_count));
+    slot_t * slot(f_slots + idx);
+    memset(slot->f_name, 0, sizeof(slot->f_name));
+    memcpy(slot->f_name, name.data(), name.size());
+    __atomic_store_n(&slot->f_tick, import_legacy_tick(service_name), __ATOMIC_RELEASE);
+    sync(slot, sizeof(*slot));
+
+    __atomic_store_n(&f_header->f_slot_count, f_header->f_slot_count + 1, __ATOMIC_RELEASE);
+    sync(f_header, sizeof(*f_header));
+
+    f_slot_map[service_name] = idx;
+
+    return slot;
+}
+
+
+/** \brief Read the tick from the old \<service>.txt spool file.
+ *
+ * \param[in] service_name  The name of the service.
+ *
+ * \return The tick found in the file or 0.
+ */
+int64_t cron_spool::import_legacy_tick(QString const & service_name) const
+{
+    QFile spool_file(QString("%1/%2.txt").arg(f_spool_path).arg(service_name));
+    if(!spool_file.open(QIODevice::ReadOnly))
+    {
+        return 0;
+    }
+    bool ok(false);
+    int64_t const tick(QString::fromUtf8(spool_file.readAll()).toLongLong(&ok, 10));
+    return ok ? tick : 0;
+}
+
+
+/** \brief Flush the specified data according to the sync policy.
+ *
+ * msync() requires a page aligned address so the pointer gets rounded
+ * down to the start of its page.
+ *
+ * \param[in] ptr  The start of the data that changed.
+ * \param[in] size  The size of the data that changed.
+ */
+void cron_spool::sync(void const * ptr, size_t size) const
+{
+    if(f_sync == sync_t::SYNC_NONE)
+    {
+        return;
+    }
+
+    uintptr_t const page_size(static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)));
+    uintptr_t const start(reinterpret_cast<uintptr_t>(ptr) & ~(page_size - 1));
+    uintptr_t const end(reinterpret_cast<uintptr_t>(ptr) + size);
+    msync(reinterpret_cast<void *>(start), end - start, f_sync == sync_t::SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
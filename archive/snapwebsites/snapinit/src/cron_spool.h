@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- memory mapped spool of the cron tasks ticks
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <unordered_map>
+
+namespace snapinit
+{
+
+
+class cron_spool
+{
+public:
+    enum class sync_t
+    {
+        SYNC_NONE,          // let the kernel write the pages whenever
+        SYNC_ASYNC,         // msync(MS_ASYNC) after each update (default)
+        SYNC_SYNC           // msync(MS_SYNC) after each update
+    };
+
+    static int const        MAX_SLOTS = 256;
+    static int const        MAX_NAME_LENGTH = 55;
+
+                            cron_spool();
+                            cron_spool(cron_spool const & rhs) = delete;
+    cron_spool &            operator = (cron_spool const & rhs) = delete;
+                            ~cron_spool();
+
+    bool                    open(QString const & spool_path, bool read_only = false);
+    void                    set_sync(sync_t sync);
+
+    int64_t                 get_tick(QString const & service_name);
+    void                    set_tick(QString const & service_name, int64_t tick);
+
+private:
+    struct header_t
+    {
+        char                f_magic[8];
+        uint32_t            f_version;
+        uint32_t            f_slot_count;
+        char                f_reserved[48];
+    };
+
+    struct slot_t
+    {
+        char                f_name[MAX_NAME_LENGTH + 1];
+        int64_t             f_tick;
+    };
+
+    static_assert(sizeof(header_t) == 64, "the cron spool header must be 64 bytes");
+    static_assert(sizeof(slot_t) == 64, "the cron spool slots must be 64 bytes");
+
+    typedef std::unordered_map<QString, int, common::qstring_hash>  slot_map_t;
+
+    slot_t *                find_slot(QString const & service_name, bool create);
+    int64_t                 import_legacy_tick(QString const & service_name) const;
+    void                    sync(void const * ptr, size_t size) const;
+
+    QString                 f_spool_path;
+    sync_t                  f_sync = sync_t::SYNC_ASYNC;
+    bool                    f_read_only = false;
+    int                     f_fd = -1;
+    header_t *              f_header = nullptr;
+    slot_t *                f_slots = nullptr;
+    slot_map_t              f_slot_map;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,305 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- state passed to a new snapinit binary
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "handoff.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+
+// Qt lib
+//
+#include <QByteArray>
+#include <QList>
+
+// C lib
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Pass the state of snapinit to a new snapinit binary.
+ *
+ * When snapinit receives a REEXEC message, it saves the state of its
+ * services in a memfd and executes itself again with the
+ * --rehydrate \<fd> option (see snap_init::reexec()). The children
+ * are not affected: they remain children of the same PID and the
+ * file descriptors snapinit keeps for them (listen sockets, zygote
+ * control sockets, lock file) are passed through the execve().
+ *
+ * The memfd includes one line per entry, each entry being a message
+ * as generated by snap_communicator_message::to_message():
+ *
+ * \code
+ *      HANDOFF version=1
+ *      SERVICE service=snapserver;pid=1234;registered=true;...
+ *      SERVICE service=images;start_count=3;error_count=1;...
+ * \endcode
+ *
+ * The file descriptors passed to the new binary have their
+ * close-on-exec flag cleared. If the execve() fails, cancel()
+ * sets the flag back.
+ */
+
+
+namespace snapinit
+{
+
+
+
+/////////////////////////////////////////////////
+// HANDOFF (class implementation)              //
+/////////////////////////////////////////////////
+
+
+handoff::handoff()
+{
+}
+
+
+/** \brief Close the memfd if it is still open.
+ *
+ * After a successful execve() this destructor does not run.
+ */
+handoff::~handoff()
+{
+    if(f_memfd != -1)
+    {
+        close(f_memfd);
+    }
+}
+
+
+/** \brief Add an entry to the handoff.
+ *
+ * \param[in] entry  The entry, its command names the type of entry.
+ */
+void handoff::add_entry(snap::snap_communicator_message const & entry)
+{
+    f_entries.push_back(entry);
+}
+
+
+/** \brief Get the entries added or loaded.
+ *
+ * The HANDOFF header is not included.
+ *
+ * \return The list of entries.
+ */
+handoff::entry_vector_t const & handoff::get_entries() const
+{
+    return f_entries;
+}
+
+
+/** \brief Keep a file descriptor open through the execve().
+ *
+ * \param[in] fd  The file descriptor to pass to the new binary.
+ *
+ * \return true if the close-on-exec flag could be cleared.
+ */
+bool handoff::pass_fd(int fd)
+{
+    int const flags(fcntl(fd, F_GETFD));
+    if(flags == -1
+    || fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC) == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not pass file descriptor ")(fd)(" to the new snapinit (errno: ")(e)(" -- ")(strerror(e))(").");
+        return false;
+    }
+    f_passed_fds.push_back(fd);
+    return true;
+}
+
+
+/** \brief Write the entries to a memfd.
+ *
+ * \return The memfd, rewound, or -1 on error.
+ */
+int handoff::save()
+{
+    f_memfd = common::memfd_create("snapinit-handoff");
+    if(f_memfd == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("memfd_create() failed, the state of snapinit cannot be saved (errno: ")(e)(" -- ")(strerror(e))(").");
+        return -1;
+    }
+
+    snap::snap_communicator_message header;
+    header.set_command("HANDOFF");
+    header.add_parameter("version", VERSION);
+
+    QByteArray data(header.to_message().toUtf8());
+    data += '\n';
+    for(auto const & entry : f_entries)
+    {
+        data += entry.to_message().toUtf8();
+        data += '\n';
+    }
+
+    char const * ptr(data.data());
+    ssize_t size(data.size());
+    while(size > 0)
+    {
+        ssize_t const r(write(f_memfd, ptr, size));
+        if(r <= 0)
+        {
+            if(r == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            int const e(errno);
+            SNAP_LOG_ERROR("could not write the state of snapinit to its memfd (errno: ")(e)(" -- ")(strerror(e))(").");
+            return -1;
+        }
+        ptr += r;
+        size -= r;
+    }
+
+    if(lseek(f_memfd, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+
+    return f_memfd;
+}
+
+
+/** \brief The execve() failed, we keep running.
+ *
+ * The passed file descriptors get their close-on-exec flag back and
+ * the memfd is closed.
+ */
+void handoff::cancel()
+{
+    for(auto const fd : f_passed_fds)
+    {
+        claim_fd(fd);
+    }
+    f_passed_fds.clear();
+
+    if(f_memfd != -1)
+    {
+        close(f_memfd);
+        f_memfd = -1;
+    }
+}
+
+
+/** \brief Read the entries saved by the previous snapinit binary.
+ *
+ * The \p fd gets closed.
+ *
+ * \param[in] fd  The memfd received with the --rehydrate option.
+ *
+ * \return true if the entries could be read.
+ */
+bool handoff::load(int fd)
+{
+    QByteArray data;
+    for(;;)
+    {
+        char buf[4096];
+        ssize_t const r(read(fd, buf, sizeof(buf)));
+        if(r == 0)
+        {
+            break;
+        }
+        if(r < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            int const e(errno);
+            SNAP_LOG_ERROR("could not read the state of the previous snapinit from file descriptor ")(fd)(" (errno: ")(e)(" -- ")(strerror(e))(").");
+            close(fd);
+            return false;
+        }
+        data.append(buf, static_cast<int>(r));
+    }
+    close(fd);
+
+    QList<QByteArray> const lines(data.split('\n'));
+    bool has_header(false);
+    for(auto const & line : lines)
+    {
+        if(line.isEmpty())
+        {
+            continue;
+        }
+
+        snap::snap_communicator_message entry;
+        if(!entry.from_message(QString::fromUtf8(line)))
+        {
+            SNAP_LOG_ERROR("invalid entry \"")(QString::fromUtf8(line))("\" in the state of the previous snapinit.");
+            return false;
+        }
+
+        if(!has_header)
+        {
+            if(entry.get_command() != "HANDOFF"
+            || entry.get_integer_parameter("version") != VERSION)
+            {
+                SNAP_LOG_ERROR("the state of the previous snapinit is not a version ")(VERSION)(" handoff.");
+                return false;
+            }
+            has_header = true;
+            continue;
+        }
+
+        f_entries.push_back(entry);
+    }
+
+    return has_header;
+}
+
+
+/** \brief Take ownership of a file descriptor passed by the previous binary.
+ *
+ * The close-on-exec flag gets set again so our children do not
+ * inherit the descriptor.
+ *
+ * \param[in] fd  The file descriptor.
+ *
+ * \return true if \p fd is a valid file descriptor.
+ */
+bool handoff::claim_fd(int fd)
+{
+    int const flags(fcntl(fd, F_GETFD));
+    if(flags == -1)
+    {
+        return false;
+    }
+    return fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
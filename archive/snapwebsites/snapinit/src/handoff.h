@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- state passed to a new snapinit binary
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// snapwebsites lib
+//
+#include "snap_communicator.h"
+
+// C++ lib
+//
+#include <vector>
+
+namespace snapinit
+{
+
+
+class handoff
+{
+public:
+    typedef std::vector<snap::snap_communicator_message>    entry_vector_t;
+
+    static int const        VERSION = 1;
+
+                            handoff();
+                            handoff(handoff const & rhs) = delete;
+    handoff &               operator = (handoff const & rhs) = delete;
+                            ~handoff();
+
+    void                    add_entry(snap::snap_communicator_message const & entry);
+    entry_vector_t const &  get_entries() const;
+    bool                    pass_fd(int fd);
+    int                     save();
+    void                    cancel();
+    bool                    load(int fd);
+
+    static bool             claim_fd(int fd);
+
+private:
+    entry_vector_t          f_entries;
+    std::vector<int>        f_passed_fds;
+    int                     f_memfd = -1;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
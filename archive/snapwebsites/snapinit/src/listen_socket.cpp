@@ -0,0 +1,438 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- sockets bound by snapinit on behalf of the services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "listen_socket.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+#include "not_reached.h"
+#include "not_used.h"
+#include "tcp_client_server.h"
+
+// C++ lib
+//
+#include <memory>
+#include <string>
+
+// C lib
+//
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Sockets bound by snapinit and passed to the services.
+ *
+ * A service XML file can include any number of \<listen> tags. snapinit
+ * binds these sockets itself and passes them to the process of the
+ * service as inherited file descriptors, the same way systemd does
+ * (i.e. the LISTEN_FDS, LISTEN_PID, and LISTEN_FDNAMES environment
+ * variables, the first socket being file descriptor 3.)
+ *
+ * \code
+ *      <listen name="http" type="tcp" backlog="256">127.0.0.1:8080</listen>
+ *      <listen type="udp">127.0.0.1:4041</listen>
+ *      <listen type="unix" mode="0660">/run/snapwebsites/snapdbproxy.sock</listen>
+ * \endcode
+ *
+ * The sockets remain open in snapinit while the process restarts so
+ * the clients which connect in the meantime get queued in the kernel
+ * backlog instead of being refused.
+ */
+
+
+namespace snapinit
+{
+
+
+
+/////////////////////////////////////////////////
+// LISTEN SOCKET (class implementation)        //
+/////////////////////////////////////////////////
+
+
+listen_socket::listen_socket()
+{
+}
+
+
+/** \brief Close the socket.
+ *
+ * The Unix socket file, if any, gets removed.
+ */
+listen_socket::~listen_socket()
+{
+    close();
+}
+
+
+/** \brief Read the definition of the socket from a \<listen> tag.
+ *
+ * The text of the tag is an address and port for the "tcp" (default)
+ * and "udp" types, as parsed by tcp_client_server::get_addr_port(),
+ * or a full path for the "unix" type.
+ *
+ * \param[in] e  The \<listen> element.
+ * \param[in] service_name  The name of the service, used in errors
+ *                          and as the default name of the socket.
+ */
+void listen_socket::configure(QDomElement e, QString const & service_name)
+{
+    f_name = e.attribute("name", service_name);
+    if(f_name.isEmpty()
+    || f_name.contains(':'))
+    {
+        common::fatal_error(QString("the name of a <listen> tag of service \"%1\" cannot be empty or include a colon.")
+                            .arg(service_name));
+        snap::NOTREACHED();
+    }
+
+    QString const type(e.attribute("type", "tcp"));
+    if(type == "tcp")
+    {
+        f_type = type_t::TYPE_TCP;
+    }
+    else if(type == "udp")
+    {
+        f_type = type_t::TYPE_UDP;
+    }
+    else if(type == "unix")
+    {
+        f_type = type_t::TYPE_UNIX;
+    }
+    else
+    {
+        common::fatal_error(QString("the type of a <listen> tag of service \"%1\" must be \"tcp\", \"udp\" or \"unix\", not \"%2\".")
+                            .arg(service_name)
+                            .arg(type));
+        snap::NOTREACHED();
+    }
+
+    QString const address(e.text().trimmed());
+    if(f_type == type_t::TYPE_UNIX)
+    {
+        if(!address.startsWith("/")
+        || address.toUtf8().size() >= static_cast<int>(sizeof(sockaddr_un::sun_path)))
+        {
+            common::fatal_error(QString("the <listen> tag of service \"%1\" must be a full path of less than %2 characters for a Unix socket.")
+                                .arg(service_name)
+                                .arg(sizeof(sockaddr_un::sun_path)));
+            snap::NOTREACHED();
+        }
+        f_path = address;
+
+        if(e.hasAttribute("mode"))
+        {
+            bool ok(false);
+            f_mode = e.attribute("mode").toInt(&ok, 8);
+            if(!ok || f_mode < 0 || f_mode > 0777)
+            {
+                common::fatal_error(QString("the mode attribute of a <listen> tag of service \"%1\" must be an octal number such as 0660.")
+                                    .arg(service_name));
+                snap::NOTREACHED();
+            }
+        }
+    }
+    else
+    {
+        if(address.isEmpty())
+        {
+            common::fatal_error(QString("the <listen> tag of service \"%1\" returned an empty string which does not represent a valid IP and port specification.")
+                                .arg(service_name));
+            snap::NOTREACHED();
+        }
+        f_addr = "127.0.0.1";
+        f_port = 0;
+        tcp_client_server::get_addr_port(address, f_addr, f_port, f_type == type_t::TYPE_UDP ? "udp" : "tcp");
+        if(f_port <= 0)
+        {
+            common::fatal_error(QString("the <listen> tag of service \"%1\" must include a port.")
+                                .arg(service_name));
+            snap::NOTREACHED();
+        }
+    }
+
+    if(e.hasAttribute("backlog"))
+    {
+        bool ok(false);
+        f_backlog = e.attribute("backlog").toInt(&ok, 10);
+        if(!ok || f_backlog < 1)
+        {
+            common::fatal_error(QString("the backlog attribute of a <listen> tag of service \"%1\" must be a positive number.")
+                                .arg(service_name));
+            snap::NOTREACHED();
+        }
+    }
+}
+
+
+/** \brief Get the name of the socket.
+ *
+ * The name is passed to the child in the LISTEN_FDNAMES variable. It
+ * defaults to the name of the service.
+ *
+ * \return The name of this socket.
+ */
+QString const & listen_socket::get_name() const
+{
+    return f_name;
+}
+
+
+/** \brief Get a string representing the address of this socket.
+ *
+ * Two sockets with the same address are viewed as the same socket
+ * when a service gets replaced after a reload.
+ *
+ * \return The type and address of the socket, i.e. "tcp:127.0.0.1:8080".
+ */
+QString listen_socket::get_address() const
+{
+    switch(f_type)
+    {
+    case type_t::TYPE_TCP:
+        return QString("tcp:%1:%2").arg(f_addr).arg(f_port);
+
+    case type_t::TYPE_UDP:
+        return QString("udp:%1:%2").arg(f_addr).arg(f_port);
+
+    case type_t::TYPE_UNIX:
+        break;
+
+    }
+    return QString("unix:%1").arg(f_path);
+}
+
+
+/** \brief Check whether this is a Unix socket.
+ *
+ * \return true if the socket was defined with type="unix".
+ */
+bool listen_socket::is_unix() const
+{
+    return f_type == type_t::TYPE_UNIX;
+}
+
+
+/** \brief Bind the socket with SO_REUSEPORT.
+ *
+ * The instances of a service with an \<instances> tag each bind their
+ * own socket to the same address and the kernel spreads the new
+ * connections between them. This does not apply to Unix sockets.
+ *
+ * \param[in] reuseport  Whether SO_REUSEPORT gets set on the socket.
+ */
+void listen_socket::set_reuseport(bool reuseport)
+{
+    f_reuseport = reuseport;
+}
+
+
+/** \brief Bind the socket.
+ *
+ * The socket gets created once and remains open until the service
+ * gets removed. Calling this function again is a no-op.
+ *
+ * The socket is marked close-on-exec so only the process it gets
+ * explicitly passed to inherits it.
+ *
+ * \return true if the socket is open.
+ */
+bool listen_socket::open()
+{
+    if(f_socket != -1)
+    {
+        return true;
+    }
+
+    if(f_type == type_t::TYPE_UNIX)
+    {
+        struct sockaddr_un addr = sockaddr_un();
+        addr.sun_family = AF_UNIX;
+        QByteArray const path(f_path.toUtf8());
+        strncpy(addr.sun_path, path.data(), sizeof(addr.sun_path) - 1);
+
+        // a socket left behind by a previous instance would prevent bind()
+        //
+        unlink(addr.sun_path);
+
+        f_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(f_socket == -1
+        || bind(f_socket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0
+        || (f_mode != -1 && chmod(addr.sun_path, f_mode) != 0)
+        || listen(f_socket, f_backlog) != 0)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR("could not listen on Unix socket \"")(f_path)("\" (errno: ")(e)(" -- ")(strerror(e))(").");
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool const udp(f_type == type_t::TYPE_UDP);
+
+    struct addrinfo hints = addrinfo();
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+    struct addrinfo * info(nullptr);
+    int const r(getaddrinfo(f_addr.toUtf8().data(), std::to_string(f_port).c_str(), &hints, &info));
+    if(r != 0 || info == nullptr)
+    {
+        SNAP_LOG_ERROR("invalid address \"")(f_addr)("\" in <listen> tag (")(gai_strerror(r))(").");
+        return false;
+    }
+    std::shared_ptr<struct addrinfo> ai(info, freeaddrinfo);
+
+    f_socket = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if(f_socket != -1)
+    {
+        int const reuse(1);
+        snap::NOTUSED(setsockopt(f_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)));
+    }
+    if(f_socket != -1
+    && f_reuseport)
+    {
+        int const reuse(1);
+        if(setsockopt(f_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR("could not set SO_REUSEPORT on \"")(get_address())("\" (errno: ")(e)(" -- ")(strerror(e))(").");
+            close();
+            return false;
+        }
+    }
+    if(f_socket == -1
+    || bind(f_socket, info->ai_addr, info->ai_addrlen) != 0
+    || (!udp && listen(f_socket, f_backlog) != 0))
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not listen on \"")(get_address())("\" (errno: ")(e)(" -- ")(strerror(e))(").");
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+
+/** \brief Close the socket.
+ *
+ * For a Unix socket, the file gets removed too.
+ */
+void listen_socket::close()
+{
+    if(f_socket == -1)
+    {
+        return;
+    }
+
+    ::close(f_socket);
+    f_socket = -1;
+
+    if(f_type == type_t::TYPE_UNIX)
+    {
+        unlink(f_path.toUtf8().data());
+    }
+}
+
+
+/** \brief Check whether the socket is bound.
+ *
+ * \return true if open() succeeded.
+ */
+bool listen_socket::is_open() const
+{
+    return f_socket != -1;
+}
+
+
+/** \brief Get the socket file descriptor.
+ *
+ * \return The socket or -1 if not open.
+ */
+int listen_socket::get_socket() const
+{
+    return f_socket;
+}
+
+
+/** \brief Take over the socket of another listen_socket.
+ *
+ * When a service gets replaced after a reload of the configuration,
+ * the new service takes the sockets of the old service which have
+ * the same address so they never get closed.
+ *
+ * \param[in,out] rhs  The socket to take over, it gets marked as closed.
+ *
+ * \return true if the socket was taken over.
+ */
+bool listen_socket::adopt(listen_socket & rhs)
+{
+    if(f_socket != -1
+    || rhs.f_socket == -1
+    || get_address() != rhs.get_address())
+    {
+        return false;
+    }
+
+    f_socket = rhs.f_socket;
+    rhs.f_socket = -1;
+
+    return true;
+}
+
+
+/** \brief Take over a socket bound by the previous snapinit binary.
+ *
+ * After snapinit executed a new version of itself, the sockets it
+ * had bound are passed to the new binary (see snap_init::reexec()).
+ *
+ * \param[in] socket  The socket file descriptor.
+ *
+ * \return true if the socket was taken, false if this object already
+ *         has a socket.
+ */
+bool listen_socket::adopt_socket(int socket)
+{
+    if(f_socket != -1
+    || socket == -1)
+    {
+        return false;
+    }
+
+    f_socket = socket;
+
+    return true;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
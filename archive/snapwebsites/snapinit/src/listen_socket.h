@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- sockets bound by snapinit on behalf of the services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QDomElement>
+#include <QString>
+
+// C++ lib
+//
+#include <memory>
+#include <vector>
+
+namespace snapinit
+{
+
+
+class listen_socket
+{
+public:
+    typedef std::shared_ptr<listen_socket>  pointer_t;
+    typedef std::vector<pointer_t>          vector_t;
+
+    // the first socket passed to a child, as defined by sd_listen_fds()
+    //
+    static int const        LISTEN_FDS_START = 3;
+
+    enum class type_t
+    {
+        TYPE_TCP,
+        TYPE_UDP,
+        TYPE_UNIX
+    };
+
+                            listen_socket();
+                            listen_socket(listen_socket const & rhs) = delete;
+    listen_socket &         operator = (listen_socket const & rhs) = delete;
+                            ~listen_socket();
+
+    void                    configure(QDomElement e, QString const & service_name);
+    QString const &         get_name() const;
+    QString                 get_address() const;
+    bool                    is_unix() const;
+    void                    set_reuseport(bool reuseport);
+
+    bool                    open();
+    void                    close();
+    bool                    is_open() const;
+    int                     get_socket() const;
+    bool                    adopt(listen_socket & rhs);
+    bool                    adopt_socket(int socket);
+
+private:
+    QString                 f_name;
+    type_t                  f_type = type_t::TYPE_TCP;
+    QString                 f_addr;
+    int                     f_port = 0;
+    QString                 f_path;
+    int                     f_mode = -1;            // -1 keeps the mode defined by the umask
+    int                     f_backlog = 128;
+    bool                    f_reuseport = false;
+    int                     f_socket = -1;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,268 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- table of the messages understood by snapinit
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "message_command.h"
+
+// Qt lib
+//
+#include <QLatin1String>
+#include <QStringList>
+
+// C lib
+//
+#include <stdint.h>
+
+
+/** \file
+ * \brief Search the messages understood by snapinit.
+ *
+ * snapinit receives many messages (i.e. a STATUS message each time a
+ * service registers or unregisters with snapcommunicator). Instead of
+ * searching the command in a map of strings, the command gets hashed
+ * and the hash directly gives us the only command it can be. One
+ * string comparison then confirms the command.
+ *
+ * The hash is FNV-1a with a seed. The seed is searched at compile time
+ * so that each command ends up in a different slot (a perfect hash).
+ * Adding a command which breaks this property stops the compilation
+ * with a static_assert() instead of silently slowing down the lookup.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief The name of each command.
+ *
+ * The names must be in the same order as the message_command_t
+ * enumeration, without the MESSAGE_COMMAND_UNSUPPORTED entry.
+ */
+constexpr char const * g_message_commands[] =
+{
+    "GETSTATUS",
+    "HELP",
+    "LOAD",
+    "LOG",
+    "QUITTING",
+    "READY",
+    "REEXEC",
+    "RELOADCONFIG",
+    "RESTART",
+    "SAFE",
+    "STATS",
+    "STATUS",
+    "STOP",
+    "UNKNOWN"
+};
+
+constexpr size_t COMMAND_COUNT = sizeof(g_message_commands) / sizeof(g_message_commands[0]);
+
+static_assert(COMMAND_COUNT + 1 == MESSAGE_COMMAND_COUNT, "the g_message_commands table and the message_command_t enumeration are out of sync.");
+
+
+/** \brief The number of slots of the hash table.
+ *
+ * This has to be a power of two.
+ */
+constexpr size_t SLOT_COUNT = 32;
+
+constexpr uint32_t NO_SEED = static_cast<uint32_t>(-1);
+
+
+/** \brief Hash a command.
+ *
+ * The same function is used at compile time with the names of the
+ * commands and at run time with the UTF-16 characters of the QString.
+ * Commands are ASCII so both give the same result.
+ *
+ * \param[in] s  The characters of the command.
+ * \param[in] len  The number of characters in \p s.
+ * \param[in] seed  The seed of the hash.
+ *
+ * \return The hash of the command.
+ */
+template<typename C>
+constexpr uint32_t command_hash(C const * s, size_t len, uint32_t seed)
+{
+    uint32_t h(2166136261U ^ seed);
+    for(size_t i(0); i < len; ++i)
+    {
+        h ^= static_cast<uint32_t>(s[i]);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+
+constexpr size_t command_length(char const * s)
+{
+    size_t len(0);
+    while(s[len] != '\0')
+    {
+        ++len;
+    }
+    return len;
+}
+
+
+constexpr size_t command_slot(size_t idx, uint32_t seed)
+{
+    return command_hash(g_message_commands[idx], command_length(g_message_commands[idx]), seed) & (SLOT_COUNT - 1);
+}
+
+
+/** \brief Check whether \p seed puts each command in its own slot.
+ *
+ * \param[in] seed  The seed to check.
+ *
+ * \return true if no two commands share a slot.
+ */
+constexpr bool is_perfect_seed(uint32_t seed)
+{
+    bool used[SLOT_COUNT] = {};
+    for(size_t idx(0); idx < COMMAND_COUNT; ++idx)
+    {
+        size_t const slot(command_slot(idx, seed));
+        if(used[slot])
+        {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+
+constexpr uint32_t find_seed()
+{
+    for(uint32_t seed(0); seed < 10000; ++seed)
+    {
+        if(is_perfect_seed(seed))
+        {
+            return seed;
+        }
+    }
+    return NO_SEED;
+}
+
+
+constexpr uint32_t g_seed = find_seed();
+
+static_assert(g_seed != NO_SEED, "no perfect hash seed found for the snapinit commands, increase SLOT_COUNT.");
+
+
+struct slots_t
+{
+    int8_t      f_command[SLOT_COUNT];
+};
+
+
+constexpr slots_t build_slots()
+{
+    slots_t result = {};
+    for(size_t slot(0); slot < SLOT_COUNT; ++slot)
+    {
+        result.f_command[slot] = -1;
+    }
+    for(size_t idx(0); idx < COMMAND_COUNT; ++idx)
+    {
+        result.f_command[command_slot(idx, g_seed)] = static_cast<int8_t>(idx);
+    }
+    return result;
+}
+
+
+constexpr slots_t g_slots = build_slots();
+
+
+}
+// no name namespace
+
+
+
+/** \brief Search a command.
+ *
+ * \param[in] command  The command of a message.
+ *
+ * \return The command or MESSAGE_COMMAND_UNSUPPORTED if snapinit does not
+ *         understand that command.
+ */
+message_command_t find_message_command(QString const & command)
+{
+    uint32_t const h(command_hash(command.utf16(), command.length(), g_seed));
+    int const idx(g_slots.f_command[h & (SLOT_COUNT - 1)]);
+    if(idx < 0
+    || command != QLatin1String(g_message_commands[idx]))
+    {
+        return message_command_t::MESSAGE_COMMAND_UNSUPPORTED;
+    }
+    return static_cast<message_command_t>(idx);
+}
+
+
+/** \brief Get the name of a command.
+ *
+ * \param[in] command  The command.
+ *
+ * \return The name of the command, "unsupported" for
+ *         MESSAGE_COMMAND_UNSUPPORTED.
+ */
+char const * message_command_name(message_command_t const command)
+{
+    size_t const idx(static_cast<size_t>(command));
+    if(idx >= COMMAND_COUNT)
+    {
+        return "unsupported";
+    }
+    return g_message_commands[idx];
+}
+
+
+/** \brief Get the list of commands as sent in the COMMANDS reply.
+ *
+ * \return The comma separated list of commands.
+ */
+QString const & message_command_list()
+{
+    static QString const g_list(
+        []()
+        {
+            QStringList list;
+            for(auto const name : g_message_commands)
+            {
+                list << name;
+            }
+            return list.join(",");
+        }());
+    return g_list;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,63 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- table of the messages understood by snapinit
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// Qt lib
+//
+#include <QString>
+
+namespace snapinit
+{
+
+
+// the order must match the names in message_command.cpp
+//
+enum class message_command_t
+{
+    MESSAGE_COMMAND_GETSTATUS,
+    MESSAGE_COMMAND_HELP,
+    MESSAGE_COMMAND_LOAD,
+    MESSAGE_COMMAND_LOG,
+    MESSAGE_COMMAND_QUITTING,
+    MESSAGE_COMMAND_READY,
+    MESSAGE_COMMAND_REEXEC,
+    MESSAGE_COMMAND_RELOADCONFIG,
+    MESSAGE_COMMAND_RESTART,
+    MESSAGE_COMMAND_SAFE,
+    MESSAGE_COMMAND_STATS,
+    MESSAGE_COMMAND_STATUS,
+    MESSAGE_COMMAND_STOP,
+    MESSAGE_COMMAND_UNKNOWN,
+
+    MESSAGE_COMMAND_UNSUPPORTED     // not a command, returned for commands we do not understand
+};
+
+size_t const MESSAGE_COMMAND_COUNT = static_cast<size_t>(message_command_t::MESSAGE_COMMAND_UNSUPPORTED) + 1;
+
+
+message_command_t           find_message_command(QString const & command);
+char const *                message_command_name(message_command_t const command);
+QString const &             message_command_list();
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
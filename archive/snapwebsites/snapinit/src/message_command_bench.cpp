@@ -0,0 +1,276 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- benchmark of the message command lookup
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "message_command.h"
+
+// snapwebsites
+//
+#include "log.h"
+#include "snap_communicator.h"
+
+// Qt lib
+//
+#include <QVector>
+
+// C++ lib
+//
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+
+// C lib
+//
+#include <stdlib.h>
+
+
+/** \file
+ * \brief Measure the cost of the dispatch of a message command.
+ *
+ * This standalone tool compares the dispatch of process_message() with
+ * the one it replaced:
+ *
+ * \li the old dispatch formats the message with to_message() for the
+ *     trace, copies the command, searches it in a std::map keyed by
+ *     QString and calls the handler through a std::function;
+ * \li the new dispatch only formats the message when the trace is
+ *     enabled, searches the command with find_message_command() and
+ *     switches on the result.
+ *
+ * The messages mimic a flood of STATUS messages (one per service that
+ * registers or unregisters with snapcommunicator) mixed with the other
+ * commands and a few commands snapinit does not understand.
+ *
+ * It is not built by default:
+ *
+ * \code
+ *      make snapinit_message_bench
+ *      ./snapinit_message_bench [iterations]
+ * \endcode
+ */
+
+
+namespace
+{
+
+
+typedef std::function<void(snap::snap_communicator_message const &)>    message_func_t;
+typedef std::map<QString, message_func_t>                               message_func_map_t;
+
+
+/** \brief The counters incremented by the message handlers.
+ *
+ * Both dispatches count the messages per command so their results
+ * can be compared.
+ */
+typedef std::vector<size_t>     counts_t;
+
+
+size_t const UNSUPPORTED_INDEX = static_cast<size_t>(snapinit::message_command_t::MESSAGE_COMMAND_UNSUPPORTED);
+
+
+/** \brief The dispatch as it was before the perfect hash.
+ *
+ * The map is created the same way snap_init used to create its
+ * f_tcp_message_map: one lambda per command.
+ */
+class map_dispatch
+{
+public:
+    map_dispatch()
+        : f_counts(snapinit::MESSAGE_COMMAND_COUNT)
+    {
+        for(size_t idx(0); idx < UNSUPPORTED_INDEX; ++idx)
+        {
+            snapinit::message_command_t const command(static_cast<snapinit::message_command_t>(idx));
+            f_message_map[snapinit::message_command_name(command)] =
+                    [this, idx](snap::snap_communicator_message const &)
+                    {
+                        ++f_counts[idx];
+                    };
+        }
+    }
+
+    void process_message(snap::snap_communicator_message const & message)
+    {
+        // the old SNAP_LOG_TRACE() formatted the message even when the
+        // trace was not visible
+        //
+        f_trace_size += message.to_message().length();
+
+        QString const command(message.get_command());
+
+        auto const & tcp_command( f_message_map.find(command) );
+        if( tcp_command == f_message_map.end() )
+        {
+            ++f_counts[UNSUPPORTED_INDEX];
+            return;
+        }
+
+        (tcp_command->second)(message);
+    }
+
+    counts_t const & get_counts() const
+    {
+        return f_counts;
+    }
+
+private:
+    message_func_map_t          f_message_map;
+    counts_t                    f_counts;
+    size_t                      f_trace_size = 0;
+};
+
+
+/** \brief The dispatch as done by process_message() now.
+ *
+ * The switch of process_message() calls one function per command;
+ * here every case would increment its own counter so the switch is
+ * reduced to the increment.
+ */
+class hash_dispatch
+{
+public:
+    hash_dispatch()
+        : f_counts(snapinit::MESSAGE_COMMAND_COUNT)
+    {
+    }
+
+    void process_message(snap::snap_communicator_message const & message)
+    {
+        if(snap::logging::is_enabled_for(snap::logging::log_level_t::LOG_LEVEL_TRACE))
+        {
+            f_trace_size += message.to_message().length();
+        }
+
+        QString const & command(message.get_command());
+        snapinit::message_command_t const id(snapinit::find_message_command(command));
+        ++f_counts[static_cast<size_t>(id)];
+    }
+
+    counts_t const & get_counts() const
+    {
+        return f_counts;
+    }
+
+private:
+    counts_t                    f_counts;
+    size_t                      f_trace_size = 0;
+};
+
+
+/** \brief Time a dispatch over the messages.
+ *
+ * \param[in] name  The name printed with the result.
+ * \param[in] dispatch  The dispatch to time.
+ * \param[in] messages  The messages to dispatch.
+ * \param[in] iterations  The number of messages to dispatch.
+ */
+template<typename D>
+void run(char const * name, D & dispatch, QVector<snap::snap_communicator_message> const & messages, size_t iterations)
+{
+    size_t const count(static_cast<size_t>(messages.size()));
+    auto const start(std::chrono::steady_clock::now());
+    for(size_t idx(0); idx < iterations; ++idx)
+    {
+        dispatch.process_message(messages[idx % count]);
+    }
+    auto const end(std::chrono::steady_clock::now());
+
+    double const ns(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    std::cout << name << ": " << ns / static_cast<double>(iterations) << " ns per message" << std::endl;
+}
+
+
+/** \brief Create a message as snapcommunicator would forward it.
+ *
+ * \param[in] command  The command of the message.
+ *
+ * \return The new message.
+ */
+snap::snap_communicator_message create_message(QString const & command)
+{
+    snap::snap_communicator_message message;
+    message.set_sent_from_server("localhost");
+    message.set_sent_from_service("snapcommunicator");
+    message.set_service("snapinit");
+    message.set_command(command);
+    return message;
+}
+
+
+}
+// no name namespace
+
+
+
+int main(int argc, char * argv[])
+{
+    size_t const iterations(argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000UL);
+    if(iterations == 0)
+    {
+        std::cerr << "usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+
+    // 9 out of 10 messages are STATUS messages, the rest goes through
+    // the other commands and a few unsupported ones
+    //
+    QVector<QString> const services{
+        "snapserver", "snapbackend", "snapdbproxy", "snapwatchdog",
+        "snapfirewall", "snaplock", "snapmanagerdaemon", "sendmail", "images"
+    };
+    QVector<QString> const others{
+        "HELP", "LOG", "QUITTING", "READY", "SAFE", "STOP", "UNKNOWN",
+        "GETSTATUS", "LOAD", "REEXEC", "RELOADCONFIG", "RESTART", "STATS",
+        "PING", "CLOCK_STABLE", "STATUSES"
+    };
+    QVector<snap::snap_communicator_message> messages;
+    for(auto const & other : others)
+    {
+        for(auto const & service : services)
+        {
+            snap::snap_communicator_message status(create_message("STATUS"));
+            status.add_parameter("service", service);
+            status.add_parameter("status", "up");
+            status.add_parameter("up_since", "1476601287");
+            messages << status;
+        }
+        messages << create_message(other);
+    }
+
+    map_dispatch old_dispatch;
+    hash_dispatch new_dispatch;
+    run("std::map + std::function + to_message()", old_dispatch, messages, iterations);
+    run("perfect hash + switch", new_dispatch, messages, iterations);
+    if(old_dispatch.get_counts() != new_dispatch.get_counts())
+    {
+        std::cerr << "error: the two dispatches do not find the same commands." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,534 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- metrics exporter of snapinit
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "metrics.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+#include "not_reached.h"
+#include "not_used.h"
+
+// C++ lib
+//
+#include <algorithm>
+
+// C lib
+//
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Export the snapinit metrics in the Prometheus text format.
+ *
+ * When the metrics_listen parameter is defined in snapinit.conf, snapinit
+ * listens on that Unix socket or local TCP port. Each connection gets
+ * one HTTP/1.0 reply with the current metrics and gets closed. The
+ * request itself is not checked further than being a GET, so
+ * `curl http://127.0.0.1:<port>/metrics` and
+ * `curl --unix-socket <path> http://localhost/metrics` both work.
+ *
+ * The metrics are generated on demand by the snap_init object, this
+ * file only offers the helpers to write them and the connections to
+ * serve them.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief The largest request we accept from a client.
+ *
+ * We only want the first line, anything larger than this is an error.
+ */
+size_t const MAX_REQUEST_SIZE = 8192;
+
+
+/** \brief How long a client has to send its request and read our reply.
+ */
+int64_t const CLIENT_TIMEOUT = 5LL * common::SECONDS_TO_MICROSECONDS;
+
+
+/** \brief One client of the metrics server.
+ *
+ * The client reads the HTTP request and then writes the reply. Once
+ * the reply was sent, the connection removes itself from the
+ * communicator which closes the socket.
+ */
+class metrics_client
+        : public snap::snap_communicator::snap_connection
+{
+public:
+    typedef std::shared_ptr<metrics_client>     pointer_t;
+
+    metrics_client(int socket, metrics_server::generator_t generator)
+        : f_socket(socket)
+        , f_generator(generator)
+    {
+        set_timeout_delay(CLIENT_TIMEOUT);
+    }
+
+    virtual ~metrics_client() override
+    {
+        close(f_socket);
+    }
+
+    // snap::snap_communicator::snap_connection implementation
+    virtual bool is_reader() const override
+    {
+        return f_reply.empty();
+    }
+
+    virtual bool is_writer() const override
+    {
+        return !f_reply.empty();
+    }
+
+    virtual int get_socket() const override
+    {
+        return f_socket;
+    }
+
+    virtual void process_read() override
+    {
+        char buf[1024];
+        ssize_t const r(read(f_socket, buf, sizeof(buf)));
+        if(r <= 0)
+        {
+            if(r == 0 || (errno != EAGAIN && errno != EINTR))
+            {
+                done();
+            }
+            return;
+        }
+        f_request.append(buf, r);
+
+        if(f_request.size() > MAX_REQUEST_SIZE)
+        {
+            reply("413 Request Entity Too Large", std::string());
+            return;
+        }
+        if(f_request.find("\r\n\r\n") == std::string::npos
+        && f_request.find("\n\n") == std::string::npos)
+        {
+            // wait for the end of the headers
+            //
+            return;
+        }
+
+        if(f_request.compare(0, 4, "GET ") != 0)
+        {
+            reply("405 Method Not Allowed", std::string());
+            return;
+        }
+        reply("200 OK", f_generator());
+    }
+
+    virtual void process_write() override
+    {
+        ssize_t const r(write(f_socket, f_reply.data() + f_position, f_reply.size() - f_position));
+        if(r < 0)
+        {
+            if(errno != EAGAIN && errno != EINTR)
+            {
+                done();
+            }
+            return;
+        }
+        f_position += r;
+        if(f_position >= f_reply.size())
+        {
+            done();
+        }
+    }
+
+    virtual void process_timeout() override
+    {
+        done();
+    }
+
+private:
+    void reply(char const * status, std::string const & body)
+    {
+        f_reply = std::string("HTTP/1.0 ")
+                + status
+                + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                + std::to_string(body.size())
+                + "\r\nConnection: close\r\n\r\n"
+                + body;
+        f_position = 0;
+    }
+
+    void done()
+    {
+        snap::snap_communicator::instance()->remove_connection(shared_from_this());
+    }
+
+    int                             f_socket = -1;
+    metrics_server::generator_t     f_generator;
+    std::string                     f_request;
+    std::string                     f_reply;
+    size_t                          f_position = 0;
+};
+
+
+/** \brief Escape a label value.
+ *
+ * The backslash, double quote and new line characters must be escaped
+ * in a label value.
+ *
+ * \param[in] value  The value to escape.
+ *
+ * \return The escaped value.
+ */
+QString escape_label(QString const & value)
+{
+    QString result(value);
+    result.replace("\\", "\\\\");
+    result.replace("\"", "\\\"");
+    result.replace("\n", "\\n");
+    return result;
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// METRICS SUMMARY (class implementation)      //
+/////////////////////////////////////////////////
+
+
+/** \brief Record one more value in this summary.
+ *
+ * \param[in] value  The value to record, in general a duration in
+ *                   microseconds.
+ */
+void metrics_summary::record(int64_t value)
+{
+    ++f_count;
+    f_sum += value;
+    f_max = std::max(f_max, value);
+    f_last = value;
+}
+
+
+int64_t metrics_summary::get_count() const
+{
+    return f_count;
+}
+
+
+int64_t metrics_summary::get_sum() const
+{
+    return f_sum;
+}
+
+
+int64_t metrics_summary::get_max() const
+{
+    return f_max;
+}
+
+
+int64_t metrics_summary::get_last() const
+{
+    return f_last;
+}
+
+
+
+
+/////////////////////////////////////////////////
+// METRICS WRITER (class implementation)       //
+/////////////////////////////////////////////////
+
+
+/** \brief Start a new metric family.
+ *
+ * All the samples of a family must be written right after this call.
+ *
+ * \param[in] name  The name of the metric.
+ * \param[in] type  The type of the metric ("counter", "gauge", "summary").
+ * \param[in] help  A one line description of the metric.
+ */
+void metrics_writer::family(char const * name, char const * type, char const * help)
+{
+    f_text += "# HELP ";
+    f_text += name;
+    f_text += " ";
+    f_text += help;
+    f_text += "\n# TYPE ";
+    f_text += name;
+    f_text += " ";
+    f_text += type;
+    f_text += "\n";
+}
+
+
+/** \brief Write one sample.
+ *
+ * \param[in] name  The name of the metric.
+ * \param[in] labels  The labels as created by label(), joined by commas.
+ * \param[in] value  The value of the sample.
+ */
+void metrics_writer::sample(char const * name, QString const & labels, int64_t value)
+{
+    line(name, "", labels, QString("%1").arg(value));
+}
+
+
+/** \brief Write one sample in seconds.
+ *
+ * \param[in] name  The name of the metric.
+ * \param[in] labels  The labels as created by label(), joined by commas.
+ * \param[in] us  The value of the sample in microseconds.
+ */
+void metrics_writer::sample_seconds(char const * name, QString const & labels, int64_t us)
+{
+    line(name, "", labels, QString::number(static_cast<double>(us) / common::SECONDS_TO_MICROSECONDS, 'f', 6));
+}
+
+
+/** \brief Write a summary of durations.
+ *
+ * The summary is written as the _count and _sum samples. The maximum
+ * does not fit the summary type so it has to be written as a separate
+ * gauge by the caller if required.
+ *
+ * \param[in] name  The name of the metric.
+ * \param[in] labels  The labels as created by label(), joined by commas.
+ * \param[in] summary  The summary of durations in microseconds.
+ */
+void metrics_writer::summary_seconds(char const * name, QString const & labels, metrics_summary const & summary)
+{
+    line(name, "_sum", labels, QString::number(static_cast<double>(summary.get_sum()) / common::SECONDS_TO_MICROSECONDS, 'f', 6));
+    line(name, "_count", labels, QString("%1").arg(summary.get_count()));
+}
+
+
+/** \brief Create one label.
+ *
+ * \param[in] name  The name of the label.
+ * \param[in] value  The value of the label, it gets escaped.
+ *
+ * \return The label as name="value".
+ */
+QString metrics_writer::label(char const * name, QString const & value)
+{
+    return QString("%1=\"%2\"").arg(name).arg(escape_label(value));
+}
+
+
+/** \brief Retrieve the metrics written so far.
+ *
+ * \return The metrics in the Prometheus text format.
+ */
+std::string const & metrics_writer::get_text() const
+{
+    return f_text;
+}
+
+
+void metrics_writer::line(char const * name, char const * suffix, QString const & labels, QString const & value)
+{
+    f_text += name;
+    f_text += suffix;
+    if(!labels.isEmpty())
+    {
+        f_text += "{";
+        f_text += labels.toUtf8().data();
+        f_text += "}";
+    }
+    f_text += " ";
+    f_text += value.toUtf8().data();
+    f_text += "\n";
+}
+
+
+
+
+/////////////////////////////////////////////////
+// METRICS SERVER (class implementation)       //
+/////////////////////////////////////////////////
+
+
+/** \brief Create the metrics server socket.
+ *
+ * The \p listen parameter is either the full path to a Unix socket
+ * (it starts with a '/') or an IPv4 address and a port separated by
+ * a colon. Only local connections should be allowed, so the address
+ * should be 127.0.0.1.
+ *
+ * \param[in] listen  Where to listen for connections.
+ * \param[in] generator  The function generating the metrics.
+ */
+metrics_server::metrics_server(QString const & listen, generator_t generator)
+    : f_generator(generator)
+{
+    if(listen.startsWith("/"))
+    {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        QByteArray const path(listen.toUtf8());
+        if(static_cast<size_t>(path.size()) >= sizeof(addr.sun_path))
+        {
+            common::fatal_error(QString("metrics_listen path \"%1\" is too long for a Unix socket.").arg(listen));
+            snap::NOTREACHED();
+        }
+        strncpy(addr.sun_path, path.data(), sizeof(addr.sun_path) - 1);
+
+        // a socket left behind by a previous instance would prevent bind()
+        //
+        unlink(addr.sun_path);
+
+        f_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(f_socket != -1
+        && bind(f_socket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0)
+        {
+            f_unix_path = listen;
+        }
+        else if(f_socket != -1)
+        {
+            close(f_socket);
+            f_socket = -1;
+        }
+    }
+    else
+    {
+        int const pos(listen.lastIndexOf(':'));
+        bool ok(false);
+        int const port(pos > 0 ? listen.mid(pos + 1).toInt(&ok, 10) : 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if(!ok
+        || port <= 0
+        || port > 65535
+        || inet_pton(AF_INET, listen.left(pos).toUtf8().data(), &addr.sin_addr) != 1)
+        {
+            common::fatal_error(QString("metrics_listen \"%1\" must be a path to a Unix socket or an IPv4 address and a port (i.e. 127.0.0.1:9137).").arg(listen));
+            snap::NOTREACHED();
+        }
+
+        f_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(f_socket != -1)
+        {
+            int const reuse(1);
+            snap::NOTUSED(setsockopt(f_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)));
+            if(bind(f_socket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+            {
+                close(f_socket);
+                f_socket = -1;
+            }
+        }
+    }
+
+    if(f_socket == -1
+    || ::listen(f_socket, 16) != 0)
+    {
+        int const e(errno);
+        common::fatal_error(QString("metrics_server::metrics_server(): could not listen on \"%1\" (errno: %2 -- %3).")
+                            .arg(listen)
+                            .arg(e)
+                            .arg(strerror(e)));
+        snap::NOTREACHED();
+    }
+}
+
+
+/** \brief Close the server socket.
+ *
+ * The Unix socket file, if any, gets removed.
+ */
+metrics_server::~metrics_server()
+{
+    close(f_socket);
+    if(!f_unix_path.isEmpty())
+    {
+        unlink(f_unix_path.toUtf8().data());
+    }
+}
+
+
+/** \brief The server socket becomes readable when a client connects.
+ *
+ * \return Always true.
+ */
+bool metrics_server::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Return the server socket so the communicator can poll() it.
+ *
+ * \return The server socket.
+ */
+int metrics_server::get_socket() const
+{
+    return f_socket;
+}
+
+
+/** \brief Accept a new client.
+ *
+ * The new client gets added to the communicator. It sends the metrics
+ * once it received the request.
+ */
+void metrics_server::process_read()
+{
+    int const client(accept4(f_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+    if(client == -1)
+    {
+        if(errno != EAGAIN && errno != EINTR)
+        {
+            int const e(errno);
+            SNAP_LOG_WARNING("metrics server accept() failed (errno: ")(e)(" -- ")(strerror(e))(").");
+        }
+        return;
+    }
+
+    metrics_client::pointer_t connection(std::make_shared<metrics_client>(client, f_generator));
+    connection->set_name("snapinit metrics client");
+    connection->set_priority(120);
+    snap::snap_communicator::instance()->add_connection(connection);
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- metrics exporter of snapinit
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// snapwebsites lib
+//
+#include "snap_communicator.h"
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace snapinit
+{
+
+
+class metrics_summary
+{
+public:
+    void                    record(int64_t value);
+
+    int64_t                 get_count() const;
+    int64_t                 get_sum() const;
+    int64_t                 get_max() const;
+    int64_t                 get_last() const;
+
+private:
+    int64_t                 f_count = 0;
+    int64_t                 f_sum = 0;
+    int64_t                 f_max = 0;
+    int64_t                 f_last = 0;
+};
+
+
+class metrics_writer
+{
+public:
+    void                    family(char const * name, char const * type, char const * help);
+    void                    sample(char const * name, QString const & labels, int64_t value);
+    void                    sample_seconds(char const * name, QString const & labels, int64_t us);
+    void                    summary_seconds(char const * name, QString const & labels, metrics_summary const & summary);
+
+    static QString          label(char const * name, QString const & value);
+
+    std::string const &     get_text() const;
+
+private:
+    void                    line(char const * name, char const * suffix, QString const & labels, QString const & value);
+
+    std::string             f_text;
+};
+
+
+class metrics_server
+        : public snap::snap_communicator::snap_connection
+{
+public:
+    typedef std::shared_ptr<metrics_server>     pointer_t;
+    typedef std::function<std::string()>        generator_t;
+
+                            metrics_server(QString const & listen, generator_t generator);
+                            metrics_server(metrics_server const & rhs) = delete;
+    metrics_server &        operator = (metrics_server const & rhs) = delete;
+    virtual                 ~metrics_server() override;
+
+    // snap::snap_communicator::snap_connection implementation
+    virtual bool            is_reader() const override;
+    virtual int             get_socket() const override;
+    virtual void            process_read() override;
+
+private:
+    int                     f_socket = -1;
+    QString                 f_unix_path;
+    generator_t             f_generator;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
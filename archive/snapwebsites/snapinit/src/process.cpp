@@ -30,13 +30,24 @@
 #include "log.h"
 #include "not_used.h"
 
+// Qt lib
+//
+#include <QStringList>
+
 // C library
 //
 #include <grp.h>
 #include <proc/sysinfo.h>
 #include <pwd.h>
 #include <syslog.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 
 /** \file
@@ -111,6 +122,239 @@
 namespace snapinit
 {
 
+namespace
+{
+
+/** \brief The stack used by the child created by spawn_child().
+ *
+ * The child created with clone(CLONE_VM | CLONE_VFORK) shares our
+ * memory so it needs its own stack. Since the parent is suspended
+ * until the child calls execv() only one child uses this stack at
+ * a time.
+ */
+alignas(16) char    g_spawn_stack[64 * 1024];
+
+
+/** \brief Write a PID in decimal in a buffer.
+ *
+ * The child cannot use snprintf() or allocate memory, so this function
+ * converts the number by hand. The buffer must be large enough for
+ * the digits and the null terminator.
+ *
+ * \param[out] buf  The buffer receiving the digits.
+ * \param[in] pid  The PID to convert.
+ */
+void write_pid(char * buf, pid_t pid)
+{
+    char digits[16];
+    int count(0);
+    do
+    {
+        digits[count] = static_cast<char>('0' + pid % 10);
+        ++count;
+        pid /= 10;
+    }
+    while(pid > 0 && count < static_cast<int>(sizeof(digits)));
+    while(count > 0)
+    {
+        --count;
+        *buf = digits[count];
+        ++buf;
+    }
+    *buf = '\0';
+}
+
+
+/** \brief Move the inherited descriptors where the child expects them.
+ *
+ * The listen sockets and the readiness pipe get duplicated above the
+ * final range first so a descriptor which is already at one of the
+ * final positions does not get closed before it was moved. The
+ * temporary copies are close-on-exec, the final ones are not since
+ * dup2() clears that flag.
+ *
+ * This function is called by the child. It only makes system calls.
+ *
+ * \param[in,out] fds  The descriptors to pass to the service.
+ *
+ * \return true if all the descriptors were moved.
+ */
+bool move_child_fds(std::vector<int> & fds)
+{
+    int const count(static_cast<int>(fds.size()));
+    for(int idx(0); idx < count; ++idx)
+    {
+        fds[idx] = fcntl(fds[idx], F_DUPFD_CLOEXEC, listen_socket::LISTEN_FDS_START + count);
+        if(fds[idx] == -1)
+        {
+            return false;
+        }
+    }
+    for(int idx(0); idx < count; ++idx)
+    {
+        if(dup2(fds[idx], listen_socket::LISTEN_FDS_START + idx) == -1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+// no name namespace
+
+
+/////////////////////////////////////////////////
+// PROCESS PIDFD (class implementation)        //
+/////////////////////////////////////////////////
+
+
+/** \brief Initialize the pidfd connection.
+ *
+ * The connection takes ownership of the \p pidfd file descriptor.
+ *
+ * \param[in] p  The process watched by this connection.
+ * \param[in] pidfd  The pidfd of the child process.
+ */
+process_pidfd::process_pidfd(process * p, int pidfd)
+    : f_process(p)
+    , f_pidfd(pidfd)
+{
+}
+
+
+/** \brief Close the pidfd.
+ *
+ * The destructor closes the pidfd. Note that closing the pidfd
+ * does not reap the child, the process object is expected to do
+ * that with waitpid() first.
+ */
+process_pidfd::~process_pidfd()
+{
+    if(f_pidfd != -1)
+    {
+        close(f_pidfd);
+    }
+}
+
+
+/** \brief Retrieve the pidfd.
+ *
+ * \return The pidfd attached to this connection.
+ */
+int process_pidfd::get_pidfd() const
+{
+    return f_pidfd;
+}
+
+
+/** \brief A pidfd is always a reader.
+ *
+ * The pidfd becomes readable when the child exits, which is the
+ * only event we are interested in.
+ *
+ * \return Always true.
+ */
+bool process_pidfd::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Return the pidfd so the communicator can poll() it.
+ *
+ * \return The pidfd.
+ */
+int process_pidfd::get_socket() const
+{
+    return f_pidfd;
+}
+
+
+/** \brief The child of this process exited.
+ *
+ * The communicator calls this function once the pidfd is readable,
+ * meaning that the child exited. The process object takes care of
+ * reaping it.
+ */
+void process_pidfd::process_read()
+{
+    f_process->action_pidfd_readable();
+}
+
+
+
+
+/////////////////////////////////////////////////
+// PROCESS READY PIPE (class implementation)   //
+/////////////////////////////////////////////////
+
+
+/** \brief Initialize the readiness pipe connection.
+ *
+ * \param[in] p  The process waiting for its child to be ready.
+ * \param[in] pipe  The read end of the readiness pipe, this object
+ *                  takes ownership of it.
+ */
+process_ready_pipe::process_ready_pipe(process * p, int pipe)
+    : f_process(p)
+    , f_pipe(pipe)
+{
+}
+
+
+/** \brief Close the read end of the readiness pipe.
+ */
+process_ready_pipe::~process_ready_pipe()
+{
+    if(f_pipe != -1)
+    {
+        close(f_pipe);
+    }
+}
+
+
+/** \brief The readiness pipe is always a reader.
+ *
+ * \return Always true.
+ */
+bool process_ready_pipe::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Return the pipe so the communicator can poll() it.
+ *
+ * \return The read end of the readiness pipe.
+ */
+int process_ready_pipe::get_socket() const
+{
+    return f_pipe;
+}
+
+
+/** \brief The child wrote to the readiness pipe or closed it.
+ *
+ * Anything written to the pipe, a single byte or a "READY=1" line,
+ * means that the child is ready. If the child closes the pipe (or
+ * dies) without writing to it, it is not ready.
+ */
+void process_ready_pipe::process_read()
+{
+    char buf[64];
+    ssize_t const r(read(f_pipe, buf, sizeof(buf)));
+    if(r == -1
+    && (errno == EAGAIN || errno == EINTR))
+    {
+        return;
+    }
+    f_process->action_ready_notified(r > 0);
+}
+
+
+
+
 /////////////////////////////////////////////////
 // PROCESS (class implementation)              //
 /////////////////////////////////////////////////
@@ -147,6 +391,7 @@ process::process(std::shared_ptr<snap_init> si, service * s)
 void process::set_user(QString const & user)
 {
     f_user = user;
+    f_exec_prepared = false;
 }
 
 
@@ -164,6 +409,7 @@ void process::set_user(QString const & user)
 void process::set_group(QString const & group)
 {
     f_group = group;
+    f_exec_prepared = false;
 }
 
 
@@ -213,6 +459,7 @@ bool process::set_command(QString const & binary_path, QString const & command)
     // keep a copy although at this time we are not using it anywhere...
     //
     f_command = command;
+    f_exec_prepared = false;
 
     // we have a special case for snapinit--we do not have to find it
     // because we are not going to use its f_full_path anyway
@@ -304,6 +551,7 @@ bool process::exists() const
 void process::set_config_filename(QString const & config_filename)
 {
     f_config_filename = config_filename;
+    f_exec_prepared = false;
 }
 
 
@@ -326,6 +574,7 @@ void process::set_config_filename(QString const & config_filename)
 void process::set_options(QString const & options)
 {
     f_options = options;
+    f_exec_prepared = false;
 }
 
 
@@ -343,6 +592,7 @@ void process::set_options(QString const & options)
 void process::set_common_options(std::vector<QString> const & common_options)
 {
     f_common_options = std::move(common_options);
+    f_exec_prepared = false;
 }
 
 
@@ -381,6 +631,216 @@ void process::set_nice(int const nice)
 }
 
 
+/** \brief Define the instance index of this process.
+ *
+ * When a service runs more than one instance, each process gets its
+ * index on its command line with the --instance option so it can
+ * tell the others apart (i.e. to register under a different name.)
+ *
+ * \param[in] instance  The index of this instance, -1 for none.
+ */
+void process::set_instance(int instance)
+{
+    f_instance = instance;
+    f_exec_prepared = false;
+}
+
+
+/** \brief Pin this process to a CPU.
+ *
+ * The child sets its CPU affinity to that one CPU before it executes
+ * the service.
+ *
+ * \param[in] cpu  The CPU number or -1 to leave the affinity alone.
+ */
+void process::set_cpu(int cpu)
+{
+    f_cpu = cpu;
+}
+
+
+/** \brief Define the restart policy of this process.
+ *
+ * The service sets the backoff policy which defines how long to wait
+ * before restarting the process after it died with an error and how
+ * many errors are acceptable before the service gets paused.
+ *
+ * \param[in] b  The backoff policy to use with this process.
+ */
+void process::set_backoff(backoff const & b)
+{
+    f_backoff = b;
+}
+
+
+/** \brief Use a pipe for the readiness notification of this process.
+ *
+ * When true, the child inherits the write end of a pipe and snapinit
+ * considers the process registered as soon as the child writes to it,
+ * instead of waiting for snapcommunicator to send a STATUS message.
+ *
+ * \param[in] ready_pipe  Whether the readiness pipe is used.
+ */
+void process::set_ready_pipe(bool ready_pipe)
+{
+    f_ready_pipe = ready_pipe;
+    f_exec_prepared = false;
+}
+
+
+/** \brief Start this process as a zygote.
+ *
+ * When true, the child inherits one end of a control socket and its
+ * number is passed in the SNAPINIT_ZYGOTE_FD environment variable.
+ * The child is expected to initialize itself and then block reading
+ * that socket. It starts its actual work once it receives a byte. If
+ * it reads the end of the file instead, snapinit went away and the
+ * child is expected to exit.
+ *
+ * This is used by cron tasks to keep a warm spare between two ticks.
+ *
+ * \param[in] zygote  Whether the process starts parked.
+ */
+void process::set_zygote(bool zygote)
+{
+    f_zygote = zygote;
+    f_exec_prepared = false;
+}
+
+
+/** \brief Retrieve the restart policy of this process.
+ *
+ * \return A reference to the backoff policy of this process.
+ */
+backoff & process::get_backoff()
+{
+    return f_backoff;
+}
+
+
+/** \brief Retrieve the cgroup of this process.
+ *
+ * The service configures the cgroup limits from its \<cgroup> tag.
+ *
+ * \return A reference to the cgroup of this process.
+ */
+cgroup & process::get_cgroup()
+{
+    return f_cgroup;
+}
+
+
+/** \brief Retrieve the resource usage history of this process.
+ *
+ * The history gets updated each time the child dies and when
+ * snapinit samples the running services.
+ *
+ * \return A reference to the resource usage of this process.
+ */
+resource_usage & process::get_resource_usage()
+{
+    return f_resource_usage;
+}
+
+
+/** \brief Retrieve the resource usage history of this process.
+ *
+ * \return A constant reference to the resource usage of this process.
+ */
+resource_usage const & process::get_resource_usage() const
+{
+    return f_resource_usage;
+}
+
+
+/** \brief Add a socket to pass to the process.
+ *
+ * The service adds one socket per \<listen> tag.
+ *
+ * \param[in] s  The socket to add.
+ */
+void process::add_listen_socket(listen_socket::pointer_t s)
+{
+    f_listen_sockets.push_back(s);
+    f_exec_prepared = false;
+}
+
+
+/** \brief Retrieve the sockets passed to the process.
+ *
+ * \return The list of listen sockets, in the order they get passed.
+ */
+listen_socket::vector_t const & process::get_listen_sockets() const
+{
+    return f_listen_sockets;
+}
+
+
+/** \brief Bind the sockets of this process.
+ *
+ * The sockets are bound once and remain open between runs of the
+ * process so clients can connect while the process (re)starts.
+ *
+ * \return true if all the sockets are bound.
+ */
+bool process::open_listen_sockets()
+{
+    bool result(true);
+    for(auto const & s : f_listen_sockets)
+    {
+        if(!s->open())
+        {
+            result = false;
+        }
+    }
+    return result;
+}
+
+
+/** \brief Check whether clients can already connect to this process.
+ *
+ * \return true if the process has sockets and they all are bound.
+ */
+bool process::is_listening() const
+{
+    if(f_listen_sockets.empty())
+    {
+        return false;
+    }
+    return std::all_of(
+            f_listen_sockets.begin(),
+            f_listen_sockets.end(),
+            [](auto const & s)
+            {
+                return s->is_open();
+            });
+}
+
+
+/** \brief Take over the sockets of another process.
+ *
+ * When a service gets replaced by a reload of the configuration, its
+ * replacement takes the sockets with the same address so they are
+ * never closed. The other sockets of \p rhs get closed when it gets
+ * destroyed.
+ *
+ * \param[in,out] rhs  The process of the service being replaced.
+ */
+void process::adopt_listen_sockets(process & rhs)
+{
+    for(auto const & s : f_listen_sockets)
+    {
+        for(auto const & old_socket : rhs.f_listen_sockets)
+        {
+            if(s->adopt(*old_socket))
+            {
+                break;
+            }
+        }
+    }
+}
+
+
 /** \brief The service has to be started now.
  *
  * This function starts the service process now.
@@ -394,6 +854,8 @@ void process::action_start()
         throw std::runtime_error("attempt to start a process that is not currently STOPPED.");
     }
 
+    ++f_start_count;
+
     if(start_service_process())
     {
         action_process_unregistered();
@@ -460,20 +922,174 @@ void process::action_died(termination_t termination)
 }
 
 
-void process::action_process_registered()
+/** \brief Transform the status of a dead child in a termination.
+ *
+ * This function receives the \p status as returned by wait4() for
+ * the child of this process. It logs how the child terminated and
+ * then calls action_died() with the corresponding termination.
+ *
+ * The resources used by the child are saved in its resource usage
+ * history. For cron tasks, the cost of the run is also logged so
+ * one can follow it from one deploy to the next.
+ *
+ * It is called by the snapinit SIGCHLD handler and when the pidfd
+ * of the child becomes readable.
+ *
+ * \param[in] status  The status of the child as returned by wait4().
+ * \param[in] usage  The resources used by the child as returned by wait4().
+ */
+void process::action_exited(int status, struct rusage const & usage)
 {
-    if(f_state != process_state_t::PROCESS_STATE_UNREGISTERED)
+    // keep our own pointer, action_died() may remove our service
+    //
+    std::shared_ptr<snap_init> si(snap_init_ptr());
+    int64_t const reap_start(snap::snap_communicator::get_current_date());
+
+    QString const service_name(f_service->get_service_name());
+
+    f_resource_usage.record_run(f_start_date, snap::snap_communicator::get_current_date(), status, usage);
+    if(f_service->is_cron_task())
     {
-        throw std::runtime_error(std::string("only an UNREGISTERED process can become REGISTERED, right now process state is ") + state_to_string(f_state) + ".");
+        resource_usage::run_t const & run(f_resource_usage.get_run(f_resource_usage.get_run_count() - 1));
+        SNAP_LOG_INFO("Cron task \"")
+                     (service_name)
+                     ("\" ran for ")
+                     ((run.f_end_date - run.f_start_date) / 1000)
+                     ("ms, user: ")
+                     (run.f_user_time / 1000)
+                     ("ms, system: ")
+                     (run.f_system_time / 1000)
+                     ("ms, max. RSS: ")
+                     (run.f_max_rss)
+                     ("Kb, major faults: ")
+                     (run.f_major_faults)
+                     (".");
     }
-    if(f_safe_message.isEmpty())
-    {
-        f_state = process_state_t::PROCESS_STATE_REGISTERED;
 
-        f_service->process_status_changed();
-    }
-    //else -- wait on the safe message instead
-}
+    termination_t termination(termination_t::TERMINATION_ABORT);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+    if(WIFEXITED(status))
+    {
+        int const exit_code(WEXITSTATUS(status));
+
+        if( exit_code == 0 )
+        {
+            // when this happens there is not really anything to tell about
+            SNAP_LOG_DEBUG("Service \"")(service_name)("\" terminated normally.");
+            termination = termination_t::TERMINATION_NORMAL;
+        }
+        else
+        {
+            SNAP_LOG_INFO("Service \"")(service_name)("\" terminated normally, but with exit code ")(exit_code);
+            termination = termination_t::TERMINATION_ERROR;
+        }
+    }
+    else if(WIFSIGNALED(status))
+    {
+        int const signal_code(WTERMSIG(status));
+        bool const has_code_dump(!!WCOREDUMP(status));
+
+        SNAP_LOG_ERROR("Service \"")
+                      (service_name)
+                      ("\" terminated because of OS signal \"")
+                      (strsignal(signal_code))
+                      ("\" (")
+                      (signal_code)
+                      (")")
+                      (has_code_dump ? " and a core dump was generated" : "")
+                      (".");
+    }
+    else
+    {
+        // I do not think we can reach here...
+        //
+        SNAP_LOG_ERROR("Service \"")(service_name)("\" terminated abnormally in an unknown way.");
+    }
+#pragma GCC diagnostic pop
+
+    // the child is gone, we do not need its pidfd nor its readiness
+    // pipe anymore
+    //
+    close_pidfd();
+    close_ready_pipe();
+    f_died_parked = f_zygote_socket != -1;
+    close_zygote_socket();
+
+    // call this after we generated the error output so the logs
+    // appear in a sensible order
+    //
+    action_died(termination);
+
+    si->record_reap_duration(snap::snap_communicator::get_current_date() - reap_start);
+}
+
+
+/** \brief The pidfd of our child is readable.
+ *
+ * When the child exits, its pidfd becomes readable and this function
+ * gets called. Since the pidfd is attached to that one child, we can
+ * call wait4() on its PID without having to search for the service
+ * and the PID cannot have been reused since the child is a zombie
+ * until we reap it here.
+ */
+void process::action_pidfd_readable()
+{
+    int status(0);
+    struct rusage usage = {};
+    pid_t const died_pid(wait4(f_pid, &status, WNOHANG, &usage));
+    if(died_pid == 0)
+    {
+        // spurious wake up, the child is still running
+        //
+        return;
+    }
+
+    if(died_pid == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("wait4() returned an error (")
+                      (strerror(e))
+                      (") for service \"")
+                      (f_service->get_service_name())
+                      ("\" with pidfd.");
+
+        // do not poll() a pidfd which will stay readable forever
+        //
+        close_pidfd();
+        return;
+    }
+
+    action_exited(status, usage);
+}
+
+
+void process::action_process_registered()
+{
+    f_registered_with_communicator = true;
+
+    // the child may already have said that it was ready through its
+    // readiness pipe
+    //
+    if(f_state == process_state_t::PROCESS_STATE_REGISTERED
+    && f_ready_pipe)
+    {
+        return;
+    }
+
+    if(f_state != process_state_t::PROCESS_STATE_UNREGISTERED)
+    {
+        throw std::runtime_error(std::string("only an UNREGISTERED process can become REGISTERED, right now process state is ") + state_to_string(f_state) + ".");
+    }
+    if(f_safe_message.isEmpty())
+    {
+        f_state = process_state_t::PROCESS_STATE_REGISTERED;
+
+        f_service->process_status_changed();
+    }
+    //else -- wait on the safe message instead
+}
 
 
 void process::action_process_unregistered()
@@ -484,6 +1100,7 @@ void process::action_process_unregistered()
         throw std::runtime_error("only a STOPPED or REGISTERED process can become UNREGISTERED.");
     }
     f_state = process_state_t::PROCESS_STATE_UNREGISTERED;
+    f_registered_with_communicator = false;
 
     //if(f_command == "snapcommunicator")
     //{
@@ -498,6 +1115,93 @@ void process::action_process_unregistered()
 }
 
 
+/** \brief Release a parked child.
+ *
+ * The child of a zygote process waits on its control socket until
+ * this function sends it a byte. The start date of the process gets
+ * reset so the duration of the run does not include the time the
+ * child was parked.
+ *
+ * \return true if the child was released, false if it was not parked
+ *         or is already gone.
+ */
+bool process::action_release()
+{
+    if(f_zygote_socket == -1)
+    {
+        return false;
+    }
+
+    char const go('1');
+    ssize_t const r(send(f_zygote_socket, &go, 1, MSG_NOSIGNAL));
+    int const e(errno);
+    close_zygote_socket();
+    if(r != 1)
+    {
+        SNAP_LOG_WARNING("could not release the parked process of service \"")
+                        (f_service->get_service_name())
+                        ("\" (errno: ")
+                        (e)
+                        (" -- ")
+                        (strerror(e))
+                        (").");
+        return false;
+    }
+
+    f_start_date = snap::snap_communicator::get_current_date();
+
+    SNAP_LOG_TRACE("released the parked process of service \"")(f_service->get_service_name())("\".");
+
+    return true;
+}
+
+
+/** \brief The child wrote to its readiness pipe or closed it.
+ *
+ * If the child is ready, the process becomes REGISTERED right away,
+ * which wakes up the services depending on it. When a \<safe> message
+ * is expected, the process still has to wait for that message.
+ *
+ * The pipe is not needed anymore either way.
+ *
+ * \param[in] ready  Whether the child wrote to the pipe (true) or
+ *                   closed it (false).
+ */
+void process::action_ready_notified(bool ready)
+{
+    close_ready_pipe();
+
+    if(!ready)
+    {
+        return;
+    }
+
+    SNAP_LOG_TRACE("service \"")(f_service->get_service_name())("\" is ready (readiness pipe).");
+
+    if(f_state == process_state_t::PROCESS_STATE_UNREGISTERED
+    && f_safe_message.isEmpty())
+    {
+        f_state = process_state_t::PROCESS_STATE_REGISTERED;
+
+        f_service->process_status_changed();
+    }
+}
+
+
+/** \brief Check whether the child registered with snapcommunicator.
+ *
+ * A process which uses the readiness pipe can be REGISTERED before
+ * it is known to snapcommunicator, in which case sending it a STOP
+ * message would be futile.
+ *
+ * \return true if snapcommunicator said that the child is up.
+ */
+bool process::is_registered_with_communicator() const
+{
+    return f_registered_with_communicator;
+}
+
+
 /** \brief We just received a safe message, check whether this is valid.
  *
  * This function checks whether the safe message we just received matches
@@ -555,7 +1259,11 @@ void process::action_safe_message(QString const & message)
 void process::action_dead()
 {
     f_state = process_state_t::PROCESS_STATE_STOPPED;
-    f_error_count = 0;
+    f_backoff.reset();
+
+    // the PID is not attached to this process anymore
+    //
+    snap_init_ptr()->unregister_service_pid(f_pid);
 
     // let the service know that we died, allow for the service
     // to start a timer to call action_start() soonish or if it is
@@ -578,50 +1286,40 @@ void process::action_dead()
 void process::action_error(bool immediate_error)
 {
     f_state = process_state_t::PROCESS_STATE_ERROR;
+    ++f_error_count;
+
+    // the PID is not attached to this process anymore (if fork() failed
+    // f_pid is -1 and this is a no-op)
+    //
+    snap_init_ptr()->unregister_service_pid(f_pid);
 
     f_service->process_status_changed();
 
     f_state = process_state_t::PROCESS_STATE_STOPPED;
 
-    // did the process die too quickly?
-    //
-    // TBD: put the MAX_START_INTERVAL in the .conf?
-    //
-    if(immediate_error
-    || f_end_date - f_start_date < MAX_START_INTERVAL)
-    {
-        ++f_error_count;
-    }
-    else
-    {
-        f_error_count = 0;
-    }
-
-    // if too many errors happened too quickly, then call the
-    // process_pause() function
+    // if the error budget is exhausted, or fork() failed immediately,
+    // then we ask the service to pause for a while before calling
+    // action_start() again
     //
-    // TBD: put the MAX_START_COUNT in the .conf?
+    // the record_error() has to be called even on immediate errors
+    // so the error score stays current
     //
-    if(f_error_count >= MAX_START_COUNT
+    if(f_backoff.record_error(f_start_date, f_end_date)
     || immediate_error)
     {
-        // if too many errors occurred in a row, or fork() failed immediately
-        // then we ask the service to pause for a while before calling
-        // action_start() again
-        //
         f_service->process_pause();
 
-        // reset the counter now for next time
+        // reset the backoff now for next time
         //
-        f_error_count = 0;
+        f_backoff.reset();
     }
     else
     {
         // let the service know that we died, allow for the service
-        // to either call action_start() immediately or if it is
+        // to restart us once the backoff delay elapsed or if it is
         // in its STOPPING state to ignore the event
         //
-        f_service->process_died();
+        f_service->process_died(f_backoff.next_delay());
     }
 
     f_service->process_status_changed();
@@ -647,12 +1345,86 @@ bool process::is_stopped() const
 }
 
 
+/** \brief Check whether the process uses the readiness pipe.
+ *
+ * \return true if set_ready_pipe() was called with true.
+ */
+bool process::has_ready_pipe() const
+{
+    return f_ready_pipe;
+}
+
+
+/** \brief Check whether the service is a \<zygote/> cron task.
+ *
+ * \return true if the children are started ahead of their tick and
+ *         parked until released.
+ */
+bool process::is_zygote() const
+{
+    return f_zygote;
+}
+
+
+/** \brief Check whether the child is waiting to be released.
+ *
+ * \return true if the child of a zygote process was not yet released.
+ */
+bool process::is_parked() const
+{
+    return f_zygote_socket != -1;
+}
+
+
+/** \brief Check whether the last child died before it was released.
+ *
+ * \return true if the last child of a zygote process exited while
+ *         still parked.
+ */
+bool process::died_parked() const
+{
+    return f_died_parked;
+}
+
+
 pid_t process::get_pid() const
 {
     return f_pid;
 }
 
 
+/** \brief Get the number of times this process was started.
+ *
+ * \return The number of calls to action_start().
+ */
+int64_t process::get_start_count() const
+{
+    return f_start_count;
+}
+
+
+/** \brief Get the number of times this process died with an error.
+ *
+ * This includes the processes which could not be started at all.
+ *
+ * \return The number of calls to action_error().
+ */
+int64_t process::get_error_count() const
+{
+    return f_error_count;
+}
+
+
+/** \brief Check whether the child is supervised with a pidfd.
+ *
+ * \return true if the death of the child is reported through its pidfd.
+ */
+bool process::has_pidfd() const
+{
+    return !!f_pidfd_connection;
+}
+
+
 QString const & process::get_config_filename() const
 {
     return f_config_filename;
@@ -677,9 +1449,12 @@ QString const & process::get_config_filename() const
  */
 bool process::kill_process(int signum)
 {
-    // TODO: verify pid?
+    // with a pidfd the signal cannot reach another process which
+    // reused the PID of our child
     //
-    int const retval(::kill( f_pid, signum ));
+    int const retval(f_pidfd_connection
+                ? common::pidfd_send_signal( f_pidfd_connection->get_pidfd(), signum )
+                : ::kill( f_pid, signum ));
     if( retval == -1 )
     {
         // we consider this a fatal error, although if we could not
@@ -700,6 +1475,193 @@ bool process::kill_process(int signum)
 }
 
 
+/** \brief Check whether the process can be passed to a new snapinit.
+ *
+ * A process which is still starting cannot be passed: the STATUS or
+ * SAFE message telling us that it is up could arrive while no snapinit
+ * is connected to snapcommunicator. A parked child has not started yet
+ * so it can be passed.
+ *
+ * \return true if the process is stopped, registered or parked.
+ */
+bool process::can_hand_off() const
+{
+    return !is_running()
+        || is_registered()
+        || is_parked();
+}
+
+
+/** \brief Save the state of this process before snapinit re-executes itself.
+ *
+ * The counters, the listen sockets and, if the child is running, its
+ * PID, its state, its readiness pipe and its zygote control socket get
+ * saved in \p entry.
+ * The file descriptors are passed to the new binary through \p h.
+ *
+ * The pidfd is not passed, the new binary opens a new one.
+ *
+ * \param[in,out] entry  The entry of the service.
+ * \param[in,out] h  The handoff receiving the file descriptors.
+ *
+ * \return false if a file descriptor could not be passed.
+ */
+bool process::save_handoff(snap::snap_communicator_message & entry, handoff & h) const
+{
+    entry.add_parameter("start_count", QString("%1").arg(f_start_count));
+    entry.add_parameter("error_count", QString("%1").arg(f_error_count));
+
+    // the names cannot include a colon, as in LISTEN_FDNAMES
+    //
+    QStringList names;
+    QStringList fds;
+    for(auto const & s : f_listen_sockets)
+    {
+        if(s->is_open())
+        {
+            if(!h.pass_fd(s->get_socket()))
+            {
+                return false;
+            }
+            names << s->get_name();
+            fds << QString("%1").arg(s->get_socket());
+        }
+    }
+    if(!names.isEmpty())
+    {
+        entry.add_parameter("listen_names", names.join(":"));
+        entry.add_parameter("listen_fds", fds.join(":"));
+    }
+
+    if(!f_cgroup.get_path().isEmpty())
+    {
+        entry.add_parameter("cgroup", f_cgroup.get_path());
+    }
+
+    if(!is_running())
+    {
+        return true;
+    }
+
+    entry.add_parameter("pid", f_pid);
+    entry.add_parameter("start_date", QString("%1").arg(f_start_date));
+    entry.add_parameter("registered", is_registered() ? "true" : "false");
+    entry.add_parameter("communicator", f_registered_with_communicator ? "true" : "false");
+    if(f_ready_pipe_connection)
+    {
+        if(!h.pass_fd(f_ready_pipe_connection->get_socket()))
+        {
+            return false;
+        }
+        entry.add_parameter("ready_pipe", f_ready_pipe_connection->get_socket());
+    }
+    if(f_zygote_socket != -1)
+    {
+        if(!h.pass_fd(f_zygote_socket))
+        {
+            return false;
+        }
+        entry.add_parameter("zygote_socket", f_zygote_socket);
+    }
+
+    return true;
+}
+
+
+/** \brief Restore the state saved by the previous snapinit binary.
+ *
+ * The child, if any, is adopted as is: it is still our child since
+ * execve() does not change our PID. A new pidfd gets opened on it.
+ * If it died in the meantime, it is a zombie and gets reaped as usual.
+ *
+ * The snapcommunicator process restarts UNREGISTERED because our new
+ * connection registers again and msg_ready() marks it as registered.
+ *
+ * \param[in] entry  The entry of the service, see save_handoff().
+ */
+void process::rehydrate(snap::snap_communicator_message const & entry)
+{
+    f_start_count = entry.get_integer_parameter("start_count");
+    f_error_count = entry.get_integer_parameter("error_count");
+
+    if(entry.has_parameter("listen_names"))
+    {
+        QStringList const names(entry.get_parameter("listen_names").split(':'));
+        QStringList const fds(entry.get_parameter("listen_fds").split(':'));
+        for(int idx(0); idx < names.size() && idx < fds.size(); ++idx)
+        {
+            int const fd(fds[idx].toInt());
+            if(!handoff::claim_fd(fd))
+            {
+                continue;
+            }
+            auto const it(std::find_if(
+                      f_listen_sockets.begin()
+                    , f_listen_sockets.end()
+                    , [&names, idx](auto const & s)
+                      {
+                          return s->get_name() == names[idx];
+                      }));
+            if(it == f_listen_sockets.end()
+            || !(*it)->adopt_socket(fd))
+            {
+                SNAP_LOG_WARNING("socket \"")
+                                (names[idx])
+                                ("\" of service \"")
+                                (f_service->get_service_name())
+                                ("\" is not defined anymore, it gets closed.");
+                close(fd);
+            }
+        }
+    }
+
+    // the process may be running in that cgroup, the next processes
+    // of the service go there too
+    //
+    if(entry.has_parameter("cgroup")
+    && f_cgroup.is_defined())
+    {
+        snap::NOTUSED(f_cgroup.adopt(entry.get_parameter("cgroup")));
+    }
+
+    if(!entry.has_parameter("pid"))
+    {
+        return;
+    }
+
+    f_pid = static_cast<pid_t>(entry.get_integer_parameter("pid"));
+    f_start_date = entry.get_integer_parameter("start_date");
+    f_registered_with_communicator = entry.get_parameter("communicator") == "true";
+    f_state = entry.get_parameter("registered") == "true"
+           && !f_service->is_snapcommunicator()
+                    ? process_state_t::PROCESS_STATE_REGISTERED
+                    : process_state_t::PROCESS_STATE_UNREGISTERED;
+    f_died_parked = false;
+    if(entry.has_parameter("ready_pipe"))
+    {
+        int const ready_pipe(static_cast<int>(entry.get_integer_parameter("ready_pipe")));
+        if(handoff::claim_fd(ready_pipe))
+        {
+            f_ready_pipe_connection = std::make_shared<process_ready_pipe>(this, ready_pipe);
+            f_ready_pipe_connection->set_name(f_service->get_service_name() + " ready pipe");
+            f_ready_pipe_connection->set_priority(55);
+            snap::snap_communicator::instance()->add_connection(f_ready_pipe_connection);
+        }
+    }
+    if(entry.has_parameter("zygote_socket"))
+    {
+        int const zygote_socket(static_cast<int>(entry.get_integer_parameter("zygote_socket")));
+        if(handoff::claim_fd(zygote_socket))
+        {
+            f_zygote_socket = zygote_socket;
+        }
+    }
+
+    snap_init_ptr()->register_service_pid(f_pid, f_service->shared_from_this());
+    open_pidfd();
+}
+
+
 std::shared_ptr<snap_init> process::snap_init_ptr()
 {
     snap_init::pointer_t locked(f_snap_init.lock());
@@ -721,6 +1683,12 @@ bool process::start_service_process()
     //
     f_start_date = snap::snap_communicator::get_current_date();
 
+    startup_trace::pointer_t trace(snap_init_ptr()->get_startup_trace());
+    if(trace)
+    {
+        trace->process_starting(f_service->get_service_name());
+    }
+
     // if this is the snapinit service, then it is always running
     // (or this code would not be executed!)
     //
@@ -729,25 +1697,140 @@ bool process::start_service_process()
         // this is us!
         //
         f_pid = getpid();
+        snap_init_ptr()->register_service_pid(f_pid, f_service->shared_from_this());
+        if(trace)
+        {
+            trace->process_spawned(f_service->get_service_name());
+        }
         return true;
     }
 
-    pid_t const parent_pid(getpid());
-    f_pid = fork();
-
-    // child?
+    // convert the command line, user and group once, the child
+    // then only has to make system calls
     //
-    if(f_pid == 0)
+    if(!prepare_exec())
     {
-        exec_child(parent_pid);
-        snap::NOTREACHED();
+        return false;
     }
 
-    // error?
+    // the sockets are bound once, then the child gets a copy of each
     //
-    if(-1 == f_pid)
+    if(!open_listen_sockets())
     {
-        int const e(errno);
+        return false;
+    }
+    f_exec_fds.clear();
+    for(auto const & s : f_listen_sockets)
+    {
+        f_exec_fds.push_back(s->get_socket());
+    }
+
+    // the readiness pipe, the child inherits the write end right after
+    // the listen sockets
+    //
+    int ready_pipe[2] = { -1, -1 };
+    if(f_ready_pipe)
+    {
+        if(pipe2(ready_pipe, O_CLOEXEC) != 0)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR("pipe2() failed to create the readiness pipe of service \"")(f_service->get_service_name())("\". (errno: ")(e)(" -- ")(strerror(e))(")");
+            return false;
+        }
+        f_exec_fds.push_back(ready_pipe[1]);
+    }
+
+    // the zygote control socket comes right after the readiness pipe
+    //
+    int zygote_socket[2] = { -1, -1 };
+    if(f_zygote)
+    {
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, zygote_socket) != 0)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR("socketpair() failed to create the zygote control socket of service \"")(f_service->get_service_name())("\". (errno: ")(e)(" -- ")(strerror(e))(")");
+            if(ready_pipe[0] != -1)
+            {
+                close(ready_pipe[0]);
+                close(ready_pipe[1]);
+            }
+            return false;
+        }
+        f_exec_fds.push_back(zygote_socket[1]);
+    }
+
+    // create the cgroup of the service, the child moves itself in it
+    //
+    f_exec_cgroup_fd = -1;
+    if(f_cgroup.is_defined()
+    && f_cgroup.create(snap_init_ptr()->get_cgroup_root(), f_service->get_service_name()))
+    {
+        f_exec_cgroup_fd = f_cgroup.get_procs_fd();
+    }
+
+    pid_t const parent_pid(getpid());
+    if(snap_init_ptr()->get_vfork_spawn())
+    {
+        if(!spawn_child(parent_pid)
+        && f_pid != -1)
+        {
+            // the child was created but it could not execute the service
+            //
+            if(ready_pipe[0] != -1)
+            {
+                close(ready_pipe[0]);
+                close(ready_pipe[1]);
+            }
+            if(zygote_socket[0] != -1)
+            {
+                close(zygote_socket[0]);
+                close(zygote_socket[1]);
+            }
+            return false;
+        }
+    }
+    else
+    {
+        f_pid = fork();
+
+        // child?
+        //
+        if(f_pid == 0)
+        {
+            exec_child(parent_pid);
+            snap::NOTREACHED();
+        }
+    }
+
+    // the write end of the readiness pipe only belongs to the child
+    //
+    if(ready_pipe[1] != -1)
+    {
+        int const e(errno);
+        close(ready_pipe[1]);
+        errno = e;
+    }
+    if(zygote_socket[1] != -1)
+    {
+        int const e(errno);
+        close(zygote_socket[1]);
+        errno = e;
+    }
+
+    // error?
+    //
+    if(-1 == f_pid)
+    {
+        if(ready_pipe[0] != -1)
+        {
+            close(ready_pipe[0]);
+        }
+        if(zygote_socket[0] != -1)
+        {
+            close(zygote_socket[0]);
+        }
+
+        int const e(errno);
         SNAP_LOG_ERROR("fork() failed to create a child process to start service \"")(f_service->get_service_name())("\". (errno: ")(e)(" -- ")(strerror(e))(")");
 
         // request the proc library to read memory information
@@ -757,12 +1840,512 @@ bool process::start_service_process()
         return false;
     }
 
+    // save the PID in the snapinit index so we can quickly find this
+    // service again when the process dies
+    //
+    snap_init_ptr()->register_service_pid(f_pid, f_service->shared_from_this());
+
+    // watch the child through a pidfd when possible
+    //
+    open_pidfd();
+
+    // wait for the child to tell us it is ready
+    //
+    f_registered_with_communicator = false;
+    if(ready_pipe[0] != -1)
+    {
+        f_ready_pipe_connection = std::make_shared<process_ready_pipe>(this, ready_pipe[0]);
+        f_ready_pipe_connection->set_name(f_service->get_service_name() + " ready pipe");
+        f_ready_pipe_connection->set_priority(55);
+        snap::snap_communicator::instance()->add_connection(f_ready_pipe_connection);
+    }
+
+    // the child stays parked until action_release()
+    //
+    f_died_parked = false;
+    f_zygote_socket = zygote_socket[0];
+
+    if(trace)
+    {
+        trace->process_spawned(f_service->get_service_name());
+    }
+
     // here we are considered started and running
     //
     return true;
 }
 
 
+/** \brief Start watching the child through its pidfd.
+ *
+ * When snapinit uses pidfd supervision, this function gets a pidfd for
+ * the child we just created and adds it to the communicator. The death
+ * of the child then wakes up this very process object.
+ *
+ * The child cannot be reaped before we call waitpid() on it so its PID
+ * cannot have been reused between the fork() and the pidfd_open().
+ *
+ * If the pidfd cannot be created, the child is supervised by the
+ * SIGCHLD handler instead.
+ */
+void process::open_pidfd()
+{
+    snap_init::pointer_t si(snap_init_ptr());
+    if(!si->get_pidfd_supervision())
+    {
+        return;
+    }
+
+    int const pidfd(common::pidfd_open(f_pid));
+    if(pidfd == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_WARNING("pidfd_open() failed for service \"")
+                        (f_service->get_service_name())
+                        ("\" (errno: ")
+                        (e)
+                        (" -- ")
+                        (strerror(e))
+                        ("), falling back to SIGCHLD.");
+        si->register_sigchld_pid(f_pid);
+        return;
+    }
+
+    f_pidfd_connection = std::make_shared<process_pidfd>(this, pidfd);
+    f_pidfd_connection->set_name(f_service->get_service_name() + " pidfd");
+    f_pidfd_connection->set_priority(55);
+    snap::snap_communicator::instance()->add_connection(f_pidfd_connection);
+}
+
+
+/** \brief Stop watching the child through its pidfd.
+ *
+ * This function removes the pidfd connection from the communicator
+ * which closes the pidfd. It is safe to call it when no pidfd is
+ * attached to this process.
+ */
+void process::close_pidfd()
+{
+    if(f_pidfd_connection)
+    {
+        snap::snap_communicator::instance()->remove_connection(f_pidfd_connection);
+        f_pidfd_connection.reset();
+    }
+}
+
+
+/** \brief Stop polling the readiness pipe.
+ *
+ * This function removes the readiness pipe connection from the
+ * communicator which closes the pipe. It is safe to call it when
+ * the process does not use a readiness pipe.
+ */
+void process::close_ready_pipe()
+{
+    if(f_ready_pipe_connection)
+    {
+        snap::snap_communicator::instance()->remove_connection(f_ready_pipe_connection);
+        f_ready_pipe_connection.reset();
+    }
+}
+
+
+/** \brief Close our end of the zygote control socket.
+ *
+ * A child still parked reads the end of the file and exits.
+ */
+void process::close_zygote_socket()
+{
+    if(f_zygote_socket != -1)
+    {
+        close(f_zygote_socket);
+        f_zygote_socket = -1;
+    }
+}
+
+
+/** \brief Prepare the data used to execute the child.
+ *
+ * This function computes the command line arguments, the user and
+ * group identifiers and the quiet flag once. The results are cached
+ * until one of the setters changes the corresponding parameter.
+ *
+ * This way the child, whether created with fork() or clone(), does not
+ * have to convert QString objects or call getpwnam()/getgrnam(), which
+ * are not safe in a child sharing our memory.
+ *
+ * \return true if the data is ready, false if the user or group could
+ *         not be found.
+ */
+bool process::prepare_exec()
+{
+    if(f_exec_prepared)
+    {
+        return true;
+    }
+
+    f_exec_args.clear();
+    f_exec_args.push_back(f_full_path.toUtf8().data());
+
+    // various services may offer common options which are defined in
+    // the <common-options> tag (i.e. snapcommunicator and snapdbproxy)
+    //
+    // note that the snapinit service is  given a few common options
+    // of its own (See snapinit.cpp for details) even though it does
+    // not come from an XML file
+    //
+    std::for_each(
+            f_common_options.begin(),
+            f_common_options.end(),
+            [this](auto const & options)
+            {
+                std::string const opts(options.toUtf8().data());
+                this->parse_options(f_exec_args, opts.c_str());
+            });
+
+    if( !f_config_filename.isEmpty() )
+    {
+        f_exec_args.push_back("--config");
+        f_exec_args.push_back(f_config_filename.toUtf8().data());
+    }
+    if( !f_options.isEmpty() )
+    {
+        // f_options is one long string, we need to break it up in
+        // arguments paying attention to quotes
+        //
+        // XXX: we could implement a way to avoid a second --debug
+        //      if it was defined in the f_options and on snapinit's
+        //      command line
+        //
+        std::string const opts(f_options.toUtf8().data());
+        parse_options(f_exec_args, opts.c_str());
+    }
+    if(f_instance >= 0)
+    {
+        f_exec_args.push_back("--instance");
+        f_exec_args.push_back(std::to_string(f_instance));
+    }
+
+    // execv() needs plain string pointers
+    //
+    f_exec_argv.clear();
+    std::transform( std::begin(f_exec_args), std::end(f_exec_args), std::back_inserter(f_exec_argv),
+        [&](const auto& a)
+        {
+            return a.c_str();
+        });
+    //
+    f_exec_argv.push_back(nullptr);
+
+    f_exec_command_line = snap::join_strings(f_exec_args, " ");
+
+    // find the non-priv user/group if f_user and f_group are set
+    //
+    f_exec_gid = static_cast<gid_t>(-1);
+    f_exec_uid = static_cast<uid_t>(-1);
+    if( getuid() == 0 )
+    {
+        if( !f_group.isEmpty() )
+        {
+            struct group * grp(getgrnam(f_group.toUtf8().data()));
+            if( nullptr == grp )
+            {
+                SNAP_LOG_ERROR("Cannot locate group '")(f_group)("'! Create it first, then run the server.");
+                return false;
+            }
+            f_exec_gid = grp->gr_gid;
+        }
+        //
+        if( !f_user.isEmpty() )
+        {
+            struct passwd * pswd(getpwnam(f_user.toUtf8().data()));
+            if( nullptr == pswd )
+            {
+                SNAP_LOG_ERROR("Cannot locate user '")(f_user)("'! Create it first, then run the server.");
+                return false;
+            }
+            f_exec_uid = pswd->pw_uid;
+        }
+    }
+
+    // the environment only needs to be changed to pass sockets,
+    // the readiness pipe or the zygote control socket
+    //
+    f_exec_env.clear();
+    f_exec_envp.clear();
+    f_exec_listen_pid = nullptr;
+    if(!f_listen_sockets.empty()
+    || f_ready_pipe
+    || f_zygote)
+    {
+        for(char ** e(environ); *e != nullptr; ++e)
+        {
+            if(strncmp(*e, "LISTEN_", 7) != 0
+            && strncmp(*e, "SNAPINIT_READY_FD=", 18) != 0
+            && strncmp(*e, "SNAPINIT_ZYGOTE_FD=", 19) != 0)
+            {
+                f_exec_env.push_back(*e);
+            }
+        }
+        if(f_ready_pipe)
+        {
+            f_exec_env.push_back(QString("SNAPINIT_READY_FD=%1").arg(listen_socket::LISTEN_FDS_START + f_listen_sockets.size()).toUtf8().data());
+        }
+        if(f_zygote)
+        {
+            f_exec_env.push_back(QString("SNAPINIT_ZYGOTE_FD=%1").arg(listen_socket::LISTEN_FDS_START + f_listen_sockets.size() + (f_ready_pipe ? 1 : 0)).toUtf8().data());
+        }
+        if(!f_listen_sockets.empty())
+        {
+            f_exec_env.push_back(QString("LISTEN_FDS=%1").arg(f_listen_sockets.size()).toUtf8().data());
+            snap::snap_string_list names;
+            for(auto const & s : f_listen_sockets)
+            {
+                names << s->get_name();
+            }
+            f_exec_env.push_back(QString("LISTEN_FDNAMES=%1").arg(names.join(":")).toUtf8().data());
+
+            // the child writes its PID in the space reserved here
+            //
+            f_exec_env.push_back(std::string("LISTEN_PID=") + std::string(15, '0'));
+        }
+
+        std::transform( std::begin(f_exec_env), std::end(f_exec_env), std::back_inserter(f_exec_envp),
+            [&](const auto& a)
+            {
+                return a.c_str();
+            });
+        f_exec_envp.push_back(nullptr);
+        if(!f_listen_sockets.empty())
+        {
+            f_exec_listen_pid = &f_exec_env.back()[11];
+        }
+    }
+
+    f_exec_quiet = !snap_init_ptr()->get_debug();
+
+    f_exec_prepared = true;
+
+    return true;
+}
+
+
+/** \brief Start the child with clone(CLONE_VM | CLONE_VFORK).
+ *
+ * Contrary to fork(), this function does not duplicate the snapinit
+ * memory. The child runs in our address space, on its own small
+ * stack, until it calls execv(). Meanwhile the parent is suspended.
+ * This is much faster on large processes and it cannot fail because
+ * the kernel refuses to commit a copy of our memory.
+ *
+ * Since the child shares our memory it only makes system calls using
+ * the data computed by prepare_exec(). If one of them fails, the child
+ * saves errno in f_spawn_errno before exiting so the parent can report
+ * the error and reap the child immediately.
+ *
+ * posix_spawn() is not used because it cannot set the parent death
+ * signal, the nice value, or switch user.
+ *
+ * \param[in] parent_pid  The PID of snapinit.
+ *
+ * \return false if the child could not be started. If clone() itself
+ *         failed, f_pid is -1, otherwise f_pid is the PID of the child
+ *         which was already reaped.
+ */
+bool process::spawn_child(pid_t parent_pid)
+{
+    SNAP_LOG_TRACE(QString("starting service with command line: \"%1\"").arg(f_exec_command_line.c_str()));
+
+    f_spawn_parent_pid = parent_pid;
+    f_spawn_errno = 0;
+    f_spawn_step = nullptr;
+
+    f_pid = clone(&process::spawn_child_main
+                , g_spawn_stack + sizeof(g_spawn_stack)
+                , CLONE_VM | CLONE_VFORK | SIGCHLD
+                , this);
+    if(f_pid == -1)
+    {
+        // the caller reports the errno
+        //
+        return false;
+    }
+
+    if(f_spawn_errno != 0)
+    {
+        // the child already exited, reap it now so the SIGCHLD handler
+        // does not see an unknown PID
+        //
+        int status(0);
+        snap::NOTUSED(waitpid(f_pid, &status, 0));
+        SNAP_LOG_ERROR("service::run() child: process \"")
+                      (f_exec_command_line)
+                      ("\" failed to start! ")
+                      (f_spawn_step)
+                      ("() failed (errno: ")
+                      (f_spawn_errno)
+                      (", ")
+                      (strerror(f_spawn_errno))
+                      (")");
+        return false;
+    }
+
+    return true;
+}
+
+
+/** \brief The code run by the clone()'d child.
+ *
+ * This function runs in the child created by spawn_child(). It shares
+ * the memory of snapinit so it must not allocate memory, log, or
+ * otherwise call anything other than system calls.
+ *
+ * \param[in] data  The process object.
+ *
+ * \return The function never returns, it calls execv() or _exit().
+ */
+int process::spawn_child_main(void * data)
+{
+    process * p(reinterpret_cast<process *>(data));
+
+    auto const failed([p](char const * step)
+        {
+            p->f_spawn_errno = errno;
+            p->f_spawn_step = step;
+            _exit(1);
+        });
+
+    // make sure that the SIGHUP is sent to us if our parent dies
+    //
+    prctl(PR_SET_PDEATHSIG, SIGHUP);
+
+    // unblock those signals we blocked in the main snapinit process
+    // because the children should not have such a mask on startup
+    //
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGQUIT);
+    sigaddset(&set, SIGINT);
+    sigprocmask(SIG_UNBLOCK, &set, nullptr);
+
+    // see exec_child() about the process group
+    //
+    setpgid(0, 0);
+
+    // the parent is suspended until we execv() or _exit() so this
+    // should never happen, but we keep the same test as exec_child()
+    //
+    if(p->f_spawn_parent_pid != getppid())
+    {
+        errno = ESRCH;
+        failed("getppid");
+    }
+
+    // see exec_child() about the cgroup
+    //
+    if(p->f_exec_cgroup_fd != -1
+    && write(p->f_exec_cgroup_fd, "0", 1) != 1)
+    {
+        failed("write(cgroup.procs)");
+    }
+
+    if(p->f_nice >= 0)
+    {
+        setpriority(PRIO_PROCESS, 0, p->f_nice);
+    }
+
+    // see exec_child() about the CPU affinity
+    //
+    if(p->f_cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(p->f_cpu, &cpus);
+        if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        {
+            failed("sched_setaffinity");
+        }
+    }
+
+    if(p->f_coredump_limit != 0)
+    {
+        struct rlimit core_limits;
+        core_limits.rlim_cur = p->f_coredump_limit;
+        core_limits.rlim_max = p->f_coredump_limit;
+        setrlimit(RLIMIT_CORE, &core_limits);
+    }
+
+    // Quiet up the console by redirecting these from/to /dev/null
+    // except in debug mode
+    //
+    if(p->f_exec_quiet)
+    {
+        int const null_fd(open("/dev/null", O_RDWR));
+        if(null_fd == -1)
+        {
+            failed("open");
+        }
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if(null_fd > STDERR_FILENO)
+        {
+            close(null_fd);
+        }
+    }
+
+    // see exec_child() about the listen sockets
+    //
+    if(!move_child_fds(p->f_exec_fds))
+    {
+        failed("dup2");
+    }
+    if(p->f_exec_listen_pid != nullptr)
+    {
+        write_pid(p->f_exec_listen_pid, getpid());
+    }
+
+    // Group first, then user. Otherwise you lose privs to change your group!
+    //
+    // the glibc setgid()/setuid() functions broadcast the change to all
+    // the threads of the process and use glibc internal state, which is
+    // the memory of snapinit here; like posix_spawn(), use the raw system
+    // calls, our child has a single thread
+    //
+    if(p->f_exec_gid != static_cast<gid_t>(-1)
+    && syscall(SYS_setgid, p->f_exec_gid) != 0)
+    {
+        failed("setgid");
+    }
+    if(p->f_exec_uid != static_cast<uid_t>(-1)
+    && syscall(SYS_setuid, p->f_exec_uid) != 0)
+    {
+        failed("setuid");
+    }
+
+    if(p->f_exec_envp.empty())
+    {
+        execv(
+            p->f_exec_argv[0],
+            const_cast<char * const *>(&p->f_exec_argv[0])
+        );
+    }
+    else
+    {
+        execve(
+            p->f_exec_argv[0],
+            const_cast<char * const *>(&p->f_exec_argv[0]),
+            const_cast<char * const *>(&p->f_exec_envp[0])
+        );
+    }
+
+    failed("execv");
+    return 1;
+}
+
+
 void process::parse_options(std::vector<std::string> & args, char const * s)
 {
     auto const push_arg([&args](char const * start, char const * end, bool const push_empty = false)
@@ -876,12 +2459,49 @@ void process::exec_child(pid_t parent_pid)
         snap::NOTREACHED();
     }
 
+    // move to the cgroup of the service before we drop our privileges
+    // and before the service has a chance to create children
+    //
+    if(f_exec_cgroup_fd != -1
+    && write(f_exec_cgroup_fd, "0", 1) != 1)
+    {
+        int const e(errno);
+        common::fatal_error(QString("service::run():child: could not move to cgroup \"%1\" (errno: %2, %3).")
+                        .arg(f_cgroup.get_path())
+                        .arg(e)
+                        .arg(strerror(e))
+                        );
+        snap::NOTREACHED();
+    }
+
     if(f_nice >= 0)
     {
         SNAP_LOG_TRACE("set nice of ")(f_service->get_service_name())(" to ")(f_nice);
         setpriority(PRIO_PROCESS, 0, f_nice);
     }
 
+    // pin the instance to its CPU; like the other failures in the
+    // child, a failure means the process does not start (the same as
+    // in spawn_child_main())
+    //
+    if(f_cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(f_cpu, &cpus);
+        if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        {
+            int const e(errno);
+            common::fatal_error(QString("service::run():child: could not pin %1 to CPU %2 (errno: %3, %4).")
+                            .arg(f_service->get_service_name())
+                            .arg(f_cpu)
+                            .arg(e)
+                            .arg(strerror(e))
+                            );
+            snap::NOTREACHED();
+        }
+    }
+
     // if the user requested core dump files, we turn on the feature here
     //
     // We do not change it if f_coredump_limit is set to zero, that way
@@ -903,53 +2523,6 @@ void process::exec_child(pid_t parent_pid)
         setrlimit(RLIMIT_CORE, &core_limits);
     }
 
-    std::vector<std::string> args;
-    args.push_back(f_full_path.toUtf8().data());
-
-    // various services may offer common options which are defined in
-    // the <common-options> tag (i.e. snapcommunicator and snapdbproxy)
-    //
-    // note that the snapinit service is  given a few common options
-    // of its own (See snapinit.cpp for details) even though it does
-    // not come from an XML file
-    //
-    std::for_each(
-            f_common_options.begin(),
-            f_common_options.end(),
-            [this, &args](auto const & options)
-            {
-                std::string const opts(options.toUtf8().data());
-                this->parse_options(args, opts.c_str());
-            });
-
-    if( !f_config_filename.isEmpty() )
-    {
-        args.push_back("--config");
-        args.push_back(f_config_filename.toUtf8().data());
-    }
-    if( !f_options.isEmpty() )
-    {
-        // f_options is one long string, we need to break it up in
-        // arguments paying attention to quotes
-        //
-        // XXX: we could implement a way to avoid a second --debug
-        //      if it was defined in the f_options and on snapinit's
-        //      command line
-        //
-        std::string const opts(f_options.toUtf8().data());
-        parse_options(args, opts.c_str());
-    }
-
-    // execv() needs plain string pointers
-    std::vector<char const *> args_p;
-    std::transform( std::begin(args), std::end(args), std::back_inserter(args_p),
-        [&](const auto& a)
-        {
-            return a.c_str();
-        });
-    //
-    args_p.push_back(nullptr);
-
     // Quiet up the console by redirecting these from/to /dev/null
     // except in debug mode
     //
@@ -964,65 +2537,69 @@ void process::exec_child(pid_t parent_pid)
         freopen( "/dev/null", "w", stderr );
     }
 
+    // pass the listen sockets as file descriptors 3, 4, ... the way
+    // systemd does, followed by the readiness pipe; LISTEN_PID has
+    // to be our own PID
+    //
+    if(!move_child_fds(f_exec_fds))
+    {
+        int const e(errno);
+        common::fatal_error(QString("service::run():child: could not pass the listen sockets (errno: %1, %2).")
+                        .arg(e)
+                        .arg(strerror(e))
+                        );
+        snap::NOTREACHED();
+    }
+    if(f_exec_listen_pid != nullptr)
+    {
+        write_pid(f_exec_listen_pid, getpid());
+    }
+
     // drop to non-priv user/group if f_user and f_group are set
     //
-    if( getuid() == 0 )
+    // Group first, then user. Otherwise you lose privs to change your group!
+    //
+    if(f_exec_gid != static_cast<gid_t>(-1)
+    && setgid(f_exec_gid) != 0)
     {
-        // Group first, then user. Otherwise you lose privs to change your group!
-        //
-        if( !f_group.isEmpty() )
-        {
-            struct group * grp(getgrnam(f_group.toUtf8().data()));
-            if( nullptr == grp )
-            {
-                common::fatal_error( QString("Cannot locate group '%1'! Create it first, then run the server.").arg(f_group) );
-                exit(1);
-            }
-            const int sw_grp_id = grp->gr_gid;
-            //
-            if( setgid( sw_grp_id ) != 0 )
-            {
-                common::fatal_error( QString("Cannot drop to group '%1'!").arg(f_group) );
-                exit(1);
-            }
-        }
-        //
-        if( !f_user.isEmpty() )
-        {
-            struct passwd * pswd(getpwnam(f_user.toUtf8().data()));
-            if( nullptr == pswd )
-            {
-                common::fatal_error( QString("Cannot locate user '%1'! Create it first, then run the server.").arg(f_user) );
-                exit(1);
-            }
-            const int sw_usr_id = pswd->pw_uid;
-            //
-            if( setuid( sw_usr_id ) != 0 )
-            {
-                common::fatal_error( QString("Cannot drop to user '%1'!").arg(f_user) );
-                exit(1);
-            }
-        }
+        common::fatal_error( QString("Cannot drop to group '%1'!").arg(f_group) );
+        exit(1);
+    }
+    if(f_exec_uid != static_cast<uid_t>(-1)
+    && setuid(f_exec_uid) != 0)
+    {
+        common::fatal_error( QString("Cannot drop to user '%1'!").arg(f_user) );
+        exit(1);
     }
 
     // make sure we can have an idea of how the command looks like
     //
-    std::string const command_line(snap::join_strings(args, " "));
-    SNAP_LOG_TRACE(QString("starting service with command line: \"%1\"").arg(command_line.c_str()));
+    SNAP_LOG_TRACE(QString("starting service with command line: \"%1\"").arg(f_exec_command_line.c_str()));
 
     // Execute the child processes
     //
-    execv(
-        args_p[0],
-        const_cast<char * const *>(&args_p[0])
-    );
+    if(f_exec_envp.empty())
+    {
+        execv(
+            f_exec_argv[0],
+            const_cast<char * const *>(&f_exec_argv[0])
+        );
+    }
+    else
+    {
+        execve(
+            f_exec_argv[0],
+            const_cast<char * const *>(&f_exec_argv[0]),
+            const_cast<char * const *>(&f_exec_envp[0])
+        );
+    }
 #pragma GCC diagnostic pop
 
     // the command did not start...
     //
     int const e(errno);
     common::fatal_error(QString("service::run() child: process \"%1\" failed to start! (errno: %2, %3)")
-                    .arg(command_line.c_str())
+                    .arg(f_exec_command_line.c_str())
                     .arg(e)
                     .arg(strerror(e))
                     );
@@ -23,7 +23,16 @@
 
 // ourselves
 //
+#include "backoff.h"
+#include "cgroup.h"
 #include "common.h"
+#include "handoff.h"
+#include "listen_socket.h"
+#include "resource_usage.h"
+
+// snapwebsites lib
+//
+#include "snap_communicator.h"
 
 // Qt lib
 //
@@ -32,6 +41,8 @@
 // C++ lib
 //
 #include <memory>
+#include <string>
+#include <vector>
 
 // C lib
 //
@@ -42,6 +53,7 @@ namespace snapinit
 
 class snap_init;
 class service;
+class process;
 
 
 enum class termination_t
@@ -52,6 +64,72 @@ enum class termination_t
 };
 
 
+/** \brief Watch a child process through its pidfd.
+ *
+ * When the kernel supports pidfd_open(), each child process gets a
+ * pidfd which becomes readable once the child exits. This connection
+ * adds that pidfd to the snap_communicator so the death of a child
+ * is reported directly to its process object instead of going through
+ * the global SIGCHLD handler.
+ *
+ * The connection owns the pidfd and closes it when destroyed.
+ */
+class process_pidfd
+        : public snap::snap_communicator::snap_connection
+{
+public:
+    typedef std::shared_ptr<process_pidfd>  pointer_t;
+
+                            process_pidfd(process * p, int pidfd);
+                            process_pidfd(process_pidfd const & rhs) = delete;
+    process_pidfd &         operator = (process_pidfd const & rhs) = delete;
+    virtual                 ~process_pidfd() override;
+
+    int                     get_pidfd() const;
+
+    // snap::snap_communicator::snap_connection implementation
+    virtual bool            is_reader() const override;
+    virtual int             get_socket() const override;
+    virtual void            process_read() override;
+
+private:
+    process *               f_process = nullptr; // the process owns this connection, so a bare pointer is enough
+    int                     f_pidfd = -1;
+};
+
+
+/** \brief Wait for the child to say that it is ready.
+ *
+ * When a service uses the pipe readiness notification, its child
+ * inherits the write end of a pipe and writes to it once ready. This
+ * connection polls the read end so the process becomes registered
+ * without waiting for snapcommunicator to relay a STATUS message.
+ *
+ * The connection owns the read end of the pipe and closes it when
+ * destroyed.
+ */
+class process_ready_pipe
+        : public snap::snap_communicator::snap_connection
+{
+public:
+    typedef std::shared_ptr<process_ready_pipe>  pointer_t;
+
+                            process_ready_pipe(process * p, int pipe);
+                            process_ready_pipe(process_ready_pipe const & rhs) = delete;
+    process_ready_pipe &    operator = (process_ready_pipe const & rhs) = delete;
+    virtual                 ~process_ready_pipe() override;
+
+    // snap::snap_communicator::snap_connection implementation
+    virtual bool            is_reader() const override;
+    virtual int             get_socket() const override;
+    virtual void            process_read() override;
+
+private:
+    process *               f_process = nullptr; // the process owns this connection, so a bare pointer is enough
+    int                     f_pipe = -1;
+};
+
+
 class process
 {
 public:
@@ -69,22 +147,53 @@ public:
     void                    set_common_options(std::vector<QString> const & options);
     void                    set_safe_message(QString const & safe_message);
     void                    set_nice(int const nice);
+    void                    set_backoff(backoff const & b);
+    void                    set_ready_pipe(bool ready_pipe);
+    void                    set_zygote(bool zygote);
+    void                    set_instance(int instance);
+    void                    set_cpu(int cpu);
+    backoff &               get_backoff();
+    cgroup &                get_cgroup();
+    resource_usage &        get_resource_usage();
+    resource_usage const &  get_resource_usage() const;
+    void                    add_listen_socket(listen_socket::pointer_t s);
+    listen_socket::vector_t const &
+                            get_listen_sockets() const;
+    bool                    open_listen_sockets();
+    bool                    is_listening() const;
+    void                    adopt_listen_sockets(process & rhs);
 
     void                    action_start();
     void                    action_died(termination_t termination);
     void                    action_process_registered();
     void                    action_process_unregistered();
     void                    action_safe_message(QString const & message);
+    void                    action_exited(int status, struct rusage const & usage);
+    void                    action_pidfd_readable();
+    void                    action_ready_notified(bool ready);
+    bool                    action_release();
 
     bool                    is_running() const;
     bool                    is_registered() const;
+    bool                    is_registered_with_communicator() const;
     bool                    is_stopped() const;
+    bool                    has_ready_pipe() const;
+    bool                    is_zygote() const;
+    bool                    is_parked() const;
+    bool                    died_parked() const;
 
     pid_t                   get_pid() const;
+    int64_t                 get_start_count() const;
+    int64_t                 get_error_count() const;
+    bool                    has_pidfd() const;
     QString const &         get_config_filename() const;
 
     bool                    kill_process(int signum);
 
+    bool                    can_hand_off() const;
+    bool                    save_handoff(snap::snap_communicator_message & entry, handoff & h) const;
+    void                    rehydrate(snap::snap_communicator_message const & entry);
+
 private:
     enum class process_state_t
     {
@@ -101,14 +210,18 @@ private:
     bool                        exists() const;
     void                        parse_options(std::vector<std::string> & args, char const * s);
     bool                        start_service_process();
+    bool                        prepare_exec();
+    bool                        spawn_child(pid_t parent_pid);
+    static int                  spawn_child_main(void * data);
+    void                        open_pidfd();
+    void                        close_pidfd();
+    void                        close_ready_pipe();
+    void                        close_zygote_socket();
     [[noreturn]] void           exec_child(pid_t parent_pid);
     std::shared_ptr<snap_init>  snap_init_ptr();
 
     static char const *         state_to_string( process_state_t const state );
 
-    static int64_t const        MAX_START_INTERVAL = 60LL * common::SECONDS_TO_MICROSECONDS; // 1 minute in microseconds
-    static int const            MAX_START_COUNT = 5;
-
     // parents
     //
     std::weak_ptr<snap_init>    f_snap_init;
@@ -117,14 +230,29 @@ private:
     // current state
     //
     process_state_t             f_state = process_state_t::PROCESS_STATE_STOPPED;
-    int                         f_error_count = 0;
+    backoff                     f_backoff;
+    cgroup                      f_cgroup;
+    resource_usage              f_resource_usage;
+    listen_socket::vector_t     f_listen_sockets;
+    int64_t                     f_start_count = 0;
+    int64_t                     f_error_count = 0;
 
     // information to run the process
     //
     int64_t                     f_start_date = 0;       // in microseconds, to calculate an interval
     int64_t                     f_end_date = 0;         // in microseconds, to calculate an interval
     int                         f_nice = -1;
+    int                         f_instance = -1;        // -1 when the service has a single instance
+    int                         f_cpu = -1;             // -1 when the process is not pinned to a CPU
     pid_t                       f_pid = -1;
+    process_pidfd::pointer_t    f_pidfd_connection;
+    bool                        f_ready_pipe = false;
+    process_ready_pipe::pointer_t
+                                f_ready_pipe_connection;
+    bool                        f_registered_with_communicator = false;
+    bool                        f_zygote = false;
+    int                         f_zygote_socket = -1;   // our end of the control socket while the child is parked
+    bool                        f_died_parked = false;
     rlim_t                      f_coredump_limit = 0;   // leave shell setup by default
     QString                     f_safe_message;
     QString                     f_user;
@@ -134,6 +262,27 @@ private:
     QString                     f_config_filename;
     QString                     f_options;
     std::vector<QString>        f_common_options;
+
+    // data computed by prepare_exec() so the child only makes system calls
+    //
+    bool                        f_exec_prepared = false;
+    bool                        f_exec_quiet = true;
+    std::vector<std::string>    f_exec_args;
+    std::vector<char const *>   f_exec_argv;
+    std::string                 f_exec_command_line;
+    uid_t                       f_exec_uid = static_cast<uid_t>(-1);
+    gid_t                       f_exec_gid = static_cast<gid_t>(-1);
+    int                         f_exec_cgroup_fd = -1;
+    std::vector<std::string>    f_exec_env;
+    std::vector<char const *>   f_exec_envp;
+    char *                      f_exec_listen_pid = nullptr;    // digits of LISTEN_PID=, written by the child
+    std::vector<int>            f_exec_fds;                     // scratch copy of the descriptors passed to the child, modified by the child
+
+    // written by the clone()'d child which shares our memory
+    //
+    pid_t                       f_spawn_parent_pid = -1;
+    int                         f_spawn_errno = 0;
+    char const *                f_spawn_step = nullptr;
 };
 
 
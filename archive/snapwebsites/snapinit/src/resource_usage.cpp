@@ -0,0 +1,365 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- resource usage accounting of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "resource_usage.h"
+
+// snapwebsites lib
+//
+#include "snap_communicator.h"
+
+// C++ lib
+//
+#include <stdexcept>
+#include <string>
+
+// C lib
+//
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Keep track of the resources used by the processes of a service.
+ *
+ * Each time a process dies, snapinit reaps it with wait4() which gives
+ * us the resources it used: CPU time, maximum resident set size, page
+ * faults and context switches. These are saved along the start and end
+ * dates of the run in a ring buffer of the last HISTORY_SIZE runs.
+ * This is mainly useful for cron tasks: one can compare the cost of the
+ * runs before and after a deploy.
+ *
+ * Processes which are still running are sampled from /proc/<pid>/stat
+ * at a regular interval (see the stats_sample_interval parameter in
+ * snapinit.conf) so the STATS message can also report about them.
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief Convert a timeval to microseconds.
+ *
+ * \param[in] tv  The timeval to convert.
+ *
+ * \return The number of microseconds in \p tv.
+ */
+int64_t timeval_to_us(struct timeval const & tv)
+{
+    return static_cast<int64_t>(tv.tv_sec) * common::SECONDS_TO_MICROSECONDS + tv.tv_usec;
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// RESOURCE USAGE (class implementation)       //
+/////////////////////////////////////////////////
+
+
+/** \brief The names of the fields output by run_to_string().
+ *
+ * \return A comma separated list of field names.
+ */
+char const * resource_usage::run_fields()
+{
+    return "start,wall,user,system,maxrss,minflt,majflt,nvcsw,nivcsw,status";
+}
+
+
+/** \brief The names of the fields output by sample_to_string().
+ *
+ * \return A comma separated list of field names.
+ */
+char const * resource_usage::sample_fields()
+{
+    return "date,user,system,rss,minflt,majflt,threads";
+}
+
+
+/** \brief Save the resources used by a process which just died.
+ *
+ * If the ring buffer is full, the oldest run gets overwritten.
+ *
+ * The live sample is cleared since the process is gone.
+ *
+ * \param[in] start_date  The date when the process was started.
+ * \param[in] end_date  The date when the process died.
+ * \param[in] status  The status returned by wait4().
+ * \param[in] usage  The resources returned by wait4().
+ */
+void resource_usage::record_run(int64_t start_date, int64_t end_date, int status, struct rusage const & usage)
+{
+    run_t & run(f_runs[f_next]);
+    run.f_start_date = start_date;
+    run.f_end_date = end_date;
+    run.f_user_time = timeval_to_us(usage.ru_utime);
+    run.f_system_time = timeval_to_us(usage.ru_stime);
+    run.f_max_rss = usage.ru_maxrss;
+    run.f_minor_faults = usage.ru_minflt;
+    run.f_major_faults = usage.ru_majflt;
+    run.f_voluntary_switches = usage.ru_nvcsw;
+    run.f_involuntary_switches = usage.ru_nivcsw;
+    run.f_status = status;
+
+    f_next = (f_next + 1) % HISTORY_SIZE;
+    if(f_count < HISTORY_SIZE)
+    {
+        ++f_count;
+    }
+    ++f_total_runs;
+
+    clear_sample();
+}
+
+
+/** \brief Get the number of runs currently in the ring buffer.
+ *
+ * \return A number between 0 and HISTORY_SIZE.
+ */
+size_t resource_usage::get_run_count() const
+{
+    return f_count;
+}
+
+
+/** \brief Get one of the runs saved in the ring buffer.
+ *
+ * \param[in] idx  The index of the run, 0 is the oldest run.
+ *
+ * \return A reference to the run.
+ */
+resource_usage::run_t const & resource_usage::get_run(size_t idx) const
+{
+    if(idx >= f_count)
+    {
+        throw std::out_of_range("resource_usage::get_run() called with an index out of range.");
+    }
+    return f_runs[(f_next + HISTORY_SIZE - f_count + idx) % HISTORY_SIZE];
+}
+
+
+/** \brief Get the number of runs recorded since snapinit started.
+ *
+ * Contrary to get_run_count(), this number is not limited to the
+ * size of the ring buffer.
+ *
+ * \return The total number of runs.
+ */
+int64_t resource_usage::get_total_runs() const
+{
+    return f_total_runs;
+}
+
+
+/** \brief Sample a running process.
+ *
+ * This function reads /proc/<pid>/stat and saves the CPU time, the
+ * resident set size, the page faults and the number of threads of
+ * the process.
+ *
+ * \param[in] pid  The process to sample.
+ *
+ * \return true if the sample was taken, false if the file could not
+ *         be read or parsed (i.e. the process just died).
+ */
+bool resource_usage::sample(pid_t pid)
+{
+    std::string const filename("/proc/" + std::to_string(pid) + "/stat");
+    int const fd(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+    if(fd == -1)
+    {
+        return false;
+    }
+    char buf[1024];
+    ssize_t const size(read(fd, buf, sizeof(buf) - 1));
+    close(fd);
+    if(size <= 0)
+    {
+        return false;
+    }
+    buf[size] = '\0';
+
+    // the command name (field 2) may include spaces and parenthesis,
+    // the fields we want are after the last ')'
+    //
+    char const * s(strrchr(buf, ')'));
+    if(s == nullptr)
+    {
+        return false;
+    }
+    ++s;
+
+    // field 3 is right after the ')', we want 10, 12, 14, 15, 20 and 24
+    //
+    int64_t fields[25] = {};
+    for(int field(3); field <= 24; ++field)
+    {
+        while(*s == ' ')
+        {
+            ++s;
+        }
+        if(*s == '\0')
+        {
+            return false;
+        }
+        if(field != 3)  // field 3 is the state, a letter
+        {
+            fields[field] = strtoll(s, nullptr, 10);
+        }
+        while(*s != ' ' && *s != '\0')
+        {
+            ++s;
+        }
+    }
+
+    static int64_t const clock_ticks(sysconf(_SC_CLK_TCK));
+    static int64_t const page_size(sysconf(_SC_PAGESIZE));
+
+    f_sample.f_date = snap::snap_communicator::get_current_date();
+    f_sample.f_minor_faults = fields[10];
+    f_sample.f_major_faults = fields[12];
+    f_sample.f_user_time = fields[14] * common::SECONDS_TO_MICROSECONDS / clock_ticks;
+    f_sample.f_system_time = fields[15] * common::SECONDS_TO_MICROSECONDS / clock_ticks;
+    f_sample.f_threads = fields[20];
+    f_sample.f_rss = fields[24] * page_size / 1024;
+    f_has_sample = true;
+
+    return true;
+}
+
+
+/** \brief Forget about the last sample.
+ *
+ * This is called when the process dies so we do not report a process
+ * which is gone.
+ */
+void resource_usage::clear_sample()
+{
+    f_has_sample = false;
+}
+
+
+/** \brief Check whether a sample of the running process is available.
+ *
+ * \return true if sample() succeeded since the process was started.
+ */
+bool resource_usage::has_sample() const
+{
+    return f_has_sample;
+}
+
+
+/** \brief Get the last sample of the running process.
+ *
+ * \return A reference to the last sample.
+ */
+resource_usage::sample_t const & resource_usage::get_sample() const
+{
+    return f_sample;
+}
+
+
+/** \brief Transform a run in a string.
+ *
+ * The fields are separated by commas and appear in the order defined
+ * by run_fields(). The start date is in seconds, the wall and CPU
+ * times are in microseconds and the maximum RSS in kilobytes.
+ *
+ * \param[in] run  The run to transform.
+ *
+ * \return The run as a string.
+ */
+QString resource_usage::run_to_string(run_t const & run) const
+{
+    return QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10")
+                .arg(run.f_start_date / common::SECONDS_TO_MICROSECONDS)
+                .arg(run.f_end_date - run.f_start_date)
+                .arg(run.f_user_time)
+                .arg(run.f_system_time)
+                .arg(run.f_max_rss)
+                .arg(run.f_minor_faults)
+                .arg(run.f_major_faults)
+                .arg(run.f_voluntary_switches)
+                .arg(run.f_involuntary_switches)
+                .arg(run.f_status);
+}
+
+
+/** \brief Transform the whole ring buffer in a string.
+ *
+ * The runs are separated by semicolons, the oldest run first.
+ *
+ * \return The history as a string, empty if no run was recorded yet.
+ */
+QString resource_usage::history_to_string() const
+{
+    QString result;
+    for(size_t idx(0); idx < f_count; ++idx)
+    {
+        if(idx != 0)
+        {
+            result += ";";
+        }
+        result += run_to_string(get_run(idx));
+    }
+    return result;
+}
+
+
+/** \brief Transform the last sample in a string.
+ *
+ * The fields are separated by commas and appear in the order defined
+ * by sample_fields().
+ *
+ * \return The sample as a string, empty if there is no sample.
+ */
+QString resource_usage::sample_to_string() const
+{
+    if(!f_has_sample)
+    {
+        return QString();
+    }
+    return QString("%1,%2,%3,%4,%5,%6,%7")
+                .arg(f_sample.f_date / common::SECONDS_TO_MICROSECONDS)
+                .arg(f_sample.f_user_time)
+                .arg(f_sample.f_system_time)
+                .arg(f_sample.f_rss)
+                .arg(f_sample.f_minor_faults)
+                .arg(f_sample.f_major_faults)
+                .arg(f_sample.f_threads);
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
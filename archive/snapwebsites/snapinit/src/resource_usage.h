@@ -0,0 +1,107 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- resource usage accounting of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <array>
+
+// C lib
+//
+#include <sys/resource.h>
+
+namespace snapinit
+{
+
+
+class resource_usage
+{
+public:
+    static size_t const         HISTORY_SIZE = 32;
+
+    // the cost of one run of the process, from wait4()
+    //
+    struct run_t
+    {
+        int64_t                 f_start_date = 0;       // microseconds
+        int64_t                 f_end_date = 0;         // microseconds
+        int64_t                 f_user_time = 0;        // microseconds
+        int64_t                 f_system_time = 0;      // microseconds
+        int64_t                 f_max_rss = 0;          // kilobytes
+        int64_t                 f_minor_faults = 0;
+        int64_t                 f_major_faults = 0;
+        int64_t                 f_voluntary_switches = 0;
+        int64_t                 f_involuntary_switches = 0;
+        int                     f_status = 0;           // as returned by wait4()
+    };
+
+    // the state of a running process, from /proc/<pid>/stat
+    //
+    struct sample_t
+    {
+        int64_t                 f_date = 0;             // microseconds
+        int64_t                 f_user_time = 0;        // microseconds
+        int64_t                 f_system_time = 0;      // microseconds
+        int64_t                 f_rss = 0;              // kilobytes
+        int64_t                 f_minor_faults = 0;
+        int64_t                 f_major_faults = 0;
+        int64_t                 f_threads = 0;
+    };
+
+    static char const *         run_fields();
+    static char const *         sample_fields();
+
+    void                        record_run(int64_t start_date, int64_t end_date, int status, struct rusage const & usage);
+    size_t                      get_run_count() const;
+    run_t const &               get_run(size_t idx) const;
+    int64_t                     get_total_runs() const;
+
+    bool                        sample(pid_t pid);
+    void                        clear_sample();
+    bool                        has_sample() const;
+    sample_t const &            get_sample() const;
+
+    QString                     run_to_string(run_t const & run) const;
+    QString                     history_to_string() const;
+    QString                     sample_to_string() const;
+
+private:
+    std::array<run_t, HISTORY_SIZE>
+                                f_runs;
+    size_t                      f_next = 0;
+    size_t                      f_count = 0;
+    int64_t                     f_total_runs = 0;
+    sample_t                    f_sample;
+    bool                        f_has_sample = false;
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
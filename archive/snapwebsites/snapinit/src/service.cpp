@@ -30,6 +30,10 @@
 #include "log.h"
 #include "not_used.h"
 
+// Qt lib
+//
+#include <QCryptographicHash>
+
 // C++ lib
 //
 #include <sstream>
@@ -257,24 +261,16 @@ service::dependency_t::dependency_t(QString const & service_name, dependency_typ
  * The constructor initializes the service object. It saves the pointer
  * back to the snap_init object as a weak pointer.
  *
- * It also initializes the snapcommunicator timer which is used whenever
- * we want to wake up this service to run it. The timer is disabled by
- * default to avoid starting this up in the wrong order.
+ * The service timer is managed by the snap_init timer wheel. It is
+ * off by default to avoid starting this up in the wrong order.
  *
  * \param[in] si  The parent snap_init object.
  */
 service::service( std::shared_ptr<snap_init> si )
-    : snap_timer(-1)
-    , f_snap_init(si)
+    : f_snap_init(si)
+    , f_state_date(snap::snap_communicator::get_current_date())
     , f_process(si, this)
 {
-    // by default our timer is turned off
-    //
-    set_enable(false);
-
-    // timer has a low priority (runs last)
-    //
-    set_priority(100);
 }
 
 
@@ -288,7 +284,7 @@ service::service( std::shared_ptr<snap_init> si )
  */
 service::pointer_t service::shared_from_this() const
 {
-    return std::dynamic_pointer_cast<service>(const_cast<service *>(this)->snap_timer::shared_from_this());
+    return const_cast<service *>(this)->std::enable_shared_from_this<service>::shared_from_this();
 }
 
 
@@ -319,15 +315,10 @@ void service::configure_as_snapinit()
     //f_snapcommunicator_port = 4040;
     //f_snapdbproxy_addr.clear();
     //f_snapdbproxy_port = 4042;
-    //f_cron = 0;
     f_process.set_user("root");
     f_process.set_group("root");
     f_dep_name_list.clear();
     f_dep_name_list.push_back(dependency_t("snapcommunicator", dependency_t::dependency_type_t::DEPENDENCY_TYPE_STRONG));
-
-    // set snap_communicator connection name to help with debugging
-    //
-    set_name(f_service_name + " timer");
 }
 
 
@@ -395,6 +386,77 @@ void service::configure(QDomElement e, QString const & binary_path, std::vector<
         }
     }
 
+    // a service may run more than one instance of its process, each
+    // instance is a service of its own named "<name>-<index>" except
+    // the first one which keeps the name of the service
+    //
+    f_base_name = f_service_name;
+    {
+        QDomElement const sub_element(e.firstChildElement("instances"));
+        if(!sub_element.isNull())
+        {
+            std::vector<int> const cpus(common::get_allowed_cpus());
+            QString const instances(sub_element.text().trimmed());
+            if(instances == "auto")
+            {
+                f_instance_count = static_cast<int>(cpus.size());
+            }
+            else
+            {
+                bool ok(false);
+                f_instance_count = instances.toInt(&ok, 10);
+                if(!ok || f_instance_count < 1 || f_instance_count > 1024)
+                {
+                    common::fatal_error(QString("the instances tag of service \"%1\" must be \"auto\" or a number between 1 and 1024.").arg(f_service_name));
+                    snap::NOTREACHED();
+                }
+            }
+            if(f_instance >= f_instance_count)
+            {
+                throw std::logic_error("service::configure() called with an instance index out of range.");
+            }
+            if(f_instance_count > 1)
+            {
+                if(f_instance > 0)
+                {
+                    f_service_name = QString("%1-%2").arg(f_base_name).arg(f_instance);
+                }
+                f_process.set_instance(f_instance);
+
+                // instance i runs on the i-th CPU we are allowed to use
+                //
+                QString const pin(sub_element.attribute("pin", "false"));
+                if(pin == "true")
+                {
+                    f_process.set_cpu(cpus[f_instance % cpus.size()]);
+                }
+                else if(pin != "false")
+                {
+                    common::fatal_error(QString("the pin attribute of the instances tag of service \"%1\" must be \"true\" or \"false\".").arg(f_base_name));
+                    snap::NOTREACHED();
+                }
+            }
+        }
+    }
+
+    // the number of instances may follow the load, the instances
+    // above the minimum start without a process
+    //
+    {
+        QDomElement const sub_element(e.firstChildElement("autoscale"));
+        if(!sub_element.isNull())
+        {
+            if(f_instance_count < 2)
+            {
+                common::fatal_error(QString("the autoscale tag of service \"%1\" requires an instances tag with at least 2 instances.").arg(f_base_name));
+                snap::NOTREACHED();
+            }
+            f_autoscaler = std::make_shared<autoscaler>();
+            f_autoscaler->configure(sub_element, f_base_name, f_instance_count);
+            f_scaled_down = f_instance >= f_autoscaler->get_min();
+        }
+    }
+
     // user may specify a wait to use before moving forward with the next
     // item (i.e. wait on snapcommunicator before trying to connect to it)
     //
@@ -468,6 +530,127 @@ void service::configure(QDomElement e, QString const & binary_path, std::vector<
         }
     }
 
+    // how long we wait for the process to stop after the STOP message
+    // and then after the SIGTERM; the defaults come from snapinit.conf
+    //
+    f_stop_timeout = snap_init_ptr()->get_default_stop_timeout();
+    {
+        QDomElement const sub_element(e.firstChildElement("stop-timeout"));
+        if(!sub_element.isNull())
+        {
+            bool ok(false);
+            int const timeout(sub_element.text().toInt(&ok, 10));
+            if(!ok || timeout < 1 || timeout > 3600)
+            {
+                common::fatal_error(QString("the stop-timeout tag of service \"%1\" must be a number of seconds between 1 and 3600.").arg(f_service_name));
+                snap::NOTREACHED();
+            }
+            f_stop_timeout = timeout * common::SECONDS_TO_MICROSECONDS;
+        }
+    }
+    f_terminate_timeout = snap_init_ptr()->get_default_terminate_timeout();
+    {
+        QDomElement const sub_element(e.firstChildElement("terminate-timeout"));
+        if(!sub_element.isNull())
+        {
+            bool ok(false);
+            int const timeout(sub_element.text().toInt(&ok, 10));
+            if(!ok || timeout < 1 || timeout > 600)
+            {
+                common::fatal_error(QString("the terminate-timeout tag of service \"%1\" must be a number of seconds between 1 and 600.").arg(f_service_name));
+                snap::NOTREACHED();
+            }
+            f_terminate_timeout = timeout * common::SECONDS_TO_MICROSECONDS;
+        }
+    }
+
+    // how a restart (RESTART message or new definition) happens
+    //
+    {
+        QDomElement const sub_element(e.firstChildElement("restart"));
+        if(!sub_element.isNull())
+        {
+            QString const restart(sub_element.text().trimmed());
+            if(restart == "overlap")
+            {
+                f_overlap_restart = true;
+            }
+            else if(restart != "stop")
+            {
+                common::fatal_error(QString("the restart tag of service \"%1\" must be \"stop\" or \"overlap\", not \"%2\".")
+                                    .arg(f_service_name)
+                                    .arg(restart));
+                snap::NOTREACHED();
+            }
+        }
+    }
+
+    // the restart backoff policy defaults to the snapinit.conf
+    // parameters, the service may override any of them
+    //
+    {
+        backoff b(snap_init_ptr()->get_default_backoff());
+        QDomElement const sub_element(e.firstChildElement("backoff"));
+        if(!sub_element.isNull())
+        {
+            b.configure(sub_element, f_service_name);
+        }
+        f_process.set_backoff(b);
+    }
+
+    // the cgroup v2 limits of the service process
+    //
+    {
+        QDomElement const sub_element(e.firstChildElement("cgroup"));
+        if(!sub_element.isNull())
+        {
+            f_process.get_cgroup().configure(sub_element, f_service_name);
+        }
+    }
+
+    // how the service tells us that it is ready
+    //
+    {
+        QDomElement const sub_element(e.firstChildElement("readiness"));
+        if(!sub_element.isNull())
+        {
+            QString const readiness(sub_element.text().trimmed());
+            if(readiness == "pipe")
+            {
+                f_process.set_ready_pipe(true);
+            }
+            else if(readiness != "snapcommunicator")
+            {
+                common::fatal_error(QString("the readiness tag of service \"%1\" must be \"snapcommunicator\" or \"pipe\", not \"%2\".")
+                                    .arg(f_service_name)
+                                    .arg(readiness));
+                snap::NOTREACHED();
+            }
+        }
+    }
+
+    // the sockets snapinit binds on behalf of the service
+    //
+    for(QDomElement sub_element(e.firstChildElement("listen"));
+        !sub_element.isNull();
+        sub_element = sub_element.nextSiblingElement("listen"))
+    {
+        listen_socket::pointer_t s(std::make_shared<listen_socket>());
+        s->configure(sub_element, f_base_name);
+        if(f_instance_count > 1)
+        {
+            // each instance binds its own socket to the same port
+            //
+            if(s->is_unix())
+            {
+                common::fatal_error(QString("the <listen> tags of service \"%1\" cannot use Unix sockets since it runs more than one instance.").arg(f_base_name));
+                snap::NOTREACHED();
+            }
+            s->set_reuseport(true);
+        }
+        f_process.add_listen_socket(s);
+    }
+
     // user may specify a safe tag, in that case we have to wait for
     // a SAFE message with the same name as the one specified in this
     // safe tag
@@ -709,40 +892,47 @@ void service::configure(QDomElement e, QString const & binary_path, std::vector<
         QDomElement sub_element(e.firstChildElement("cron"));
         if(!sub_element.isNull())
         {
-            if(sub_element.text() == "off")
-            {
-                f_cron = 0;
-            }
-            else
+            f_cron.parse(sub_element.text(), f_service_name);
+
+            // the jitter shifts all the ticks by a number of seconds
+            // which depends on the server name so the computers of a
+            // cluster do not all run the task at the same time
+            //
+            if(sub_element.hasAttribute("jitter"))
             {
                 bool ok(false);
-                f_cron = sub_element.text().toInt(&ok, 10);
-                if(!ok)
+                int64_t const jitter(sub_element.attribute("jitter").toLongLong(&ok, 10));
+                if(!ok || jitter < 0)
                 {
-                    common::fatal_error(QString("the cron tag of service \"%1\" must be a valid decimal number representing a number of seconds to wait between each execution.")
+                    common::fatal_error(QString("the jitter attribute of the cron tag of service \"%1\" must be a positive number of seconds.")
                                           .arg(f_service_name));
                     snap::NOTREACHED();
                 }
-                // we function like anacron and know when we have to run
-                // (i.e. whether we missed some prior runs) so very large
-                // cron values will work just as expected
-                // (see /var/spool/snapwebsites/*)
-                //
-                // TBD: offer a similar syntax to crontab? frankly we are not
-                //      trying to replace cron and at this time we have just
-                //      one service that runs every 5 min. so here...
-                //
-                if(f_cron < 60
-                || f_cron > 86400 * 367)
-                {
-                    common::fatal_error(QString("the cron tag of service \"%1\" must be a number between 60 (1 minute) and 31708800 (a little over 1 year in seconds).")
-                                  .arg(f_service_name));
-                    snap::NOTREACHED();
-                }
+                f_cron.set_jitter(jitter, snap_init_ptr()->get_server_name() + "/" + f_service_name);
+            }
+
+            if(sub_element.hasAttribute("catch-up"))
+            {
+                f_cron.set_catch_up(sub_element.attribute("catch-up"), f_service_name);
             }
         }
     }
 
+    // a cron task may keep a warm spare between two ticks
+    //
+    {
+        QDomElement const sub_element(e.firstChildElement("zygote"));
+        if(!sub_element.isNull())
+        {
+            if(!is_cron_task())
+            {
+                common::fatal_error(QString("the zygote tag of service \"%1\" can only be used along a cron tag.").arg(f_service_name));
+                snap::NOTREACHED();
+            }
+            f_process.set_zygote(true);
+        }
+    }
+
     // non-priv user to drop to after child has forked
     // (if empty, then we stay at the user level we were at)
     //
@@ -799,11 +989,13 @@ void service::configure(QDomElement e, QString const & binary_path, std::vector<
                                             .arg(f_service_name));
                         snap::NOTREACHED();
                     }
+                    QString const type(n.attribute("type"));
                     f_dep_name_list.push_back(
                             dependency_t(
                                 dep_name,
-                                n.attribute("type") == "weak" ? dependency_t::dependency_type_t::DEPENDENCY_TYPE_WEAK
-                                                              : dependency_t::dependency_type_t::DEPENDENCY_TYPE_STRONG
+                                type == "weak"   ? dependency_t::dependency_type_t::DEPENDENCY_TYPE_WEAK
+                              : type == "socket" ? dependency_t::dependency_type_t::DEPENDENCY_TYPE_SOCKET
+                                                 : dependency_t::dependency_type_t::DEPENDENCY_TYPE_STRONG
                             )
                         );
                 }
@@ -813,10 +1005,28 @@ void service::configure(QDomElement e, QString const & binary_path, std::vector<
         }
     }
 
-    // the XML configuration worked, create a timer too
+    // the cron ticks and the snapcommunicator connection are only
+    // meaningful for a single process
+    //
+    if(f_instance_count > 1
+    && (is_cron_task() || is_snapcommunicator()))
+    {
+        common::fatal_error(QString("service \"%1\" cannot run more than one instance, it is a cron task or the snapcommunicator.").arg(f_base_name));
+        snap::NOTREACHED();
+    }
+
+    // while both processes run, they are registered under the same name
+    // so the new one has to say that it is ready through its pipe
     //
-    set_name(f_service_name + " timer");
+    if(f_overlap_restart
+    && (is_cron_task() || is_snapcommunicator() || !f_process.has_ready_pipe()))
+    {
+        common::fatal_error(QString("service \"%1\" cannot use <restart>overlap</restart>, it is a cron task, the snapcommunicator or it does not use <readiness>pipe</readiness>.").arg(f_service_name));
+        snap::NOTREACHED();
+    }
 
+    // the XML configuration worked, make sure the cron spool is up to date
+    //
     if(is_cron_task())
     {
         compute_next_tick(false);
@@ -865,6 +1075,10 @@ void service::init_prereqs_list()
 
 void service::init_depends_list()
 {
+    // on a reload the list gets rebuilt from scratch
+    //
+    f_depends_list.clear();
+
     snap_init::pointer_t si(snap_init_ptr());
     std::for_each(
             std::begin(f_dep_name_list),
@@ -921,6 +1135,71 @@ service::weak_vector_t const & service::get_depends_list() const
 }
 
 
+/** \brief Retrieve the names of the services we depend on.
+ *
+ * This function returns the names found in the \<dependencies> tag
+ * of this service, whether the dependency is weak or strong. The
+ * snap_init object uses it to build its pre-requirements index.
+ *
+ * \return The list of service names this service depends on.
+ */
+snap::snap_string_list service::get_dependency_names() const
+{
+    snap::snap_string_list names;
+    for(auto const & dependency : f_dep_name_list)
+    {
+        names << dependency.f_service_name;
+    }
+    return names;
+}
+
+
+/** \brief Retrieve the names of the strong dependencies of this service.
+ *
+ * On a reload, snapinit verifies that all the strong dependencies of
+ * the new set of services exist before applying any change since a
+ * missing strong dependency is otherwise a fatal error.
+ *
+ * \return The list of service names this service cannot run without.
+ */
+snap::snap_string_list service::get_strong_dependency_names() const
+{
+    snap::snap_string_list names;
+    for(auto const & dependency : f_dep_name_list)
+    {
+        if(dependency.f_type != dependency_t::dependency_type_t::DEPENDENCY_TYPE_WEAK)
+        {
+            names << dependency.f_service_name;
+        }
+    }
+    return names;
+}
+
+
+/** \brief Save the definition this service was created from.
+ *
+ * The definition is the XML document of the service as a string. When
+ * the configuration gets reloaded, only the services which definition
+ * changed get restarted.
+ *
+ * \param[in] definition  The XML of the service.
+ */
+void service::set_definition(QString const & definition)
+{
+    f_definition = definition;
+}
+
+
+/** \brief Retrieve the definition of this service.
+ *
+ * \return The XML this service was created from, empty for snapinit.
+ */
+QString const & service::get_definition() const
+{
+    return f_definition;
+}
+
+
 /** \brief Pause this service if it is running.
  *
  * If the process of this service is not running, then nothing happens.
@@ -937,7 +1216,37 @@ void service::action_ready()
     {
         throw std::runtime_error("a service cannot go from STOPPING to READY.");
     }
-    f_service_state = service_state_t::SERVICE_STATE_READY;
+    set_service_state(service_state_t::SERVICE_STATE_READY);
+
+    // bind our sockets now so the services depending on them through
+    // a socket dependency can start right away
+    //
+    if(!f_process.open_listen_sockets())
+    {
+        SNAP_LOG_WARNING("some of the sockets of service \"")(f_service_name)("\" could not be bound, it will be tried again when the process starts.");
+    }
+    else if(is_listening())
+    {
+        for(auto const & p : f_prereqs_list)
+        {
+            auto const svc(p.lock());
+            if(svc
+            && svc->f_service_state == service_state_t::SERVICE_STATE_READY
+            && svc->is_socket_dependency(f_service_name))
+            {
+                svc->process_ready();
+            }
+        }
+    }
+
+    // an instance which the load does not require never registers
+    //
+    startup_trace::pointer_t trace(snap_init_ptr()->get_startup_trace());
+    if(trace
+    && !f_scaled_down)
+    {
+        trace->service_ready(f_service_name);
+    }
 
     process_ready();
 
@@ -998,7 +1307,7 @@ void service::action_godown()
         return;
     }
 
-    f_service_state = service_state_t::SERVICE_STATE_GOINGDOWN;
+    set_service_state(service_state_t::SERVICE_STATE_GOINGDOWN);
 
     process_stop();
 }
@@ -1014,86 +1323,523 @@ void service::action_godown()
  */
 void service::action_stop()
 {
+    // a replacement which did not take over yet is unknown to snap_init
+    // so it would not be stopped with the other services
+    //
+    if(f_replacement
+    && !f_replacement->f_replaced.expired())
+    {
+        f_replacement->abort_overlap();
+        f_replacement.reset();
+    }
+
     // only switch to STOP if we are not already in that mode
     //
     if(f_service_state != service_state_t::SERVICE_STATE_STOPPING)
     {
-        f_service_state = service_state_t::SERVICE_STATE_STOPPING;
+        set_service_state(service_state_t::SERVICE_STATE_STOPPING);
 
         process_stop();
     }
 }
 
 
-/** \brief The stopping process was aborted or ended.
+/** \brief Retire this service after a reload of the configuration.
  *
- * Whenever the stopping process ends, it becomes idle again. This
- * happens whenever a process death is detected since the timer
- * associated with that service can now also be stopped.
+ * The service was removed from the configuration or its definition
+ * changed. Contrary to action_stop(), this only stops the process of
+ * this very service: its dependencies and the services depending on
+ * it are left alone. The service remains READY while its process
+ * stops so the usual STOP, SIGTERM, SIGKILL escalation applies.
+ *
+ * A cron task which is currently running is allowed to finish its run.
+ *
+ * Once the process is gone (or immediately if it is not running),
+ * the service gets removed and the \p replacement, if any, takes
+ * over.
+ *
+ * If the \p replacement uses \<restart>overlap\</restart> and our
+ * process is running, the order is reversed: the process of the
+ * replacement gets started first, on the same listening sockets, and
+ * our process is only stopped once the replacement is ready (see
+ * process_replacement_ready()).
+ *
+ * \param[in] replacement  The service with the new definition or a
+ *                         null pointer if the service was removed.
  */
-void service::action_idle()
+void service::action_retire(pointer_t replacement)
 {
-    if(f_stopping_state != stopping_state_t::STOPPING_STATE_IDLE)
+    // a service already going down will be removed anyway
+    //
+    if(f_service_state == service_state_t::SERVICE_STATE_GOINGDOWN
+    || f_service_state == service_state_t::SERVICE_STATE_STOPPING)
     {
-        f_stopping_state = stopping_state_t::STOPPING_STATE_IDLE;
-
-        // stop this timer since we avoided the stopping timeout
-        // by detecting that the process stopped early enough
-        //
-        set_enable(false);
+        return;
     }
-}
-
-
 
-void service::process_ready()
-{
-    // well that process is not stopped so we cannot start it anyway
+    // the replacement of an overlapped restart already runs
     //
-    if(!f_process.is_stopped())
+    if(f_replacement
+    && !f_replacement->f_replaced.expired())
     {
+        SNAP_LOG_WARNING("service \"")
+                        (f_service_name)
+                        ("\" is already being replaced by an overlapped restart, try again once it is done.");
         return;
     }
 
-    // verify that all dependencies are registered
-    // 
-    for( auto const & s : f_depends_list )
+    f_retiring = true;
+    f_replacement = replacement;
+
+    if(f_service_state == service_state_t::SERVICE_STATE_READY
+    && is_running())
     {
-        auto const & svc(s.lock());
-        if(svc
-        && !svc->is_registered())
+        if(replacement
+        && replacement->f_overlap_restart
+        && f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE)
         {
-            // Not quite ready to start... wait next event and check again
+            SNAP_LOG_INFO("overlapped restart of service \"")
+                         (f_service_name)
+                         ("\": starting the new process first.");
+
+            // the new process gets the very same listening sockets,
+            // our process keeps its own copy until it exits
             //
-            SNAP_LOG_TRACE("Dependency service '")
-                          (svc->get_service_name())
-                          ("' has not yet started for dependent service '")
-                          (f_service_name)
-                          ("'. Deferring start.");
+            replacement->f_replaced = shared_from_this();
+            replacement->f_process.adopt_listen_sockets(f_process);
+            snap_init_ptr()->start_replacement(replacement);
             return;
         }
+
+        if((!is_cron_task() || f_process.is_parked())
+        && f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE)
+        {
+            process_stop_initiate();
+        }
+        return;
     }
 
-    // the process can be started now, do so
-    //
-    // Note: if the following call fails, a callback will automatically
-    //       be called so we have nothing to do here to handle error cases
-    //
-    f_process.action_start();
+    process_retired();
 }
 
 
-/** \brief Execute the stop process.
- *
- * This function initiates the stop process. This is a sub-state machine
- * that handles the stopping of a process. It has a few states as
- * defined at the top of the file (i.e. idle, stop, terminate, kill).
- *
- * It gets called by various functions that want to stop the process
- * such as the action_stop() and action_godown() functions.
+/** \brief The shutdown deadline was reached.
  *
- * Further calls after the timers time out are redirected to the
- * process_stop_timeout() function instead which knows how to escalate
+ * snapinit calls this function on all the services still present
+ * once the shutdown_timeout delay is over. A process which is still
+ * waiting on its pre-requirements or which did not yet react to its
+ * STOP message gets a SIGTERM right away. The usual escalation to a
+ * SIGKILL follows after the terminate timeout.
+ */
+void service::action_terminate()
+{
+    if(f_service_state != service_state_t::SERVICE_STATE_STOPPING
+    || f_service_name == "snapinit"
+    || !is_running())
+    {
+        return;
+    }
+
+    if(f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE
+    || f_stopping_state == stopping_state_t::STOPPING_STATE_STOP)
+    {
+        disarm_timer();
+        process_stop_terminate();
+    }
+}
+
+
+/** \brief Start this instance because the load requires it.
+ *
+ * The autoscaler of the service decided that one more instance has
+ * to run. If the service is READY, its process gets started as usual
+ * (i.e. once its dependencies are registered and it gets a start slot.)
+ * A paused instance starts once its pause is over.
+ */
+void service::action_scale_up()
+{
+    if(!f_scaled_down)
+    {
+        return;
+    }
+    f_scaled_down = false;
+
+    if(f_service_state == service_state_t::SERVICE_STATE_READY)
+    {
+        process_ready();
+    }
+    process_status_changed();
+}
+
+
+/** \brief Stop this instance because the load does not require it.
+ *
+ * The process gets stopped like a retiring service (STOP, then SIGTERM,
+ * then SIGKILL) except that the service remains in place, READY to be
+ * scaled up again.
+ */
+void service::action_scale_down()
+{
+    if(f_scaled_down)
+    {
+        return;
+    }
+    f_scaled_down = true;
+
+    if(f_service_state == service_state_t::SERVICE_STATE_READY)
+    {
+        if(is_running())
+        {
+            if(f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE)
+            {
+                process_stop_initiate();
+            }
+        }
+        else
+        {
+            // a restart may be pending
+            //
+            disarm_timer();
+        }
+    }
+    process_status_changed();
+}
+
+
+/** \brief Check whether this service can be passed to a new snapinit.
+ *
+ * A service which is being stopped, retired or replaced, or which
+ * process is still starting, has to be done first. See
+ * snap_init::reexec().
+ *
+ * \return true if the service is READY or PAUSED and its process
+ *         can be passed.
+ */
+bool service::can_hand_off() const
+{
+    return (f_service_state == service_state_t::SERVICE_STATE_READY
+         || f_service_state == service_state_t::SERVICE_STATE_PAUSED)
+        && f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE
+        && !f_retiring
+        && !f_replacement
+        && f_replaced.expired()
+        && f_process.can_hand_off();
+}
+
+
+/** \brief Save the state of this service before snapinit re-executes itself.
+ *
+ * The entry includes the state of the service, its timer, the tick of
+ * a cron task, the scaling of the instances and the state of the
+ * process (see process::save_handoff()).
+ *
+ * A hash of the definition is included so the new snapinit can tell
+ * whether the XML file changed since the process was started.
+ *
+ * \param[in,out] entry  The entry to fill.
+ * \param[in,out] h  The handoff receiving the file descriptors.
+ *
+ * \return false if a file descriptor could not be passed.
+ */
+bool service::save_handoff(snap::snap_communicator_message & entry, handoff & h)
+{
+    entry.add_parameter("service", f_service_name);
+    entry.add_parameter("state", f_service_state == service_state_t::SERVICE_STATE_PAUSED ? "paused" : "ready");
+    entry.add_parameter("pause_count", QString("%1").arg(f_pause_count));
+    entry.add_parameter("definition", QString::fromUtf8(QCryptographicHash::hash(f_definition.toUtf8(), QCryptographicHash::Md5).toHex()));
+
+    int64_t const timer(snap_init_ptr()->get_timer_wheel()->get_date(this));
+    if(timer != 0)
+    {
+        entry.add_parameter("timer", QString("%1").arg(timer));
+    }
+
+    if(is_cron_task())
+    {
+        entry.add_parameter("cron_tick", QString("%1").arg(snap_init_ptr()->get_cron_spool().get_tick(f_service_name)));
+        entry.add_parameter("cron_scheduled", QString("%1").arg(f_cron_scheduled_date));
+        entry.add_parameter("park_spare", f_park_spare ? "true" : "false");
+    }
+
+    if(f_autoscaler)
+    {
+        entry.add_parameter("autoscale_active", f_autoscaler->get_active());
+    }
+
+    return f_process.save_handoff(entry, h);
+}
+
+
+/** \brief Restore the state saved by the previous snapinit binary.
+ *
+ * This replaces action_ready() for the services found in the handoff.
+ * The process is adopted, the timer is armed again and the service
+ * goes to the READY or PAUSED state without starting anything.
+ *
+ * A READY service without a process nor a timer may be waiting on a
+ * dependency, it gets woken up once all the services were restored.
+ *
+ * \param[in] entry  The entry of this service, see save_handoff().
+ */
+void service::rehydrate(snap::snap_communicator_message const & entry)
+{
+    f_pause_count = entry.get_integer_parameter("pause_count");
+
+    if(entry.get_parameter("definition") != QString::fromUtf8(QCryptographicHash::hash(f_definition.toUtf8(), QCryptographicHash::Md5).toHex()))
+    {
+        SNAP_LOG_WARNING("the definition of service \"")
+                        (f_service_name)
+                        ("\" changed since its process was started, send RESTART service=")
+                        (f_service_name)
+                        (" to apply it.");
+    }
+
+    if(f_autoscaler
+    && entry.has_parameter("autoscale_active"))
+    {
+        f_autoscaler->set_active(static_cast<int>(entry.get_integer_parameter("autoscale_active")));
+        f_scaled_down = f_instance >= f_autoscaler->get_active();
+    }
+
+    // configure() moved the tick of a task which was running as if
+    // it had been missed, put it back
+    //
+    if(is_cron_task()
+    && entry.has_parameter("cron_tick"))
+    {
+        int64_t const tick(entry.get_integer_parameter("cron_tick"));
+        cron_spool & spool(snap_init_ptr()->get_cron_spool());
+        if(spool.get_tick(f_service_name) != tick)
+        {
+            spool.set_tick(f_service_name, tick);
+        }
+        f_cron_scheduled_date = entry.get_integer_parameter("cron_scheduled");
+        f_park_spare = entry.get_parameter("park_spare") == "true";
+    }
+
+    f_process.rehydrate(entry);
+
+    if(entry.get_parameter("state") == "paused")
+    {
+        set_service_state(service_state_t::SERVICE_STATE_PAUSED);
+    }
+    else
+    {
+        set_service_state(service_state_t::SERVICE_STATE_READY);
+
+        // the sockets which were not open in the previous snapinit
+        //
+        if(!f_process.open_listen_sockets())
+        {
+            SNAP_LOG_WARNING("some of the sockets of service \"")(f_service_name)("\" could not be bound, it will be tried again when the process starts.");
+        }
+    }
+
+    int64_t const timer(entry.has_parameter("timer") ? entry.get_integer_parameter("timer") : 0);
+    if(timer != 0)
+    {
+        arm_timer(timer);
+    }
+    else if(f_service_state == service_state_t::SERVICE_STATE_READY
+         && f_process.is_stopped())
+    {
+        arm_timer(snap::snap_communicator::get_current_date());
+    }
+}
+
+
+/** \brief The stopping process was aborted or ended.
+ *
+ * Whenever the stopping process ends, it becomes idle again. This
+ * happens whenever a process death is detected since the timer
+ * associated with that service can now also be stopped.
+ */
+void service::action_idle()
+{
+    if(f_stopping_state != stopping_state_t::STOPPING_STATE_IDLE)
+    {
+        f_stopping_state = stopping_state_t::STOPPING_STATE_IDLE;
+
+        // stop this timer since we avoided the stopping timeout
+        // by detecting that the process stopped early enough
+        //
+        disarm_timer();
+    }
+}
+
+
+
+void service::process_ready()
+{
+    // a warm spare gets released on its tick
+    //
+    if(f_process.is_parked())
+    {
+        if(f_service_state == service_state_t::SERVICE_STATE_READY
+        && !f_retiring)
+        {
+            release_spare();
+        }
+        return;
+    }
+
+    // well that process is not stopped so we cannot start it anyway
+    //
+    // a process which is not registered yet may hold its start slot
+    // for too long, snap_init releases it once start_timeout elapsed
+    //
+    if(!f_process.is_stopped())
+    {
+        if(!is_registered())
+        {
+            snap_init_ptr()->start_slot_timeout(shared_from_this());
+        }
+        return;
+    }
+
+    // a retiring service never gets restarted and an instance which
+    // the load does not require waits for the autoscaler
+    //
+    if(f_retiring
+    || f_scaled_down)
+    {
+        return;
+    }
+
+    // verify that all dependencies are registered
+    //
+    // a dependency used only through its sockets does not need to be
+    // registered once its sockets are bound
+    //
+    for( auto const & s : f_depends_list )
+    {
+        auto const & svc(s.lock());
+        if(svc
+        && !svc->is_registered()
+        && !(svc->is_listening() && is_socket_dependency(svc->get_service_name())))
+        {
+            // Not quite ready to start... wait next event and check again
+            //
+            SNAP_LOG_TRACE("Dependency service '")
+                          (svc->get_service_name())
+                          ("' has not yet started for dependent service '")
+                          (f_service_name)
+                          ("'. Deferring start.");
+            return;
+        }
+    }
+
+    // the scheduler may limit the number of services starting in
+    // parallel, if we cannot get a slot, snap_init wakes us up later
+    //
+    if(!is_cron_task()
+    && !snap_init_ptr()->request_start_slot(shared_from_this()))
+    {
+        SNAP_LOG_TRACE("Too many services are starting, deferring start of service '")
+                      (f_service_name)
+                      ("'.");
+        return;
+    }
+
+    // a zygote cron task which just ran starts its next process right
+    // away, it remains parked until the tick
+    //
+    if(f_park_spare)
+    {
+        f_park_spare = false;
+        if(f_cron_scheduled_date > snap::snap_communicator::get_current_date())
+        {
+            f_process.action_start();
+            if(f_process.is_parked())
+            {
+                snap_init_ptr()->service_status_changed(shared_from_this());
+                arm_timer(f_cron_scheduled_date);
+            }
+            return;
+        }
+    }
+
+    // for cron tasks, keep track of how late we start compared to the tick
+    //
+    if(is_cron_task()
+    && f_cron_scheduled_date != 0)
+    {
+        int64_t const now(snap::snap_communicator::get_current_date());
+        if(now >= f_cron_scheduled_date)
+        {
+            f_cron_lag.record(now - f_cron_scheduled_date);
+        }
+        f_cron_scheduled_date = 0;
+    }
+
+    // the process can be started now, do so
+    //
+    // Note: if the following call fails, a callback will automatically
+    //       be called so we have nothing to do here to handle error cases
+    //
+    f_process.action_start();
+
+    // a zygote started on its tick (the first run or after the spare
+    // died) does not need to wait
+    //
+    if(f_process.is_parked())
+    {
+        f_process.action_release();
+    }
+
+    // wake up once start_timeout elapsed in case the process does not
+    // register by then (see snap_init::start_slot_timeout())
+    //
+    int64_t const start_timeout(snap_init_ptr()->get_start_timeout());
+    if(start_timeout > 0
+    && !is_cron_task()
+    && f_process.is_running()
+    && !is_registered())
+    {
+        arm_timer(snap::snap_communicator::get_current_date() + start_timeout);
+    }
+}
+
+
+/** \brief Release the warm spare of a zygote cron task.
+ *
+ * The timer of the service is armed for the tick while the spare is
+ * parked. If we get here earlier (i.e. after a reload) we simply wait
+ * some more.
+ */
+void service::release_spare()
+{
+    int64_t const now(snap::snap_communicator::get_current_date());
+    if(f_cron_scheduled_date > now)
+    {
+        arm_timer(f_cron_scheduled_date);
+        return;
+    }
+
+    if(f_cron_scheduled_date != 0)
+    {
+        f_cron_lag.record(now - f_cron_scheduled_date);
+        f_cron_scheduled_date = 0;
+    }
+
+    if(f_process.action_release())
+    {
+        snap_init_ptr()->service_status_changed(shared_from_this());
+    }
+}
+
+
+/** \brief Execute the stop process.
+ *
+ * This function initiates the stop process. This is a sub-state machine
+ * that handles the stopping of a process. It has a few states as
+ * defined at the top of the file (i.e. idle, stop, terminate, kill).
+ *
+ * It gets called by various functions that want to stop the process
+ * such as the action_stop() and action_godown() functions.
+ *
+ * Further calls after the timers time out are redirected to the
+ * process_stop_timeout() function instead which knows how to escalate
  * the state to the next level.
  */
 void service::process_stop()
@@ -1123,6 +1869,17 @@ void service::process_stop()
             std::back_inserter(running_prereqs),
             is_process_running);
 
+    // the STOP messages of all the other services go through the
+    // snapcommunicator so on a full stop it has to be the last one
+    // to go, whether the other services depend on it or not
+    //
+    if(f_service_state == service_state_t::SERVICE_STATE_STOPPING
+    && is_snapcommunicator()
+    && running_prereqs.empty())
+    {
+        snap_init_ptr()->get_stop_blockers(shared_from_this(), running_prereqs);
+    }
+
     if(!running_prereqs.empty())
     {
         // there are pre-requirements, stop them first, when one dies
@@ -1209,12 +1966,14 @@ void service::process_stop_initiate()
         //
         f_stopping_state = stopping_state_t::STOPPING_STATE_STOP;
 
-        set_enable(true);
-        set_timeout_date(snap::snap_communicator::get_current_date());
+        arm_timer(snap::snap_communicator::get_current_date());
         return;
     }
 
-    if(is_registered())
+    // a process which said it was ready through its readiness pipe
+    // may not yet be known by snapcommunicator
+    //
+    if(f_process.is_registered_with_communicator())
     {
         f_stopping_state = stopping_state_t::STOPPING_STATE_STOP;
 
@@ -1239,8 +1998,7 @@ void service::process_stop_initiate()
 
         // this may not work so we use the timer to know what to do next
         //
-        set_enable(true);
-        set_timeout_date(snap::snap_communicator::get_current_date() + SERVICE_STOP_DELAY);
+        arm_timer(snap::snap_communicator::get_current_date() + f_stop_timeout);
     }
     else
     {
@@ -1311,8 +2069,7 @@ void service::process_stop_terminate()
 
     // this may not work so we use the timer to know what to do next
     //
-    set_enable(true);
-    set_timeout_date(snap::snap_communicator::get_current_date() + SERVICE_TERMINATE_DELAY);
+    arm_timer(snap::snap_communicator::get_current_date() + f_terminate_timeout);
 }
 
 
@@ -1332,8 +2089,7 @@ void service::process_stop_kill()
 
     // this may not work so we use the timer to know what to do next
     //
-    set_enable(true);
-    set_timeout_date(snap::snap_communicator::get_current_date() + SERVICE_TERMINATE_DELAY);
+    arm_timer(snap::snap_communicator::get_current_date() + f_terminate_timeout);
 }
 
 
@@ -1353,7 +2109,7 @@ void service::process_stop_kill()
  * At this point, we do not do anything about the services that depend
  * on this service because the retry will happen very quickly.
  */
-void service::process_died()
+void service::process_died(int64_t retry_delay)
 {
     // this service process is now dead, reflect that in the stopping state
     //
@@ -1374,24 +2130,65 @@ void service::process_died()
         return;
 
     case service_state_t::SERVICE_STATE_READY:
+        // the configuration was reloaded and this service is going away
+        //
+        if(f_retiring)
+        {
+            process_retired();
+            return;
+        }
+
+        // the old process keeps running while the replacement retries
+        //
+        if(!f_replaced.expired())
+        {
+            SNAP_LOG_WARNING("the new process of service \"")
+                            (f_service_name)
+                            ("\" died before it was ready, the old process keeps running.");
+        }
+
+        // the autoscaler stopped this instance, it stays down
+        //
+        if(f_scaled_down)
+        {
+            return;
+        }
+
         // state remains the same, pause for a while and then will
         // restart whenever we get awaken
         //
         if(is_cron_task())
         {
+            // a warm spare which died before its tick did not run, its
+            // tick is still pending and a normal process gets started
+            // on it
+            //
+            if(f_process.died_parked())
+            {
+                arm_timer(compute_next_tick(false));
+                return;
+            }
+
             // this is the normal way the cron process is expected to die
             //
             // setup the next tick and re-enable the timer
             //
-            compute_next_tick(true);
-            set_enable(true);
+            int64_t const next_tick(compute_next_tick(true));
+            if(f_process.is_zygote())
+            {
+                // start the next warm spare from the timer
+                //
+                f_park_spare = true;
+                arm_timer(snap::snap_communicator::get_current_date());
+                return;
+            }
+            arm_timer(next_tick);
             return;
         }
 
         // wait a little bit and try to start the process again
         //
-        set_enable(true);
-        set_timeout_date(snap::snap_communicator::get_current_date() + QUICK_RETRY_INTERVAL);
+        arm_timer(snap::snap_communicator::get_current_date() + retry_delay);
         break;
 
     case service_state_t::SERVICE_STATE_PAUSED:
@@ -1408,50 +2205,94 @@ void service::process_died()
         break;
 
     case service_state_t::SERVICE_STATE_STOPPING:
-        // we were stopped, remove ourselves from the snapinit environment
-        //
-        snap_init_ptr()->remove_service(shared_from_this());
-
-        // check whether other processes can now be stopped; when we
-        // are in this state, all the services are already set to
-        // state STOPPING so we know we can directly call process_stop()
-        //
-        std::for_each(
-                f_depends_list.begin(),
-                f_depends_list.end(),
-                [](auto const & s)
-                {
-                    auto const svc(s.lock());
-                    if(!svc)
-                    {
-                        return;
-                    }
-                    if(svc->f_service_state == service_state_t::SERVICE_STATE_STOPPING)
-                    {
-                        // if still IDLE then we need to give it a kick
-                        //
-                        svc->process_stop();
-                    }
-                    else
-                    {
-                        // not yet marked as stopping, make sure it is now
-                        //
-                        svc->action_stop();
-                    }
-                });
+        process_stopped();
         break;
 
     }
 }
 
 
+/** \brief Ask the process being replaced to exit.
+ *
+ * This is the drain of an overlapped restart: the process gets a
+ * SIGTERM and has the stop timeout, instead of the terminate timeout,
+ * to exit. The usual SIGKILL follows if it does not.
+ */
+void service::process_stop_drain()
+{
+    f_stopping_state = stopping_state_t::STOPPING_STATE_TERMINATE;
+
+    if(!f_process.kill_process(SIGTERM))
+    {
+        process_stop_kill();
+        return;
+    }
+
+    arm_timer(snap::snap_communicator::get_current_date() + f_stop_timeout);
+}
+
+
+/** \brief The process of a STOPPING service is gone.
+ *
+ * The service gets removed from snapinit and the services it depends
+ * on get a kick since they may now be able to stop too. This is what
+ * makes the shutdown go in waves: a service is stopped as soon as all
+ * the services depending on it are gone and all the services of one
+ * wave stop concurrently.
+ *
+ * The snapcommunicator is kicked too since it waits for all the other
+ * services (see process_stop()).
+ */
+void service::process_stopped()
+{
+    pointer_t const me(shared_from_this());
+    std::shared_ptr<snap_init> si(snap_init_ptr());
+
+    si->remove_service(me);
+
+    // check whether other processes can now be stopped; when we
+    // are in this state, all the services are already set to
+    // state STOPPING so we know we can directly call process_stop()
+    //
+    service::weak_vector_t kick(f_depends_list);
+    service::pointer_t const snapcommunicator(si->get_snapcommunicator_service());
+    if(snapcommunicator
+    && snapcommunicator != me)
+    {
+        kick.push_back(snapcommunicator);
+    }
+    std::for_each(
+            kick.begin(),
+            kick.end(),
+            [](auto const & s)
+            {
+                auto const svc(s.lock());
+                if(!svc)
+                {
+                    return;
+                }
+                if(svc->f_service_state == service_state_t::SERVICE_STATE_STOPPING)
+                {
+                    // if still IDLE then we need to give it a kick
+                    //
+                    svc->process_stop();
+                }
+                else
+                {
+                    // not yet marked as stopping, make sure it is now
+                    //
+                    svc->action_stop();
+                }
+            });
+}
+
+
 /** \brief Pause this service for a while.
  *
- * In this case, the process died too quickly (within
- * process::MAX_START_INTERVAL between the start and end)
- * and too many times
- * (i.e. process::MAX_START_COUNT times in a row), so the
- * process is asking us to take a break.
+ * In this case, the process died with an error too many times
+ * in a short period of time (i.e. it exhausted the error budget
+ * of its backoff policy), so the process is asking us to take
+ * a break.
  *
  * The following function react differently depending on the
  * type of service that died too quickly:
@@ -1474,6 +2315,26 @@ void service::process_pause()
     //
     action_idle();
 
+    // a retiring service does not get paused, it is going away
+    //
+    if(f_retiring
+    && f_service_state == service_state_t::SERVICE_STATE_READY)
+    {
+        process_retired();
+        return;
+    }
+
+    // an instance stopped by the autoscaler which died with an error
+    // is not restarted anyway
+    //
+    if(f_scaled_down
+    && f_service_state == service_state_t::SERVICE_STATE_READY)
+    {
+        return;
+    }
+
+    ++f_pause_count;
+
     // if the CRON service always dies with an error (i.e. it crashes before
     // it is done) then we will end up here with that task, only it requires
     // special handling compare to others and it is considered bad enough
@@ -1487,10 +2348,10 @@ void service::process_pause()
         SNAP_LOG_ERROR("service::process_pause() was called with the CRON task (\"")(f_service_name)("\").");
 
         // make sure the system goes on even though the CRON task is
-        // probably in a pitiful state.
+        // probably in a pitiful state (a warm spare which died did
+        // not use its tick.)
         //
-        compute_next_tick(true);
-        set_enable(true);
+        arm_timer(compute_next_tick(!f_process.died_parked()));
         return;
     }
 
@@ -1501,7 +2362,7 @@ void service::process_pause()
     {
         // first remove ourselves
         //
-        f_service_state = service_state_t::SERVICE_STATE_STOPPING;
+        set_service_state(service_state_t::SERVICE_STATE_STOPPING);
         snap_init_ptr()->remove_service(shared_from_this());
 
         // then make sure to terminate snapinit
@@ -1518,7 +2379,7 @@ void service::process_pause()
     {
         // just remove ourselves
         //
-        f_service_state = service_state_t::SERVICE_STATE_STOPPING;
+        set_service_state(service_state_t::SERVICE_STATE_STOPPING);
         snap_init_ptr()->remove_service(shared_from_this());
         return;
     }
@@ -1562,9 +2423,7 @@ void service::process_pause()
         break;
 
     case service_state_t::SERVICE_STATE_STOPPING:
-        // we were stopped, remove ourselves from the snapinit environment
-        //
-        snap_init_ptr()->remove_service(shared_from_this());
+        process_stopped();
         return;
 
     }
@@ -1575,7 +2434,7 @@ void service::process_pause()
     // stop our pre-required services if any and then sleep for a while
     // before trying to restart ourselves
     //
-    f_service_state = service_state_t::SERVICE_STATE_PAUSED;
+    set_service_state(service_state_t::SERVICE_STATE_PAUSED);
 
     // check whether we have pre-required servics still running
     //
@@ -1657,8 +2516,7 @@ void service::process_pause()
  */
 void service::start_pause_timer()
 {
-    set_enable(true);
-    set_timeout_date(snap::snap_communicator::get_current_date() + f_recovery * common::SECONDS_TO_MICROSECONDS);
+    arm_timer(snap::snap_communicator::get_current_date() + f_process.get_backoff().add_jitter(f_recovery * common::SECONDS_TO_MICROSECONDS));
 }
 
 
@@ -1679,50 +2537,136 @@ void service::process_prereqs_down()
             is_process_running));
     if(it != f_prereqs_list.end())
     {
-        // all pre-required services are down, we can now start the
-        // pause timer
-        //
-        start_pause_timer();
+        // all pre-required services are down, we can now start the
+        // pause timer
+        //
+        start_pause_timer();
+        return;
+    }
+
+    // some pre-required services are still running...
+}
+
+
+/** \brief This service process died while in its "Service GoDown" state.
+ *
+ * The process was asked to go down and successfully did so. Now the may
+ * have to wake up the paused process (which initiated this process for
+ * us to go down.)
+ *
+ * The service also changes back to "Ready Service".
+ */
+void service::process_wentdown()
+{
+    std::for_each(
+            f_depends_list.begin(),
+            f_depends_list.end(),
+            [](auto const & s)
+            {
+                // any of our dependencies which are paused need us to
+                // call the process_prereqs_down() to make sure we
+                // start the pause timer if necessary
+                //
+                auto const & svc(s.lock());
+                if(svc
+                && svc->f_service_state == service_state_t::SERVICE_STATE_PAUSED)
+                {
+                    svc->process_prereqs_down();
+                }
+            });
+
+    // Note: we have to call action_ready() here because the state of
+    //       the paused process may have changed in such a way that
+    //       this service can be restarted now (it should not happen
+    //       but this is cleaner, none the less.)
+    //
+    action_ready();
+}
+
+
+/** \brief The process of a retiring service is gone.
+ *
+ * The service is marked DISABLED so any late callback gets ignored,
+ * then snapinit removes it and starts its replacement, if any.
+ */
+void service::process_retired()
+{
+    pointer_t const me(shared_from_this());
+    pointer_t const replacement(f_replacement);
+    f_replacement.reset();
+
+    disarm_timer();
+    set_service_state(service_state_t::SERVICE_STATE_DISABLED);
+
+    // an aborted replacement was never added to snap_init
+    //
+    if(f_overlap_aborted)
+    {
+        return;
+    }
+
+    // our process died before the replacement of an overlapped restart
+    // was ready, it takes over right away
+    //
+    if(replacement)
+    {
+        replacement->f_replaced.reset();
+    }
+
+    snap_init_ptr()->retire_service(me, replacement);
+}
+
+
+/** \brief The replacement of an overlapped restart is ready.
+ *
+ * The new process registered (i.e. wrote to its readiness pipe) so
+ * it takes our place in snap_init and our process gets drained: it
+ * receives a SIGTERM and has the stop timeout to finish its current
+ * work and exit before it gets a SIGKILL.
+ *
+ * A STOP message cannot be used here since it is sent by name and
+ * the new process may already be registered with that name.
+ */
+void service::process_replacement_ready()
+{
+    pointer_t const replacement(f_replacement);
+    f_replacement.reset();
+
+    if(replacement)
+    {
+        snap_init_ptr()->take_over(shared_from_this(), replacement);
+    }
+
+    if(!is_running())
+    {
+        process_retired();
         return;
     }
 
-    // some pre-required services are still running...
+    if(f_stopping_state == stopping_state_t::STOPPING_STATE_IDLE)
+    {
+        process_stop_drain();
+    }
 }
 
 
-/** \brief This service process died while in its "Service GoDown" state.
- *
- * The process was asked to go down and successfully did so. Now the may
- * have to wake up the paused process (which initiated this process for
- * us to go down.)
+/** \brief Drop the replacement of an overlapped restart.
  *
- * The service also changes back to "Ready Service".
+ * snapinit is stopping before the replacement was ready. Since
+ * snap_init does not know about the replacement, its process gets
+ * killed right away instead of going through the usual stop waves.
  */
-void service::process_wentdown()
+void service::abort_overlap()
 {
-    std::for_each(
-            f_depends_list.begin(),
-            f_depends_list.end(),
-            [](auto const & s)
-            {
-                // any of our dependencies which are paused need us to
-                // call the process_prereqs_down() to make sure we
-                // start the pause timer if necessary
-                //
-                auto const & svc(s.lock());
-                if(svc
-                && svc->f_service_state == service_state_t::SERVICE_STATE_PAUSED)
-                {
-                    svc->process_prereqs_down();
-                }
-            });
+    f_replaced.reset();
+    f_retiring = true;
+    f_overlap_aborted = true;
 
-    // Note: we have to call action_ready() here because the state of
-    //       the paused process may have changed in such a way that
-    //       this service can be restarted now (it should not happen
-    //       but this is cleaner, none the less.)
-    //
-    action_ready();
+    disarm_timer();
+    if(is_running())
+    {
+        process_stop_kill();
+    }
 }
 
 
@@ -1744,6 +2688,39 @@ void service::process_wentdown()
  */
 void service::process_status_changed()
 {
+    // the replacement of an overlapped restart does not report its
+    // status until it takes over, the old process is still the service
+    //
+    pointer_t const replaced(f_replaced.lock());
+    if(!replaced)
+    {
+        snap_init_ptr()->service_status_changed(shared_from_this());
+    }
+
+    // once registered (or dead) the process does not count as a
+    // starting process anymore
+    //
+    if(!is_running()
+    || is_registered())
+    {
+        snap_init::pointer_t si(snap_init_ptr());
+        si->release_start_slot(shared_from_this());
+
+        startup_trace::pointer_t trace(si->get_startup_trace());
+        if(trace)
+        {
+            if(is_registered())
+            {
+                trace->process_registered(f_service_name);
+            }
+            else
+            {
+                trace->process_died(f_service_name);
+            }
+            si->check_startup_trace();
+        }
+    }
+
     if(is_registered())
     {
         // Going to registered means we need to give a little kick to
@@ -1774,6 +2751,15 @@ void service::process_status_changed()
 
                     }
                 });
+
+        // the new process of an overlapped restart is ready, now the
+        // old one can go
+        //
+        if(replaced)
+        {
+            f_replaced.reset();
+            replaced->process_replacement_ready();
+        }
     }
 }
 
@@ -1790,11 +2776,145 @@ int service::get_service_index() const
 }
 
 
+/** \brief Save the topological level of this service.
+ *
+ * The level is computed by snap_init::compute_start_levels(). A service
+ * without dependencies is at level 0; other services are one level
+ * above their highest dependency. Services on the same level do not
+ * depend on each other and can be started in parallel.
+ *
+ * \param[in] level  The start level of this service.
+ */
+void service::set_start_level(int level)
+{
+    f_start_level = level;
+}
+
+
+/** \brief Define which instance of its service this object represents.
+ *
+ * This has to be called before configure() which computes the name of
+ * the instance from it.
+ *
+ * \param[in] instance  The index of the instance, 0 for the first one.
+ */
+void service::set_instance(int instance)
+{
+    f_instance = instance;
+}
+
+
+/** \brief Get the index of the instance this object represents.
+ *
+ * \return The index of the instance, 0 for the first one.
+ */
+int service::get_instance() const
+{
+    return f_instance;
+}
+
+
+/** \brief Get the number of instances defined by the \<instances> tag.
+ *
+ * \return The number of instances, 1 when the tag is not used.
+ */
+int service::get_instance_count() const
+{
+    return f_instance_count;
+}
+
+
+/** \brief Get the name of the service without the instance suffix.
+ *
+ * \return The name attribute of the service XML file.
+ */
+QString const & service::get_base_name() const
+{
+    return f_base_name;
+}
+
+
+/** \brief Get the autoscaler of the instances of this service.
+ *
+ * \return The autoscaler or a null pointer without an \<autoscale> tag.
+ */
+autoscaler::pointer_t service::get_autoscaler() const
+{
+    return f_autoscaler;
+}
+
+
+/** \brief Share the autoscaler of the first instance.
+ *
+ * configure() creates an autoscaler for each instance. snap_init
+ * replaces it with the one of the first instance so all the instances
+ * of a service share the same state. This is also used when a single
+ * instance gets restarted, so whether the instance is active comes
+ * from the current state of the autoscaler.
+ *
+ * \param[in] a  The autoscaler of the first instance.
+ */
+void service::set_autoscaler(autoscaler::pointer_t a)
+{
+    f_autoscaler = a;
+    f_scaled_down = f_instance >= a->get_active();
+}
+
+
+/** \brief Check whether the load does not require this instance.
+ *
+ * \return true if the process of this instance is not to be started.
+ */
+bool service::is_scaled_down() const
+{
+    return f_scaled_down;
+}
+
+
+/** \brief Retrieve the topological level of this service.
+ *
+ * \return The start level or -1 if not yet computed.
+ */
+int service::get_start_level() const
+{
+    return f_start_level;
+}
+
+
+/** \brief Wake up a service which is waiting for a start slot.
+ *
+ * snap_init calls this function when a service which was waiting
+ * for a start slot may now get one. We use the service timer so
+ * the process gets started from the communicator loop instead of
+ * from within the status change of another service.
+ */
+void service::wakeup_start()
+{
+    if(f_service_state == service_state_t::SERVICE_STATE_READY)
+    {
+        arm_timer(snap::snap_communicator::get_current_date());
+    }
+}
+
+
+/** \brief Get the longest time this service may take to stop.
+ *
+ * This is the delay given to the process to react to its STOP message
+ * plus the delay given to react to its SIGTERM.
+ *
+ * \return The stop deadline of this service in microseconds.
+ */
+int64_t service::get_stop_timeout() const
+{
+    return f_stop_timeout + f_terminate_timeout;
+}
+
+
 
 /** \brief Process a timeout on a connection.
  *
  * This function should probably be cut into a few sub-functions. It
- * handles all the time out callbacks from snapcommunicator. These
+ * handles all the time out callbacks from the timer wheel. These
  * are used to start and stop services.
  *
  * \li Start process
@@ -1827,11 +2947,8 @@ int service::get_service_index() const
  */
 void service::process_timeout()
 {
-    // always disable the service timer on receipt of a timeout
-    // we will re-enable it as required
+    // the timer wheel already removed our timer, we re-arm it as required
     //
-    set_enable(false);
-
     switch(f_service_state)
     {
     case service_state_t::SERVICE_STATE_DISABLED:
@@ -1839,9 +2956,17 @@ void service::process_timeout()
         break;
 
     case service_state_t::SERVICE_STATE_READY:
-        // try to start the process if not already running
+        // a retiring service may be waiting on its process to stop,
+        // otherwise try to start the process if not already running
         //
-        process_ready();
+        if(f_stopping_state != stopping_state_t::STOPPING_STATE_IDLE)
+        {
+            process_stop_timeout();
+        }
+        else
+        {
+            process_ready();
+        }
         break;
 
     case service_state_t::SERVICE_STATE_PAUSED:
@@ -1867,119 +2992,177 @@ void service::process_timeout()
 
 
 
-bool service::is_dependency_of( QString const & service_name )
-{
-    return f_dep_name_list.end() != std::find_if(
-                                        f_dep_name_list.begin(),
-                                        f_dep_name_list.end(),
-                                        [&service_name](auto const & dependency)
-                                        {
-                                            return dependency.f_service_name == service_name;
-                                        });
-}
-
-
 /** \brief For a CRON task, we have to compute the next tick.
  *
  * CRON tasks run when a specific tick happens. If the process
  * is still running when the tick happens, then the service
  * ignores that tick, which is considered lost.
+ *
+ * \param[in] just_ran  Whether the task just ran.
+ *
+ * \return The date of the next tick in microseconds.
  */
-void service::compute_next_tick(bool just_ran)
+int64_t service::compute_next_tick(bool just_ran)
 {
-    // when the cron task does not start properly, we set a timeout
-    // delay of a few seconds, which needs to be reset
+    // current time
     //
-    set_timeout_delay(-1);
+    int64_t const now(snap::snap_child::get_current_date() / common::SECONDS_TO_MICROSECONDS);
 
-    // compute the tick exactly on 'now' or just before now
+    // retrieve the pending tick from the cron spool, 0 if we never ran
     //
-    // current time
-    int64_t const now(snap::snap_child::get_current_date() / common::SECONDS_TO_MICROSECONDS);
-    // our hard coded start date
-    int64_t const start_date(SNAP_UNIX_TIMESTAMP(2012, 1, 1, 0, 0, 0));
-    // number of seconds from the start
-    int64_t const diff(now - start_date);
-    // number of ticks from the start
-    int64_t const ticks(diff / f_cron);
-    // time using exact ticks
-    int64_t latest_tick(start_date + ticks * f_cron); // latest_tick <= now (rounded down)
-
-    // check whether the spool file exists, if so read it
-    //
-    QString const spool_path(snap_init_ptr()->get_spool_path());
-    QString const spool_filename(QString("%1/%2.txt").arg(spool_path).arg(f_service_name));
-    QFile spool_file(spool_filename);
-    if(!spool_file.open(QIODevice::ReadWrite))
-    {
-        // since we open in R/W it has to succeed, although it could be empty
+    cron_spool & spool(snap_init_ptr()->get_cron_spool());
+    int64_t const last_tick(spool.get_tick(f_service_name));
+    int64_t tick(last_tick);
+    if(last_tick == 0)
+    {
+        // never ran, run that process once as soon as possible
+        // unless we are asked to skip missed ticks
         //
-        SNAP_LOG_ERROR("cron service \"")
-                      (f_service_name)
-                      ("\" could not open its spool file \"")
-                      (spool_filename)
-                      ("\".");
-        return;
+        tick = f_cron.get_catch_up() == cron_schedule::catch_up_t::CATCH_UP_SKIP
+                    ? f_cron.next_after(now)
+                    : now;
     }
-    QByteArray const data(spool_file.readAll());
-    bool update(true);
-    bool ok(false);
-    int64_t last_tick(0);
-    if(!data.isEmpty())
+    else if(!just_ran && last_tick >= now)
     {
-        // the file exists and has a tick defined
-        //
-        QString const last_time(QString::fromUtf8(data.data()));
-        last_tick = last_time.toLongLong(&ok, 10);
+        // last_tick is now or in the future so we can keep it
+        // as is (happen often when starting snapinit)
     }
-    int64_t timestamp(0);
-    if(ok)
+    else
     {
-        if(just_ran && last_tick == latest_tick)
-        {
-            // this one is the case when we have to move forward
-            //
-            //    latest_tick + f_cron > now  (i.e. in the future)
-            //
-            latest_tick += f_cron;
-            timestamp = latest_tick * common::SECONDS_TO_MICROSECONDS;
-        }
-        else if(last_tick >= latest_tick)
+        // when the task just ran, last_tick was used and we move to
+        // the next one; otherwise snapinit was not running when
+        // last_tick happened, which is handled as a missed tick
+        //
+        int64_t const next(just_ran ? f_cron.next_after(last_tick) : last_tick);
+        if(next > now)
         {
-            // last_tick is now or in the future so we can keep it
-            // as is (happen often when starting snapinit)
-            //
-            timestamp = last_tick * common::SECONDS_TO_MICROSECONDS;
-            update = false;
+            tick = next;
         }
         else
         {
-            // this looks like we may have missed a tick or two
-            // so this task already timed out...
+            // we missed one or more ticks
             //
-            timestamp = latest_tick * common::SECONDS_TO_MICROSECONDS;
+            switch(f_cron.get_catch_up())
+            {
+            case cron_schedule::catch_up_t::CATCH_UP_SKIP:
+                tick = f_cron.next_after(now);
+                break;
+
+            case cron_schedule::catch_up_t::CATCH_UP_RUN_ONCE:
+                tick = f_cron.latest_at(next, now);
+                break;
+
+            case cron_schedule::catch_up_t::CATCH_UP_RUN_ALL:
+                tick = next;
+                break;
+
+            }
         }
     }
-    else
+
+    if(tick != last_tick)
     {
-        // never ran, use this latest tick so we run that process
-        // once as soon as possible.
-        //
-        timestamp = latest_tick * common::SECONDS_TO_MICROSECONDS;
+        spool.set_tick(f_service_name, tick);
     }
 
-    if(update)
+    int64_t const timestamp(tick * common::SECONDS_TO_MICROSECONDS);
+    SNAP_LOG_TRACE("service::compute_next_tick(): timestamp = ")(timestamp);
+    f_cron_scheduled_date = timestamp;
+    return timestamp;
+}
+
+
+/** \brief Change the state of this service.
+ *
+ * The time spent in the previous state gets added to its total so
+ * the metrics can show how long each service spends in each state.
+ *
+ * \param[in] state  The new state.
+ */
+void service::set_service_state(service_state_t const state)
+{
+    int64_t const now(snap::snap_communicator::get_current_date());
+    f_state_durations[static_cast<int>(f_service_state)] += now - f_state_date;
+    f_state_date = now;
+    f_service_state = state;
+}
+
+
+/** \brief Get the number of times this service got paused.
+ *
+ * This counts the calls to process_pause() which happen when the
+ * process exhausted its error budget or could not be started at all.
+ *
+ * \return The number of pause events.
+ */
+int64_t service::get_pause_count() const
+{
+    return f_pause_count;
+}
+
+
+/** \brief Get the lag between the cron ticks and the actual starts.
+ *
+ * This is only updated for cron tasks.
+ *
+ * \return The summary of the lags in microseconds.
+ */
+metrics_summary const & service::get_cron_lag() const
+{
+    return f_cron_lag;
+}
+
+
+/** \brief Get the total time this service spent in each state.
+ *
+ * The time spent in the current state so far is included.
+ *
+ * \return A list of state names and durations in microseconds.
+ */
+std::vector<std::pair<QString, int64_t>> service::get_state_durations() const
+{
+    service_state_t const states[] =
     {
-        // reset the file
-        spool_file.seek(0);
-        spool_file.resize(0);
+        service_state_t::SERVICE_STATE_DISABLED,
+        service_state_t::SERVICE_STATE_READY,
+        service_state_t::SERVICE_STATE_PAUSED,
+        service_state_t::SERVICE_STATE_GOINGDOWN,
+        service_state_t::SERVICE_STATE_STOPPING
+    };
 
-        // then write the new tick timestop
-        spool_file.write(QString("%1").arg(latest_tick).toUtf8());
+    int64_t const now(snap::snap_communicator::get_current_date());
+    std::vector<std::pair<QString, int64_t>> result;
+    for(auto const state : states)
+    {
+        int64_t duration(f_state_durations[static_cast<int>(state)]);
+        if(state == f_service_state)
+        {
+            duration += now - f_state_date;
+        }
+        result.push_back(std::make_pair(QString::fromUtf8(state_to_string(state)).mid(14).toLower(), duration));
     }
+    return result;
+}
 
-    SNAP_LOG_TRACE("service::compute_next_tick(): timestamp = ")(timestamp);
-    set_timeout_date(timestamp);
+
+/** \brief Wake this service up at the specified date.
+ *
+ * This replaces the previous timer of this service, if any. When the
+ * date is reached, the timer wheel calls process_timeout().
+ *
+ * \param[in] date  The date in microseconds.
+ */
+void service::arm_timer(int64_t date)
+{
+    snap_init_ptr()->get_timer_wheel()->schedule(shared_from_this(), date);
+}
+
+
+/** \brief Cancel the timer of this service, if any.
+ */
+void service::disarm_timer()
+{
+    snap_init_ptr()->get_timer_wheel()->cancel(this);
 }
 
 
@@ -2076,6 +3259,40 @@ bool service::is_running() const
 
 
 
+/** \brief Get the status of this service as sent to the status listeners.
+ *
+ * \return "paused", "parked" (a warm spare waiting for its tick),
+ *         "up" (registered), "starting" (running but not yet
+ *         registered), "standby" (an instance the load does not
+ *         require) or "down".
+ */
+QString service::get_status() const
+{
+    if(is_paused())
+    {
+        return "paused";
+    }
+    if(f_process.is_parked())
+    {
+        return "parked";
+    }
+    if(f_scaled_down
+    && !is_running())
+    {
+        return "standby";
+    }
+    if(is_registered())
+    {
+        return "up";
+    }
+    if(is_running())
+    {
+        return "starting";
+    }
+    return "down";
+}
+
+
 /** \brief Check whether a link between two services is weak.
  *
  * This function check wether the user defined the dependency
@@ -2109,6 +3326,41 @@ bool service::is_weak_dependency( QString const & service_name )
 }
 
 
+/** \brief Check whether a dependency is only used through its sockets.
+ *
+ * A dependency marked with type="socket" is a strong dependency,
+ * except that this service does not wait for it to be registered
+ * before starting when snapinit already bound the sockets of the
+ * dependency (see the \<listen> tag); the clients get queued in the
+ * socket backlog until the dependency accepts them.
+ *
+ * \param[in] service_name  The name of the dependency to check out.
+ *
+ * \return true if the named dependency is marked as a socket dependency.
+ */
+bool service::is_socket_dependency( QString const & service_name )
+{
+    return f_dep_name_list.end() != std::find_if(
+            f_dep_name_list.begin(),
+            f_dep_name_list.end(),
+            [service_name](auto const & dep)
+            {
+                return dep.f_service_name == service_name
+                    && dep.f_type == dependency_t::dependency_type_t::DEPENDENCY_TYPE_SOCKET;
+            });
+}
+
+
+/** \brief Check whether the sockets of this service are bound.
+ *
+ * \return true if the service has \<listen> sockets and they all are bound.
+ */
+bool service::is_listening() const
+{
+    return f_process.is_listening();
+}
+
+
 
 
 
@@ -2223,7 +3475,7 @@ bool service::is_disabled() const
  */
 bool service::is_cron_task() const
 {
-    return f_cron != 0;
+    return f_cron.is_defined();
 }
 
 
@@ -2231,9 +3483,6 @@ bool service::is_cron_task() const
  *
  * This function returns the name of the server.
  *
- * Note that since we derive from a snap_connection, you also have
- * a get_name() function, which returns the connection name instead.
- *
  * \return The service name as defined in the name attribute of
  *         the \<service> tag found in the snapinit.xml file.
  */
@@ -25,6 +25,9 @@
 
 // ourselves
 //
+#include "autoscaler.h"
+#include "cron_schedule.h"
+#include "metrics.h"
 #include "process.h"
 
 // snapwebsites lib
@@ -43,6 +46,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 // C lib
@@ -63,7 +67,7 @@ class snap_init;
 /////////////////////////////////////////////////
 
 class service
-        : public snap::snap_communicator::snap_timer
+        : public std::enable_shared_from_this<service>
 {
 public:
     typedef std::shared_ptr<service>        pointer_t;
@@ -71,6 +75,8 @@ public:
     typedef std::weak_ptr<service>          weak_pointer_t;
     typedef std::vector<weak_pointer_t>     weak_vector_t;
     typedef std::map<QString, pointer_t>    map_t;
+    typedef std::unordered_map<QString, pointer_t, common::qstring_hash>        hash_t;
+    typedef std::unordered_map<QString, weak_vector_t, common::qstring_hash>    weak_hash_t;
 
     static int64_t const        QUICK_RETRY_INTERVAL = 1000000LL;           // 1 second
     static int64_t const        SERVICE_STOP_DELAY = 120 * 1000000LL;       // 2 minutes
@@ -87,18 +93,20 @@ public:
     void                        configure(QDomElement e, QString const & binary_path, std::vector<QString> & common_options);
     void                        finish_configuration(std::vector<QString> & common_options);
 
-    // snap::snap_communicator::snap_timer implementation
-    virtual void                process_timeout() override;
+    // called by the timer_wheel
+    void                        process_timeout();
 
     bool                        is_disabled() const;
     bool                        is_cron_task() const;
     bool                        is_snapcommunicator() const;
     bool                        is_snapdbproxy() const;
-    bool                        is_dependency_of( QString const & service_name );
     bool                        is_running() const;
     bool                        is_registered() const;
     bool                        is_paused() const;
+    QString                     get_status() const;
     bool                        is_weak_dependency( QString const & service_name );
+    bool                        is_socket_dependency( QString const & service_name );
+    bool                        is_listening() const;
 
     QString const &             get_service_name() const;
     std::string                 get_snapcommunicator_string() const;
@@ -108,21 +116,47 @@ public:
 
     process &                       get_process();
     service::weak_vector_t const &  get_depends_list() const;
+    snap::snap_string_list          get_dependency_names() const;
+    snap::snap_string_list          get_strong_dependency_names() const;
+    void                            set_definition(QString const & definition);
+    QString const &                 get_definition() const;
 
     void                        action_ready();
     void                        action_godown();
     void                        action_stop();
-
-    void                        process_died();
+    void                        action_retire(pointer_t replacement);
+    void                        action_terminate();
+    void                        action_scale_up();
+    void                        action_scale_down();
+    bool                        can_hand_off() const;
+    bool                        save_handoff(snap::snap_communicator_message & entry, handoff & h);
+    void                        rehydrate(snap::snap_communicator_message const & entry);
+
+    void                        process_died(int64_t retry_delay = QUICK_RETRY_INTERVAL);
     void                        process_pause();
     void                        process_status_changed();
 
     void                        set_service_index(int index);
     int                         get_service_index() const;
+    void                        set_start_level(int level);
+    int                         get_start_level() const;
+    void                        set_instance(int instance);
+    int                         get_instance() const;
+    int                         get_instance_count() const;
+    QString const &             get_base_name() const;
+    autoscaler::pointer_t       get_autoscaler() const;
+    void                        set_autoscaler(autoscaler::pointer_t a);
+    bool                        is_scaled_down() const;
+    void                        wakeup_start();
+    int64_t                     get_stop_timeout() const;
+
+    int64_t                     get_pause_count() const;
+    metrics_summary const &     get_cron_lag() const;
+    std::vector<std::pair<QString, int64_t>>
+                                get_state_durations() const;
 
     bool                        operator < (service const & rhs) const;
 
-protected:
     pointer_t                   shared_from_this() const;
 
 private:
@@ -152,7 +186,8 @@ private:
         enum class dependency_type_t
         {
             DEPENDENCY_TYPE_STRONG,         // a strong dependency must exist
-            DEPENDENCY_TYPE_WEAK            // a weak dependency does not need to exist, if not there, ignore it without errors
+            DEPENDENCY_TYPE_WEAK,           // a weak dependency does not need to exist, if not there, ignore it without errors
+            DEPENDENCY_TYPE_SOCKET          // a strong dependency which we only need to be listening, not registered
         };
 
                             dependency_t();
@@ -173,11 +208,20 @@ private:
     void                        process_stop_kill();            // send SIGKILL
     void                        process_wentdown();
     void                        process_prereqs_down();
-
+    void                        process_retired();
+    void                        process_stopped();
+    void                        process_replacement_ready();
+    void                        process_stop_drain();           // send SIGTERM to the process being replaced
+    void                        abort_overlap();
+    void                        release_spare();
+
+    void                        set_service_state(service_state_t const state);
     void                        init_prereqs_list();
     void                        init_depends_list();
+    void                        arm_timer(int64_t date);
+    void                        disarm_timer();
     void                        start_pause_timer();
-    void                        compute_next_tick(bool just_ran);
+    int64_t                     compute_next_tick(bool just_ran);
     std::shared_ptr<snap_init>  snap_init_ptr();
 
     static char const *         state_to_string( service_state_t const state );
@@ -191,21 +235,39 @@ private:
     service_state_t             f_service_state = service_state_t::SERVICE_STATE_DISABLED;
     stopping_state_t            f_stopping_state = stopping_state_t::STOPPING_STATE_IDLE;
 
+    // metrics
+    //
+    int64_t                     f_state_date = 0;                   // date when f_service_state was last changed
+    int64_t                     f_state_durations[5] = {};          // total time spent in each service_state_t, in microseconds
+    int64_t                     f_pause_count = 0;
+    int64_t                     f_cron_scheduled_date = 0;          // date of the next tick as returned by compute_next_tick()
+    metrics_summary             f_cron_lag;                         // actual start date minus scheduled date
+    bool                        f_park_spare = false;               // the next start of a zygote cron task gets parked
+
     // data from XML files (some also goes in the f_process object)
     //
     QString                     f_service_name;
+    QString                     f_base_name;                        // f_service_name without the instance suffix
+    int                         f_instance = 0;
+    int                         f_instance_count = 1;
+    autoscaler::pointer_t       f_autoscaler;                       // shared by all the instances, null without an <autoscale> tag
+    bool                        f_scaled_down = false;              // the load does not require this instance, do not start its process
     bool                        f_disabled = false;
     bool                        f_required = false;
     int                         f_wait_interval = 1;    // in seconds
     int                         f_recovery = 0;         // in seconds
+    int64_t                     f_stop_timeout = SERVICE_STOP_DELAY;            // STOP to SIGTERM, in microseconds
+    int64_t                     f_terminate_timeout = SERVICE_TERMINATE_DELAY;  // SIGTERM to SIGKILL, in microseconds
+    bool                        f_overlap_restart = false;          // start the replacement before stopping the old process
     QString                     f_safe_message;
     int                         f_priority = DEFAULT_PRIORITY;
     QString                     f_snapcommunicator_addr;            // to connect with snapcommunicator
     int                         f_snapcommunicator_port = 4040;     // to connect with snapcommunicator
     QString                     f_snapdbproxy_addr;                 // to connect with snapdbproxy
     int                         f_snapdbproxy_port = 4042;          // to connect with snapdbproxy
-    int                         f_cron = 0;                         // if 0, then off (i.e. not a cron task)
+    cron_schedule               f_cron;                             // if not defined, then off (i.e. not a cron task)
     dependency_t::vector_t      f_dep_name_list;
+    QString                     f_definition;                       // the XML the service was created from, to detect changes on a reload
 
     // computed data
     //
@@ -214,6 +276,14 @@ private:
     service::weak_vector_t      f_depends_list;         // list of dependencies (we need those)
 
     int                         f_service_index = -1;  // used to generate the snapinit.dot file
+    int                         f_start_level = -1;    // topological level in the dependency graph, 0 means no dependencies
+
+    // reload of the configuration
+    //
+    bool                        f_retiring = false;     // the service was removed or changed, do not restart its process
+    pointer_t                   f_replacement;          // the service taking over once our process is gone (may be null)
+    weak_pointer_t              f_replaced;             // the service we replace while our process starts in an overlapped restart
+    bool                        f_overlap_aborted = false;  // we never took over, snap_init does not know about us
 };
 
 
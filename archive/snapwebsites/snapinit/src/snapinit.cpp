@@ -33,6 +33,11 @@
 #include "mkdir_p.h"
 #include "not_used.h"
 
+// Qt lib
+//
+#include <QDateTime>
+#include <QStringList>
+
 // C++ library
 //
 #include <sstream>
@@ -42,7 +47,12 @@
 //
 #include <fcntl.h>
 #include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/wait.h>
 
 
@@ -395,7 +405,7 @@ advgetopt::getopt::option const g_snapinit_options[] =
         advgetopt::getopt::GETOPT_FLAG_SHOW_USAGE_ON_ERROR,
         nullptr,
         nullptr,
-        "Usage: %p [-<opt>] <start|restart|stop>",
+        "Usage: %p [-<opt>] <start|restart|stop|upgrade>",
         advgetopt::getopt::argument_mode_t::help_argument
     },
     {
@@ -478,6 +488,14 @@ advgetopt::getopt::option const g_snapinit_options[] =
         "Only output to the console, not the log file.",
         advgetopt::getopt::argument_mode_t::no_argument
     },
+    {
+        '\0',
+        0,
+        "rehydrate",
+        nullptr,
+        "Internal: file descriptor with the state saved by the previous snapinit binary on a REEXEC.",
+        advgetopt::getopt::argument_mode_t::required_argument
+    },
     {
         '\0',
         advgetopt::getopt::GETOPT_FLAG_ENVIRONMENT_VARIABLE,
@@ -494,6 +512,14 @@ advgetopt::getopt::option const g_snapinit_options[] =
         "test whether snapinit is running; exit with 0 if so, 1 otherwise.",
         advgetopt::getopt::argument_mode_t::no_argument
     },
+    {
+        '\0',
+        advgetopt::getopt::GETOPT_FLAG_ENVIRONMENT_VARIABLE,
+        "trace-startup",
+        nullptr,
+        "Trace the startup of the services and save the trace in <filename>.json (Chrome trace-event format) and <filename>.txt (summary and critical path).",
+        advgetopt::getopt::argument_mode_t::required_argument
+    },
     {
         '\0',
         advgetopt::getopt::GETOPT_FLAG_ENVIRONMENT_VARIABLE,
@@ -545,11 +571,17 @@ snap_init::pointer_t snap_init::f_instance;
 
 snap_init::snap_init( int argc, char * argv[] )
     : f_opt(argc, argv, g_snapinit_options, g_configuration_files, "SNAPINIT_OPTIONS")
+    , f_argv(argv, argv + argc)
     , f_lock_filename( QString("%1/snapinit-lock.pid")
                        .arg(QString::fromUtf8(f_opt.get_string("lockdir").c_str()))
                      )
     , f_lock_file( f_lock_filename )
+    , f_stop_progress_filename( QString("%1/snapinit-stop.log")
+                       .arg(QString::fromUtf8(f_opt.get_string("lockdir").c_str()))
+                     )
     , f_communicator(snap::snap_communicator::instance())
+    , f_timer_wheel(std::make_shared<timer_wheel>())
+    , f_start_date(snap::snap_communicator::get_current_date())
 {
     // commands that return immediately
     //
@@ -751,8 +783,6 @@ snap_init::snap_init( int argc, char * argv[] )
     // do not do too much in the constructor or we may get in
     // trouble (i.e. calling shared_from_this() from the
     // constructor fails)
-
-    init_message_functions();
 }
 
 
@@ -773,241 +803,313 @@ snap_init::~snap_init()
 }
 
 
-/** \brief Initialize the map of functions to handle message.
+/** \brief Send the status of all our services.
+ *
+ * A status listener sends this message when it starts or when it
+ * detects a gap in the sequence numbers of the SERVICESTATUS messages.
+ * The reply is a SERVICESTATUS message with "full" set to "true".
  *
- * This function creates a couple of function maps. One is for the
- * UDP message and the other is for the TCP messages.
+ * \param[in] message  The GETSTATUS message.
+ */
+void snap_init::msg_getstatus(snap::snap_communicator_message const & message)
+{
+    if(f_status_batch)
+    {
+        f_status_batch->send_snapshot(message.get_sent_from_server(), message.get_sent_from_service());
+    }
+}
+
+
+/** \brief Reply to the HELP message.
  *
- * See the process_message() function for their usage.
+ * All the services have to implement the HELP command. The reply is
+ * the list of commands understood by snapinit.
  */
-void snap_init::init_message_functions()
+void snap_init::msg_help(snap::snap_communicator_message const & message)
 {
-    // ******************* TCP and UDP messages
+    snap::NOTUSED(message);
 
-    auto stop_func =
-            [&]( snap::snap_communicator_message const& )
-            {
-                // someone asking us to stop snap_init; this means we want to stop
-                // all the services that snap_init started; if we have a
-                // snapcommunicator, then we use that to send the STOP signal to
-                // all services at once
-                //
-                terminate_services();
-            };
+    snap::snap_communicator_message reply;
+    reply.set_command("COMMANDS");
 
-    // someone sent "snapinit/STOP" to snapcommunicator
-    // or "[whatever/]STOP" directly to snapinit (via UDP)
+    // list of commands understood by snapinit
     //
-    f_udp_message_map = {
-        {
-            "STOP",
-            stop_func
-        }
-    };
+    reply.add_parameter("list", message_command_list());
 
-    // ******************* TCP only messages
-    f_tcp_message_map = {
-        {
-            // all have to implement the HELP command
-            //
-            "HELP",
-            [&]( snap::snap_communicator_message const & )
-            {
-                snap::snap_communicator_message reply;
-                reply.set_command("COMMANDS");
+    f_listener_connection->send_message(reply);
+}
 
-                // list of commands understood by snapinit
-                //
-                reply.add_parameter("list", "HELP,LOG,QUITTING,READY,RELOADCONFIG,SAFE,STATUS,STOP,UNKNOWN");
 
-                f_listener_connection->send_message(reply);
-            }
-        },
+/** \brief An instance of a service reports its load.
+ *
+ * Services with an \<autoscale> tag using the "queue" metric send
+ * this message periodically with the number of items waiting in
+ * their queue. The value is used the next time the services get
+ * sampled (see autoscale_services()).
+ *
+ * \param[in] message  The LOAD message with the "service" and "queue"
+ *                     parameters.
+ */
+void snap_init::msg_load(snap::snap_communicator_message const & message)
+{
+    QString const service_name(message.get_parameter("service"));
+    service::pointer_t const s(get_service(service_name));
+    if(!s
+    || !s->get_autoscaler()
+    || s->get_autoscaler()->get_metric() != autoscaler::metric_t::METRIC_QUEUE)
+    {
+        SNAP_LOG_TRACE("received LOAD for service \"")(service_name)("\" which is not scaled on its queue depth, ignore.");
+        return;
+    }
+
+    bool ok(false);
+    QString const & queue(message.get_parameter("queue"));
+    int64_t const depth(queue.toLongLong(&ok, 10));
+    if(!ok || depth < 0)
+    {
+        SNAP_LOG_ERROR("received LOAD message from \"")(service_name)("\" with an invalid \"queue\" parameter (\"")(queue)("\").");
+        return;
+    }
+
+    s->get_autoscaler()->record_queue(s->get_instance(), depth, snap::snap_communicator::get_current_date());
+}
+
+
+/** \brief Reconfigure the logger.
+ */
+void snap_init::msg_log(snap::snap_communicator_message const & message)
+{
+    snap::NOTUSED(message);
+
+    SNAP_LOG_INFO("Logging reconfiguration.");
+    snap::logging::reconfigure();
+}
+
+
+/** \brief We are registered with snapcommunicator.
+ *
+ * Once snapcommunicator accepted our registration, we send it the list
+ * of local services.
+ */
+void snap_init::msg_ready(snap::snap_communicator_message const & message)
+{
+    snap::NOTUSED(message);
+
+    // mark the snapcommunicator and snapinit services
+    // as registered
+    //
+    // we do not receive the STATUS event for the snapinit
+    // service because it has to register itself before it
+    // can send the COMMNANDS message and therefore
+    // snapcommunicator does not yet know we are interested
+    // by that message.
+    //
+    f_snapcommunicator_service->get_process().action_process_registered();
+    f_snapinit_service->get_process().action_process_registered();
+
+    // send the list of local services to the snapcommunicator
+    //
+    snap::snap_communicator_message reply;
+    reply.set_command("SERVICES");
+
+    QString const & services(get_services_list());
+    SNAP_LOG_TRACE("READY: list to send to server: [")(services)("].");
+    reply.add_parameter("list", services);
+
+    f_listener_connection->send_message(reply);
+}
+
+
+/** \brief Execute the snapinit binary again.
+ *
+ * This message is sent by `snapinit upgrade`, generally after the
+ * snapinit package was upgraded. The services keep running, see
+ * reexec() for details.
+ */
+void snap_init::msg_reexec(snap::snap_communicator_message const & message)
+{
+    snap::NOTUSED(message);
+
+    reexec();
+}
+
+
+/** \brief Reload the configuration of snapinit.
+ *
+ * The services which definition changed get restarted, the others
+ * keep running. See reload_configuration() for details.
+ */
+void snap_init::msg_reloadconfig(snap::snap_communicator_message const & message)
+{
+    snap::NOTUSED(message);
+
+    reload_configuration();
+}
+
+
+/** \brief Restart the process of a service.
+ *
+ * \param[in] message  The RESTART message with the "service" parameter.
+ */
+void snap_init::msg_restart(snap::snap_communicator_message const & message)
+{
+    restart_service(message.get_parameter("service"));
+}
+
+
+/** \brief A service is now safe.
+ *
+ * \param[in] message  The SAFE message with the "pid" and "name" of
+ *                     the service.
+ */
+void snap_init::msg_safe(snap::snap_communicator_message const & message)
+{
+    // we received a "we are safe" message so we can move on and
+    // start the next service(s)
+    //
+    bool ok(false);
+    QString const & pid_string(message.get_parameter("pid"));
+    pid_t const pid(pid_string.toInt(&ok, 10));
+    if(!ok)
+    {
+        // we need to terminate the existing services cleanly
+        // so we do not use common::fatal_error() here
+        //
+        common::fatal_message(QString("received SAFE message with an invalid \"pid\" parameter (\"%1\").")
+                            .arg(pid_string));
+
+        // Simulate a STOP, we cannot continue safely
+        //
+        terminate_services();
+        return;
+    }
+
+    // search for the process by pid
+    //
+    service::pointer_t const s(get_service_by_pid(pid));
+    if(!s)
+    {
+        // process not found
+        //
+        common::fatal_message(QString("received SAFE message with a \"pid\" parameter that does not match any of our services (\"%1\").")
+                            .arg(pid_string));
+
+        // Simulate a STOP, we cannot continue safely
+        //
+        terminate_services();
+        return;
+    }
+
+    // if the safe message is valid, the following call will
+    // make things move forward as expected
+    //
+    s->get_process().action_safe_message(message.get_parameter("name"));
+
+    // // wakeup other services (i.e. when SAFE is required
+    // // the system does not start all the processes timers
+    // // at once--now that we have dependencies we could
+    // // change that though)
+    // //
+    // wakeup_services();
+}
+
+
+/** \brief Send the resource usage of our services.
+ *
+ * \param[in] message  The STATS message, with an optional "service"
+ *                     parameter.
+ */
+void snap_init::msg_stats(snap::snap_communicator_message const & message)
+{
+    // send the resource usage of one or all of our services
+    //
+    QString const service_name(message.get_parameter("service"));
+    for(auto const & s : f_service_list)
+    {
+        if(!s
+        || (!service_name.isEmpty() && s->get_service_name() != service_name))
         {
-            "LOG",
-            [&]( snap::snap_communicator_message const & )
-            {
-                SNAP_LOG_INFO("Logging reconfiguration.");
-                snap::logging::reconfigure();
-            }
-        },
+            continue;
+        }
+        process const & p(s->get_process());
+        resource_usage const & usage(p.get_resource_usage());
+
+        snap::snap_communicator_message reply;
+        reply.set_command("SERVICESTATS");
+        reply.set_server(message.get_sent_from_server());
+        reply.set_service(message.get_sent_from_service());
+        reply.add_parameter("service", s->get_service_name());
+        reply.add_parameter("running", p.is_running() ? "true" : "false");
+        if(p.is_running())
         {
-            "QUITTING",
-            stop_func
-        },
+            reply.add_parameter("pid", QString("%1").arg(p.get_pid()));
+        }
+        reply.add_parameter("total_runs", QString("%1").arg(usage.get_total_runs()));
+        reply.add_parameter("run_fields", resource_usage::run_fields());
+        reply.add_parameter("runs", usage.history_to_string());
+        if(usage.has_sample())
         {
-            "READY",
-            [&]( snap::snap_communicator_message const & )
-            {
-                // mark the snapcommunicator and snapinit services
-                // as registered
-                //
-                // we do not receive the STATUS event for the snapinit
-                // service because it has to register itself before it
-                // can send the COMMNANDS message and therefore
-                // snapcommunicator does not yet know we are interested
-                // by that message.
-                //
-                f_snapcommunicator_service->get_process().action_process_registered();
-                f_snapinit_service->get_process().action_process_registered();
-
-                // send the list of local services to the snapcommunicator
-                //
-                snap::snap_communicator_message reply;
-                reply.set_command("SERVICES");
+            reply.add_parameter("sample_fields", resource_usage::sample_fields());
+            reply.add_parameter("sample", usage.sample_to_string());
+        }
+        f_listener_connection->send_message(reply);
+    }
+}
 
-                // generate the list of services as a string of
-                // comma separated names
-                //
-                snap::snap_string_list service_list_name;
-                auto get_service_name = [&service_list_name]( auto const & svc )
-                {
-                    if(svc)
-                    {
-                        service_list_name << svc->get_service_name();
-                    }
-                };
-                //
-                std::for_each( std::begin(f_service_list), std::end(f_service_list), get_service_name );
-                QString const services(service_list_name.join(","));
-                //
-                SNAP_LOG_TRACE("READY: list to send to server: [")(services)("].");
-                reply.add_parameter("list", services);
 
-                f_listener_connection->send_message(reply);
-            }
-        },
+/** \brief A service registered or unregistered with snapcommunicator.
+ *
+ * \param[in] message  The STATUS message with the "service" and "status"
+ *                     parameters.
+ */
+void snap_init::msg_status(snap::snap_communicator_message const & message)
+{
+    auto const service_parm(message.get_parameter("service"));
+    auto const status_parm(message.get_parameter("status"));
+    //
+    service::pointer_t const s(get_service(service_parm));
+    if(s)
+    {
+        if(status_parm == "up")
         {
-            "RELOADCONFIG",
-            [&]( snap::snap_communicator_message const& )
-            {
-                // we need a full restart in this case (because snapinit
-                // cannot restart itself!)
-                //
-                // also if you are a programmer we cannot do a systemctl
-                // restart so we just skip the feature...
-                //
-                if(getuid() == 0)
-                {
-                    snap::NOTUSED(system("systemctl restart snapinit"));
-                }
-                else
-                {
-                    SNAP_LOG_WARNING("You are not running snapinit as root (because you are running as a programmer?) so the RELOADCONFIG will be ignored.");
-                }
-            }
-        },
+            s->get_process().action_process_registered();
+        }
+        else
         {
-            "SAFE",
-            [&]( snap::snap_communicator_message const & message )
-            {
-                // we received a "we are safe" message so we can move on and
-                // start the next service(s)
-                //
-                bool ok(false);
-                QString const & pid_string(message.get_parameter("pid"));
-                pid_t const pid(pid_string.toInt(&ok, 10));
-                if(!ok)
-                {
-                    // we need to terminate the existing services cleanly
-                    // so we do not use common::fatal_error() here
-                    //
-                    common::fatal_message(QString("received SAFE message with an invalid \"pid\" parameter (\"%1\").")
-                                        .arg(pid_string));
+            s->get_process().action_process_unregistered();
+        }
+        SNAP_LOG_TRACE("received status from server: service=")(service_parm)(", status=")(status_parm);
+    }
+    //else -- many services get started and are not children
+    //        of snapinit (i.e. locks, snap_child, ...)
+}
 
-                    // Simulate a STOP, we cannot continue safely
-                    //
-                    terminate_services();
-                    return;
-                }
 
-                // search for the process by pid
-                //
-                auto const s(std::find_if(
-                        f_service_list.begin(),
-                        f_service_list.end(),
-                        [&pid](auto const & svc)
-                        {
-                            if(svc)
-                            {
-                                return svc->get_process().get_pid() == pid;
-                            }
-                            return false;
-                        }));
-                if(s == f_service_list.end()
-                || !*s)
-                {
-                    // process not found
-                    //
-                    common::fatal_message(QString("received SAFE message with a \"pid\" parameter that does not match any of our services (\"%1\").")
-                                        .arg(pid_string));
+/** \brief snapcommunicator did not understand one of our messages.
+ *
+ * \param[in] message  The UNKNOWN message with the "command" parameter.
+ */
+void snap_init::msg_unknown(snap::snap_communicator_message const & message)
+{
+    SNAP_LOG_ERROR("we sent unknown command \"")(message.get_parameter("command"))("\" and probably did not get the expected result.");
+}
 
-                    // Simulate a STOP, we cannot continue safely
-                    //
-                    terminate_services();
-                    return;
-                }
 
-                // if the safe message is valid, the following call will
-                // make things move forward as expected
-                //
-                (*s)->get_process().action_safe_message(message.get_parameter("name"));
-
-                // // wakeup other services (i.e. when SAFE is required
-                // // the system does not start all the processes timers
-                // // at once--now that we have dependencies we could
-                // // change that though)
-                // //
-                // wakeup_services();
-            }
-        },
-        {
-            "STATUS",
-            [&]( snap::snap_communicator_message const & message )
-            {
-                auto const service_parm(message.get_parameter("service"));
-                auto const status_parm(message.get_parameter("status"));
-                //
-                auto const & iter(std::find_if(
-                        f_service_list.begin(),
-                        f_service_list.end(), 
-                        [service_parm](auto const & svc)
-                        {
-                            if(svc)
-                            {
-                                return svc->get_service_name() == service_parm;
-                            }
-                            return false;
-                        })
-                    );
-                if( iter != std::end(f_service_list) )
-                {
-                    if(status_parm == "up")
-                    {
-                        (*iter)->get_process().action_process_registered();
-                    }
-                    else
-                    {
-                        (*iter)->get_process().action_process_unregistered();
-                    }
-                    SNAP_LOG_TRACE("received status from server: service=")(service_parm)(", status=")(status_parm);
-                }
-                //else -- many services get started and are not children
-                //        of snapinit (i.e. locks, snap_child, ...)
-            }
-        },
-        {
-            "STOP",
-            stop_func
-        },
-        {
-            "UNKNOWN",
-            [&]( snap::snap_communicator_message const & message )
-            {
-                SNAP_LOG_ERROR("we sent unknown command \"")(message.get_parameter("command"))("\" and probably did not get the expected result.");
-            }
-        },
-    };
+/** \brief Someone asked us to stop.
+ *
+ * Someone sent "snapinit/STOP" or "QUITTING" to snapcommunicator, or
+ * "[whatever/]STOP" directly to snapinit (via UDP.) This means we want
+ * to stop all the services that snapinit started; if we have a
+ * snapcommunicator, then we use that to send the STOP signal to all
+ * services at once.
+ *
+ * \param[in] message  The STOP or QUITTING message.
+ */
+void snap_init::msg_stop(snap::snap_communicator_message const & message)
+{
+    snap::NOTUSED(message);
+
+    terminate_services();
 }
 
 
@@ -1030,6 +1132,16 @@ void snap_init::init()
         //
         f_command = command_t::COMMAND_TREE;
     }
+    else if( f_opt.is_defined( "rehydrate" ) )
+    {
+        // the previous snapinit binary executed us on a REEXEC, the
+        // command line still includes its command (start or restart)
+        // but the services are already running
+        //
+        SNAP_LOG_INFO("--------------------------------- snapinit v" SNAPINIT_VERSION_STRING " manager re-executed on ")(f_server_name);
+
+        f_command = command_t::COMMAND_START;
+    }
     else
     {
         SNAP_LOG_INFO("--------------------------------- snapinit v" SNAPINIT_VERSION_STRING " manager started on ")(f_server_name);
@@ -1059,6 +1171,10 @@ void snap_init::init()
             {
                 f_command = command_t::COMMAND_RESTART;
             }
+            else if(command == "upgrade")
+            {
+                f_command = command_t::COMMAND_UPGRADE;
+            }
             else
             {
                 SNAP_LOG_FATAL("Unknown command \"")(command)("\".");
@@ -1081,108 +1197,57 @@ void snap_init::init()
         f_spool_path = f_config["spool_path"];
     }
 
-    // make sure we can load the XML file with the various service
-    // definitions
+    // how the cron ticks get flushed to disk
     //
+    if(f_config.contains("cron_spool_sync"))
     {
-        QString const xml_services_path(f_config.contains("xml_services")
-                                        ? f_config["xml_services"]
-                                        : "/etc/snapwebsites/services.d");
-        if(xml_services_path.isEmpty())
+        QString const cron_spool_sync(f_config["cron_spool_sync"]);
+        if(cron_spool_sync == "none")
         {
-            // the XML services are mandatory (it cannot be set to an empty string)
-            common::fatal_error("the xml_services parameter cannot be empty, it has to be a path to the services XML files.");
-            snap::NOTREACHED();
+            f_cron_spool_sync = cron_spool::sync_t::SYNC_NONE;
         }
-
-        QString const pattern(QString("%1/service-*.xml").arg(xml_services_path));
-        glob_t dir = glob_t();
-        int const r(glob(
-                      pattern.toUtf8().data()
-                    , GLOB_NOESCAPE
-                    , glob_error_callback
-                    , &dir));
-        std::shared_ptr<glob_t> ai(&dir, glob_deleter);
-
-        if(r != 0)
+        else if(cron_spool_sync == "async")
         {
-            // do nothing when errors occur
-            //
-            switch(r)
-            {
-            case GLOB_NOSPACE:
-                common::fatal_error("glob() did not have enough memory to alllocate its buffers.");
-                break;
-
-            case GLOB_ABORTED:
-                common::fatal_error("glob() was aborted after a read error.");
-                break;
-
-            case GLOB_NOMATCH:
-                common::fatal_error("glob() could not find any status information.");
-                break;
-
-            default:
-                common::fatal_error(QString("unknown glob() error code: %1.").arg(r));
-                break;
-
-            }
+            f_cron_spool_sync = cron_spool::sync_t::SYNC_ASYNC;
+        }
+        else if(cron_spool_sync == "sync")
+        {
+            f_cron_spool_sync = cron_spool::sync_t::SYNC_SYNC;
+        }
+        else
+        {
+            common::fatal_error(QString("the cron_spool_sync parameter must be \"none\", \"async\" or \"sync\", \"%1\" is not valid.")
+                                .arg(cron_spool_sync));
             snap::NOTREACHED();
         }
+    }
 
-        std::vector<QString> common_options;
+    // default restart backoff policy (the services can override it)
+    //
+    load_default_backoff();
+    load_stop_timeouts();
 
+    // make sure we can load the XML file with the various service
+    // definitions
+    //
+    {
         // create a service representing ourselves
         //
         f_snapinit_service = std::make_shared<service>(shared_from_this());
         f_snapinit_service->configure_as_snapinit();
-        if(f_debug)
-        {
-            common_options.push_back("--debug");
-        }
-        common_options.push_back("--server-name");
-        common_options.push_back(f_server_name);
-        f_communicator->add_connection( f_snapinit_service );
-        f_service_list.push_back( f_snapinit_service );
+        add_service( f_snapinit_service );
 
         // load each service file
         //
-        for(size_t idx(0); idx < dir.gl_pathc; ++idx)
+        service::vector_t services;
+        snap::NOTUSED(load_services(services, f_common_options, false));
+        for(auto const & s : services)
         {
-            QString const xml_service_filename(QString::fromUtf8(dir.gl_pathv[idx]));
-
-            QFile xml_service_file(xml_service_filename);
-            if(!xml_service_file.open(QIODevice::ReadOnly))
-            {
-                // the XML services is a mandatory file we need to be able to read
-                int const e(errno);
-                common::fatal_error(QString("the XML file \"%1\" could not be opened (%2).")
-                                .arg(xml_service_filename)
-                                .arg(strerror(e)));
-                snap::NOTREACHED();
-            }
-
+            if(s->is_snapcommunicator())
             {
-                QString error_message;
-                int error_line;
-                int error_column;
-                QDomDocument doc;
-                if(!doc.setContent(&xml_service_file, false, &error_message, &error_line, &error_column))
-                {
-                    // the XML is probably not valid, setContent() returned false...
-                    // (it could also be that the file could not be read and we
-                    // got some I/O error.)
-                    //
-                    common::fatal_error(QString("the XML file \"%1\" could not be parse as valid XML (%2:%3: %4; on column: %5).")
-                                .arg(xml_service_filename)
-                                .arg(xml_service_filename)
-                                .arg(error_line)
-                                .arg(error_message)
-                                .arg(error_column));
-                    snap::NOTREACHED();
-                }
-                xml_to_service(doc, xml_service_filename, common_options);
+                f_snapcommunicator_service = s;
             }
+            add_service( s );
         }
 
         // In the end, we MUST have this service specified in the XML file,
@@ -1201,11 +1266,11 @@ void snap_init::init()
         std::for_each(
                 std::begin(f_service_list),
                 std::end(f_service_list),
-                [&common_options](service::pointer_t const svc)
+                [this](service::pointer_t const svc)
                 {
                     if(svc)
                     {
-                        svc->finish_configuration(common_options);
+                        svc->finish_configuration(f_common_options);
                     }
                 });
 
@@ -1237,11 +1302,39 @@ void snap_init::init()
             common::fatal_error(QString("the system cannot run with at least snapcommunicator and snapinit, defined in that order."));
             snap::NOTREACHED();
         }
-    }
 
-    // retrieve the direct listen information for the UDP port
-    // on which we listen as a fallback in case snapcommunicator
-    // is not available
+        compute_start_levels();
+
+        // trace the startup of the services if requested
+        //
+        if(f_command == command_t::COMMAND_START
+        && f_opt.is_defined("trace-startup")
+        && !f_opt.is_defined("rehydrate"))
+        {
+            f_startup_trace = std::make_shared<startup_trace>(QString::fromUtf8(f_opt.get_string("trace-startup").c_str()));
+            for(auto const & svc : f_service_list)
+            {
+                if(svc
+                && !svc->is_cron_task())
+                {
+                    snap::snap_string_list depends;
+                    for(auto const & d : svc->get_depends_list())
+                    {
+                        service::pointer_t const dependency(d.lock());
+                        if(dependency)
+                        {
+                            depends << dependency->get_service_name();
+                        }
+                    }
+                    f_startup_trace->add_service(svc->get_service_name(), svc->get_start_level(), depends);
+                }
+            }
+        }
+    }
+
+    // retrieve the direct listen information for the UDP port
+    // on which we listen as a fallback in case snapcommunicator
+    // is not available
     //
     {
         QString direct_listen;
@@ -1273,13 +1366,130 @@ void snap_init::init()
         }
     }
 
+    if(f_config.contains("max_parallel_starts"))
+    {
+        bool ok(false);
+        int const max_parallel_starts(f_config["max_parallel_starts"].toInt(&ok, 10));
+        if(!ok || max_parallel_starts < 0)
+        {
+            common::fatal_error(QString("the max_parallel_starts parameter must be a positive number or 0, \"%1\" is not valid.")
+                                .arg(f_config["max_parallel_starts"]));
+            snap::NOTREACHED();
+        }
+        f_max_parallel_starts = static_cast<size_t>(max_parallel_starts);
+    }
+
+    if(f_config.contains("start_timeout"))
+    {
+        bool ok(false);
+        int const start_timeout(f_config["start_timeout"].toInt(&ok, 10));
+        if(!ok || start_timeout < 0 || start_timeout > 3600)
+        {
+            common::fatal_error(QString("the start_timeout parameter must be a number of seconds between 0 and 3600, \"%1\" is not valid.")
+                                .arg(f_config["start_timeout"]));
+            snap::NOTREACHED();
+        }
+        f_start_timeout = start_timeout * common::SECONDS_TO_MICROSECONDS;
+    }
+
+    if(f_config.contains("metrics_listen"))
+    {
+        f_metrics_listen = f_config["metrics_listen"];
+    }
+
+    if(f_config.contains("status_batch_window"))
+    {
+        bool ok(false);
+        int const window(f_config["status_batch_window"].toInt(&ok, 10));
+        if(!ok || window < 0)
+        {
+            common::fatal_error(QString("the status_batch_window parameter must be a positive number of milliseconds or 0, \"%1\" is not valid.")
+                                .arg(f_config["status_batch_window"]));
+            snap::NOTREACHED();
+        }
+        f_status_batch_window = window * 1000LL;
+    }
+
+    if(f_config.contains("status_listeners"))
+    {
+        f_status_listeners = snap::snap_string_list(f_config["status_listeners"].split(',', QString::SkipEmptyParts));
+        for(auto & listener : f_status_listeners)
+        {
+            listener = listener.trimmed();
+        }
+    }
+
+    if(f_config.contains("stats_sample_interval"))
+    {
+        bool ok(false);
+        f_stats_sample_interval = f_config["stats_sample_interval"].toInt(&ok, 10);
+        if(!ok || f_stats_sample_interval < 0)
+        {
+            common::fatal_error(QString("the stats_sample_interval parameter must be a positive number of seconds or 0, \"%1\" is not valid.")
+                                .arg(f_config["stats_sample_interval"]));
+            snap::NOTREACHED();
+        }
+    }
+
+    // children are supervised through a pidfd unless the administrator
+    // asked for SIGCHLD or the kernel does not support pidfd_open()
+    //
+    {
+        QString const supervision(f_config.contains("child_supervision")
+                                ? f_config["child_supervision"]
+                                : "pidfd");
+        if(supervision == "pidfd")
+        {
+            int const pidfd(common::pidfd_open(getpid()));
+            if(pidfd == -1)
+            {
+                SNAP_LOG_INFO("pidfd_open() is not available, children will be supervised with SIGCHLD.");
+            }
+            else
+            {
+                close(pidfd);
+                f_pidfd_supervision = true;
+            }
+        }
+        else if(supervision != "sigchld")
+        {
+            common::fatal_error(QString("the child_supervision parameter must be \"pidfd\" or \"sigchld\", \"%1\" is not valid.")
+                                .arg(supervision));
+            snap::NOTREACHED();
+        }
+    }
+
+    // children are started with clone(CLONE_VM | CLONE_VFORK) unless
+    // the administrator asked for the old fork() behavior
+    //
+    if(f_config.contains("spawn_mode"))
+    {
+        QString const spawn_mode(f_config["spawn_mode"]);
+        if(spawn_mode == "fork")
+        {
+            f_vfork_spawn = false;
+        }
+        else if(spawn_mode != "vfork")
+        {
+            common::fatal_error(QString("the spawn_mode parameter must be \"vfork\" or \"fork\", \"%1\" is not valid.")
+                                .arg(spawn_mode));
+            snap::NOTREACHED();
+        }
+    }
+
     if(f_command == command_t::COMMAND_LIST)
     {
         // TODO: add support for --verbose and print much more than just
         //       the service name
         //
+        // the spool is opened read-only, it may not exist yet and
+        // --list may be used by a user who cannot write to it
+        //
+        cron_spool spool;
+        bool const has_spool(spool.open(f_spool_path, true));
+
         std::cout << "List of services, sorted by priority, to start on this server:" << std::endl;
-        auto output_service_name = []( auto const & svc )
+        auto output_service_name = [&spool, has_spool]( auto const & svc )
         {
             if(svc)
             {
@@ -1287,6 +1497,17 @@ void snap_init::init()
                 if(svc->is_cron_task())
                 {
                     std::cout << " [CRON]";
+                    int64_t const tick(has_spool ? spool.get_tick(svc->get_service_name()) : 0);
+                    if(tick == 0)
+                    {
+                        std::cout << " next run: as soon as possible";
+                    }
+                    else
+                    {
+                        std::cout << " next run: "
+                                  << QDateTime::fromTime_t(static_cast<uint>(tick)).toUTC().toString("yyyy-MM-dd HH:mm:ss")
+                                  << " UTC";
+                    }
                 }
                 if(svc->is_disabled())
                 {
@@ -1544,652 +1765,2180 @@ snap_init::pointer_t snap_init::instance()
 }
 
 
-void snap_init::xml_to_service(QDomDocument doc, QString const & xml_services_filename, std::vector<QString> & common_options)
+/** \brief Load the default restart backoff policy from snapinit.conf.
+ *
+ * The services which do not have their own \<backoff> tag use this
+ * policy. On a reload, only the services which get (re)created use
+ * the new defaults.
+ */
+void snap_init::load_default_backoff()
 {
-    // make sure the root element is valid and not disabled
-    //
-    QDomElement e(doc.documentElement());
-    if(e.isNull())      // it should always be an element
+    char const * backoff_parameters[] =
     {
-        return;
-    }
-
-    // if user wants to see a list of services, then we want to show them
-    // all, whether they are disabled or not
-    //
-    // otherwise, just skip (TODO: although if we want to ever support a
-    // runtime reload, this is not a good solution!)
-    //
-    bool const server_mode(f_command != command_t::COMMAND_LIST && f_command != command_t::COMMAND_TREE);
-    if(server_mode
-    && e.attributes().contains("disabled"))
+        "initial_delay",
+        "max_delay",
+        "multiplier",
+        "jitter",
+        "error_budget",
+        "budget_half_life"
+    };
+    for(auto const name : backoff_parameters)
     {
-        return;
+        QString const parameter(QString("restart_%1").arg(name));
+        if(f_config.contains(parameter))
+        {
+            f_default_backoff.set_parameter(name, f_config[parameter], "snapinit.conf");
+        }
     }
+}
 
-    // create the service object and have it parse the XML data
-    //
-    // Note: not found processes generate a warning instead of an error
-    //       when the command is not --list, --tree, or --stop
-    //
-    service::pointer_t s(std::make_shared<service>(shared_from_this()));
-    QString const binary_path( QString::fromUtf8(f_opt.get_string("binary-path").c_str()) );
-    s->configure(
-            e,
-            binary_path,
-            common_options
-        );
 
-    // a missing binary file is equivalent to having the service disabled
-    // and thus we want to return early and not add the file if it cannot
-    // anyway be started as a service
-    //
-    if(s->is_disabled()
-    && server_mode)
+/** \brief Load the stop timeouts from snapinit.conf.
+ *
+ * The stop_timeout and terminate_timeout parameters are the defaults
+ * of the services which do not have their own \<stop-timeout> and
+ * \<terminate-timeout> tags. The shutdown_timeout parameter limits
+ * the duration of a full stop of snapinit.
+ */
+void snap_init::load_stop_timeouts()
+{
+    auto seconds = [this](char const * name, int min, int max) -> int
+        {
+            bool ok(false);
+            int const value(f_config[name].toInt(&ok, 10));
+            if(!ok || value < min || value > max)
+            {
+                common::fatal_error(QString("the %1 parameter must be a number of seconds between %2 and %3, \"%4\" is not valid.")
+                                    .arg(name)
+                                    .arg(min)
+                                    .arg(max)
+                                    .arg(f_config[name]));
+                snap::NOTREACHED();
+            }
+            return value;
+        };
+
+    if(f_config.contains("stop_timeout"))
     {
-        return;
+        f_default_stop_timeout = seconds("stop_timeout", 1, 3600) * common::SECONDS_TO_MICROSECONDS;
     }
-
-    // avoid two services with the exact same name, we do not support such
-    //
-    QString const new_service_name(s->get_service_name());
-    if(f_service_list.end() != std::find_if(
-            f_service_list.begin(),
-            f_service_list.end(),
-            [new_service_name](auto const & svc)
-            {
-                if(svc)
-                {
-                    return svc->get_service_name() == new_service_name;
-                }
-                return false;
-            }))
+    if(f_config.contains("terminate_timeout"))
     {
-        common::fatal_error(QString("snapinit cannot start the same service more than once on \"%1\". It found \"%2\" twice in \"%3\".")
-                      .arg(f_server_name)
-                      .arg(s->get_service_name())
-                      .arg(xml_services_filename));
-        snap::NOTREACHED();
+        f_default_terminate_timeout = seconds("terminate_timeout", 1, 600) * common::SECONDS_TO_MICROSECONDS;
     }
-
-    if(s->is_snapcommunicator())
+    if(f_config.contains("shutdown_timeout"))
     {
-        // we currently only support one snapcommunicator connection
-        // mechanism, snapinit does not know anything about connecting
-        // with any other service; so if we find more than one connection
-        // service, we fail early
-        //
-        if(f_snapcommunicator_service)
-        {
-            common::fatal_error(QString("snapinit only supports one connection service at this time on \"%1\". It found two: \"%2\" and \"%3\" in \"%4\".")
-                          .arg(f_server_name)
-                          .arg(s->get_service_name())
-                          .arg(f_snapcommunicator_service->get_service_name())
-                          .arg(xml_services_filename));
-            snap::NOTREACHED();
-        }
-        //
-        f_snapcommunicator_service = s;
+        f_shutdown_timeout = seconds("shutdown_timeout", 0, 3600);
     }
-
-    // make sure to add all services as timer connections
-    // to the communicator so we can wake a service on its
-    // own (especially to support the <recovery> feature.)
-    //
-    f_communicator->add_connection( s );
-
-    f_service_list.push_back( s );
 }
 
 
-/** \brief Start a process depending on the command line command.
+/** \brief Load the service definitions from the XML files.
  *
- * This function is called once the snap_init object was initialized.
- * The function calls the corresponding function.
+ * This function reads all the service-*.xml files found in the
+ * xml_services directory and creates one service object per enabled
+ * service. The services are not added to snapinit; the caller decides
+ * what to do with them.
  *
- * At this time only three commands are supported:
+ * On startup (\p reload is false) any error is fatal. On a reload,
+ * errors which can be detected before a service gets configured are
+ * logged and the function returns false so the running services are
+ * left untouched.
  *
- * \li start
- * \li stop
- * \li restart
+ * \param[out] services  The list of services defined in the XML files.
+ * \param[out] common_options  The options to pass to all the services.
+ * \param[in] reload  Whether this is a reload of the configuration.
  *
- * The restart first calls stop() if snapinit is still running.
- * Then it calls start().
+ * \return true if all the definitions were loaded.
  */
-void snap_init::run_processes()
+bool snap_init::load_services(service::vector_t & services, std::vector<QString> & common_options, bool reload)
 {
-    if( f_command == command_t::COMMAND_START )
+    auto failed = [reload](QString const & error_message)
+        {
+            if(!reload)
+            {
+                common::fatal_error(error_message);
+                snap::NOTREACHED();
+            }
+            SNAP_LOG_ERROR(error_message)(" The configuration was not reloaded.");
+            return false;
+        };
+
+    services.clear();
+    common_options.clear();
+    if(f_debug)
     {
-        start();
+        common_options.push_back("--debug");
     }
-    else if( f_command == command_t::COMMAND_STOP )
+    common_options.push_back("--server-name");
+    common_options.push_back(f_server_name);
+
+    QString const xml_services_path(f_config.contains("xml_services")
+                                    ? f_config["xml_services"]
+                                    : "/etc/snapwebsites/services.d");
+    if(xml_services_path.isEmpty())
     {
-        stop();
+        // the XML services are mandatory (it cannot be set to an empty string)
+        return failed("the xml_services parameter cannot be empty, it has to be a path to the services XML files.");
     }
-    else if( f_command == command_t::COMMAND_RESTART )
+
+    QString const pattern(QString("%1/service-*.xml").arg(xml_services_path));
+    glob_t dir = glob_t();
+    int const r(glob(
+                  pattern.toUtf8().data()
+                , GLOB_NOESCAPE
+                , glob_error_callback
+                , &dir));
+    std::shared_ptr<glob_t> ai(&dir, glob_deleter);
+
+    if(r != 0)
     {
-        restart();
+        // do nothing when errors occur
+        //
+        switch(r)
+        {
+        case GLOB_NOSPACE:
+            return failed("glob() did not have enough memory to alllocate its buffers.");
+
+        case GLOB_ABORTED:
+            return failed("glob() was aborted after a read error.");
+
+        case GLOB_NOMATCH:
+            return failed("glob() could not find any status information.");
+
+        default:
+            return failed(QString("unknown glob() error code: %1.").arg(r));
+
+        }
     }
-    else
+
+    service::hash_t service_by_name;
+    service::pointer_t snapcommunicator_service;
+    for(size_t idx(0); idx < dir.gl_pathc; ++idx)
     {
-        SNAP_LOG_ERROR("Command '")(f_opt.get_string("--"))("' not recognized!");
-        usage();
-        snap::NOTREACHED();
+        QString const xml_service_filename(QString::fromUtf8(dir.gl_pathv[idx]));
+
+        QFile xml_service_file(xml_service_filename);
+        if(!xml_service_file.open(QIODevice::ReadOnly))
+        {
+            // the XML services is a mandatory file we need to be able to read
+            int const e(errno);
+            return failed(QString("the XML file \"%1\" could not be opened (%2).")
+                            .arg(xml_service_filename)
+                            .arg(strerror(e)));
+        }
+
+        QString error_message;
+        int error_line;
+        int error_column;
+        QDomDocument doc;
+        if(!doc.setContent(&xml_service_file, false, &error_message, &error_line, &error_column))
+        {
+            // the XML is probably not valid, setContent() returned false...
+            // (it could also be that the file could not be read and we
+            // got some I/O error.)
+            //
+            return failed(QString("the XML file \"%1\" could not be parse as valid XML (%2:%3: %4; on column: %5).")
+                            .arg(xml_service_filename)
+                            .arg(xml_service_filename)
+                            .arg(error_line)
+                            .arg(error_message)
+                            .arg(error_column));
+        }
+
+        for(auto const & s : xml_to_service(doc, xml_service_filename, common_options))
+        {
+            // avoid two services with the exact same name, we do not support such
+            //
+            if(!service_by_name.insert(std::make_pair(s->get_service_name(), s)).second)
+            {
+                return failed(QString("snapinit cannot start the same service more than once on \"%1\". It found \"%2\" twice in \"%3\".")
+                              .arg(f_server_name)
+                              .arg(s->get_service_name())
+                              .arg(xml_service_filename));
+            }
+
+            if(s->is_snapcommunicator())
+            {
+                // we currently only support one snapcommunicator connection
+                // mechanism, snapinit does not know anything about connecting
+                // with any other service; so if we find more than one connection
+                // service, we fail early
+                //
+                if(snapcommunicator_service)
+                {
+                    return failed(QString("snapinit only supports one connection service at this time on \"%1\". It found two: \"%2\" and \"%3\" in \"%4\".")
+                                  .arg(f_server_name)
+                                  .arg(s->get_service_name())
+                                  .arg(snapcommunicator_service->get_service_name())
+                                  .arg(xml_service_filename));
+                }
+                snapcommunicator_service = s;
+            }
+
+            services.push_back(s);
+        }
     }
+
+    return true;
 }
 
 
-/** \brief Process a message.
+/** \brief Create the services defined by an XML definition.
  *
- * Once started, snapinit accepts messages on a UDP port. This is offered so
- * one can avoid starting snapcommunicator. Only the STOP command should be
- * sent through the UDP port.
+ * The service parses the XML data and remembers it as its definition
+ * so a reload can detect whether it changed.
  *
- * When snapcommunicator is a service that snapinit is expected to start
- * (it should be in almost all cases), then this function is also called
- * as soon as the snapcommunicator system is in place.
+ * When the definition includes an \<instances> tag, one service gets
+ * created per instance. They all share the same definition.
  *
- * \param[in] message  The message to be handled.
- * \param[in] udp  Whether the message was received via the UDP listener.
+ * \param[in] doc  The XML document defining the service.
+ * \param[in] xml_services_filename  The name of the file \p doc was read from.
+ * \param[in,out] common_options  The options to pass to all the services.
+ *
+ * \return The new services, empty if the service is disabled.
  */
-void snap_init::process_message(snap::snap_communicator_message const & message, bool udp)
+service::vector_t snap_init::xml_to_service(QDomDocument doc, QString const & xml_services_filename, std::vector<QString> & common_options)
 {
-    SNAP_LOG_TRACE("received message [")(message.to_message())("]");
+    snap::NOTUSED(xml_services_filename);
 
-    QString const command(message.get_command());
+    // make sure the root element is valid and not disabled
+    //
+    QDomElement e(doc.documentElement());
+    if(e.isNull())      // it should always be an element
+    {
+        return service::vector_t();
+    }
 
-    // UDP messages that we accept are very limited...
-    // (especially since we cannot send a reply)
+    // if user wants to see a list of services, then we want to show them
+    // all, whether they are disabled or not
     //
-    if( udp )
+    // otherwise, just skip (on a reload, a service which becomes disabled
+    // is viewed as removed and gets stopped)
+    //
+    bool const server_mode(f_command != command_t::COMMAND_LIST && f_command != command_t::COMMAND_TREE);
+    if(server_mode
+    && e.attributes().contains("disabled"))
+    {
+        return service::vector_t();
+    }
+
+    // create the service object and have it parse the XML data, the
+    // first instance tells us how many instances there are
+    //
+    // Note: not found processes generate a warning instead of an error
+    //       when the command is not --list, --tree, or --stop
+    //
+    service::vector_t services;
+    QString const binary_path( QString::fromUtf8(f_opt.get_string("binary-path").c_str()) );
+    QString const definition(doc.toString());
+    int instance_count(1);
+    for(int instance(0); instance < instance_count; ++instance)
     {
-        auto const & udp_command( f_udp_message_map.find(command) );
-        if( udp_command == f_udp_message_map.end() )
+        service::pointer_t s(std::make_shared<service>(shared_from_this()));
+        s->set_instance(instance);
+        s->configure(
+                e,
+                binary_path,
+                common_options
+            );
+        s->set_definition(definition);
+
+        // a missing binary file is equivalent to having the service disabled
+        // and thus we want to return early and not add the file if it cannot
+        // anyway be started as a service
+        //
+        if(s->is_disabled()
+        && server_mode)
         {
-            SNAP_LOG_ERROR("command \"")(command)("\" is not supported on the UDP connection.");
-            return;
+            return service::vector_t();
         }
 
-        // Execute the command and exit
+        // all the instances share the autoscaler of the first one
         //
-        (udp_command->second)(message);
-        return;
-    }
+        if(instance > 0
+        && s->get_autoscaler())
+        {
+            s->set_autoscaler(services[0]->get_autoscaler());
+        }
 
-    auto const & tcp_command( f_tcp_message_map.find(command) );
-    if( tcp_command == f_tcp_message_map.end() )
-    {
-        // unknown command is reported and process goes on
-        //
-        SNAP_LOG_ERROR("unsupported command \"")(command)("\" was received on the TCP connection.");
-        snap::snap_communicator_message reply;
-        reply.set_command("UNKNOWN");
-        reply.add_parameter("command", command);
-        f_listener_connection->send_message(reply);
-        return;
+        instance_count = s->get_instance_count();
+        services.push_back(s);
     }
 
-    // Execute the command
-    //
-    (tcp_command->second)(message);
+    return services;
 }
 
 
-/** \brief This callback gets called on a SIGCHLD signal.
+/** \brief Add a service to the list of services managed by snapinit.
  *
- * Whenever a child dies, we receive a SIGCHLD. The snapcommunicator
- * library knows how to handle those signals and ends up calling this
- * function when one happens. Only, at this point the snapcommunicator
- * does not tell us which child died. So we quickly look through our
- * list (in comparison to having a timer and poll the list once a
- * second, this is still way faster since 99.9% of the time our
- * processes do not just die!)
+ * This function adds the service to the communicator, to the main
+ * list of services (the one we sort by priority) and to the indexes
+ * we use to quickly find a service by name and the services that
+ * depend on a given service.
  *
- * In most cases, this process will restart the service. Only if the
- * service was restarted many times in a very short period of time
- * it may actually be removed from the list instead or put to sleep
- * for a while ("put to sleep" means not restarted at all...)
+ * The QString used as the key is the service own name so the
+ * index shares the string data with the service.
  *
- * \warning
- * This function will call itself if it detects that a process dies
- * and it has to terminate snapinit itself.
+ * \param[in] s  The service to add.
  */
-void snap_init::service_died()
+void snap_init::add_service(service::pointer_t s)
 {
-    SNAP_LOG_TRACE("snap_init::service_died()");
+    f_service_list.push_back( s );
+    f_services_list.clear();
 
-    // this loop takes care of all the children that just sent us a SIGCHLD
+    f_service_by_name[s->get_service_name()] = s;
+
+    // reverse index of the dependencies, the names may reference
+    // services that are not yet loaded or disabled, get_prereqs_list()
+    // ignores those
     //
-    // IMPORTANT NOTE: although the pid is a process resource and we
-    //                 could think that it would be better/cleaner
-    //                 to call a 'did_process_died()' function, it
-    //                 would then mean we have to check ALL processes;
-    //                 so with 12 or so daemons, you'd call waitpid()
-    //                 12 times; this current loop calls waitpid()
-    //                 once per dead process + 1 only (so most often
-    //                 2 times); it can also become difficult to
-    //                 interpret the return type of a function such
-    //                 as 'did_process_died()' as it is likely to
-    //                 change over time to incorporate more things
-    //                 that have nothing to do with SIGCHLD...
+    // a dependency may be listed more than once, the service is only
+    // added once to the list of each name
     //
-    for(;;)
+    snap::snap_string_list const dependencies(s->get_dependency_names());
+    for(auto const & name : dependencies)
     {
-        int status;
-        pid_t const died_pid(waitpid(-1, &status, WNOHANG));
-        if(died_pid == 0)
+        service::weak_vector_t & prereqs(f_prereqs_by_name[name]);
+        if(prereqs.end() == std::find_if(
+                            prereqs.begin(),
+                            prereqs.end(),
+                            [&s](auto const & w)
+                            {
+                                return w.lock() == s;
+                            }))
         {
-            // all children that died were checked, we are done
-            //
-            break;
+            prereqs.push_back(s);
         }
+    }
+}
 
-        // waitpid() returned an error
-        //
-        if( died_pid == -1 )
-        {
-            // when using waitpid(-1, ...) we get here and not in the
-            // case where waitpid() returns zero!
-            //
-            if(errno == ECHILD)
-            {
-                break;
-            }
-
-            // we probably do not want to continue on errors
-            // we may even need to call fatal_error() instead
-            //
-            int const e(errno);
-            SNAP_LOG_ERROR("waitpid() returned an error (")(strerror(e))(").");
 
-            // should we continue to waitpid()? I'm not too sure what that
-            // would give us outside of an infinite loop
-            //
-            break;
+/** \brief Rebuild the dependency links between the services.
+ *
+ * After services were added, removed or replaced by a reload of the
+ * configuration, the pre-requirements and dependencies of all the
+ * services are computed again, the list is sorted by priority again
+ * and the start levels are recomputed.
+ */
+void snap_init::relink_services()
+{
+    for(auto const & svc : f_service_list)
+    {
+        if(svc)
+        {
+            svc->set_start_level(-1);
+            svc->finish_configuration(f_common_options);
         }
+    }
 
-        // we found a child, search for it
-        //
-        auto const dead_service_iter(std::find_if(
-                f_service_list.begin(),
-                f_service_list.end(),
-                [died_pid](auto const svc)
+    // removed services leave null pointers behind, keep them at the end
+    //
+    std::stable_sort(
+            std::begin(f_service_list),
+            std::end(f_service_list),
+            [](service::pointer_t const a, service::pointer_t const b)
+            {
+                if(!a)
                 {
-                    if(svc)
-                    {
-                        return svc->get_process().get_pid() == died_pid;
-                    }
                     return false;
-                }));
-        bool const found(dead_service_iter != f_service_list.end()
-                      && *dead_service_iter);
+                }
+                if(!b)
+                {
+                    return true;
+                }
+                return *a < *b;
+            });
 
-        QString service_name(found ? (*dead_service_iter)->get_service_name() : "unknown_service");
-        if(!found)
-        {
-            SNAP_LOG_FATAL("waitpid() returned unknown PID ")(died_pid);
-        }
+    compute_start_levels();
+    f_services_list.clear();
+}
 
-        termination_t termination(termination_t::TERMINATION_ABORT);
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wold-style-cast"
-        if(WIFEXITED(status))
-        {
-            int const exit_code(WEXITSTATUS(status));
+/** \brief Reload the configuration without restarting snapinit.
+ *
+ * This function reads snapinit.conf and the XML files of the services
+ * again and compares the new set of services with the running one:
+ *
+ * \li a new service gets added and started;
+ * \li a removed (or now disabled) service gets its process stopped and
+ *     is then removed;
+ * \li a service which definition changed gets its process stopped and
+ *     is then replaced by a service using the new definition.
+ *
+ * The other services, including the ones depending on a service being
+ * restarted, are not touched.
+ *
+ * The snapcommunicator and snapinit services cannot be changed this way,
+ * a change to the snapcommunicator definition is ignored with a warning
+ * saying that snapinit needs to be restarted.
+ *
+ * Only the xml_services path and the restart_... parameters of
+ * snapinit.conf are taken in account by a reload.
+ */
+void snap_init::reload_configuration()
+{
+    if(f_snapinit_state != snapinit_state_t::SNAPINIT_STATE_READY)
+    {
+        SNAP_LOG_WARNING("snapinit is stopping, the RELOADCONFIG message is ignored.");
+        return;
+    }
 
-            if( exit_code == 0 )
-            {
-                // when this happens there is not really anything to tell about
-                SNAP_LOG_DEBUG("Service \"")(service_name)("\" terminated normally.");
-                termination = termination_t::TERMINATION_NORMAL;
-            }
-            else
+    SNAP_LOG_INFO("reloading the snapinit configuration.");
+
+    f_config.read_config_file( f_opt.get_string("config").c_str() );
+    load_default_backoff();
+    load_stop_timeouts();
+
+    service::vector_t services;
+    std::vector<QString> common_options;
+    if(!load_services(services, common_options, true))
+    {
+        return;
+    }
+
+    // index the new set of services and verify it before changing anything
+    //
+    service::hash_t new_service_by_name;
+    service::pointer_t new_snapcommunicator_service;
+    for(auto const & s : services)
+    {
+        new_service_by_name[s->get_service_name()] = s;
+        if(s->is_snapcommunicator())
+        {
+            new_snapcommunicator_service = s;
+        }
+    }
+    if(!new_snapcommunicator_service
+    || new_snapcommunicator_service->get_service_name() != f_snapcommunicator_service->get_service_name())
+    {
+        SNAP_LOG_ERROR("the connection service cannot be removed or renamed with a RELOADCONFIG. The configuration was not reloaded.");
+        return;
+    }
+    for(auto const & s : services)
+    {
+        snap::snap_string_list const dependencies(s->get_strong_dependency_names());
+        for(auto const & name : dependencies)
+        {
+            if(name != f_snapinit_service->get_service_name()
+            && new_service_by_name.find(name) == new_service_by_name.end())
             {
-                SNAP_LOG_INFO("Service \"")(service_name)("\" terminated normally, but with exit code ")(exit_code);
-                termination = termination_t::TERMINATION_ERROR;
+                SNAP_LOG_ERROR("strong dependency service \"")(name)("\" of service \"")(s->get_service_name())("\" not found. The configuration was not reloaded.");
+                return;
             }
         }
-        else if(WIFSIGNALED(status))
-        {
-            int const signal_code(WTERMSIG(status));
-            bool const has_code_dump(!!WCOREDUMP(status));
+    }
+    if(new_snapcommunicator_service->get_definition() != f_snapcommunicator_service->get_definition())
+    {
+        SNAP_LOG_WARNING("the definition of the \"")
+                        (f_snapcommunicator_service->get_service_name())
+                        ("\" service changed; snapinit needs to be restarted for that change to be applied.");
+    }
 
-            SNAP_LOG_ERROR("Service \"")
-                          (service_name)
-                          ("\" terminated because of OS signal \"")
-                          (strsignal(signal_code))
-                          ("\" (")
-                          (signal_code)
-                          (")")
-                          (has_code_dump ? " and a core dump was generated" : "")
-                          (".");
-        }
-        else
+    f_common_options = common_options;
+
+    // first add the new services so the services being replaced can
+    // find their new dependencies
+    //
+    service::vector_t added;
+    for(auto const & s : services)
+    {
+        if(!get_service(s->get_service_name()))
         {
-            // I do not think we can reach here...
-            //
-            SNAP_LOG_ERROR("Service \"")(service_name)("\" terminated abnormally in an unknown way.");
+            SNAP_LOG_INFO("adding service \"")(s->get_service_name())("\".");
+            add_service(s);
+            added.push_back(s);
         }
-#pragma GCC diagnostic pop
+    }
+    if(!added.empty())
+    {
+        relink_services();
+    }
 
-        if(dead_service_iter != f_service_list.end()
-        && *dead_service_iter)
+    // then stop the services which were removed or changed, the
+    // replacements get started once the old processes are gone
+    //
+    service::vector_t const current(f_service_list);
+    for(auto const & svc : current)
+    {
+        if(!svc
+        || svc == f_snapinit_service
+        || svc == f_snapcommunicator_service)
         {
-            // call this after we generated the error output so the logs
-            // appear in a sensible order
-            //
-            (*dead_service_iter)->get_process().action_died(termination);
+            continue;
         }
-        else
+        auto const it(new_service_by_name.find(svc->get_service_name()));
+        if(it == new_service_by_name.end())
         {
-            // making this a fatal issue, frankly there is no way we could
-            // lose the child before we tell it to get lost!
-            //
-            common::fatal_error("snapinit received the PID from an unknown process.");
-            snap::NOTREACHED();
+            SNAP_LOG_INFO("removing service \"")(svc->get_service_name())("\".");
+            svc->action_retire(service::pointer_t());
         }
+        else if(it->second->get_definition() != svc->get_definition())
+        {
+            SNAP_LOG_INFO("restarting service \"")(svc->get_service_name())("\" with its new definition.");
+            svc->action_retire(it->second);
+        }
+    }
+
+    for(auto const & s : added)
+    {
+        s->action_ready();
     }
 }
 
 
-/** \brief Remove a service from the list of services.
+/** \brief Start a process depending on the command line command.
  *
- * This function searches for the specified service and removes it from
- * the list of services managed by snapinit.
+ * This function is called once the snap_init object was initialized.
+ * The function calls the corresponding function.
  *
- * snapinit also has copies of a few other services that it keeps around
- * to help with calling various functions. These are resetted alongside.
- * (i.e. since a find_if() of that service would return std::end() and
- * we need to match that behavior either way.)
+ * At this time only three commands are supported:
  *
- * A service can be removed once. After that it is gone for good.
+ * \li start
+ * \li stop
+ * \li restart
+ * \li upgrade
  *
- * \param[in] service  The service being removed.
+ * The restart first calls stop() if snapinit is still running.
+ * Then it calls start().
  */
-void snap_init::remove_service(service::pointer_t service)
+void snap_init::run_processes()
 {
-    SNAP_LOG_TRACE("request to remove service \"")
-                  (service->get_service_name())
-                  ("\".");
-
-    // remove the service from our main list
-    //
-    snap::NOTUSED(std::find_if(
-            f_service_list.begin(),
-            f_service_list.end(),
-            [&service](auto & svc)
-            {
-                if(svc == service)
-                {
-                    svc.reset();
-                    return true;
-                }
-                return false;
-            }));
-
-    // the service is also a timer that we need to remove from
-    // the snapcommunicator list
-    //
-    f_communicator->remove_connection(service);
-
-    // connection service gone?
-    //
-    if(service == f_snapcommunicator_service)
+    if( f_command == command_t::COMMAND_START )
     {
-        f_snapcommunicator_service.reset();
-
-        // if the snapcommunicator is no more so is its connection
-        //
-        if(f_listener_connection)
-        {
-            f_communicator->remove_connection(f_listener_connection);
-            f_listener_connection.reset();
-        }
+        start();
     }
-    else if(service == f_snapinit_service)
+    else if( f_command == command_t::COMMAND_STOP )
     {
-        f_snapinit_service.reset();
+        stop();
     }
-
-    // the list does not get empty because we cannot remove pointers
-    // (we have recursive loops and that would crash with SEGV or such)
-    //
-    if( f_service_list.end() == std::find_if(
-                                    f_service_list.begin(),
-                                    f_service_list.end(),
-                                    [](auto const & svc)
-                                    {
-                                        return !!svc;
-                                    }))
+    else if( f_command == command_t::COMMAND_RESTART )
     {
-        SNAP_LOG_TRACE("snap_init::remove_service(): service list empty!");
-
-        // no more services, also remove our other connections so
-        // we exit the snapcommunicator loop
-        //
-        f_communicator->remove_connection(f_ping_server);
-        f_communicator->remove_connection(f_child_signal);
-        f_communicator->remove_connection(f_term_signal);
-        f_communicator->remove_connection(f_quit_signal);
-        f_communicator->remove_connection(f_int_signal);
-
-        if(f_listener_connection)
-        {
-            f_communicator->remove_connection(f_listener_connection);
-            f_listener_connection.reset();
-
-            SNAP_LOG_FATAL("f_listener_connection was not properly removed when the f_connection_service was removed!");
-        }
+        restart();
+    }
+    else if( f_command == command_t::COMMAND_UPGRADE )
+    {
+        upgrade();
     }
-#if 0
     else
     {
-        SNAP_LOG_TRACE("**** snap_init::remove_service(): service list NOT empty:");
-        for( auto const & svc : f_service_list )
-        {
-            if(svc)
-            {
-                SNAP_LOG_TRACE("******* service '")(svc->get_service_name())("' is still in the list!");
-            }
-        }
+        SNAP_LOG_ERROR("Command '")(f_opt.get_string("--"))("' not recognized!");
+        usage();
+        snap::NOTREACHED();
     }
-#endif
 }
 
 
-
-
-/** \brief Process a user termination signal.
+/** \brief Process a message.
  *
- * This funtion is called whenever the user presses Ctlr-C, Ctrl-?, or Ctrl-\
- * on their keyboard (SIGINT, SIGTERM, or SIGQUIT). This function makes sure
- * to stop the process cleanly in this case by calling the
- * terminate_services() function.
+ * Once started, snapinit accepts messages on a UDP port. This is offered so
+ * one can avoid starting snapcommunicator. Only the STOP command should be
+ * sent through the UDP port.
  *
- * \param[in] sig_name  The name of the Unix signal that generated this call.
+ * When snapcommunicator is a service that snapinit is expected to start
+ * (it should be in almost all cases), then this function is also called
+ * as soon as the snapcommunicator system is in place.
+ *
+ * \param[in] message  The message to be handled.
+ * \param[in] udp  Whether the message was received via the UDP listener.
  */
-void snap_init::user_signal_caught(char const * sig_name)
+void snap_init::process_message(snap::snap_communicator_message const & message, bool udp)
 {
-    std::stringstream ss;
-    ss << "User signal caught: " << sig_name;
-    SNAP_LOG_INFO(ss.str());
-    if(common::is_a_tty())
+    // to_message() is costly, only call it when the trace is visible
+    //
+    if(snap::logging::is_enabled_for(snap::logging::log_level_t::LOG_LEVEL_TRACE))
     {
-        std::cerr << "snapinit: " << ss.str() << std::endl;
+        SNAP_LOG_TRACE("received message [")(message.to_message())("]");
     }
 
-    // by calling this function, snapinit will quit once all the
-    // services stopped
-    //
-    terminate_services();
+    QString const & command(message.get_command());
+    message_command_t const id(find_message_command(command));
+
+    // UDP messages that we accept are very limited...
+    // (especially since we cannot send a reply)
+    //
+    // someone sent "[whatever/]STOP" directly to snapinit (via UDP)
+    //
+    if( udp )
+    {
+        if( id != message_command_t::MESSAGE_COMMAND_STOP )
+        {
+            SNAP_LOG_ERROR("command \"")(command)("\" is not supported on the UDP connection.");
+            ++f_udp_message_counts[static_cast<size_t>(message_command_t::MESSAGE_COMMAND_UNSUPPORTED)];
+            return;
+        }
+        ++f_udp_message_counts[static_cast<size_t>(id)];
+
+        // Execute the command and exit
+        //
+        msg_stop(message);
+        return;
+    }
+
+    ++f_tcp_message_counts[static_cast<size_t>(id)];
+
+    switch(id)
+    {
+    case message_command_t::MESSAGE_COMMAND_GETSTATUS:
+        msg_getstatus(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_HELP:
+        msg_help(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_LOAD:
+        msg_load(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_LOG:
+        msg_log(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_QUITTING:
+    case message_command_t::MESSAGE_COMMAND_STOP:
+        msg_stop(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_READY:
+        msg_ready(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_REEXEC:
+        msg_reexec(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_RELOADCONFIG:
+        msg_reloadconfig(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_RESTART:
+        msg_restart(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_SAFE:
+        msg_safe(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_STATS:
+        msg_stats(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_STATUS:
+        msg_status(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_UNKNOWN:
+        msg_unknown(message);
+        break;
+
+    case message_command_t::MESSAGE_COMMAND_UNSUPPORTED:
+        {
+            // unknown command is reported and process goes on
+            //
+            SNAP_LOG_ERROR("unsupported command \"")(command)("\" was received on the TCP connection.");
+            snap::snap_communicator_message reply;
+            reply.set_command("UNKNOWN");
+            reply.add_parameter("command", command);
+            f_listener_connection->send_message(reply);
+        }
+        break;
+
+    }
+}
+
+
+/** \brief This callback gets called on a SIGCHLD signal.
+ *
+ * Whenever a child dies, we receive a SIGCHLD. The snapcommunicator
+ * library knows how to handle those signals and ends up calling this
+ * function when one happens. Only, at this point the snapcommunicator
+ * does not tell us which child died. So we reap all the dead children
+ * with wait4() and find each service through the PID index (see
+ * register_service_pid()) so the cost of a SIGCHLD does not depend on
+ * the number of services we manage.
+ *
+ * When the pidfd supervision is in use, the children are reaped by
+ * their own process object when their pidfd becomes readable. In that
+ * case this function only checks the few children for which we could
+ * not get a pidfd (see register_sigchld_pid()); calling wait4(-1)
+ * would otherwise steal the status of the other children.
+ *
+ * In most cases, this process will restart the service. Only if the
+ * service was restarted many times in a very short period of time
+ * it may actually be removed from the list instead or put to sleep
+ * for a while ("put to sleep" means not restarted at all...)
+ *
+ * \warning
+ * This function will call itself if it detects that a process dies
+ * and it has to terminate snapinit itself.
+ */
+void snap_init::service_died()
+{
+    SNAP_LOG_TRACE("snap_init::service_died()");
+
+    if(f_pidfd_supervision)
+    {
+        // copy the list since action_exited() unregisters the PID
+        //
+        std::vector<pid_t> const sigchld_pids(f_sigchld_pids.begin(), f_sigchld_pids.end());
+        for(auto const pid : sigchld_pids)
+        {
+            int status;
+            struct rusage usage = {};
+            if(wait4(pid, &status, WNOHANG, &usage) == pid)
+            {
+                child_exited(pid, status, usage);
+            }
+        }
+        return;
+    }
+
+    // this loop takes care of all the children that just sent us a SIGCHLD
+    //
+    // IMPORTANT NOTE: although the pid is a process resource and we
+    //                 could think that it would be better/cleaner
+    //                 to call a 'did_process_died()' function, it
+    //                 would then mean we have to check ALL processes;
+    //                 so with 12 or so daemons, you'd call wait4()
+    //                 12 times; this current loop calls wait4()
+    //                 once per dead process + 1 only (so most often
+    //                 2 times); it can also become difficult to
+    //                 interpret the return type of a function such
+    //                 as 'did_process_died()' as it is likely to
+    //                 change over time to incorporate more things
+    //                 that have nothing to do with SIGCHLD...
+    //
+    for(;;)
+    {
+        int status;
+        struct rusage usage = {};
+        pid_t const died_pid(wait4(-1, &status, WNOHANG, &usage));
+        if(died_pid == 0)
+        {
+            // all children that died were checked, we are done
+            //
+            break;
+        }
+
+        // wait4() returned an error
+        //
+        if( died_pid == -1 )
+        {
+            // when using wait4(-1, ...) we get here and not in the
+            // case where wait4() returns zero!
+            //
+            if(errno == ECHILD)
+            {
+                break;
+            }
+
+            // we probably do not want to continue on errors
+            // we may even need to call fatal_error() instead
+            //
+            int const e(errno);
+            SNAP_LOG_ERROR("wait4() returned an error (")(strerror(e))(").");
+
+            // should we continue to wait4()? I'm not too sure what that
+            // would give us outside of an infinite loop
+            //
+            break;
+        }
+
+        child_exited(died_pid, status, usage);
+    }
+}
+
+
+/** \brief Forward the status of a dead child to its process.
+ *
+ * This function searches the service attached to \p died_pid and
+ * lets its process know about the death of the child.
+ *
+ * \param[in] died_pid  The PID returned by wait4().
+ * \param[in] status  The status returned by wait4().
+ * \param[in] usage  The resources used by the child as returned by wait4().
+ */
+void snap_init::child_exited(pid_t died_pid, int status, struct rusage const & usage)
+{
+    service::pointer_t const dead_service(get_service_by_pid(died_pid));
+    if(!dead_service)
+    {
+        // a child of the previous snapinit binary which service was
+        // removed from the configuration (see rehydrate_services())
+        //
+        if(f_orphan_pids.erase(died_pid) != 0)
+        {
+            unregister_service_pid(died_pid);
+            SNAP_LOG_INFO("process ")(died_pid)(" of a removed service exited.");
+            return;
+        }
+
+        // making this a fatal issue, frankly there is no way we could
+        // lose the child before we tell it to get lost!
+        //
+        SNAP_LOG_FATAL("wait4() returned unknown PID ")(died_pid);
+        common::fatal_error("snapinit received the PID from an unknown process.");
+        snap::NOTREACHED();
+    }
+
+    dead_service->get_process().action_exited(status, usage);
+}
+
+
+/** \brief Remove a service from the list of services.
+ *
+ * This function searches for the specified service and removes it from
+ * the list of services managed by snapinit.
+ *
+ * snapinit also has copies of a few other services that it keeps around
+ * to help with calling various functions. These are resetted alongside.
+ * (i.e. since a find_if() of that service would return std::end() and
+ * we need to match that behavior either way.)
+ *
+ * A service can be removed once. After that it is gone for good.
+ *
+ * \param[in] service  The service being removed.
+ */
+void snap_init::remove_service(service::pointer_t service)
+{
+    SNAP_LOG_TRACE("request to remove service \"")
+                  (service->get_service_name())
+                  ("\".");
+
+    // a removed service cannot hold a start slot
+    //
+    release_start_slot(service);
+
+    // remove the service from our name index
+    //
+    auto const by_name(f_service_by_name.find(service->get_service_name()));
+    if(by_name != f_service_by_name.end()
+    && by_name->second == service)
+    {
+        f_service_by_name.erase(by_name);
+    }
+
+    // remove the service from our main list
+    //
+    snap::NOTUSED(std::find_if(
+            f_service_list.begin(),
+            f_service_list.end(),
+            [&service](auto & svc)
+            {
+                if(svc == service)
+                {
+                    svc.reset();
+                    return true;
+                }
+                return false;
+            }));
+
+    // the service may still have a timer in our timer wheel
+    //
+    f_timer_wheel->cancel(service.get());
+
+    // the SERVICES list has to be regenerated and the status listeners
+    // have to know that this service is gone (unless the replacement
+    // of an overlapped restart already took its name)
+    //
+    f_services_list.clear();
+    if(f_status_batch
+    && f_service_by_name.find(service->get_service_name()) == f_service_by_name.end())
+    {
+        f_status_batch->service_changed(service->get_service_name(), "removed");
+    }
+
+    // on a shutdown, tell how long each service took to go away
+    //
+    if(f_snapinit_state == snapinit_state_t::SNAPINIT_STATE_STOPPING
+    && service != f_snapinit_service)
+    {
+        QString const message(QString("service \"%1\" stopped %2 ms after the shutdown started.")
+                                .arg(service->get_service_name())
+                                .arg((snap::snap_communicator::get_current_date() - f_shutdown_date) / 1000));
+        SNAP_LOG_INFO(message);
+        stop_progress(message);
+    }
+
+    // connection service gone?
+    //
+    if(service == f_snapcommunicator_service)
+    {
+        f_snapcommunicator_service.reset();
+
+        // if the snapcommunicator is no more so is its connection
+        //
+        if(f_listener_connection)
+        {
+            f_communicator->remove_connection(f_listener_connection);
+            f_listener_connection.reset();
+        }
+    }
+    else if(service == f_snapinit_service)
+    {
+        f_snapinit_service.reset();
+    }
+
+    // the list does not get empty because we cannot remove pointers
+    // (we have recursive loops and that would crash with SEGV or such)
+    //
+    if( f_service_by_name.empty() )
+    {
+        SNAP_LOG_TRACE("snap_init::remove_service(): service list empty!");
+
+        if(f_snapinit_state == snapinit_state_t::SNAPINIT_STATE_STOPPING)
+        {
+            QString const message(QString("all the services stopped in %1 ms.")
+                                    .arg((snap::snap_communicator::get_current_date() - f_shutdown_date) / 1000));
+            SNAP_LOG_INFO(message);
+            stop_progress(message);
+            if(f_stop_progress_fd != -1)
+            {
+                ::close(f_stop_progress_fd);
+                f_stop_progress_fd = -1;
+            }
+        }
+
+        // no more services, also remove our other connections so
+        // we exit the snapcommunicator loop
+        //
+        f_communicator->remove_connection(f_timer_wheel);
+        if(f_status_batch)
+        {
+            f_communicator->remove_connection(f_status_batch);
+        }
+        if(f_stats_timer)
+        {
+            f_communicator->remove_connection(f_stats_timer);
+        }
+        if(f_shutdown_timer)
+        {
+            f_communicator->remove_connection(f_shutdown_timer);
+        }
+        if(f_metrics_server)
+        {
+            f_communicator->remove_connection(f_metrics_server);
+        }
+        f_communicator->remove_connection(f_ping_server);
+        f_communicator->remove_connection(f_child_signal);
+        f_communicator->remove_connection(f_term_signal);
+        f_communicator->remove_connection(f_quit_signal);
+        f_communicator->remove_connection(f_int_signal);
+
+        if(f_listener_connection)
+        {
+            f_communicator->remove_connection(f_listener_connection);
+            f_listener_connection.reset();
+
+            SNAP_LOG_FATAL("f_listener_connection was not properly removed when the f_connection_service was removed!");
+        }
+    }
+#if 0
+    else
+    {
+        SNAP_LOG_TRACE("**** snap_init::remove_service(): service list NOT empty:");
+        for( auto const & svc : f_service_list )
+        {
+            if(svc)
+            {
+                SNAP_LOG_TRACE("******* service '")(svc->get_service_name())("' is still in the list!");
+            }
+        }
+    }
+#endif
+}
+
+
+
+
+/** \brief Remove a retired service and start its replacement.
+ *
+ * This function is called by a service which was removed or changed
+ * by a reload of the configuration once its process is gone.
+ *
+ * \param[in] s  The service being retired.
+ * \param[in] replacement  The service with the new definition, may be null.
+ */
+void snap_init::retire_service(service::pointer_t s, service::pointer_t replacement)
+{
+    remove_service(s);
+
+    if(replacement)
+    {
+        // keep the sockets open so clients get queued meanwhile
+        //
+        replacement->get_process().adopt_listen_sockets(s->get_process());
+        add_service(replacement);
+    }
+
+    relink_services();
+
+    // the replacement of an overlapped restart already runs
+    //
+    if(replacement
+    && f_snapinit_state == snapinit_state_t::SNAPINIT_STATE_READY
+    && !replacement->is_running())
+    {
+        replacement->action_ready();
+    }
+}
+
+
+/** \brief Start the process of the replacement of an overlapped restart.
+ *
+ * The replacement is not yet added to our lists, the service it
+ * replaces keeps its place until the new process is ready (see
+ * take_over()). It still needs its dependencies and options to start.
+ *
+ * \param[in] replacement  The service with the new process.
+ */
+void snap_init::start_replacement(service::pointer_t replacement)
+{
+    replacement->finish_configuration(f_common_options);
+    replacement->action_ready();
+}
+
+
+/** \brief The replacement of an overlapped restart takes over.
+ *
+ * The new process is ready so the replacement gets added to our
+ * lists and becomes the service known by that name. The old service
+ * remains in f_service_list until its process is gone so a shutdown
+ * still waits for it.
+ *
+ * \param[in] s  The service being replaced.
+ * \param[in] replacement  The service taking over.
+ */
+void snap_init::take_over(service::pointer_t s, service::pointer_t replacement)
+{
+    SNAP_LOG_INFO("overlapped restart of service \"")
+                 (s->get_service_name())
+                 ("\": the new process is ready, draining the old one.");
+
+    add_service(replacement);
+    relink_services();
+    service_status_changed(replacement);
+}
+
+
+/** \brief Restart the process of one service.
+ *
+ * A new service gets created from the definition of the service and
+ * replaces it as on a RELOADCONFIG (see service::action_retire()).
+ * This is used after an upgrade which changed the binary but not the
+ * XML file. With \<restart>overlap\</restart> the new process starts
+ * before the old one gets stopped.
+ *
+ * \param[in] service_name  The name of the service to restart.
+ */
+void snap_init::restart_service(QString const & service_name)
+{
+    if(f_snapinit_state != snapinit_state_t::SNAPINIT_STATE_READY)
+    {
+        SNAP_LOG_WARNING("snapinit is stopping, the RESTART message is ignored.");
+        return;
+    }
+
+    service::pointer_t const s(get_service(service_name));
+    if(!s
+    || s == f_snapinit_service
+    || s == f_snapcommunicator_service)
+    {
+        SNAP_LOG_ERROR("service \"")(service_name)("\" cannot be restarted, it does not exist or it is the connection service.");
+        return;
+    }
+
+    QDomDocument doc;
+    if(!doc.setContent(s->get_definition()))
+    {
+        SNAP_LOG_ERROR("the definition of service \"")(service_name)("\" could not be parsed again, it was not restarted.");
+        return;
+    }
+
+    std::vector<QString> common_options(f_common_options);
+    for(auto const & replacement : xml_to_service(doc, QString(), common_options))
+    {
+        if(replacement->get_service_name() == service_name)
+        {
+            // the instances of an autoscaled service share their autoscaler
+            //
+            if(s->get_autoscaler())
+            {
+                replacement->set_autoscaler(s->get_autoscaler());
+            }
+
+            SNAP_LOG_INFO("restarting service \"")(service_name)("\".");
+            s->action_retire(replacement);
+            return;
+        }
+    }
+
+    SNAP_LOG_ERROR("service \"")(service_name)("\" could not be created again, it was not restarted.");
+}
+
+
+/** \brief Execute the snapinit binary again without stopping the services.
+ *
+ * The state of the services (PID, counters, listen sockets, cron
+ * ticks...) gets saved in a memfd (see the handoff class) and the
+ * snapinit binary is executed again with the --rehydrate option. Our
+ * PID does not change so the processes remain our children.
+ *
+ * The REEXEC is refused while snapinit is stopping and while a
+ * service is starting, stopping, or being replaced. It is also
+ * refused when the state cannot be saved. In all those cases,
+ * snapinit keeps running as before and the REEXEC can be sent again
+ * later.
+ *
+ * The binary is found with /proc/self/exe so the new version
+ * installed by the package manager gets executed, even though the
+ * old file was deleted.
+ */
+void snap_init::reexec()
+{
+    if(f_snapinit_state != snapinit_state_t::SNAPINIT_STATE_READY)
+    {
+        SNAP_LOG_WARNING("snapinit is stopping, the REEXEC message is ignored.");
+        return;
+    }
+
+    if(!f_lock_file.isOpen())
+    {
+        SNAP_LOG_ERROR("the lock file is not open, snapinit cannot execute itself again.");
+        return;
+    }
+
+    for(auto const & s : f_service_list)
+    {
+        if(s
+        && s != f_snapinit_service
+        && !s->is_disabled()
+        && !s->can_hand_off())
+        {
+            SNAP_LOG_WARNING("service \"")
+                            (s->get_service_name())
+                            ("\" is starting or stopping, the REEXEC message is ignored; try again later.");
+            return;
+        }
+    }
+
+    char exe[PATH_MAX + 1];
+    ssize_t const len(readlink("/proc/self/exe", exe, PATH_MAX));
+    if(len <= 0)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR("could not find the snapinit binary (errno: ")(e)(" -- ")(strerror(e))(").");
+        return;
+    }
+    std::string binary(exe, len);
+    std::string const deleted(" (deleted)");
+    if(binary.length() > deleted.length()
+    && binary.compare(binary.length() - deleted.length(), deleted.length(), deleted) == 0)
+    {
+        binary.resize(binary.length() - deleted.length());
+    }
+
+    handoff h;
+
+    int const lock_fd(f_lock_file.handle());
+    if(!h.pass_fd(lock_fd))
+    {
+        h.cancel();
+        return;
+    }
+    snap::snap_communicator_message header;
+    header.set_command("SNAPINIT");
+    header.add_parameter("lock", lock_fd);
+    header.add_parameter("start_date", QString("%1").arg(f_start_date));
+    header.add_parameter("cgroup_root", f_cgroup_root);
+    h.add_entry(header);
+
+    for(auto const & s : f_service_list)
+    {
+        if(!s
+        || s == f_snapinit_service
+        || s->is_disabled())
+        {
+            continue;
+        }
+
+        snap::snap_communicator_message entry;
+        entry.set_command("SERVICE");
+        if(!s->save_handoff(entry, h))
+        {
+            SNAP_LOG_ERROR("the state of service \"")
+                          (s->get_service_name())
+                          ("\" could not be saved, the REEXEC message is ignored.");
+            h.cancel();
+            return;
+        }
+        h.add_entry(entry);
+    }
+
+    int const fd(h.save());
+    if(fd == -1)
+    {
+        h.cancel();
+        return;
+    }
+
+    // same command line, except for the --rehydrate of a previous REEXEC
+    //
+    std::vector<std::string> args;
+    args.push_back(f_argv.empty() ? binary : f_argv[0]);
+    args.push_back("--rehydrate");
+    args.push_back(std::to_string(fd));
+    for(size_t idx(1); idx < f_argv.size(); ++idx)
+    {
+        if(f_argv[idx] == "--rehydrate")
+        {
+            ++idx;
+            continue;
+        }
+        args.push_back(f_argv[idx]);
+    }
+    std::vector<char *> argv;
+    for(auto & a : args)
+    {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    SNAP_LOG_INFO("executing \"")(binary)("\" again, the services keep running.");
+
+    execv(binary.c_str(), argv.data());
+
+    // we are still here, the services are still ours
+    //
+    int const e(errno);
+    SNAP_LOG_ERROR("execv() of \"")(binary)("\" failed, snapinit keeps running (errno: ")(e)(" -- ")(strerror(e))(").");
+    h.cancel();
+}
+
+
+/** \brief Take over the services of the previous snapinit binary.
+ *
+ * The configuration was read from disk again, so each entry saved by
+ * the previous binary gets attached to the service of the same name
+ * which then rehydrates its state and its process instead of starting
+ * a new one (see service::rehydrate().)
+ *
+ * A process which service was removed from the configuration (or
+ * disabled) is still our child. It gets terminated and its file descriptors
+ * closed. Services which were added get started as usual.
+ *
+ * \param[in] h  The state loaded from the --rehydrate memfd.
+ */
+void snap_init::rehydrate_services(handoff const & h)
+{
+    f_snapinit_service->action_ready();
+
+    std::set<service::pointer_t> rehydrated;
+    for(auto const & entry : h.get_entries())
+    {
+        if(entry.get_command() != "SERVICE")
+        {
+            continue;
+        }
+
+        QString const service_name(entry.get_parameter("service"));
+        service::pointer_t const s(get_service(service_name));
+        if(s
+        && s != f_snapinit_service
+        && !s->is_disabled()
+        && rehydrated.find(s) == rehydrated.end())
+        {
+            s->rehydrate(entry);
+            rehydrated.insert(s);
+            continue;
+        }
+
+        QStringList fds(entry.has_parameter("listen_fds")
+                            ? entry.get_parameter("listen_fds").split(':', QString::SkipEmptyParts)
+                            : QStringList());
+        if(entry.has_parameter("ready_pipe"))
+        {
+            fds << entry.get_parameter("ready_pipe");
+        }
+        if(entry.has_parameter("zygote_socket"))
+        {
+            fds << entry.get_parameter("zygote_socket");
+        }
+        for(auto const & fd : fds)
+        {
+            ::close(fd.toInt());
+        }
+
+        if(entry.has_parameter("pid"))
+        {
+            pid_t const pid(entry.get_integer_parameter("pid"));
+            SNAP_LOG_WARNING("service \"")
+                            (service_name)
+                            ("\" was removed from the configuration, terminating its process ")
+                            (pid)
+                            (".");
+            ::kill(pid, SIGTERM);
+            f_orphan_pids.insert(pid);
+            if(f_pidfd_supervision)
+            {
+                register_sigchld_pid(pid);
+            }
+        }
+    }
+
+    // services added to the configuration start now
+    //
+    for(auto const & s : f_service_list)
+    {
+        if(s
+        && s != f_snapinit_service
+        && rehydrated.find(s) == rehydrated.end())
+        {
+            s->action_ready();
+        }
+    }
+
+    SNAP_LOG_INFO("snapinit took over ")(rehydrated.size())(" services from the previous binary.");
+}
+
+
+
+
+/** \brief Process a user termination signal.
+ *
+ * This funtion is called whenever the user presses Ctlr-C, Ctrl-?, or Ctrl-\
+ * on their keyboard (SIGINT, SIGTERM, or SIGQUIT). This function makes sure
+ * to stop the process cleanly in this case by calling the
+ * terminate_services() function.
+ *
+ * \param[in] sig_name  The name of the Unix signal that generated this call.
+ */
+void snap_init::user_signal_caught(char const * sig_name)
+{
+    std::stringstream ss;
+    ss << "User signal caught: " << sig_name;
+    SNAP_LOG_INFO(ss.str());
+    if(common::is_a_tty())
+    {
+        std::cerr << "snapinit: " << ss.str() << std::endl;
+    }
+
+    // by calling this function, snapinit will quit once all the
+    // services stopped
+    //
+    terminate_services();
+}
+
+
+/** \brief Check whether snapinit is running (has a lock file in place.)
+ *
+ * The snapinit process creates a lock file on the 'start' command.
+ * If that lock file exists, then it is viewed as locked and that
+ * snapinit is already running. This prevents you from starting
+ * multiple instances of the snapinit server. It is still possible
+ * to start snapinit with other commands, especially the 'stop'
+ * and 'restart' commands, but also the --version and --list
+ * command line options work just fine even when the lock is in
+ * place.
+ *
+ * \return true if the snapinit process lock file exists.
+ */
+bool snap_init::is_running() const
+{
+    return f_lock_file.exists();
+}
+
+
+/** \brief Retrieve the path to the spool directory.
+ *
+ * The spool directory is used by the anacron tool and we do the
+ * same thing. We save the time in seconds when we last ran a
+ * CRON process in a file under that directory.
+ *
+ * This function makes sure that the spool directory exists
+ * the first time it is called. After that, it is assumed
+ * that the path never changes so it does not try to recreate
+ * the path.
+ *
+ * \return The path to the spool file.
+ */
+QString const & snap_init::get_spool_path() const
+{
+    if(!f_spool_directory_created)
+    {
+        f_spool_directory_created = true;
+
+        // make sure that the directory exists
+        //
+        if(snap::mkdir_p(f_spool_path, false) != 0)
+        {
+            common::fatal_error(QString("snapinit could not create directory \"%1\" to save spool data.")
+                                .arg(f_spool_path));
+            snap::NOTREACHED();
+        }
+    }
+
+    return f_spool_path;
+}
+
+
+/** \brief Retrieve the spool of the cron tasks.
+ *
+ * The spool file is opened the first time this function is called.
+ * If it cannot be opened, the cron ticks are not saved and each
+ * cron task runs once as soon as snapinit starts.
+ *
+ * \return A reference to the cron spool.
+ */
+cron_spool & snap_init::get_cron_spool()
+{
+    if(!f_cron_spool_opened)
+    {
+        f_cron_spool_opened = true;
+        f_cron_spool.set_sync(f_cron_spool_sync);
+        f_cron_spool.open(get_spool_path());
+    }
+
+    return f_cron_spool;
+}
+
+
+/** \brief Retrieve the name of the server.
+ *
+ * This parameter returns the value of the server_name=... parameter
+ * defined in the snapinit configuration file or the hostname if
+ * the server_name=... parameter was not defined.
+ *
+ * \return The name of the server this snapinit instance is running on.
+ */
+QString const & snap_init::get_server_name() const
+{
+    return f_server_name;
+}
+
+
+/** \brief Check whether we were started in debug mode.
+ *
+ * \return true if the --debug command line optionw as used.
+ */
+bool snap_init::get_debug() const
+{
+    return f_debug;
+}
+
+
+/** \brief Retrieve the default restart backoff policy.
+ *
+ * The services start with this policy and may override some of its
+ * parameters in their XML file.
+ *
+ * \return The backoff policy defined in snapinit.conf.
+ */
+backoff const & snap_init::get_default_backoff() const
+{
+    return f_default_backoff;
+}
+
+
+/** \brief Retrieve the default delay given to a process to stop.
+ *
+ * This is how long a process has to exit after it was sent a STOP
+ * message before it gets a SIGTERM.
+ *
+ * \return The stop_timeout of snapinit.conf in microseconds.
+ */
+int64_t snap_init::get_default_stop_timeout() const
+{
+    return f_default_stop_timeout;
+}
+
+
+/** \brief Retrieve the default delay given to a process to terminate.
+ *
+ * This is how long a process has to exit after it was sent a SIGTERM
+ * before it gets a SIGKILL.
+ *
+ * \return The terminate_timeout of snapinit.conf in microseconds.
+ */
+int64_t snap_init::get_default_terminate_timeout() const
+{
+    return f_default_terminate_timeout;
+}
+
+
+/** \brief Get the delay after which a starting service gives its slot back.
+ *
+ * \return The start_timeout parameter in microseconds, 0 when turned off.
+ */
+int64_t snap_init::get_start_timeout() const
+{
+    return f_start_timeout;
+}
+
+
+/** \brief Check whether children are supervised through a pidfd.
+ *
+ * \return true if each child gets a pidfd in the communicator, false
+ *         if the SIGCHLD handler reaps all the children.
+ */
+bool snap_init::get_pidfd_supervision() const
+{
+    return f_pidfd_supervision;
+}
+
+
+/** \brief Check how children get started.
+ *
+ * \return true if children are started with clone(CLONE_VM | CLONE_VFORK),
+ *         false if they are started with fork().
+ */
+bool snap_init::get_vfork_spawn() const
+{
+    return f_vfork_spawn;
+}
+
+
+/** \brief Retrieve the cgroup under which the services cgroups get created.
+ *
+ * The cgroup root gets prepared by start() before any service process
+ * gets created: with cgroup v2 a cgroup which has processes cannot
+ * enable controllers for its children, so snapinit has to move itself
+ * to its leaf cgroup while it is still alone. After a REEXEC, the
+ * root prepared by the previous binary is reused as is.
+ *
+ * The root is defined by the cgroup_root parameter of snapinit.conf.
+ * By default, the cgroup in which snapinit runs is used. If
+ * cgroup_root is set to "off" or cgroup v2 cannot be used, the
+ * function returns an empty string and the services run in the
+ * snapinit cgroup.
+ *
+ * \return The path to the root cgroup or an empty string.
+ */
+QString const & snap_init::get_cgroup_root()
+{
+    if(!f_cgroup_root_ready)
+    {
+        f_cgroup_root_ready = true;
+
+        QString const root(f_config.contains("cgroup_root") ? f_config["cgroup_root"] : QString());
+        if(root != "off")
+        {
+            f_cgroup_root = cgroup::setup_root(root);
+        }
+    }
+
+    return f_cgroup_root;
+}
+
+
+/** \brief Retrieve a copy of the data path.
+ *
+ * This function returns the path to the snapinit home directory.
+ *
+ * \return The data_path parameter as defined in the snapinit.conf or the
+ *         default which is "/var/lib/snapwebsites".
+ */
+QString const & snap_init::get_data_path() const
+{
+    return f_data_path;
+}
+
+
+/** \brief Retrieve the service used to inter-connect services.
+ *
+ * This function returns the information about the server that is
+ * used to inter-connect services together. This should be the
+ * snapcommunicator service.
+ *
+ * \exception std::logic_error
+ * The function raises that exception if it gets called too soon
+ * (i.e. before a connection service is found in the XML file.)
+ *
+ * \return A smart pointer to the snapcommunicator service.
+ */
+service::pointer_t snap_init::get_snapcommunicator_service() const
+{
+    if(!f_snapcommunicator_service)
+    {
+        throw std::logic_error("snapcommunicator service requested before it was defined or after it was dropped.");
+    }
+
+    return f_snapcommunicator_service;
+}
+
+
+/** \brief Send a message to snapcommunicator
+ *
+ * This function sends a message to the snapcommunicator service.
+ *
+ * \note
+ * If snapcommunicator is not yet connected or the connection was
+ * lost, the message will be stacked and sent as soon as the
+ * snapcommunicator comes back.
+ *
+ * \param[in] message  The message to send.
+ */
+void snap_init::send_message(snap::snap_communicator_message const & message)
+{
+    if(f_listener_connection)
+    {
+        f_listener_connection->send_message(message);
+    }
+}
+
+
+/** \brief List the servers we are starting to the log.
+ *
+ * This function prints out the list of services that this instance
+ * of snapinit is managing.
+ *
+ * The list may be shorten as time goes if some services die too
+ * many times. This gives you an exact list on startup.
+ *
+ * Note that services marked as disabled in the snapinit.xml file
+ * are not loaded at all so they will not make it to the log from
+ * this function.
+ */
+void snap_init::log_selected_servers() const
+{
+    std::stringstream ss;
+    ss << "Enabled servers:";
+
+    auto log_service_name = [&ss](auto const & svc)
+    {
+        if(svc)
+        {
+            ss << " [" << svc->get_service_name() << "]";
+        }
+    };
+
+    std::for_each( std::begin(f_service_list), std::end(f_service_list), log_service_name );
+
+    SNAP_LOG_INFO(ss.str());
+}
+
+
+
+/** \brief Compute the start level of each service.
+ *
+ * The services and their dependencies form a directed acyclic graph.
+ * This function computes the topological level of each service: a
+ * service without dependencies is at level 0 and any other service
+ * is one level above its highest dependency.
+ *
+ * All the services of one level can be started in parallel once the
+ * previous levels are registered. When the number of services starting
+ * in parallel is limited (see max_parallel_starts), the services waiting
+ * for a slot are started by level so the critical path goes first.
+ *
+ * A loop in the dependencies would prevent all the services in that
+ * loop from ever starting so this is a fatal error.
+ */
+void snap_init::compute_start_levels()
+{
+    int max_level(0);
+    std::function<int(service::pointer_t const &)> compute_level;
+    compute_level = [&compute_level, &max_level](service::pointer_t const & svc)
+        {
+            int level(svc->get_start_level());
+            if(level >= 0)
+            {
+                return level;
+            }
+            if(level == -2)
+            {
+                common::fatal_error(QString("service \"%1\" is part of a dependency loop.")
+                                    .arg(svc->get_service_name()));
+                snap::NOTREACHED();
+            }
+
+            // mark as "being computed" to detect loops
+            //
+            svc->set_start_level(-2);
+
+            level = 0;
+            for(auto const & d : svc->get_depends_list())
+            {
+                service::pointer_t const dependency(d.lock());
+                if(dependency)
+                {
+                    level = std::max(level, compute_level(dependency) + 1);
+                }
+            }
+            svc->set_start_level(level);
+            max_level = std::max(max_level, level);
+            return level;
+        };
+
+    for(auto const & svc : f_service_list)
+    {
+        if(svc)
+        {
+            snap::NOTUSED(compute_level(svc));
+        }
+    }
+
+    SNAP_LOG_DEBUG("the services dependency graph has ")(max_level + 1)(" start levels.");
+}
+
+
+/** \brief Retrieve the startup trace.
+ *
+ * \return The startup trace or a null pointer if the startup is not
+ *         being traced (anymore.)
+ */
+startup_trace::pointer_t snap_init::get_startup_trace() const
+{
+    return f_startup_trace;
+}
+
+
+/** \brief The status of a service may have changed.
+ *
+ * The new status is given to the status batch which sends the changes
+ * to the status listeners once its window is over.
+ *
+ * \param[in] s  The service which status may have changed.
+ */
+void snap_init::service_status_changed(service::pointer_t s)
+{
+    if(f_status_batch)
+    {
+        f_status_batch->service_changed(s->get_service_name(), s->get_status());
+    }
+}
+
+
+/** \brief Get the list of our services as sent in the SERVICES message.
+ *
+ * The list is generated once and kept until a service gets added or
+ * removed.
+ *
+ * \return The comma separated list of service names.
+ */
+QString const & snap_init::get_services_list()
+{
+    if(f_services_list.isEmpty())
+    {
+        snap::snap_string_list service_list_name;
+        for(auto const & svc : f_service_list)
+        {
+            if(svc)
+            {
+                service_list_name << svc->get_service_name();
+            }
+        }
+        f_services_list = service_list_name.join(",");
+    }
+    return f_services_list;
+}
+
+
+/** \brief Sample the resource usage of the running services.
+ *
+ * This function gets called every stats_sample_interval seconds. It
+ * reads /proc/<pid>/stat of each running service so the STATS message
+ * can report about processes which never die (i.e. snapserver) and
+ * about a cron task which is currently running.
+ */
+void snap_init::sample_services()
+{
+    for(auto const & s : f_service_list)
+    {
+        if(s
+        && s->get_process().is_running())
+        {
+            process & p(s->get_process());
+            snap::NOTUSED(p.get_resource_usage().sample(p.get_pid()));
+        }
+    }
+
+    autoscale_services();
+}
+
+
+/** \brief Adjust the number of running instances to the load.
+ *
+ * This function gets called right after the services were sampled.
+ * The CPU samples are given to the autoscaler of their service and
+ * then each autoscaler decides whether one instance has to be started
+ * or stopped. The queue depths are recorded as the LOAD messages
+ * arrive (see msg_load()).
+ *
+ * Loads older than three sample intervals are ignored so an instance
+ * which stopped reporting does not hold the number of instances up
+ * or down.
+ */
+void snap_init::autoscale_services()
+{
+    if(f_snapinit_state != snapinit_state_t::SNAPINIT_STATE_READY)
+    {
+        return;
+    }
+
+    int64_t const now(snap::snap_communicator::get_current_date());
+    int64_t const since(now - 3LL * f_stats_sample_interval * common::SECONDS_TO_MICROSECONDS);
+
+    // the services may change state while we scale them so work on a copy
+    //
+    service::vector_t const list(f_service_list);
+    for(auto const & s : list)
+    {
+        if(!s
+        || s->get_instance() != 0)
+        {
+            continue;
+        }
+        autoscaler::pointer_t a(s->get_autoscaler());
+        if(!a)
+        {
+            continue;
+        }
+
+        // the instances are named "<base>-<index>" except the first one;
+        // skip the whole set while a reload replaces it
+        //
+        service::vector_t instances;
+        instances.reserve(a->get_max());
+        for(int idx(0); idx < a->get_max(); ++idx)
+        {
+            service::pointer_t const svc(idx == 0
+                                ? s
+                                : get_service(QString("%1-%2").arg(s->get_base_name()).arg(idx)));
+            if(!svc
+            || svc->get_autoscaler() != a)
+            {
+                break;
+            }
+            instances.push_back(svc);
+        }
+        if(instances.size() != static_cast<size_t>(a->get_max()))
+        {
+            continue;
+        }
+
+        if(a->get_metric() == autoscaler::metric_t::METRIC_CPU)
+        {
+            for(auto const & svc : instances)
+            {
+                process const & p(svc->get_process());
+                if(p.is_running()
+                && p.get_resource_usage().has_sample())
+                {
+                    a->record_cpu(svc->get_instance(), p.get_pid(), p.get_resource_usage().get_sample());
+                }
+            }
+        }
+
+        int const active(a->get_active());
+        int const target(a->evaluate(now, since));
+        if(target > active)
+        {
+            SNAP_LOG_INFO("autoscale: starting instance \"")
+                         (instances[active]->get_service_name())
+                         ("\", ")
+                         (target)
+                         (" of ")
+                         (a->get_max())
+                         (" instances of \"")
+                         (s->get_base_name())
+                         ("\" are now active.");
+            instances[active]->action_scale_up();
+        }
+        else if(target < active)
+        {
+            SNAP_LOG_INFO("autoscale: stopping instance \"")
+                         (instances[target]->get_service_name())
+                         ("\", ")
+                         (target)
+                         (" of ")
+                         (a->get_max())
+                         (" instances of \"")
+                         (s->get_base_name())
+                         ("\" are now active.");
+            instances[target]->action_scale_down();
+        }
+    }
 }
 
 
-/** \brief Check whether snapinit is running (has a lock file in place.)
- *
- * The snapinit process creates a lock file on the 'start' command.
- * If that lock file exists, then it is viewed as locked and that
- * snapinit is already running. This prevents you from starting
- * multiple instances of the snapinit server. It is still possible
- * to start snapinit with other commands, especially the 'stop'
- * and 'restart' commands, but also the --version and --list
- * command line options work just fine even when the lock is in
- * place.
+/** \brief Keep track of the time it takes to reap a child.
  *
- * \return true if the snapinit process lock file exists.
+ * \param[in] duration  The time spent reaping the child and updating
+ *                      the state of its service, in microseconds.
  */
-bool snap_init::is_running() const
+void snap_init::record_reap_duration(int64_t duration)
 {
-    return f_lock_file.exists();
+    f_reap_duration.record(duration);
 }
 
 
-/** \brief Retrieve the path to the spool directory.
+/** \brief Generate the metrics in the Prometheus text format.
  *
- * The spool directory is used by the anacron tool and we do the
- * same thing. We save the time in seconds when we last ran a
- * CRON process in a file under that directory.
- *
- * This function makes sure that the spool directory exists
- * the first time it is called. After that, it is assumed
- * that the path never changes so it does not try to recreate
- * the path.
+ * This function gets called by the metrics server each time a client
+ * asks for the metrics. The cost is proportional to the number of
+ * services and nothing is computed when nobody asks.
  *
- * \return The path to the spool file.
+ * \return The metrics.
  */
-QString const & snap_init::get_spool_path() const
+std::string snap_init::generate_metrics() const
 {
-    if(!f_spool_directory_created)
+    metrics_writer w;
+
+    w.family("snapinit_uptime_seconds", "gauge", "Time since snapinit started.");
+    w.sample_seconds("snapinit_uptime_seconds", QString(), snap::snap_communicator::get_current_date() - f_start_date);
+
+    w.family("snapinit_service_up", "gauge", "Whether the process of the service is running.");
+    for(auto const & s : f_service_list)
     {
-        f_spool_directory_created = true;
+        if(s)
+        {
+            w.sample("snapinit_service_up", metrics_writer::label("service", s->get_service_name()), s->is_running() ? 1 : 0);
+        }
+    }
 
-        // make sure that the directory exists
-        //
-        if(snap::mkdir_p(f_spool_path, false) != 0)
+    w.family("snapinit_service_starts_total", "counter", "Number of times the process of the service was started.");
+    for(auto const & s : f_service_list)
+    {
+        if(s)
         {
-            common::fatal_error(QString("snapinit could not create directory \"%1\" to save spool data.")
-                                .arg(f_spool_path));
-            snap::NOTREACHED();
+            w.sample("snapinit_service_starts_total", metrics_writer::label("service", s->get_service_name()), s->get_process().get_start_count());
         }
     }
 
-    return f_spool_path;
-}
+    w.family("snapinit_service_errors_total", "counter", "Number of times the process of the service died with an error or could not be started.");
+    for(auto const & s : f_service_list)
+    {
+        if(s)
+        {
+            w.sample("snapinit_service_errors_total", metrics_writer::label("service", s->get_service_name()), s->get_process().get_error_count());
+        }
+    }
 
+    w.family("snapinit_service_pauses_total", "counter", "Number of times the service got paused.");
+    for(auto const & s : f_service_list)
+    {
+        if(s)
+        {
+            w.sample("snapinit_service_pauses_total", metrics_writer::label("service", s->get_service_name()), s->get_pause_count());
+        }
+    }
 
-/** \brief Retrieve the name of the server.
- *
- * This parameter returns the value of the server_name=... parameter
- * defined in the snapinit configuration file or the hostname if
- * the server_name=... parameter was not defined.
- *
- * \return The name of the server this snapinit instance is running on.
- */
-QString const & snap_init::get_server_name() const
-{
-    return f_server_name;
+    w.family("snapinit_service_state_seconds_total", "counter", "Time the service spent in each state.");
+    for(auto const & s : f_service_list)
+    {
+        if(s)
+        {
+            QString const service_label(metrics_writer::label("service", s->get_service_name()));
+            for(auto const & d : s->get_state_durations())
+            {
+                w.sample_seconds("snapinit_service_state_seconds_total", service_label + "," + metrics_writer::label("state", d.first), d.second);
+            }
+        }
+    }
+
+    w.family("snapinit_cron_lag_seconds", "summary", "Delay between the cron tick and the actual start of the task.");
+    for(auto const & s : f_service_list)
+    {
+        if(s
+        && s->is_cron_task())
+        {
+            w.summary_seconds("snapinit_cron_lag_seconds", metrics_writer::label("service", s->get_service_name()), s->get_cron_lag());
+        }
+    }
+
+    w.family("snapinit_cron_lag_max_seconds", "gauge", "Largest delay between a cron tick and the actual start of the task.");
+    for(auto const & s : f_service_list)
+    {
+        if(s
+        && s->is_cron_task())
+        {
+            w.sample_seconds("snapinit_cron_lag_max_seconds", metrics_writer::label("service", s->get_service_name()), s->get_cron_lag().get_max());
+        }
+    }
+
+    w.family("snapinit_messages_total", "counter", "Number of messages received per connection and command.");
+    for(size_t idx(0); idx < MESSAGE_COMMAND_COUNT; ++idx)
+    {
+        QString const command_label(metrics_writer::label("command", message_command_name(static_cast<message_command_t>(idx))));
+        w.sample("snapinit_messages_total", metrics_writer::label("connection", "tcp") + "," + command_label, f_tcp_message_counts[idx]);
+        w.sample("snapinit_messages_total", metrics_writer::label("connection", "udp") + "," + command_label, f_udp_message_counts[idx]);
+    }
+
+    w.family("snapinit_reap_seconds", "summary", "Time spent reaping a dead child and updating its service.");
+    w.summary_seconds("snapinit_reap_seconds", QString(), f_reap_duration);
+
+    w.family("snapinit_reap_max_seconds", "gauge", "Longest time spent reaping a dead child.");
+    w.sample_seconds("snapinit_reap_max_seconds", QString(), f_reap_duration.get_max());
+
+    return w.get_text();
 }
 
 
-/** \brief Check whether we were started in debug mode.
+/** \brief Retrieve the timer wheel.
  *
- * \return true if the --debug command line optionw as used.
+ * The services use the timer wheel to get woken up at a given date.
+ *
+ * \return The timer wheel.
  */
-bool snap_init::get_debug() const
+timer_wheel::pointer_t snap_init::get_timer_wheel() const
 {
-    return f_debug;
+    return f_timer_wheel;
 }
 
 
-/** \brief Retrieve a copy of the data path.
- *
- * This function returns the path to the snapinit home directory.
+/** \brief Save the startup trace once all the services are started.
  *
- * \return The data_path parameter as defined in the snapinit.conf or the
- *         default which is "/var/lib/snapwebsites".
+ * The services call this function whenever the status of their process
+ * changes. Once all the services registered or died, the trace is saved
+ * and we stop tracing.
  */
-QString const & snap_init::get_data_path() const
+void snap_init::check_startup_trace()
 {
-    return f_data_path;
+    if(f_startup_trace
+    && f_startup_trace->is_complete())
+    {
+        f_startup_trace->save();
+        f_startup_trace.reset();
+
+        SNAP_LOG_INFO("startup trace saved in \"")
+                     (f_opt.get_string("trace-startup"))
+                     (".json\" and \"")
+                     (f_opt.get_string("trace-startup"))
+                     (".txt\".");
+    }
 }
 
 
-/** \brief Retrieve the service used to inter-connect services.
+/** \brief Check whether a service can start its process now.
  *
- * This function returns the information about the server that is
- * used to inter-connect services together. This should be the
- * snapcommunicator service.
+ * When max_parallel_starts is not zero, at most that many services can
+ * be starting at the same time. A service is starting from the time
+ * its process is created until the process registers with
+ * snapcommunicator (or sends its SAFE message) or dies.
  *
- * \exception std::logic_error
- * The function raises that exception if it gets called too soon
- * (i.e. before a connection service is found in the XML file.)
+ * If no slot is available, the service is added to the list of waiting
+ * services and it gets awaken by release_start_slot().
  *
- * \return A smart pointer to the snapcommunicator service.
+ * \param[in] s  The service that wants to start its process.
+ *
+ * \return true if the service can start its process now.
  */
-service::pointer_t snap_init::get_snapcommunicator_service() const
+bool snap_init::request_start_slot( service::pointer_t s )
 {
-    if(!f_snapcommunicator_service)
+    if(f_max_parallel_starts == 0
+    || f_starting_services.find(s) != f_starting_services.end())
     {
-        throw std::logic_error("snapcommunicator service requested before it was defined or after it was dropped.");
+        return true;
     }
 
-    return f_snapcommunicator_service;
+    if(f_starting_services.size() < f_max_parallel_starts)
+    {
+        f_starting_services[s] = snap::snap_communicator::get_current_date();
+        return true;
+    }
+
+    auto const waiting(std::find_if(
+            f_waiting_services.begin(),
+            f_waiting_services.end(),
+            [&s](auto const & w)
+            {
+                return w.lock() == s;
+            }));
+    if(waiting == f_waiting_services.end())
+    {
+        f_waiting_services.push_back(s);
+    }
+
+    return false;
 }
 
 
-/** \brief Send a message to snapcommunicator
- *
- * This function sends a message to the snapcommunicator service.
+/** \brief A service is done starting.
  *
- * \note
- * If snapcommunicator is not yet connected or the connection was
- * lost, the message will be stacked and sent as soon as the
- * snapcommunicator comes back.
+ * This function releases the start slot of the specified service if
+ * it had one. Then it wakes up as many waiting services as there are
+ * slots available, lowest start level first and then by priority.
  *
- * \param[in] message  The message to send.
+ * \param[in] s  The service which process registered or died.
  */
-void snap_init::send_message(snap::snap_communicator_message const & message)
+void snap_init::release_start_slot( service::pointer_t s )
 {
-    if(f_listener_connection)
+    if(f_starting_services.erase(s) == 0)
     {
-        f_listener_connection->send_message(message);
+        return;
+    }
+
+    // forget about services which were removed in the meantime
+    //
+    f_waiting_services.erase(
+            std::remove_if(
+                    f_waiting_services.begin(),
+                    f_waiting_services.end(),
+                    [](auto const & w)
+                    {
+                        return !w.lock();
+                    }),
+            f_waiting_services.end());
+
+    std::sort(
+            f_waiting_services.begin(),
+            f_waiting_services.end(),
+            [](auto const & a, auto const & b)
+            {
+                service::pointer_t const svc_a(a.lock());
+                service::pointer_t const svc_b(b.lock());
+                if(svc_a->get_start_level() != svc_b->get_start_level())
+                {
+                    return svc_a->get_start_level() < svc_b->get_start_level();
+                }
+                return *svc_a < *svc_b;
+            });
+
+    // the services call request_start_slot() again from their timer
+    // so we do not reserve the slots here
+    //
+    size_t const available(f_max_parallel_starts - f_starting_services.size());
+    size_t const count(std::min(available, f_waiting_services.size()));
+    for(size_t idx(0); idx < count; ++idx)
+    {
+        f_waiting_services[idx].lock()->wakeup_start();
     }
+    f_waiting_services.erase(f_waiting_services.begin(), f_waiting_services.begin() + count);
 }
 
 
-/** \brief List the servers we are starting to the log.
- *
- * This function prints out the list of services that this instance
- * of snapinit is managing.
+/** \brief Release the start slot of a service which takes too long.
  *
- * The list may be shorten as time goes if some services die too
- * many times. This gives you an exact list on startup.
+ * A process which never registers, never sends its SAFE message, and
+ * does not die would keep its start slot forever and the startup would
+ * stall once max_parallel_starts services are in that situation. After
+ * start_timeout seconds, the slot gets released so the other services
+ * can start. The process itself keeps running.
  *
- * Note that services marked as disabled in the snapinit.xml file
- * are not loaded at all so they will not make it to the log from
- * this function.
+ * \param[in] s  The service which process did not register yet.
  */
-void snap_init::log_selected_servers() const
+void snap_init::start_slot_timeout( service::pointer_t s )
 {
-    std::stringstream ss;
-    ss << "Enabled servers:";
-
-    auto log_service_name = [&ss](auto const & svc)
+    auto const it(f_starting_services.find(s));
+    if(it == f_starting_services.end()
+    || f_start_timeout == 0
+    || snap::snap_communicator::get_current_date() < it->second + f_start_timeout)
     {
-        if(svc)
-        {
-            ss << " [" << svc->get_service_name() << "]";
-        }
-    };
+        return;
+    }
 
-    std::for_each( std::begin(f_service_list), std::end(f_service_list), log_service_name );
+    SNAP_LOG_WARNING("service \"")
+                    (s->get_service_name())
+                    ("\" did not register within ")
+                    (f_start_timeout / common::SECONDS_TO_MICROSECONDS)
+                    (" seconds, its start slot is given to the next service.");
 
-    SNAP_LOG_INFO(ss.str());
+    release_start_slot(s);
 }
 
 
-
 /** \brief Find who depends on the named service.
  *
  * \note
@@ -2217,23 +3966,51 @@ void snap_init::get_prereqs_list( QString const & service_name, service::weak_ve
         return;
     }
 
-    // check whether each 'service' is a dependency of 'service_name'
+    // the reverse dependency index gives us the services that
+    // depend on 'service_name'; ignore those that were removed
     //
-    std::for_each(
-            f_service_list.begin(),
-            f_service_list.end(),
-            [&service_name, &ret_list](auto const & svc)
-            {
-                if(svc)
-                {
-                    //SNAP_LOG_TRACE( "snap_init::get_prereqs_list(): the_service='")(service_name)("', service='")(service->get_service_name());
-                    if( svc->is_dependency_of( service_name ) )
-                    {
-                        //SNAP_LOG_TRACE("   snap_init::get_prereqs_list(): adding service '")(service->get_service_name());
-                        ret_list.push_back(svc);
-                    }
-                }
-            });
+    auto const prereqs(f_prereqs_by_name.find(service_name));
+    if(prereqs == f_prereqs_by_name.end())
+    {
+        return;
+    }
+    for(auto const & weak_svc : prereqs->second)
+    {
+        service::pointer_t const svc(weak_svc.lock());
+        if(svc
+        && get_service(svc->get_service_name()) == svc)
+        {
+            //SNAP_LOG_TRACE("   snap_init::get_prereqs_list(): adding service '")(svc->get_service_name());
+            ret_list.push_back(svc);
+        }
+    }
+}
+
+
+/** \brief Find the running services which have to stop before \p s.
+ *
+ * On a full stop, the snapcommunicator has to remain available until
+ * all the other services are gone since their STOP messages go through
+ * it. This function returns all the services which still have a
+ * running process, except \p s and the snapinit service.
+ *
+ * \param[in] s  The service which wants to stop.
+ * \param[out] ret_list  The services to wait on.
+ */
+void snap_init::get_stop_blockers( service::pointer_t s, service::weak_vector_t & ret_list ) const
+{
+    ret_list.clear();
+
+    for(auto const & svc : f_service_list)
+    {
+        if(svc
+        && svc != s
+        && svc != f_snapinit_service
+        && svc->is_running())
+        {
+            ret_list.push_back(svc);
+        }
+    }
 }
 
 
@@ -2245,23 +4022,82 @@ void snap_init::get_prereqs_list( QString const & service_name, service::weak_ve
  */
 service::pointer_t snap_init::get_service( QString const & service_name ) const
 {
-    auto get_service_name = [service_name]( auto const & svc )
+    auto const iter(f_service_by_name.find(service_name));
+    if( iter == f_service_by_name.end() )
     {
-        if(svc)
-        {
-            return svc->get_service_name() == service_name;
-        }
-        return false;
-    };
-    //
-    auto iter = std::find_if( f_service_list.begin(), f_service_list.end(), get_service_name );
-    //
-    if( iter == f_service_list.end() )
+        return service::pointer_t();
+    }
+
+    return iter->second;
+}
+
+
+/** \brief Save the PID of a service process in our PID index.
+ *
+ * Whenever a process gets started, its PID is saved in the snapinit
+ * PID index. This allows the SIGCHLD handler (service_died()) and the
+ * SAFE message handler to find the service of a process in constant
+ * time instead of searching the whole list of services each time.
+ *
+ * \param[in] pid  The PID of the process that was just started.
+ * \param[in] s  The service attached to that process.
+ */
+void snap_init::register_service_pid( pid_t pid, service::pointer_t s )
+{
+    f_pid_services[pid] = s;
+}
+
+
+/** \brief Remove a PID from the PID index.
+ *
+ * Once a process died, its PID is not valid anymore (it could even get
+ * reused by the OS for a completely different process) so the process
+ * calls this function to remove it from the PID index.
+ *
+ * \param[in] pid  The PID of the process that just died.
+ */
+void snap_init::unregister_service_pid( pid_t pid )
+{
+    f_pid_services.erase(pid);
+    f_sigchld_pids.erase(pid);
+}
+
+
+/** \brief Supervise a child with SIGCHLD instead of its pidfd.
+ *
+ * When the pidfd supervision is in use but we could not get a pidfd
+ * for a child (i.e. we ran out of file descriptors), the process
+ * calls this function so the SIGCHLD handler checks that child.
+ *
+ * The PID gets removed by unregister_service_pid().
+ *
+ * \param[in] pid  The PID of the child without a pidfd.
+ */
+void snap_init::register_sigchld_pid( pid_t pid )
+{
+    f_sigchld_pids.insert(pid);
+}
+
+
+/** \brief Search a service by the PID of its process.
+ *
+ * This function searches the PID index for the specified \p pid.
+ *
+ * \param[in] pid  The PID of the process to search.
+ *
+ * \return The pointer to the service, may be a nullptr.
+ */
+service::pointer_t snap_init::get_service_by_pid( pid_t pid ) const
+{
+    auto const it(f_pid_services.find(pid));
+    if(it == f_pid_services.end())
     {
         return service::pointer_t();
     }
 
-    return (*iter);
+    // the service may have been removed in the meantime
+    //
+    return it->second.lock();
 }
 
 
@@ -2304,11 +4140,43 @@ service::pointer_t snap_init::get_service( QString const & service_name ) const
  */
 void snap_init::terminate_services()
 {
+    // the startup is over, save what we have so far
+    //
+    if(f_startup_trace)
+    {
+        f_startup_trace->save();
+        f_startup_trace.reset();
+    }
+
     if(f_snapinit_state != snapinit_state_t::SNAPINIT_STATE_STOPPING)
     {
         // change status to STOPPING
         //
-        f_snapinit_state = snapinit_state_t::SNAPINIT_STATE_STOPPING;
+        f_snapinit_state = snapinit_state_t::SNAPINIT_STATE_STOPPING;
+        f_shutdown_date = snap::snap_communicator::get_current_date();
+
+        // "snapinit stop" prints the progress of the shutdown from
+        // this file (see wait_for_stop())
+        //
+        f_stop_progress_fd = ::open(f_stop_progress_filename.toUtf8().data(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if(f_stop_progress_fd == -1)
+        {
+            int const e(errno);
+            SNAP_LOG_WARNING("could not create \"")(f_stop_progress_filename)("\" (errno: ")(e)(" -- ")(strerror(e))("), the shutdown progress will not be reported.");
+        }
+
+        log_shutdown_plan();
+
+        // the services still running once the deadline is reached get
+        // terminated without waiting on their dependencies
+        //
+        if(f_shutdown_timeout > 0)
+        {
+            f_shutdown_timer = std::make_shared<shutdown_impl>(shared_from_this(), f_shutdown_date + f_shutdown_timeout * common::SECONDS_TO_MICROSECONDS);
+            f_shutdown_timer->set_name("snapinit shutdown timer");
+            f_shutdown_timer->set_priority(110);
+            f_communicator->add_connection(f_shutdown_timer);
+        }
 
         // call action_stop() on each service in reverse order
         //
@@ -2330,14 +4198,161 @@ void snap_init::terminate_services()
 }
 
 
-/** \brief Start the snapinit services.
+/** \brief The shutdown deadline was reached.
  *
- * This function starts the Snap! Websites services.
+ * The services which are still around get terminated immediately,
+ * whether the services depending on them are gone or not.
+ */
+void snap_init::shutdown_deadline()
+{
+    SNAP_LOG_WARNING("snapinit did not stop within the shutdown_timeout of ")
+                    (f_shutdown_timeout)
+                    (" seconds, terminating the remaining services.");
+
+    // work on a copy, the list may change under our feet
+    //
+    service::vector_t const services(f_service_list);
+    for(auto const & svc : services)
+    {
+        if(svc)
+        {
+            svc->action_terminate();
+        }
+    }
+}
+
+
+/** \brief Log the order in which the services are going to stop.
+ *
+ * A service stops once all the running services which depend on it
+ * are gone. The services are therefore stopped in waves, the services
+ * of one wave being stopped concurrently. The snapcommunicator is
+ * always part of the last wave.
+ *
+ * The worst case duration is the sum of the largest stop deadline
+ * (stop-timeout plus terminate-timeout) of each wave.
+ */
+void snap_init::log_shutdown_plan() const
+{
+    service::vector_t running;
+    for(auto const & svc : f_service_list)
+    {
+        if(svc
+        && svc != f_snapinit_service
+        && svc->is_running())
+        {
+            running.push_back(svc);
+        }
+    }
+    if(running.empty())
+    {
+        return;
+    }
+
+    // the services depending on a service have a larger start level
+    // so we see them first
+    //
+    std::stable_sort(
+            running.begin(),
+            running.end(),
+            [](auto const & lhs, auto const & rhs)
+            {
+                return lhs->get_start_level() > rhs->get_start_level();
+            });
+
+    std::unordered_map<service const *, int> waves;
+    int last_wave(0);
+    for(auto const & svc : running)
+    {
+        int const wave(waves[svc.get()]);
+        last_wave = std::max(last_wave, wave);
+        for(auto const & weak_dependency : svc->get_depends_list())
+        {
+            service::pointer_t const dependency(weak_dependency.lock());
+            if(dependency
+            && dependency->is_running())
+            {
+                int & w(waves[dependency.get()]);
+                w = std::max(w, wave + 1);
+            }
+        }
+    }
+    if(f_snapcommunicator_service
+    && f_snapcommunicator_service->is_running()
+    && running.size() > 1)
+    {
+        waves[f_snapcommunicator_service.get()] = last_wave + 1;
+        ++last_wave;
+    }
+
+    std::vector<QString> names(last_wave + 1);
+    std::vector<int64_t> deadlines(last_wave + 1);
+    for(auto const & svc : running)
+    {
+        int const wave(waves[svc.get()]);
+        if(!names[wave].isEmpty())
+        {
+            names[wave] += ", ";
+        }
+        names[wave] += svc->get_service_name();
+        deadlines[wave] = std::max(deadlines[wave], svc->get_stop_timeout());
+    }
+
+    QString plan;
+    int64_t worst_case(0);
+    for(int wave(0); wave <= last_wave; ++wave)
+    {
+        if(names[wave].isEmpty())
+        {
+            continue;
+        }
+        plan += QString(" [%1]").arg(names[wave]);
+        worst_case += deadlines[wave];
+    }
+
+    QString const message(QString("shutdown plan:%1 -- worst case: %2 seconds.")
+                            .arg(plan)
+                            .arg(worst_case / common::SECONDS_TO_MICROSECONDS));
+    SNAP_LOG_INFO(message);
+    stop_progress(message);
+}
+
+
+/** \brief Report the progress of the shutdown to "snapinit stop".
+ *
+ * The line is appended to the snapinit-stop.log file found in the
+ * lock directory. The file is left behind once snapinit exits so it
+ * also tells how the last shutdown went.
+ *
+ * \param[in] line  The line to append, without the newline.
+ */
+void snap_init::stop_progress(QString const & line) const
+{
+    if(f_stop_progress_fd == -1)
+    {
+        return;
+    }
+
+    // one write() per line so the reader never sees half a line
+    // unless the disk is full
+    //
+    QByteArray const data((line + "\n").toUtf8());
+    snap::NOTUSED(::write(f_stop_progress_fd, data.data(), data.size()));
+}
+
+
+/** \brief Create the lock file of snapinit.
+ *
+ * The lock file prevents a second snapinit from starting. It includes
+ * the PID of the running snapinit.
  *
  * If the --detach command line option was used, then the function
  * calls fork() to detach the process from the calling shell.
+ *
+ * \return false in the parent of a detached snapinit, which has to
+ *         return immediately, true otherwise.
  */
-void snap_init::start()
+bool snap_init::create_lock_file()
 {
     // The following open() prevents race conditions
     //
@@ -2465,7 +4480,7 @@ void snap_init::start()
             // function, then the file does not get deleted
             //
             f_lock_file.close();
-            return;
+            return false;
         }
 
         // the child goes on
@@ -2479,19 +4494,91 @@ void snap_init::start()
         f_lock_file.flush();
     }
 
+    return true;
+}
+
+
+/** \brief Start the snapinit services.
+ *
+ * This function starts the Snap! Websites services.
+ *
+ * If the --detach command line option was used, then the function
+ * calls fork() to detach the process from the calling shell.
+ *
+ * With the --rehydrate option, the previous snapinit binary executed
+ * us on a REEXEC message. The lock file is already ours and the
+ * services which were running keep running (see rehydrate_services().)
+ */
+void snap_init::start()
+{
+    handoff h;
+    bool const rehydrate(f_opt.is_defined("rehydrate"));
+    if(rehydrate)
+    {
+        if(!h.load(static_cast<int>(f_opt.get_long("rehydrate"))))
+        {
+            common::fatal_error("the state saved by the previous snapinit binary could not be loaded.");
+            snap::NOTREACHED();
+        }
+
+        int lock_fd(-1);
+        for(auto const & entry : h.get_entries())
+        {
+            if(entry.get_command() == "SNAPINIT")
+            {
+                lock_fd = entry.get_integer_parameter("lock");
+                f_start_date = entry.get_parameter("start_date").toLongLong();
+
+                // the previous binary already moved snapinit to its leaf
+                // cgroup, setting up the root again would nest it
+                //
+                if(entry.has_parameter("cgroup_root"))
+                {
+                    f_cgroup_root = entry.get_parameter("cgroup_root");
+                    f_cgroup_root_ready = true;
+                }
+            }
+        }
+        if(!handoff::claim_fd(lock_fd)
+        || !f_lock_file.open(lock_fd, QFile::ReadWrite))
+        {
+            common::fatal_error(QString("Lock file \"%1\" was not passed by the previous snapinit binary.")
+                                .arg(f_lock_filename));
+            snap::NOTREACHED();
+        }
+    }
+    else if(!create_lock_file())
+    {
+        // we are the parent of a detached snapinit
+        //
+        return;
+    }
+
+    // prepare the cgroup root before any child gets created, see
+    // get_cgroup_root()
+    //
+    snap::NOTUSED(get_cgroup_root());
+
     // now we are ready to mark all the services as ready so they get
     // started (by default they are in the DISABLED state)
     //
-    std::for_each(
-            std::begin(f_service_list),
-            std::end(f_service_list),
-            [](auto const & svc)
-            {
-                if(svc)
+    if(rehydrate)
+    {
+        rehydrate_services(h);
+    }
+    else
+    {
+        std::for_each(
+                std::begin(f_service_list),
+                std::end(f_service_list),
+                [](auto const & svc)
                 {
-                    svc->action_ready();
-                }
-            });
+                    if(svc)
+                    {
+                        svc->action_ready();
+                    }
+                });
+    }
 
     // this is to connect to the snapcommunicator
     //
@@ -2521,6 +4608,64 @@ void snap_init::start()
         f_communicator->add_connection(f_ping_server);
     }
 
+    // the timer wheel wakes the services up (i.e. cron ticks, restart
+    // after a pause, STOP escalation...)
+    //
+    {
+        f_timer_wheel->set_name("snapinit timer wheel");
+        f_timer_wheel->set_priority(100);
+        f_communicator->add_connection(f_timer_wheel);
+    }
+
+    // coalesce the changes of status of the services
+    //
+    {
+        f_status_batch = std::make_shared<status_batch>(
+                  f_status_batch_window
+                , f_status_listeners
+                , [this](snap::snap_communicator_message const & message)
+                  {
+                      send_message(message);
+                  });
+        f_status_batch->set_name("snapinit status batch");
+        f_status_batch->set_priority(105);
+        f_communicator->add_connection(f_status_batch);
+    }
+
+    // sample the running services for the STATS message and the
+    // autoscalers
+    //
+    if(f_stats_sample_interval > 0)
+    {
+        f_stats_timer = std::make_shared<stats_impl>(shared_from_this(), f_stats_sample_interval * common::SECONDS_TO_MICROSECONDS);
+        f_stats_timer->set_name("snapinit stats timer");
+        f_stats_timer->set_priority(110);
+        f_communicator->add_connection(f_stats_timer);
+    }
+    else
+    {
+        for(auto const & s : f_service_list)
+        {
+            if(s->get_autoscaler()
+            && s->get_instance() == 0)
+            {
+                SNAP_LOG_WARNING("stats_sample_interval is 0 so service \"")
+                                (s->get_base_name())
+                                ("\" only runs the <min> instances of its <autoscale> tag.");
+            }
+        }
+    }
+
+    // export the metrics if requested
+    //
+    if(!f_metrics_listen.isEmpty())
+    {
+        f_metrics_server = std::make_shared<metrics_server>(f_metrics_listen, [this]() { return generate_metrics(); });
+        f_metrics_server->set_name("snapinit metrics server");
+        f_metrics_server->set_priority(120);
+        f_communicator->add_connection(f_metrics_server);
+    }
+
     // initialize the SIGCHLD signal
     //
     {
@@ -2637,6 +4782,9 @@ void snap_init::start()
  * to be done. If that succeeds, then it attempts to restart the
  * services immediately after that. The restart does not return
  * until itself stopped unless the detach option is used.
+ *
+ * Since stop() returns as soon as the running instance exited, the
+ * new instance starts right away.
  */
 void snap_init::restart()
 {
@@ -2715,6 +4863,26 @@ void snap_init::stop()
 
     SNAP_LOG_INFO("Stop Snap! Websites services (pid = ")(lock_file_pid)(").");
 
+    // get ready to wait before sending the STOP so we do not miss
+    // anything: a pidfd tells us when the running snapinit exits and
+    // an inotify watch on the lock directory tells us when the lock
+    // file goes away and when the progress file gets written to
+    //
+    // the progress file of a previous stop is not of interest
+    //
+    snap::NOTUSED(unlink(f_stop_progress_filename.toUtf8().data()));
+    int const pidfd(lock_file_pid >= 0 ? common::pidfd_open(lock_file_pid) : -1);
+    int const inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if(inotify_fd != -1)
+    {
+        std::string const lock_path(f_opt.get_string("lockdir"));
+        if(inotify_add_watch(inotify_fd, lock_path.c_str(), IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_FROM) == -1)
+        {
+            int const e(errno);
+            SNAP_LOG_WARNING("could not watch \"")(lock_path)("\" (errno: ")(e)(" -- ")(strerror(e))(").");
+        }
+    }
+
     // TODO: check whether the snapcommunicator is running or not
     //       if not, we should look into sending the STOP message
     //       directly to snapinit instead of through the
@@ -2737,37 +4905,206 @@ void snap_init::stop()
 
     // wait for the processes to end and snapinit to delete the lock file
     //
-    // if it takes too long, we will exit the loop and things will
-    // eventually still be running...
+    // if it takes too long, we give up and things will eventually
+    // still be running...
     //
-    for(int idx(0); idx < f_stop_max_wait; ++idx)
+    bool const stopped(wait_for_stop(lock_file_pid, pidfd, inotify_fd));
+    if(pidfd != -1)
+    {
+        ::close(pidfd);
+    }
+    if(inotify_fd != -1)
+    {
+        ::close(inotify_fd);
+    }
+    if(stopped)
     {
-        sleep(1);
+        return;
+    }
 
-        // the lock_file_pid should always be >= 0
-        //
-        if(lock_file_pid >= 0)
+    // it failed...
+    common::fatal_error(QString("snapinit waited for %1 seconds and the running version did not return.")
+                    .arg(f_stop_max_wait));
+    snap::NOTREACHED();
+}
+
+
+/** \brief Run the 'upgrade' command of snapinit.
+ *
+ * This function sends a REEXEC message to the running snapinit which
+ * then executes its binary again without stopping the services (see
+ * reexec().) It is expected to be used after the snapinit package
+ * was upgraded.
+ *
+ * The function does not wait: the running snapinit logs whether the
+ * REEXEC happened or why it was refused.
+ */
+void snap_init::upgrade()
+{
+    if( !is_running() )
+    {
+        common::fatal_error("'snapinit upgrade' called while snapinit is not running.");
+        snap::NOTREACHED();
+    }
+
+    QString udp_addr;
+    int udp_port;
+    get_addr_port_for_snap_communicator( udp_addr, udp_port );
+
+    snap::snap_communicator_message reexec_message;
+    reexec_message.set_service("snapinit");
+    reexec_message.set_command("REEXEC");
+    if(!snap::snap_communicator::snap_udp_server_message_connection::send_message(udp_addr.toUtf8().data(), udp_port, reexec_message))
+    {
+        common::fatal_error("'snapinit upgrade' failed to send the REEXEC message to the running instance.");
+        snap::NOTREACHED();
+    }
+
+    SNAP_LOG_INFO("REEXEC sent to the running snapinit.");
+    if( common::is_a_tty() )
+    {
+        std::cerr << "snapinit: info: REEXEC sent to the running snapinit, see its logs for the result."
+                  << std::endl;
+    }
+}
+
+
+/** \brief Wait for the running snapinit to exit.
+ *
+ * The function sleeps in poll() until the running snapinit process
+ * exits (its pidfd becomes readable) or, when we do not know its PID,
+ * until the lock file gets deleted (an inotify event on the lock
+ * directory.) So we return as soon as the shutdown is over instead of
+ * up to a second later.
+ *
+ * While waiting, the lines that the running snapinit appends to the
+ * snapinit-stop.log file (the shutdown plan and the services as they
+ * stop) are logged and, if we are on a terminal, printed.
+ *
+ * When pidfd and inotify are not available, the function falls back
+ * to checking every 100 ms.
+ *
+ * \param[in] lock_file_pid  The PID of the running snapinit or -1.
+ * \param[in] pidfd  A pidfd of \p lock_file_pid or -1.
+ * \param[in] inotify_fd  An inotify watching the lock directory or -1.
+ *
+ * \return true if snapinit stopped within f_stop_max_wait seconds.
+ */
+bool snap_init::wait_for_stop(pid_t lock_file_pid, int pidfd, int inotify_fd)
+{
+    int progress_fd(-1);
+    QByteArray progress;
+    auto print_progress = [this, &progress_fd, &progress]()
+        {
+            if(progress_fd == -1)
+            {
+                progress_fd = ::open(f_stop_progress_filename.toUtf8().data(), O_RDONLY | O_CLOEXEC);
+                if(progress_fd == -1)
+                {
+                    return;
+                }
+            }
+            for(;;)
+            {
+                char buf[1024];
+                ssize_t const r(::read(progress_fd, buf, sizeof(buf)));
+                if(r <= 0)
+                {
+                    break;
+                }
+                progress.append(buf, static_cast<int>(r));
+            }
+            for(int pos(progress.indexOf('\n')); pos >= 0; pos = progress.indexOf('\n'))
+            {
+                QString const line(QString::fromUtf8(progress.left(pos)));
+                progress.remove(0, pos + 1);
+                SNAP_LOG_INFO("snapinit: ")(line);
+                if(common::is_a_tty())
+                {
+                    std::cout << "snapinit: " << line << std::endl;
+                }
+            }
+        };
+
+    auto is_stopped = [this, lock_file_pid]()
         {
-            if(getpgid(lock_file_pid) < 0)
+            // the lock_file_pid should always be >= 0
+            //
+            if(lock_file_pid >= 0)
             {
                 // errno == ESRCH -- the process does not exist anymore
-                return;
+                //
+                return getpgid(lock_file_pid) < 0;
             }
+            return !f_lock_file.exists();
+        };
+
+    int64_t const deadline(snap::snap_communicator::get_current_date() + f_stop_max_wait * common::SECONDS_TO_MICROSECONDS);
+    bool const event_driven(pidfd != -1 || inotify_fd != -1);
+    for(;;)
+    {
+        print_progress();
+        if(is_stopped())
+        {
+            // the last lines may have been written just before the exit
+            //
+            print_progress();
+            break;
         }
-        else
+
+        int64_t const now(snap::snap_communicator::get_current_date());
+        if(now >= deadline)
+        {
+            break;
+        }
+        int timeout(static_cast<int>((deadline - now + 999) / 1000));
+        if(!event_driven)
+        {
+            timeout = std::min(timeout, 100);
+        }
+
+        struct pollfd fds[2];
+        nfds_t count(0);
+        if(pidfd != -1)
+        {
+            fds[count].fd = pidfd;
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            ++count;
+        }
+        if(inotify_fd != -1)
         {
-            if( !f_lock_file.exists() )
+            fds[count].fd = inotify_fd;
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            ++count;
+        }
+        if(poll(fds, count, timeout) < 0
+        && errno != EINTR)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR("poll() failed while waiting for snapinit to stop (errno: ")(e)(" -- ")(strerror(e))(").");
+            break;
+        }
+
+        // we do not care about the details of the inotify events,
+        // just empty the queue
+        //
+        if(inotify_fd != -1)
+        {
+            char buf[4096];
+            while(::read(inotify_fd, buf, sizeof(buf)) > 0)
             {
-                // it worked!
-                return;
             }
         }
     }
 
-    // it failed...
-    common::fatal_error(QString("snapinit waited for %1 seconds and the running version did not return.")
-                    .arg(f_stop_max_wait));
-    snap::NOTREACHED();
+    if(progress_fd != -1)
+    {
+        ::close(progress_fd);
+    }
+
+    return is_stopped();
 }
 
 
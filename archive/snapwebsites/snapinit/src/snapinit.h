@@ -25,7 +25,14 @@
 
 // ourselves
 //
+#include "cron_spool.h"
+#include "handoff.h"
+#include "message_command.h"
+#include "metrics.h"
 #include "service.h"
+#include "startup_trace.h"
+#include "status_batch.h"
+#include "timer_wheel.h"
 
 // snapwebsites
 //
@@ -45,8 +52,13 @@
 // C++ lib
 //
 #include <functional>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 
 
@@ -72,7 +84,8 @@ public:
         COMMAND_STOP,
         COMMAND_RESTART,
         COMMAND_LIST,
-        COMMAND_TREE
+        COMMAND_TREE,
+        COMMAND_UPGRADE
     };
 
     /** \brief Handle incoming messages from Snap Communicator server.
@@ -311,6 +324,75 @@ public:
             f_snap_init->user_signal_caught("SIGINT");
         }
 
+    private:
+        // this is owned by a server function so no need for a smart pointer
+        snap_init::pointer_t f_snap_init;
+    };
+
+    /** \brief Sample the resource usage of the services.
+     *
+     * This class is an implementation of the snap timer connection so
+     * the running services get sampled at a regular interval.
+     */
+    class stats_impl
+            : public snap::snap_communicator::snap_timer
+    {
+    public:
+        typedef std::shared_ptr<stats_impl>    pointer_t;
+
+        /** \brief The stats timer initialization.
+         *
+         * \param[in] si  The snap init object we are sampling for.
+         * \param[in] interval  The sampling interval in microseconds.
+         */
+        stats_impl(snap_init::pointer_t si, int64_t interval)
+            : snap_timer(interval)
+            , f_snap_init(si)
+        {
+        }
+
+        // snap::snap_communicator::snap_timer implementation
+        virtual void process_timeout() override
+        {
+            f_snap_init->sample_services();
+        }
+
+    private:
+        // this is owned by a server function so no need for a smart pointer
+        snap_init::pointer_t f_snap_init;
+    };
+
+    /** \brief Enforce the shutdown deadline.
+     *
+     * This class is an implementation of the snap timer connection so
+     * the services which did not stop within shutdown_timeout seconds
+     * get terminated without waiting for their dependencies.
+     */
+    class shutdown_impl
+            : public snap::snap_communicator::snap_timer
+    {
+    public:
+        typedef std::shared_ptr<shutdown_impl>    pointer_t;
+
+        /** \brief The shutdown timer initialization.
+         *
+         * \param[in] si  The snap init object being stopped.
+         * \param[in] deadline  The date when the timer times out, in microseconds.
+         */
+        shutdown_impl(snap_init::pointer_t si, int64_t deadline)
+            : snap_timer(-1)
+            , f_snap_init(si)
+        {
+            set_timeout_date(deadline);
+        }
+
+        // snap::snap_communicator::snap_timer implementation
+        virtual void process_timeout() override
+        {
+            set_enable(false);
+            f_snap_init->shutdown_deadline();
+        }
+
     private:
         // this is owned by a server function so no need for a smart pointer
         snap_init::pointer_t f_snap_init;
@@ -326,21 +408,48 @@ public:
     void                        process_message(snap::snap_communicator_message const & message, bool udp);
     void                        service_died();
     void                        terminate_services();
+    void                        shutdown_deadline();
     void                        remove_service(service::pointer_t s);
+    void                        retire_service(service::pointer_t s, service::pointer_t replacement);
+    void                        start_replacement(service::pointer_t replacement);
+    void                        take_over(service::pointer_t s, service::pointer_t replacement);
+    void                        restart_service(QString const & service_name);
     void                        user_signal_caught(char const * sig_name);
+    void                        sample_services();
+    void                        autoscale_services();
+    void                        service_status_changed(service::pointer_t s);
+    void                        record_reap_duration(int64_t duration);
+    std::string                 generate_metrics() const;
     QString const &             get_spool_path() const;
+    cron_spool &                get_cron_spool();
     QString const &             get_server_name() const;
     bool                        get_debug() const;
+    bool                        get_pidfd_supervision() const;
+    bool                        get_vfork_spawn() const;
+    QString const &             get_cgroup_root();
+    backoff const &             get_default_backoff() const;
+    int64_t                     get_default_stop_timeout() const;
+    int64_t                     get_default_terminate_timeout() const;
+    int64_t                     get_start_timeout() const;
     QString const &             get_data_path() const;
     service::pointer_t          get_snapcommunicator_service() const;
     void                        send_message(snap::snap_communicator_message const & message);
 
     void                        get_prereqs_list( QString const & service_name, service::weak_vector_t & ret_list ) const;
+    void                        get_stop_blockers( service::pointer_t s, service::weak_vector_t & ret_list ) const;
     service::pointer_t          get_service( QString const & service_name ) const;
+    void                        register_service_pid( pid_t pid, service::pointer_t s );
+    void                        unregister_service_pid( pid_t pid );
+    void                        register_sigchld_pid( pid_t pid );
+    bool                        request_start_slot( service::pointer_t s );
+    void                        release_start_slot( service::pointer_t s );
+    void                        start_slot_timeout( service::pointer_t s );
+    startup_trace::pointer_t    get_startup_trace() const;
+    timer_wheel::pointer_t      get_timer_wheel() const;
+    void                        check_startup_trace();
 
 private:
-    typedef std::function<void(snap::snap_communicator_message const &)>    message_func_t;
-    typedef std::map<QString, message_func_t>                               message_func_map_t;
+    typedef std::unordered_map<pid_t, service::weak_pointer_t>              pid_service_map_t;
 
     enum class snapinit_state_t
     {
@@ -354,23 +463,50 @@ private:
 
     void                        usage();
     void                        init();
-    void                        init_message_functions();
+    void                        msg_getstatus(snap::snap_communicator_message const & message);
+    void                        msg_help(snap::snap_communicator_message const & message);
+    void                        msg_load(snap::snap_communicator_message const & message);
+    void                        msg_log(snap::snap_communicator_message const & message);
+    void                        msg_ready(snap::snap_communicator_message const & message);
+    void                        msg_reexec(snap::snap_communicator_message const & message);
+    void                        msg_reloadconfig(snap::snap_communicator_message const & message);
+    void                        msg_restart(snap::snap_communicator_message const & message);
+    void                        msg_safe(snap::snap_communicator_message const & message);
+    void                        msg_stats(snap::snap_communicator_message const & message);
+    void                        msg_status(snap::snap_communicator_message const & message);
+    void                        msg_stop(snap::snap_communicator_message const & message);
+    void                        msg_unknown(snap::snap_communicator_message const & message);
     static void                 sighandler( int sig );
     bool                        is_running() const;
-    void                        xml_to_service(QDomDocument doc, QString const & xml_services_filename, std::vector<QString> & common_options);
+    void                        load_default_backoff();
+    void                        load_stop_timeouts();
+    bool                        load_services(service::vector_t & services, std::vector<QString> & common_options, bool reload);
+    service::vector_t           xml_to_service(QDomDocument doc, QString const & xml_services_filename, std::vector<QString> & common_options);
+    void                        add_service(service::pointer_t s);
+    void                        relink_services();
+    void                        reload_configuration();
     void                        log_selected_servers() const;
+    bool                        create_lock_file();
     void                        start();
     void                        restart();
     void                        stop();
+    void                        upgrade();
+    void                        reexec();
+    void                        rehydrate_services(handoff const & h);
     void                        create_service_tree();
     void                        get_addr_port_for_snap_communicator( QString & udp_addr, int & udp_port ); // for UDP on "stop"
     void                        remove_lock(bool force = false) const;
+    service::pointer_t          get_service_by_pid( pid_t pid ) const;
+    void                        child_exited( pid_t died_pid, int status, struct rusage const & usage );
+    void                        compute_start_levels();
+    void                        log_shutdown_plan() const;
+    void                        stop_progress(QString const & line) const;
+    bool                        wait_for_stop(pid_t lock_file_pid, int pidfd, int inotify_fd);
+    QString const &             get_services_list();
 
     // some snapinit internal values
     //
     static pointer_t                    f_instance;
-    message_func_map_t                  f_udp_message_map;
-    message_func_map_t                  f_tcp_message_map;
 
     // snapinit current state
     snapinit_state_t                    f_snapinit_state = snapinit_state_t::SNAPINIT_STATE_READY;
@@ -378,6 +514,7 @@ private:
     // command line and .conf configuration
     //
     advgetopt::getopt                   f_opt;
+    std::vector<std::string>            f_argv;                 // to execute ourselves again on REEXEC
     snap::snap_config                   f_config;
     QString                             f_log_conf = "/etc/snapwebsites/snapinit.properties";
     command_t                           f_command = command_t::COMMAND_UNKNOWN;
@@ -385,22 +522,61 @@ private:
     QString                             f_server_name;
     QString                             f_lock_filename;
     QFile                               f_lock_file;
+    QString                             f_stop_progress_filename;
+    int                                 f_stop_progress_fd = -1;    // open while the running instance stops
     QString                             f_data_path = "/var/lib/snapwebsites";
     QString                             f_spool_path = "/var/spool/snapwebsites/snapinit";
     mutable bool                        f_spool_directory_created = false;
-    service::vector_t                   f_service_list;
+    cron_spool                          f_cron_spool;
+    cron_spool::sync_t                  f_cron_spool_sync = cron_spool::sync_t::SYNC_ASYNC;
+    bool                                f_cron_spool_opened = false;
+    service::vector_t                   f_service_list;         // sorted by priority, defines the start order
+    service::hash_t                     f_service_by_name;      // name -> service
+    service::weak_hash_t                f_prereqs_by_name;      // name -> services depending on that name
+    pid_service_map_t                   f_pid_services;
+    std::unordered_set<pid_t>           f_sigchld_pids;         // children without a pidfd when f_pidfd_supervision is true
+    std::unordered_set<pid_t>           f_orphan_pids;          // children of the previous binary which service was removed
+    bool                                f_pidfd_supervision = false;
+    bool                                f_vfork_spawn = true;
+    QString                             f_cgroup_root;
+    bool                                f_cgroup_root_ready = false;
+    size_t                              f_max_parallel_starts = 0;  // 0 means no limit
+    int64_t                             f_start_timeout = 60LL * 1000000LL;  // in microseconds, 0 turns it off
+    std::map<service::pointer_t, int64_t> f_starting_services;      // services with a process not yet registered -> date the slot was taken
+    service::weak_vector_t              f_waiting_services;     // services waiting for a start slot
+    startup_trace::pointer_t            f_startup_trace;
     int                                 f_stop_max_wait = 60;
+    int64_t                             f_default_stop_timeout = service::SERVICE_STOP_DELAY;
+    int64_t                             f_default_terminate_timeout = service::SERVICE_TERMINATE_DELAY;
+    int                                 f_shutdown_timeout = 0;         // in seconds, 0 means no global deadline
+    int64_t                             f_shutdown_date = 0;            // date when terminate_services() was first called
+    backoff                             f_default_backoff;
     service::pointer_t                  f_snapinit_service;
     service::pointer_t                  f_snapcommunicator_service;
+    std::vector<QString>                f_common_options;       // options added to the command line of all the services
 
     // snap communicator
     snap::snap_communicator::pointer_t  f_communicator;
+    timer_wheel::pointer_t              f_timer_wheel;
     listener_impl::pointer_t            f_listener_connection;
     ping_impl::pointer_t                f_ping_server;
     sigchld_impl::pointer_t             f_child_signal;
     sigterm_impl::pointer_t             f_term_signal;
     sigquit_impl::pointer_t             f_quit_signal;
     sigint_impl::pointer_t              f_int_signal;
+    stats_impl::pointer_t               f_stats_timer;
+    shutdown_impl::pointer_t            f_shutdown_timer;
+    QString                             f_metrics_listen;       // empty when the metrics are turned off
+    metrics_server::pointer_t           f_metrics_server;
+    int64_t                             f_tcp_message_counts[MESSAGE_COMMAND_COUNT] = {};
+    int64_t                             f_udp_message_counts[MESSAGE_COMMAND_COUNT] = {};
+    metrics_summary                     f_reap_duration;
+    int64_t                             f_start_date = 0;
+    status_batch::pointer_t             f_status_batch;
+    int64_t                             f_status_batch_window = 250LL * 1000LL;  // in microseconds
+    snap::snap_string_list              f_status_listeners;
+    QString                             f_services_list;        // cached SERVICES list, empty when it has to be regenerated
+    int                                 f_stats_sample_interval = 60;   // in seconds, 0 turns off the sampling
     QString                             f_udp_addr;
     int                                 f_udp_port = 4039;
 };
@@ -0,0 +1,429 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- trace the startup of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "startup_trace.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+#include "snap_communicator.h"
+
+// C++ lib
+//
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// C lib
+//
+#include <stdio.h>
+
+
+/** \file
+ * \brief Measure the time it takes to start each service.
+ *
+ * When snapinit is started with the --trace-startup command line option,
+ * it records the time at which each service goes through the following
+ * steps:
+ *
+ * \li the service enters the READY state;
+ * \li all the dependencies are registered, the process gets created;
+ * \li fork() or clone() returned; with the default vfork spawn mode this
+ *     includes the execv() since the parent is suspended until then;
+ * \li the process registered with snapcommunicator (or sent its SAFE
+ *     message) or it died.
+ *
+ * Once all the services are done starting (or snapinit is asked to
+ * stop) the trace is saved in two files: \<filename>.json, a Chrome
+ * trace-event file which can be loaded in chrome://tracing, and
+ * \<filename>.txt, a summary with the critical path (the chain of
+ * services which registered last.)
+ */
+
+
+namespace snapinit
+{
+
+
+namespace
+{
+
+
+/** \brief Convert a string to a JSON string, quotes included.
+ *
+ * The double quotes, backslashes, and control characters get escaped.
+ *
+ * \param[in] str  The string to convert.
+ *
+ * \return The JSON string in UTF-8.
+ */
+std::string json_string(QString const & str)
+{
+    std::string const utf8(str.toUtf8().data());
+    std::string result("\"");
+    for(auto const c : utf8)
+    {
+        switch(c)
+        {
+        case '"':
+            result += "\\\"";
+            break;
+
+        case '\\':
+            result += "\\\\";
+            break;
+
+        case '\n':
+            result += "\\n";
+            break;
+
+        case '\r':
+            result += "\\r";
+            break;
+
+        case '\t':
+            result += "\\t";
+            break;
+
+        default:
+            if(static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+                result += buf;
+            }
+            else
+            {
+                result += c;
+            }
+            break;
+
+        }
+    }
+    result += '"';
+    return result;
+}
+
+
+}
+// no name namespace
+
+
+
+/////////////////////////////////////////////////
+// STARTUP TRACE (class implementation)        //
+/////////////////////////////////////////////////
+
+
+/** \brief Initialize the startup trace.
+ *
+ * \param[in] filename  The path and base name of the trace files, the
+ *                      ".json" and ".txt" extensions get appended.
+ */
+startup_trace::startup_trace(QString const & filename)
+    : f_filename(filename)
+    , f_start(snap::snap_communicator::get_current_date())
+{
+}
+
+
+/** \brief Add a service to the trace.
+ *
+ * Only services added with this function get traced. The other events
+ * are ignored.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in] start_level  The topological level of the service.
+ * \param[in] depends  The names of the services this service depends on.
+ */
+void startup_trace::add_service(QString const & service_name, int start_level, snap::snap_string_list const & depends)
+{
+    service_trace_t & trace(f_traces[service_name]);
+    trace.f_service_name = service_name;
+    trace.f_start_level = start_level;
+    trace.f_depends = depends;
+    f_order.push_back(service_name);
+}
+
+
+void startup_trace::service_ready(QString const & service_name)
+{
+    service_trace_t * trace(get_trace(service_name));
+    if(trace != nullptr
+    && trace->f_ready == 0)
+    {
+        trace->f_ready = snap::snap_communicator::get_current_date();
+    }
+}
+
+
+void startup_trace::process_starting(QString const & service_name)
+{
+    service_trace_t * trace(get_trace(service_name));
+    if(trace != nullptr
+    && trace->f_starting == 0)
+    {
+        trace->f_starting = snap::snap_communicator::get_current_date();
+    }
+}
+
+
+void startup_trace::process_spawned(QString const & service_name)
+{
+    service_trace_t * trace(get_trace(service_name));
+    if(trace != nullptr
+    && trace->f_spawned == 0)
+    {
+        trace->f_spawned = snap::snap_communicator::get_current_date();
+    }
+}
+
+
+void startup_trace::process_registered(QString const & service_name)
+{
+    service_trace_t * trace(get_trace(service_name));
+    if(trace != nullptr
+    && trace->f_registered == 0
+    && trace->f_died == 0)
+    {
+        trace->f_registered = snap::snap_communicator::get_current_date();
+    }
+}
+
+
+void startup_trace::process_died(QString const & service_name)
+{
+    service_trace_t * trace(get_trace(service_name));
+    if(trace != nullptr
+    && trace->f_starting != 0
+    && trace->f_registered == 0
+    && trace->f_died == 0)
+    {
+        trace->f_died = snap::snap_communicator::get_current_date();
+    }
+}
+
+
+/** \brief Check whether all the traced services are done starting.
+ *
+ * \return true if each service registered or died.
+ */
+bool startup_trace::is_complete() const
+{
+    return std::all_of(
+            f_traces.begin(),
+            f_traces.end(),
+            [](auto const & t)
+            {
+                return t.second.f_registered != 0
+                    || t.second.f_died != 0;
+            });
+}
+
+
+/** \brief Save the trace files.
+ *
+ * This function saves the Chrome trace-event JSON file and the text
+ * summary. Services which did not finish starting are included as
+ * such.
+ */
+void startup_trace::save() const
+{
+    save_json();
+    save_summary();
+}
+
+
+startup_trace::service_trace_t * startup_trace::get_trace(QString const & service_name)
+{
+    auto it(f_traces.find(service_name));
+    if(it == f_traces.end())
+    {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+
+/** \brief Compute the time at which a service was done starting.
+ *
+ * \param[in] trace  The trace of the service.
+ *
+ * \return The time when the process registered or died, 0 if neither
+ *         happened yet.
+ */
+int64_t startup_trace::end_of(service_trace_t const & trace) const
+{
+    return trace.f_registered != 0 ? trace.f_registered : trace.f_died;
+}
+
+
+void startup_trace::save_json() const
+{
+    QString const filename(f_filename + ".json");
+    std::ofstream json;
+    json.open(filename.toUtf8().data());
+    if(!json.is_open())
+    {
+        SNAP_LOG_ERROR("could not create startup trace file \"")(filename)("\".");
+        return;
+    }
+
+    json << "{\"traceEvents\":[" << std::endl;
+
+    bool first(true);
+    auto const event([&json, &first, this](int tid, char const * name, int64_t start, int64_t end)
+        {
+            if(start == 0 || end == 0 || end < start)
+            {
+                return;
+            }
+            if(!first)
+            {
+                json << "," << std::endl;
+            }
+            first = false;
+            json << "{\"name\":" << json_string(QString::fromUtf8(name))
+                 << ",\"cat\":\"snapinit\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                 << ",\"ts\":" << (start - f_start)
+                 << ",\"dur\":" << (end - start)
+                 << "}";
+        });
+
+    int tid(0);
+    for(auto const & name : f_order)
+    {
+        ++tid;
+        service_trace_t const & trace(f_traces.at(name));
+
+        // name the "thread" after the service
+        //
+        if(!first)
+        {
+            json << "," << std::endl;
+        }
+        first = false;
+        json << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+             << ",\"args\":{\"name\":" << json_string(QString("%1 (level %2)")
+                                                            .arg(trace.f_service_name)
+                                                            .arg(trace.f_start_level))
+             << "}}";
+
+        event(tid, "wait on dependencies", trace.f_ready, trace.f_starting);
+        event(tid, "spawn", trace.f_starting, trace.f_spawned);
+        event(tid, "wait on registration", trace.f_spawned, end_of(trace));
+    }
+
+    json << std::endl << "]}" << std::endl;
+}
+
+
+void startup_trace::save_summary() const
+{
+    QString const filename(f_filename + ".txt");
+    std::ofstream txt;
+    txt.open(filename.toUtf8().data());
+    if(!txt.is_open())
+    {
+        SNAP_LOG_ERROR("could not create startup trace file \"")(filename)("\".");
+        return;
+    }
+
+    auto const ms([](int64_t start, int64_t end)
+        {
+            if(start == 0 || end == 0 || end < start)
+            {
+                return std::string("-");
+            }
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(1) << static_cast<double>(end - start) / 1000.0;
+            return ss.str();
+        });
+
+    txt << "snapinit startup trace (times in ms)" << std::endl
+        << std::endl
+        << std::left << std::setw(24) << "service"
+        << std::right << std::setw(6) << "level"
+        << std::setw(12) << "deps"
+        << std::setw(12) << "spawn"
+        << std::setw(12) << "register"
+        << std::setw(12) << "total"
+        << "  status" << std::endl;
+    for(auto const & name : f_order)
+    {
+        service_trace_t const & trace(f_traces.at(name));
+        int64_t const end(end_of(trace));
+        txt << std::left << std::setw(24) << trace.f_service_name.toUtf8().data()
+            << std::right << std::setw(6) << trace.f_start_level
+            << std::setw(12) << ms(trace.f_ready, trace.f_starting)
+            << std::setw(12) << ms(trace.f_starting, trace.f_spawned)
+            << std::setw(12) << ms(trace.f_spawned, end)
+            << std::setw(12) << ms(f_start, end)
+            << "  " << (trace.f_registered != 0 ? "registered" : (trace.f_died != 0 ? "died" : "not started"))
+            << std::endl;
+    }
+
+    // the critical path starts with the service which was done last
+    // and goes back through the dependency which was done last
+    //
+    service_trace_t const * last(nullptr);
+    for(auto const & t : f_traces)
+    {
+        if(last == nullptr
+        || end_of(t.second) > end_of(*last))
+        {
+            last = &t.second;
+        }
+    }
+
+    txt << std::endl << "critical path:" << std::endl;
+    while(last != nullptr
+       && end_of(*last) != 0)
+    {
+        txt << "  " << last->f_service_name.toUtf8().data()
+            << " done at " << ms(f_start, end_of(*last))
+            << " (deps " << ms(last->f_ready, last->f_starting)
+            << ", spawn " << ms(last->f_starting, last->f_spawned)
+            << ", register " << ms(last->f_spawned, end_of(*last))
+            << ")" << std::endl;
+
+        service_trace_t const * blocker(nullptr);
+        for(auto const & d : last->f_depends)
+        {
+            auto const it(f_traces.find(d));
+            if(it != f_traces.end()
+            && end_of(it->second) != 0
+            && (blocker == nullptr || end_of(it->second) > end_of(*blocker)))
+            {
+                blocker = &it->second;
+            }
+        }
+        last = blocker;
+    }
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
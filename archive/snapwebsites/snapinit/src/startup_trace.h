@@ -0,0 +1,94 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- trace the startup of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// snapwebsites lib
+//
+#include <snapwebsites/snap_string_list.h>
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace snapinit
+{
+
+
+class startup_trace
+{
+public:
+    typedef std::shared_ptr<startup_trace>  pointer_t;
+
+                            startup_trace(QString const & filename);
+                            startup_trace(startup_trace const & rhs) = delete;
+    startup_trace &         operator = (startup_trace const & rhs) = delete;
+
+    void                    add_service(QString const & service_name, int start_level, snap::snap_string_list const & depends);
+
+    void                    service_ready(QString const & service_name);
+    void                    process_starting(QString const & service_name);
+    void                    process_spawned(QString const & service_name);
+    void                    process_registered(QString const & service_name);
+    void                    process_died(QString const & service_name);
+
+    bool                    is_complete() const;
+    void                    save() const;
+
+private:
+    struct service_trace_t
+    {
+        QString                 f_service_name;
+        int                     f_start_level = 0;
+        snap::snap_string_list  f_depends;
+        int64_t                 f_ready = 0;            // service entered READY
+        int64_t                 f_starting = 0;         // dependencies satisfied, process being created
+        int64_t                 f_spawned = 0;          // fork()/clone() returned
+        int64_t                 f_registered = 0;       // process registered (or sent its SAFE message)
+        int64_t                 f_died = 0;             // process died before registering
+    };
+
+    typedef std::unordered_map<QString, service_trace_t, common::qstring_hash>  trace_map_t;
+
+    service_trace_t *       get_trace(QString const & service_name);
+    int64_t                 end_of(service_trace_t const & trace) const;
+    void                    save_json() const;
+    void                    save_summary() const;
+
+    QString                 f_filename;
+    int64_t                 f_start = 0;
+    trace_map_t             f_traces;
+    std::vector<QString>    f_order;                    // order in which services were added
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,205 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- batched service status notifications
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "status_batch.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+
+
+/** \file
+ * \brief Send the changes of status of the services in batches.
+ *
+ * The services change status often (a cron task starts and stops every
+ * few minutes, a service which crashes gets restarted, etc.) Instead of
+ * sending one message per change, the changes are coalesced for a short
+ * window and then sent in one SERVICESTATUS message to each of the
+ * listeners defined in snapinit.conf (status_listeners).
+ *
+ * The message only includes the services which status changed since
+ * the last message (a delta), in the "changes" parameter, as a comma
+ * separated list of \<service>=\<status>. A service which goes down and
+ * back up within the window is not included at all.
+ *
+ * Each message has a "sequence" number. A listener which notices a gap
+ * in the sequence, or which just started, sends a GETSTATUS message
+ * to snapinit and receives a SERVICESTATUS message with "full" set to
+ * "true" and the status of all the services.
+ */
+
+
+namespace snapinit
+{
+
+
+
+/////////////////////////////////////////////////
+// STATUS BATCH (class implementation)         //
+/////////////////////////////////////////////////
+
+
+/** \brief Initialize the status batch.
+ *
+ * The timer is disabled until a change of status arrives.
+ *
+ * \param[in] window  How long to coalesce the changes, in microseconds.
+ * \param[in] listeners  The names of the services to send the deltas to.
+ * \param[in] send  The function used to send the messages.
+ */
+status_batch::status_batch(int64_t window, snap::snap_string_list const & listeners, send_t send)
+    : snap_timer(-1)
+    , f_window(window)
+    , f_listeners(listeners)
+    , f_send(send)
+{
+    set_enable(false);
+}
+
+
+/** \brief Record the new status of a service.
+ *
+ * The first change after a flush starts the coalescing window.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in] status  Its new status ("up", "starting", "down", etc.)
+ */
+void status_batch::service_changed(QString const & service_name, QString const & status)
+{
+    QString & current(f_current[service_name]);
+    if(current == status)
+    {
+        return;
+    }
+    current = status;
+    f_pending.insert(service_name);
+
+    if(!is_enabled())
+    {
+        set_timeout_date(snap::snap_communicator::get_current_date() + f_window);
+        set_enable(true);
+    }
+}
+
+
+/** \brief Send the status of all the services.
+ *
+ * The pending changes are sent to the listeners first so the snapshot
+ * has the same sequence number as the last delta.
+ *
+ * \param[in] server  The server to send the snapshot to.
+ * \param[in] service  The service to send the snapshot to.
+ */
+void status_batch::send_snapshot(QString const & server, QString const & service)
+{
+    flush();
+
+    QString changes;
+    for(auto const & s : f_current)
+    {
+        if(!changes.isEmpty())
+        {
+            changes += ",";
+        }
+        changes += s.first + "=" + s.second;
+    }
+
+    snap::snap_communicator_message message(create_message(true, changes));
+    message.set_server(server);
+    message.set_service(service);
+    f_send(message);
+}
+
+
+/** \brief The coalescing window is over, send the delta.
+ */
+void status_batch::process_timeout()
+{
+    flush();
+}
+
+
+/** \brief Send the pending changes to the listeners.
+ *
+ * A service which status went back to the status last sent is not
+ * included. If nothing changed, no message is sent and the sequence
+ * number does not change.
+ */
+void status_batch::flush()
+{
+    set_enable(false);
+
+    QString changes;
+    for(auto const & name : f_pending)
+    {
+        QString const & status(f_current[name]);
+        QString & published(f_published[name]);
+        if(published == status)
+        {
+            continue;
+        }
+        published = status;
+        if(!changes.isEmpty())
+        {
+            changes += ",";
+        }
+        changes += name + "=" + status;
+    }
+    f_pending.clear();
+
+    if(changes.isEmpty())
+    {
+        return;
+    }
+
+    ++f_sequence;
+    for(auto const & listener : f_listeners)
+    {
+        snap::snap_communicator_message message(create_message(false, changes));
+        message.set_service(listener);
+        f_send(message);
+    }
+}
+
+
+/** \brief Create a SERVICESTATUS message.
+ *
+ * \param[in] full  Whether the message includes all the services.
+ * \param[in] changes  The list of \<service>=\<status>.
+ *
+ * \return The message, without a destination.
+ */
+snap::snap_communicator_message status_batch::create_message(bool full, QString const & changes) const
+{
+    snap::snap_communicator_message message;
+    message.set_command("SERVICESTATUS");
+    message.add_parameter("sequence", QString("%1").arg(f_sequence));
+    message.add_parameter("full", full ? "true" : "false");
+    message.add_parameter("changes", changes);
+    return message;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
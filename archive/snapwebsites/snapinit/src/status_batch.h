@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- batched service status notifications
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "common.h"
+
+// snapwebsites lib
+//
+#include "snap_communicator.h"
+#include "snap_string_list.h"
+
+// Qt lib
+//
+#include <QString>
+
+// C++ lib
+//
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+
+namespace snapinit
+{
+
+
+class status_batch
+        : public snap::snap_communicator::snap_timer
+{
+public:
+    typedef std::shared_ptr<status_batch>                                       pointer_t;
+    typedef std::function<void(snap::snap_communicator_message const &)>        send_t;
+
+                            status_batch(int64_t window, snap::snap_string_list const & listeners, send_t send);
+                            status_batch(status_batch const & rhs) = delete;
+    status_batch &          operator = (status_batch const & rhs) = delete;
+
+    void                    service_changed(QString const & service_name, QString const & status);
+    void                    send_snapshot(QString const & server, QString const & service);
+
+    // snap::snap_communicator::snap_timer implementation
+    virtual void            process_timeout() override;
+
+private:
+    void                    flush();
+    snap::snap_communicator_message
+                            create_message(bool full, QString const & changes) const;
+
+    int64_t                 f_window = 0;               // in microseconds
+    snap::snap_string_list  f_listeners;
+    send_t                  f_send;
+    uint64_t                f_sequence = 0;
+    std::map<QString, QString>
+                            f_current;                  // service name -> latest status
+    std::map<QString, QString>
+                            f_published;                // service name -> status last sent
+    std::set<QString>       f_pending;                  // services which changed since the last flush
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
@@ -0,0 +1,423 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- hierarchical timer wheel of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+
+// ourselves
+//
+#include "timer_wheel.h"
+
+// snapwebsites lib
+//
+#include "log.h"
+#include "not_reached.h"
+#include "not_used.h"
+
+// C++ lib
+//
+#include <algorithm>
+#include <vector>
+
+// C lib
+//
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+/** \file
+ * \brief Multiplex the timers of all the services behind one timerfd.
+ *
+ * Each service needs a timer: to start a cron task on its next tick,
+ * to restart a process after a pause, to escalate a STOP to SIGTERM
+ * and SIGKILL, etc. Instead of having one snap_timer connection per
+ * service, which the communicator has to scan each time it computes
+ * its poll() timeout, all the deadlines are saved in this hierarchical
+ * timing wheel.
+ *
+ * The wheel has LEVELS levels of SLOTS slots. A slot in level 0
+ * represents one tick (RESOLUTION microseconds), a slot in level 1
+ * represents SLOTS ticks, etc. A deadline goes in the lowest level
+ * which can represent it from the current tick. Each time the lower
+ * digits of the current tick roll over to zero, the corresponding
+ * slot of the upper level gets cascaded down. Deadlines further than
+ * the wheel can represent are saved in the last slot and inserted
+ * again when that slot gets cascaded.
+ *
+ * Scheduling and canceling a timer are O(1). The timerfd only gets
+ * reprogrammed when the new deadline is earlier than the one it is
+ * set to. Once the timerfd fires, the wheel jumps over the empty slots
+ * and fires all the deadlines which are due.
+ */
+
+
+namespace snapinit
+{
+
+
+
+/////////////////////////////////////////////////
+// TIMER WHEEL (class implementation)          //
+/////////////////////////////////////////////////
+
+
+/** \brief Initialize the timer wheel.
+ *
+ * The constructor creates the timerfd. The timer uses CLOCK_REALTIME
+ * since the dates used by the snap_communicator are based on
+ * gettimeofday().
+ */
+timer_wheel::timer_wheel()
+    : f_timerfd(timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC))
+    , f_current_tick(snap::snap_communicator::get_current_date() / RESOLUTION)
+{
+    if(f_timerfd == -1)
+    {
+        int const e(errno);
+        common::fatal_error(QString("timer_wheel::timer_wheel(): timerfd_create() failed (errno: %1 -- %2).")
+                            .arg(e)
+                            .arg(strerror(e)));
+        snap::NOTREACHED();
+    }
+}
+
+
+/** \brief Close the timerfd.
+ */
+timer_wheel::~timer_wheel()
+{
+    close(f_timerfd);
+}
+
+
+/** \brief Set the timer of a service.
+ *
+ * If the service already had a timer, it gets replaced. When \p date
+ * is in the past, the service times out as soon as possible.
+ *
+ * \param[in] s  The service to wake up.
+ * \param[in] date  The date when to wake it up, in microseconds.
+ */
+void timer_wheel::schedule(service::pointer_t s, int64_t date)
+{
+    cancel(s.get());
+
+    if(f_entries.empty())
+    {
+        // nothing pending, we can safely move to the current tick
+        //
+        f_current_tick = std::max(f_current_tick, snap::snap_communicator::get_current_date() / RESOLUTION);
+    }
+
+    // round up so we never time out early
+    //
+    entry_t & entry(f_entries[s.get()]);
+    entry.f_service = s;
+    entry.f_tick = (date + RESOLUTION - 1) / RESOLUTION;
+    insert(entry);
+
+    int64_t const tick(std::max(entry.f_tick, f_current_tick));
+    if(f_armed_tick == -1
+    || tick < f_armed_tick)
+    {
+        arm(tick);
+    }
+}
+
+
+/** \brief Remove the timer of a service.
+ *
+ * If the service does not have a timer, nothing happens.
+ *
+ * The timerfd is not reprogrammed, if it wakes us up for nothing
+ * we simply reprogram it at that time.
+ *
+ * \param[in] s  The service which timer gets removed.
+ */
+void timer_wheel::cancel(service const * s)
+{
+    auto const it(f_entries.find(s));
+    if(it == f_entries.end())
+    {
+        return;
+    }
+    if(it->second.f_slot != nullptr)
+    {
+        it->second.f_slot->erase(it->second.f_position);
+    }
+    f_entries.erase(it);
+}
+
+
+/** \brief Get the date when the timer of a service times out.
+ *
+ * The date is rounded up to the resolution of the wheel.
+ *
+ * \param[in] s  The service which timer is checked.
+ *
+ * \return The date in microseconds or 0 if the service has no timer.
+ */
+int64_t timer_wheel::get_date(service const * s) const
+{
+    auto const it(f_entries.find(s));
+    if(it == f_entries.end())
+    {
+        return 0;
+    }
+    return it->second.f_tick * RESOLUTION;
+}
+
+
+/** \brief The wheel is a reader, the timerfd becomes readable on timeouts.
+ *
+ * \return Always true.
+ */
+bool timer_wheel::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Return the timerfd so the communicator can poll() it.
+ *
+ * \return The timerfd.
+ */
+int timer_wheel::get_socket() const
+{
+    return f_timerfd;
+}
+
+
+/** \brief The timerfd expired.
+ *
+ * This function fires all the timers which are due and then
+ * reprograms the timerfd for the next deadline.
+ */
+void timer_wheel::process_read()
+{
+    uint64_t expirations(0);
+    snap::NOTUSED(read(f_timerfd, &expirations, sizeof(expirations)));
+
+    advance(snap::snap_communicator::get_current_date() / RESOLUTION);
+
+    f_armed_tick = -1;
+    if(f_entries.empty())
+    {
+        struct itimerspec const disarm = {};
+        timerfd_settime(f_timerfd, TFD_TIMER_ABSTIME, &disarm, nullptr);
+    }
+    else
+    {
+        arm(next_tick());
+    }
+}
+
+
+/** \brief Add an entry to the wheel.
+ *
+ * \param[in,out] entry  The entry to insert, its slot gets updated.
+ */
+void timer_wheel::insert(entry_t & entry)
+{
+    int64_t tick(std::max(entry.f_tick, f_current_tick));
+    int64_t delta(tick - f_current_tick);
+
+    int64_t const range(1LL << (SLOT_BITS * LEVELS));
+    if(delta >= range)
+    {
+        // too far, it gets inserted again on the next cascade
+        //
+        delta = range - 1;
+        tick = f_current_tick + delta;
+    }
+
+    int level(0);
+    while(delta >= (1LL << (SLOT_BITS * (level + 1))))
+    {
+        ++level;
+    }
+
+    slot_t & slot(f_wheel[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK]);
+    entry.f_slot = &slot;
+    entry.f_position = slot.insert(slot.end(), entry.f_service.get());
+}
+
+
+/** \brief Move the entries of an upper level slot down.
+ *
+ * \param[in] level  The level of the slot, at least 1.
+ * \param[in] idx  The index of the slot.
+ */
+void timer_wheel::cascade(int level, int64_t idx)
+{
+    slot_t slot;
+    slot.swap(f_wheel[level][idx]);
+    for(auto const s : slot)
+    {
+        insert(f_entries.at(s));
+    }
+}
+
+
+/** \brief Process all the ticks up to \p now_tick.
+ *
+ * The ticks without anything to cascade or fire are skipped.
+ *
+ * The services which time out may schedule a new timer. A new timer
+ * is never fired in the same tick so a service which asks to be woken
+ * up "now" gets called once the communicator had a chance to process
+ * the other events.
+ *
+ * \param[in] now_tick  The current tick.
+ */
+void timer_wheel::advance(int64_t now_tick)
+{
+    while(!f_entries.empty())
+    {
+        int64_t const tick(next_tick());
+        if(tick > now_tick)
+        {
+            break;
+        }
+        f_current_tick = tick;
+
+        // cascade the upper levels which slot starts on this tick
+        //
+        for(int level(1); level < LEVELS; ++level)
+        {
+            if((f_current_tick & ((1LL << (SLOT_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            int64_t const idx((f_current_tick >> (SLOT_BITS * level)) & SLOT_MASK);
+            cascade(level, idx);
+            if(idx != 0)
+            {
+                break;
+            }
+        }
+
+        // detach the entries which are due before calling any callback
+        //
+        slot_t & slot(f_wheel[0][f_current_tick & SLOT_MASK]);
+        std::vector<service const *> due;
+        due.reserve(slot.size());
+        while(!slot.empty())
+        {
+            service const * s(slot.front());
+            slot.pop_front();
+            f_entries.at(s).f_slot = nullptr;
+            due.push_back(s);
+        }
+        ++f_current_tick;
+
+        for(auto const s : due)
+        {
+            // the entry may have been canceled or rescheduled by
+            // a previous callback
+            //
+            auto const it(f_entries.find(s));
+            if(it == f_entries.end()
+            || it->second.f_slot != nullptr)
+            {
+                continue;
+            }
+            service::pointer_t svc(it->second.f_service);
+            f_entries.erase(it);
+            svc->process_timeout();
+        }
+    }
+
+    if(f_current_tick <= now_tick)
+    {
+        f_current_tick = now_tick + 1;
+    }
+}
+
+
+/** \brief Compute the next tick at which a slot needs processing.
+ *
+ * For a level 0 slot, this is the tick of that slot. For an upper
+ * level slot, this is the tick at which it gets cascaded. The
+ * function returns the smallest such tick of all the non-empty
+ * slots. It has to be called with a non-empty wheel.
+ *
+ * \return The next tick to process.
+ */
+int64_t timer_wheel::next_tick() const
+{
+    int64_t result(-1);
+    for(int level(0); level < LEVELS; ++level)
+    {
+        int const shift(SLOT_BITS * level);
+        int64_t const base((f_current_tick >> shift) & ~SLOT_MASK);
+        for(int64_t idx(0); idx < SLOTS; ++idx)
+        {
+            if(f_wheel[level][idx].empty())
+            {
+                continue;
+            }
+            int64_t tick((base | idx) << shift);
+            if(tick < f_current_tick)
+            {
+                tick += static_cast<int64_t>(SLOTS) << shift;
+            }
+            if(result == -1
+            || tick < result)
+            {
+                result = tick;
+            }
+        }
+    }
+    return result;
+}
+
+
+/** \brief Program the timerfd.
+ *
+ * \param[in] tick  The tick at which the timerfd has to wake us up.
+ */
+void timer_wheel::arm(int64_t tick)
+{
+    int64_t const date(tick * RESOLUTION);
+    struct itimerspec timeout = {};
+    timeout.it_value.tv_sec = date / common::SECONDS_TO_MICROSECONDS;
+    timeout.it_value.tv_nsec = date % common::SECONDS_TO_MICROSECONDS * 1000;
+    if(timeout.it_value.tv_sec == 0
+    && timeout.it_value.tv_nsec == 0)
+    {
+        // a zero timeout would disarm the timerfd
+        //
+        timeout.it_value.tv_nsec = 1;
+    }
+    if(timerfd_settime(f_timerfd, TFD_TIMER_ABSTIME, &timeout, nullptr) != 0)
+    {
+        int const e(errno);
+        common::fatal_error(QString("timer_wheel::arm(): timerfd_settime() failed (errno: %1 -- %2).")
+                            .arg(e)
+                            .arg(strerror(e)));
+        snap::NOTREACHED();
+    }
+    f_armed_tick = tick;
+}
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et
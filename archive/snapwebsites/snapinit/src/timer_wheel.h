@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////////
+// Snap Init Server -- hierarchical timer wheel of the snapinit services
+// Copyright (C) 2011-2016  Made to Order Software Corp.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// This server reads in a configuration file and keeps specified services running.
+// When signaled, it will terminate those services cleanly.
+/////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// ourselves
+//
+#include "service.h"
+
+// snapwebsites
+//
+#include <snapwebsites/snap_communicator.h>
+
+// C++ lib
+//
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace snapinit
+{
+
+
+class timer_wheel
+        : public snap::snap_communicator::snap_connection
+{
+public:
+    typedef std::shared_ptr<timer_wheel>    pointer_t;
+
+    static int64_t const    RESOLUTION = 10000LL;       // 10ms in microseconds
+    static int const        SLOT_BITS = 6;
+    static int const        SLOTS = 1 << SLOT_BITS;     // 64 slots per level
+    static int64_t const    SLOT_MASK = SLOTS - 1;
+    static int const        LEVELS = 4;                 // 64^4 ticks of 10ms, about 46 hours
+
+                            timer_wheel();
+                            timer_wheel(timer_wheel const & rhs) = delete;
+    timer_wheel &           operator = (timer_wheel const & rhs) = delete;
+    virtual                 ~timer_wheel() override;
+
+    void                    schedule(service::pointer_t s, int64_t date);
+    void                    cancel(service const * s);
+    int64_t                 get_date(service const * s) const;
+
+    // snap::snap_communicator::snap_connection implementation
+    virtual bool            is_reader() const override;
+    virtual int             get_socket() const override;
+    virtual void            process_read() override;
+
+private:
+    typedef std::list<service const *>      slot_t;
+
+    struct entry_t
+    {
+        service::pointer_t  f_service;
+        int64_t             f_tick = 0;
+        slot_t *            f_slot = nullptr;   // nullptr while being fired
+        slot_t::iterator    f_position;
+    };
+
+    typedef std::unordered_map<service const *, entry_t>    entry_map_t;
+
+    void                    insert(entry_t & entry);
+    void                    cascade(int level, int64_t idx);
+    void                    advance(int64_t now_tick);
+    int64_t                 next_tick() const;
+    void                    arm(int64_t tick);
+
+    int                     f_timerfd = -1;
+    int64_t                 f_current_tick = 0;     // next tick to be processed
+    int64_t                 f_armed_tick = -1;      // tick the timerfd was set to, -1 when disarmed
+    entry_map_t             f_entries;
+    slot_t                  f_wheel[LEVELS][SLOTS];
+};
+
+
+} // namespace snapinit
+// vim: ts=4 sw=4 et